@@ -1,9 +1,38 @@
+// POSIX and BSD interfaces (rwlocks, fmemopen, truncate, madvise) under strict -std modes
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
 #include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <stdarg.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 
 // =============================================
 // STRUCTURE DEFINITIONS
@@ -21,6 +50,14 @@ typedef struct {
     float location_y;
 } Ambulance;
 
+// Cold ambulance fields, only touched when a unit is displayed or saved
+typedef struct {
+    int ambulance_id;          // Unique ID for the ambulance
+    char vehicle_number[20];   // License plate number
+    char driver_name[50];      // Name of the driver
+    char driver_contact[15];   // Driver's contact number
+} AmbulanceDetails;
+
 // Structure to represent a Booking
 typedef struct {
     int booking_id;            // Unique booking ID
@@ -35,25 +72,640 @@ typedef struct {
     int status;                // 0=Pending, 1=Confirmed, 2=Dispatched, 3=Completed, 4=Cancelled
 } Booking;
 
+// Handle of a string: byte offset of its text in the string arena. Being
+// 32 bits, it limits the strings of all bookings to 4 GB.
+typedef uint32_t StrRef;
+
+// Compact booking as kept in memory; strings are handles into the arena
+typedef struct {
+    int64_t booking_time;      // Time of booking, seconds since the epoch
+    int64_t pickup_time;       // Time of pickup, 0 if not picked up yet
+    int32_t booking_id;        // Unique booking ID
+    int32_t ambulance_id;      // Ambulance assigned
+    StrRef patient_name;       // Name of the patient
+    StrRef patient_contact;    // Patient's contact number
+    StrRef pickup_location;    // Pickup address
+    StrRef hospital;           // Destination hospital (interned)
+    uint8_t emergency_level;   // 1=Normal, 2=Urgent, 3=Critical
+    uint8_t status;            // 0=Pending, 1=Confirmed, 2=Dispatched, 3=Completed, 4=Cancelled
+} BookingRecord;
+
+// Append-only storage for booking strings. Strings loaded from a snapshot
+// are read in place; handles past mapped_size refer to the heap part.
+typedef struct {
+    char* data;                // NUL-terminated strings added since loading, back to back
+    uint32_t size;             // Bytes in use
+    uint32_t capacity;         // Bytes allocated
+    const char* mapped;        // Strings of the loaded snapshot, NULL if none
+    uint32_t mapped_size;      // Bytes in the mapped part
+} StringArena;
+
+// Open-addressing set of interned strings, so repeated text is stored once
+typedef struct {
+    StrRef* refs;              // Arena handles, 0 marks a free entry
+    int capacity;              // Number of entries, always a power of two
+    int count;                 // Number of used entries
+} InternTable;
+
+#define AMBULANCE_TYPES 3            // 1=Basic, 2=Advanced, 3=Mobile ICU
+
+// One cell of the spatial grid
+typedef struct {
+    int* slots;                // Ambulance slots in this cell
+    int count;                 // Number of ambulances in this cell
+    int capacity;              // Capacity of slots array
+    int type_count[AMBULANCE_TYPES + 1]; // Ambulances per type (index 0: unknown types)
+} GridCell;
+
+// Uniform grid over the locations of all available ambulances. Units far
+// outside where the fleet is (a bad GPS fix) are kept aside as outliers
+// instead of stretching the grid over them.
+typedef struct {
+    GridCell* cells;           // cols * rows cells, row-major
+    int cols;                  // Number of cell columns
+    int rows;                  // Number of cell rows
+    float min_x, min_y;        // Lower-left corner of the covered area
+    float max_x, max_y;        // Upper-right corner of the covered area
+    float cell_size;           // Width and height of one cell
+    GridCell outliers;         // Available units outside the covered area, checked by every query
+    int outlier_limit;         // Outliers taken before the grid is rebuilt
+    int* cell_of;              // Per ambulance slot: cell index, GRID_OUTLIER_CELL, or -1 if not in the grid
+    int* pos_in_cell;          // Per ambulance slot: position inside its cell
+    int slot_capacity;         // Capacity of cell_of and pos_in_cell
+    int sized_for;             // Fleet size the cell size was chosen for
+} SpatialGrid;
+
+// Available ambulances of one type, in no particular order
+typedef struct {
+    int* slots;                // Ambulance slots of this type
+    int count;                 // Number of available ambulances of this type
+    int capacity;              // Capacity of slots array
+    int claimed_top;           // Entries at the top already claimed but not settled
+} AvailabilityPool;
+
+// Free lists of available ambulances, one per ambulance type
+typedef struct {
+    AvailabilityPool by_type[AMBULANCE_TYPES + 1]; // Index 0 holds units with an unknown type
+    int* pos;                  // Per ambulance slot: position inside its pool, or -1
+    int slot_capacity;         // Capacity of pos
+} AvailabilityPools;
+
+// Open-addressing hash table mapping an ID to its array slot
+typedef struct {
+    int* keys;                 // IDs, ID_INDEX_EMPTY marks a free entry
+    int* slots;                // Array slot stored for each key
+    int capacity;              // Number of entries, always a power of two
+    int count;                 // Number of used entries
+    int mapped;                // 1 if keys and slots point into a snapshot and are not freed
+} IdIndex;
+
+#define ID_INDEX_EMPTY INT_MIN
+
+#define EMERGENCY_LEVELS 3           // 1=Normal, 2=Urgent, 3=Critical
+
+// FIFO of pending bookings for one emergency level, longest waiting first
+typedef struct {
+    int* slots;                // Ring buffer of booking slots
+    int head;                  // Position of the oldest entry
+    int count;                 // Number of queued entries
+    int capacity;              // Size of the ring buffer, always a power of two
+} PendingQueue;
+
+#define AMBULANCE_STATUSES 4         // 0=Available, 1=Booked, 2=On Trip, 3=Maintenance
+#define BOOKING_STATUSES 5           // 0=Pending ... 4=Cancelled
+
+// Running totals for generate_report, updated at every state change.
+// The last bucket of each array counts values outside the known range.
+typedef struct {
+    int ambulance_status[AMBULANCE_STATUSES + 1];
+    int ambulance_type[AMBULANCE_TYPES + 2];     // Index 0 unused
+    int booking_status[BOOKING_STATUSES + 1];
+    int booking_level[EMERGENCY_LEVELS + 2];     // Index 0 unused
+} ReportCounters;
+
+// Closed trips booked on one UTC day, stored column by column, with a
+// zone map summarizing them. Zone map arrays are indexed [closed][level]:
+// closed is 0 for completed and 1 for cancelled trips, and the last
+// level counts levels outside the known range.
+typedef struct {
+    int64_t day;               // Days since the epoch
+    int count;                 // Trips in every column
+    int capacity;              // Capacity of every column
+    int64_t* booked_at;        // Column: time of booking, seconds since the epoch
+    uint8_t* level;            // Column: emergency level
+    uint8_t* status;           // Column: 3=Completed, 4=Cancelled
+    int32_t* ambulance_id;     // Column: ambulance assigned, 0 if none
+    int32_t* response;         // Column: seconds from booking to pickup, -1 if never picked up
+    int64_t min_time, max_time; // Zone map: earliest and latest booking time
+    int32_t min_ambulance, max_ambulance; // Zone map: range of ambulance IDs
+    int trips[2][EMERGENCY_LEVELS + 2];           // Zone map: trips
+    int answered[2][EMERGENCY_LEVELS + 2];        // Zone map: trips with a pickup
+    int64_t response_sum[2][EMERGENCY_LEVELS + 2]; // Zone map: total response seconds
+    int32_t response_max[2][EMERGENCY_LEVELS + 2]; // Zone map: longest response
+} TripDay;
+
+// Completed and cancelled bookings by the day they were booked, oldest
+// day first. The rows stay in the booking store for lookups by ID.
+typedef struct {
+    TripDay* days;
+    int day_count;
+    int day_capacity;
+    long trip_count;           // Trips in all days
+    int built;                 // Set once it holds every closed booking
+} TripArchive;
+
+// Bookings whose patient name or contact holds one search gram, oldest
+// booking first
+typedef struct {
+    int32_t* slots;            // Booking slots in increasing order
+    int count;
+    int capacity;
+} PatientPostings;
+
+// Inverted index from search grams to the bookings holding them. Names
+// give their three-character windows, wherever they occur; contacts,
+// only searched by prefix, give a hash of each of their first few
+// prefixes.
+typedef struct {
+    uint32_t* keys;            // Open-addressing table of grams, 0 marks a free entry
+    int* lists;                // Posting list of each used table entry
+    int table_capacity;        // Entries in the table, always a power of two
+    PatientPostings* postings; // One list per gram
+    int gram_count;            // Grams in the table
+    int posting_capacity;      // Capacity of postings
+    long entries;              // Booking slots in all lists
+    int built;                 // Set once it holds every booking
+} PatientIndex;
+
+// What a patient search matches its text against
+typedef enum {
+    SEARCH_NAME,               // Name contains the text
+    SEARCH_NAME_PREFIX,        // Name starts with the text
+    SEARCH_CONTACT             // Contact number starts with the text
+} SearchMode;
+
+// Booking statuses and emergency levels copied into byte columns, one
+// entry per slot, so recounts and filters over the whole history run the
+// vector kernels instead of reading every record
+typedef struct {
+    uint8_t* status;
+    uint8_t* level;
+    int capacity;
+    int built;                 // Set once it holds every booking
+} BookingColumns;
+
+// Open bookings (pending, confirmed or dispatched) in slot order, so
+// active calls are listed without reading the closed ones
+typedef struct {
+    int* slots;
+    int count;
+    int capacity;
+    int built;                 // Set once it holds every open booking
+} ActiveBookings;
+
+// Which bookings a listing shows
+typedef struct {
+    int status;                // 0-4, LIST_ACTIVE or LIST_ANY
+    int level;                 // Emergency level, 0 for any
+    int64_t from, to;          // Booking time window: from inclusive, to exclusive
+} BookingFilter;
+
+// Which ambulances a listing shows
+typedef struct {
+    int status;                // 0-3 or LIST_ANY
+    int type;                  // 1-3, 0 for any
+} AmbulanceFilter;
+
+#define TEXT_BUFFER_SIZE 65536       // Output gathered before it is written
+
+// Output gathered into one write instead of one per line, which is what
+// a terminal costs when every row is printed on its own
+typedef struct {
+    FILE* out;
+    size_t used;
+    char data[TEXT_BUFFER_SIZE];
+} TextBuffer;
+
+// Which archived trips a query covers
+typedef struct {
+    int64_t from, to;          // Booking time window: from inclusive, to exclusive
+    int level;                 // Emergency level, 0 for any
+    int status;                // 3=Completed or 4=Cancelled, 0 for either
+    int ambulance_id;          // Ambulance assigned, 0 for any
+} TripFilter;
+
+// Totals over the trips a query matched
+typedef struct {
+    long trips;                // Trips matched
+    long answered;             // Of those, trips with a pickup
+    double mean_response;      // Mean seconds from booking to pickup over answered trips
+    int max_response;          // Longest of those
+    int days_skipped;          // Days ruled out by their zone maps
+    int days_summarized;       // Days totalled from their zone maps alone
+    int days_scanned;          // Days whose columns were read
+} TripStats;
+
+// Outcome of a booking or fleet operation
+typedef enum {
+    OP_OK = 0,
+    OP_NOT_FOUND,              // No booking with that ID
+    OP_INVALID,                // Argument out of range
+    OP_CLOSED,                 // Booking is already completed or cancelled
+    OP_UNASSIGNED,             // Pending booking has no ambulance; it can only be cancelled
+    OP_NO_MEMORY               // Allocation failed
+} OpResult;
+
+// One call of a batch dispatch
+typedef struct {
+    Booking request;           // Patient details in; ID, ambulance and status out
+    float loc_x, loc_y;        // Where the patient is
+    float distance;            // Out: distance to the assigned unit, -1 if queued
+} DispatchCall;
+
+// One position report from an ambulance's GPS unit
+typedef struct {
+    int ambulance_id;          // Unit reporting
+    float loc_x, loc_y;        // Where it is now
+    int applied;               // Out: 1 if the unit was found and moved
+} PositionUpdate;
+
+// Snapshot file contents that loaded data is used from in place
+typedef struct {
+    unsigned char* base;       // Start of the file contents, NULL if nothing is mapped
+    size_t size;               // File size in bytes
+} SnapshotMapping;
+
+// Append-only log of changes made since the last snapshot
+typedef struct {
+    FILE* file;                // Journal file, positioned at its end
+    char path[260];            // Name of the journal file
+    unsigned char* buffer;     // Records not yet handed to the file
+    size_t used;               // Bytes in buffer
+    size_t capacity;           // Size of buffer
+    uint64_t next_lsn;         // Sequence number of the next record
+    uint64_t durable_lsn;      // Last record known to be on disk
+    uint64_t file_size;        // Bytes in the file, including buffered records
+    int unsynced;              // Records appended since the last fsync
+    double oldest_unsynced;    // When the oldest of them was appended
+    int replayed;              // Records applied during recovery
+    long syncs;                // Number of fsyncs issued
+    int failed;                // Set after a write or fsync error
+} Journal;
+
+// Snapshot being written by a child process while dispatch carries on
+typedef struct {
+    long pid;                  // Child writing it, 0 if none
+    uint64_t lsn;              // Last journal record the snapshot holds
+    uint64_t journal_offset;   // Journal size when it was taken; later records are kept
+    double started;            // When it was taken
+} BackgroundSave;
+
+#define ROAD_SCRATCH_SLOTS 16        // Road searches that can run at once without allocating
+
+// Entry of a road search heap
+typedef struct {
+    float key;                 // Time so far plus a lower bound on the time to go
+    float cost;                // Time so far
+    int node;
+} RoadHeapEntry;
+
+// Working memory of one road search, reused from search to search
+typedef struct {
+    float* cost;               // Best time found per node, valid where stamp matches search
+    uint32_t* stamp;           // Search that last set each node's time
+    uint32_t search;           // Number of the current search
+    RoadHeapEntry* heap;       // Nodes to visit, smallest key first
+    int heap_size;
+    int heap_capacity;
+    int in_use;                // Taken by a running query (changed atomically)
+} RoadScratch;
+
+// Road graph used to rank ambulances by drive time. Never changes once
+// loaded, so any number of queries can read it at once.
+typedef struct {
+    int node_count;            // Junctions
+    int arc_count;             // One-way road segments
+    float* node_x;             // Junction locations
+    float* node_y;
+    int* out_start;            // Arcs leaving node v: out_start[v] .. out_start[v + 1] - 1
+    int* out_node;             // Node each leaving arc ends at
+    float* out_seconds;        // Drive time of each leaving arc
+    int* in_start;             // The same arcs grouped by the node they end at
+    int* in_node;              // Node each arriving arc starts from
+    float* in_seconds;
+    int landmark_count;        // Landmarks per node in the tables below
+    float* from_landmark;      // [node * landmark_count + i]: time from landmark i to the node
+    float* to_landmark;        // [node * landmark_count + i]: time from the node to landmark i
+    int* cell_start;           // Snapping grid: nodes of cell c are cell_node[cell_start[c] ..]
+    int* cell_node;
+    int cols, rows;            // Snapping grid size
+    float min_x, min_y;        // Lower-left corner of the snapping grid
+    float cell_size;
+    RoadScratch scratch[ROAD_SCRATCH_SLOTS]; // Search memory handed out to queries
+} RoadNetwork;
+
 // Structure to manage the system
 typedef struct {
-    Ambulance* ambulances;     // Dynamic array of ambulances
-    Booking* bookings;         // Dynamic array of bookings
+    unsigned char* amb_status; // Hot fleet column: status per ambulance slot
+    unsigned char* amb_type;   // Hot fleet column: type per ambulance slot
+    float* amb_x;              // Hot fleet column: location per ambulance slot
+    float* amb_y;
+    AmbulanceDetails* amb_details; // Cold side table: ID, vehicle and driver
+    int* unsettled;            // Slots claimed under a shared fleet lock whose indexes are not updated yet
+    int unsettled_count;       // Entries in unsettled, changed atomically
+    int defer_claims;          // Set while several threads may claim ambulances at once
+    BookingRecord** booking_chunks; // Fixed-size chunks of bookings; records never move
     int ambulance_count;       // Current number of ambulances
     int booking_count;         // Current number of bookings
-    int ambulance_capacity;    // Capacity of ambulances array
-    int booking_capacity;      // Capacity of bookings array
+    int ambulance_capacity;    // Capacity of the fleet columns
+    int booking_capacity;      // Bookings that fit in the allocated chunks
+    int chunk_count;           // Number of allocated booking chunks
+    int chunk_capacity;        // Capacity of booking_chunks directory
+    int mapped_chunks;         // Leading chunks that live in the snapshot mapping
+    SpatialGrid grid;          // Spatial index of available ambulances
+    AvailabilityPools pools;   // Available ambulances by type
+    IdIndex booking_index;     // booking_id -> booking slot
+    IdIndex ambulance_index;   // ambulance_id -> ambulance slot
+    StringArena strings;       // Text of all booking strings
+    InternTable interned;      // Hospital names stored once
+    PendingQueue pending[EMERGENCY_LEVELS + 1]; // Waiting bookings by emergency level
+    ReportCounters counters;   // Totals shown in the report
+    SnapshotMapping snapshot;  // Snapshot the bookings were loaded from
+    Journal* journal;          // Where changes are logged, NULL when not journaling
+    BackgroundSave saving;     // Snapshot being written in the background
+    RoadNetwork* roads;        // Road graph for drive times, NULL if none is loaded
+    TripArchive archive;       // Closed trips by column for time-window reports
+    PatientIndex patients;     // Bookings by patient name and contact
+    ActiveBookings active;     // Open bookings, for listing active calls
+    BookingColumns columns;    // Status and level bytes, for the recount and filter kernels
+    int time_ordered;          // Leading bookings known to be in booking-time order
 } BAPESSS_System;
 
+// =============================================
+// BOOKING STORE SETTINGS
+// =============================================
+#define BOOKING_CHUNK_SHIFT 10                       // log2 of bookings per chunk
+#define BOOKING_CHUNK_SIZE (1 << BOOKING_CHUNK_SHIFT) // Bookings per chunk
+
+// =============================================
+// SNAPSHOT FORMAT
+// =============================================
+#define SNAPSHOT_FILE "bapesss.snap"
+#define SNAPSHOT_MAGIC "BAPESSS"               // 8 bytes including the NUL
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u        // Reads back differently on the other byte order
+#define SNAPSHOT_ALIGNMENT 64                  // Every section starts on a cache-line boundary
+#define SNAPSHOT_MAX_SECTIONS 32
+#define SNAPSHOT_SYNC_BYTES (16u << 20)        // Written bytes allowed to wait for one fsync
+
+// Sections of a snapshot; each holds one array
+enum {
+    SECTION_AMB_STATUS = 1,    // unsigned char per ambulance
+    SECTION_AMB_TYPE,          // unsigned char per ambulance
+    SECTION_AMB_X,             // float per ambulance
+    SECTION_AMB_Y,             // float per ambulance
+    SECTION_AMB_DETAILS,       // AmbulanceDetails per ambulance
+    SECTION_BOOKINGS,          // BookingRecord per booking
+    SECTION_STRINGS,           // String arena bytes
+    SECTION_INTERN,            // Intern table entries
+    SECTION_BOOKING_KEYS,      // Booking ID index keys
+    SECTION_BOOKING_SLOTS,     // Booking ID index slots
+    SECTION_PENDING,           // Queue lengths per level, then the queued slots
+    SECTION_COUNTERS,          // ReportCounters
+    SECTION_COUNT = SECTION_COUNTERS
+};
+
+// Fixed header at the start of a snapshot file
+typedef struct {
+    char magic[8];             // SNAPSHOT_MAGIC
+    uint32_t version;          // SNAPSHOT_VERSION
+    uint32_t byte_order;       // SNAPSHOT_BYTE_ORDER as stored by the writer
+    uint32_t header_size;      // sizeof(SnapshotHeader)
+    uint32_t section_count;    // Entries in the section table after the header
+    uint64_t file_size;        // Total file size, to detect truncation
+    int32_t ambulance_count;
+    int32_t booking_count;
+    int32_t booking_index_count; // Used entries in the booking ID index
+    int32_t intern_count;      // Used entries in the intern table
+    uint64_t table_checksum;   // Checksum of the header (this field zero) and section table
+    uint64_t journal_lsn;      // Last journal record included, 0 if none
+} SnapshotHeader;
+
+// Section table entry
+typedef struct {
+    uint32_t id;               // SECTION_*
+    uint32_t record_size;      // Size of one element, to detect layout changes
+    uint64_t offset;           // Start of the section, a multiple of SNAPSHOT_ALIGNMENT
+    uint64_t length;           // Bytes in the section
+    uint64_t checksum;         // Checksum of the section bytes
+} SnapshotSection;
+
+// =============================================
+// JOURNAL FORMAT
+// =============================================
+#define JOURNAL_FILE "bapesss.journal"
+#define JOURNAL_MAGIC "BAPJRNL"                // 8 bytes including the NUL
+#define JOURNAL_VERSION 1
+#define JOURNAL_BUFFER_SIZE (64 * 1024)        // Records buffered before a write
+#define JOURNAL_MAX_RECORD 4096                // Largest valid payload
+#define JOURNAL_GROUP_RECORDS 64               // Records that share one fsync at most
+#define JOURNAL_GROUP_DELAY 0.005              // Seconds a record may wait for its fsync
+#define JOURNAL_COMPACT_BYTES (64u * 1024 * 1024) // Journal size that triggers a new snapshot
+
+// Kinds of journal record; each one replays a single state change
+enum {
+    JOURNAL_ADD_BOOKING = 1,   // JournalNewBooking followed by four NUL-terminated strings
+    JOURNAL_ASSIGN,            // JournalChange: ambulance given to a booking
+    JOURNAL_STATUS,            // JournalChange: booking moved to Confirmed or Dispatched
+    JOURNAL_CLOSE,             // JournalChange: booking completed or cancelled, ambulance freed
+    JOURNAL_ADD_AMBULANCE      // Ambulance record
+};
+
+// Start of a journal file
+typedef struct {
+    char magic[8];             // JOURNAL_MAGIC
+    uint32_t version;          // JOURNAL_VERSION
+    uint32_t byte_order;       // SNAPSHOT_BYTE_ORDER as stored by the writer
+    uint64_t base_lsn;         // Snapshot LSN the records apply on top of
+    uint64_t checksum;         // Checksum of the fields above
+} JournalFileHeader;
+
+// Header of every journal record
+typedef struct {
+    uint32_t type;             // JOURNAL_*
+    uint32_t length;           // Payload bytes after the header
+    uint64_t lsn;              // One more than the previous record's
+    uint64_t checksum;         // Checksum of the header (this field zero) and payload
+} JournalRecordHeader;
+
+// Payload of JOURNAL_ADD_BOOKING before its strings
+typedef struct {
+    int64_t booking_time;
+    int32_t booking_id;
+    int32_t emergency_level;
+    int32_t queued;            // 1 if the booking joined the pending queue
+    int32_t reserved;
+} JournalNewBooking;
+
+// Payload of the booking change records
+typedef struct {
+    int64_t time;              // Pickup time for JOURNAL_STATUS, otherwise 0
+    int32_t booking_id;
+    int32_t value;             // Ambulance ID for JOURNAL_ASSIGN, otherwise the new status
+} JournalChange;
+
+// =============================================
+// SPATIAL INDEX SETTINGS
+// =============================================
+#define GRID_AMBULANCES_PER_CELL 4   // Average ambulances per cell the grid is sized for
+#define GRID_PADDING 0.25f           // Extra margin around the fleet's bounding box
+#define GRID_OUTLIER_SHARE 128       // 1 in this many units per side and axis is left out when sizing the grid
+#define GRID_OUTLIER_SLACK 8         // Outliers always taken before the grid is rebuilt
+#define GRID_OUTLIER_CELL -2         // cell_of value of a unit kept with the outliers
+#define NEAREST_SHOW_COUNT 3         // Units listed by find_nearest_ambulance
+#define NEARBY_RADIUS 5.0f           // Radius used for the "units nearby" count
+#define NEAREST_SCAN_FLEET 64        // Fleets up to this size are scanned instead of searched by cell
+#define NEAREST_BLOCK 1024           // Units a batch of queries is checked against before moving on
+
+// =============================================
+// POSITION UPDATE SETTINGS
+// =============================================
+#define POSITION_MAX_BATCH 4096      // Most position reports applied together
+#define POSITION_CHUNK 256           // Reports applied per exclusive fleet lock in server mode
+
+// =============================================
+// TRIP ARCHIVE SETTINGS
+// =============================================
+#define ARCHIVE_DAY_SECONDS 86400    // Trips are grouped by the UTC day they were booked on
+#define ARCHIVE_MAX_BUCKETS 744      // Most buckets in one volume query (31 days by the hour)
+
+// =============================================
+// PATIENT SEARCH SETTINGS
+// =============================================
+#define SEARCH_MIN_SUBSTRING 3       // Shortest text matched anywhere in a name
+#define SEARCH_MAX_GRAMS 128         // Grams of one booking (name and contact) or one search
+#define SEARCH_GRAM_CONTACT (1u << 31) // Marks a contact gram; name grams use the low 24 bits
+#define SEARCH_CONTACT_PREFIX 6      // Longest contact prefix with a list of its own
+#define SEARCH_MAX_RESULTS 50        // Most bookings one search returns
+#define SEARCH_SHOW_COUNT 20         // Matches listed by search_bookings
+
+// =============================================
+// LISTING SETTINGS
+// =============================================
+#define LIST_ANY -1                  // Status filter accepting every status
+#define LIST_ACTIVE -2               // Booking status filter for pending, confirmed and dispatched
+#define LIST_PAGE_SIZE 20            // Rows per page of the menu listings
+#define LIST_MAX_PAGE 100            // Most rows one batch listing returns
+
+// =============================================
+// AGGREGATION SETTINGS
+// =============================================
+#define HISTOGRAM_MAX_BINS 8         // Most bins histogram_bytes counts separately
+#define AGGREGATE_PARALLEL_MIN (1 << 20) // Bookings before a recount is split across threads
+#define AGGREGATE_MAX_THREADS 16     // Most threads one recount uses
+
+// =============================================
+// BATCH ASSIGNMENT SETTINGS
+// =============================================
+#define ASSIGN_CANDIDATES 8          // Nearest qualified units first considered per call
+#define ASSIGN_MAX_CALLS 1024        // Most calls dispatched together
+
+// =============================================
+// ROAD NETWORK SETTINGS
+// =============================================
+#define ROADS_FILE "bapesss.roads"   // Road graph loaded at startup when present
+#define ROAD_LANDMARKS 8             // Landmarks whose travel times bound the A* searches
+#define ROAD_CANDIDATES 16           // Nearest units by straight line that are ranked by drive time
+#define ROAD_NODES_PER_CELL 4        // Average junctions per snapping cell
+#define ROAD_MAX_NODES 100000000     // Largest junction number accepted
+
 // =============================================
 // FUNCTION PROTOTYPES
 // =============================================
 BAPESSS_System* create_system();
 void free_system(BAPESSS_System* system);
+int append_ambulance(BAPESSS_System* system, const Ambulance* ambulance);
+void get_ambulance(BAPESSS_System* system, int slot, Ambulance* out);
+void clear_fleet(BAPESSS_System* system);
+int nearest_available_scan(BAPESSS_System* system, float loc_x, float loc_y, float* out_dist2);
+int nearest_available_batch(BAPESSS_System* system, const float* loc_x, const float* loc_y,
+                            const int* min_type, int count, int* out_slots, float* out_dist2);
+int run_benchmark(int argc, char* argv[]);
+BookingRecord* booking_at(BAPESSS_System* system, int slot);
+int append_booking(BAPESSS_System* system, const Booking* booking);
+void get_booking(BAPESSS_System* system, int slot, Booking* out);
+StrRef arena_add(StringArena* arena, const char* text);
+const char* booking_str(BAPESSS_System* system, StrRef ref);
+StrRef intern_string(BAPESSS_System* system, const char* text);
+void strings_init(BAPESSS_System* system);
+void strings_clear(BAPESSS_System* system);
+void strings_free(BAPESSS_System* system);
+void clear_bookings(BAPESSS_System* system);
+void archive_init(TripArchive* archive);
+void archive_free(TripArchive* archive);
+int archive_append(TripArchive* archive, const BookingRecord* record);
+int archive_build(BAPESSS_System* system);
+void archive_add(BAPESSS_System* system, int booking_slot);
+void archive_query(const TripArchive* archive, const TripFilter* filter, TripStats* out);
+long archive_volume(const TripArchive* archive, const TripFilter* filter, int64_t bucket_seconds,
+                    long* counts, int bucket_count);
+void patient_index_init(PatientIndex* index);
+void patient_index_free(PatientIndex* index);
+int patient_index_build(BAPESSS_System* system);
+void patient_index_add(BAPESSS_System* system, int booking_slot);
+int search_patients(BAPESSS_System* system, SearchMode mode, const char* text, int* out_slots, int max_out);
+void active_init(ActiveBookings* active);
+void active_free(ActiveBookings* active);
+int active_build(BAPESSS_System* system);
+void active_track(BAPESSS_System* system, int booking_slot, int was_open);
+int list_bookings(BAPESSS_System* system, const BookingFilter* filter, int after_slot, int* out_slots, int max_out);
+int list_ambulances(BAPESSS_System* system, const AmbulanceFilter* filter, int after_slot, int* out_slots,
+                    int max_out);
+void text_init(TextBuffer* text, FILE* out);
+void text_printf(TextBuffer* text, const char* format, ...);
+void text_flush(TextBuffer* text);
 void display_menu();
 void add_sample_data(BAPESSS_System* system);
+int create_booking(BAPESSS_System* system, Booking* request);
+int create_booking_with(BAPESSS_System* system, Booking* request, int ambulance_slot);
+int create_booking_claimed(BAPESSS_System* system, Booking* request, int claimed_slot);
+int road_network_load(const char* path, RoadNetwork** out);
+void road_network_free(RoadNetwork* roads);
+int road_snap(const RoadNetwork* roads, float loc_x, float loc_y);
+int attach_roads(BAPESSS_System* system, const char* path);
+int rank_by_eta(BAPESSS_System* system, float loc_x, float loc_y, int min_type, int k,
+                int* out_slots, float* out_seconds);
+int plan_batch_assignment(BAPESSS_System* system, const DispatchCall* calls, int count, int* out_slots);
+int dispatch_batch(BAPESSS_System* system, DispatchCall* calls, int count);
+OpResult change_booking_status(BAPESSS_System* system, int booking_id, int new_status, int* out_served);
+int register_ambulance(BAPESSS_System* system, Ambulance* ambulance, int* out_served);
+int write_data_files(BAPESSS_System* system);
+int read_data_files(BAPESSS_System* system);
+int read_legacy_files(BAPESSS_System* system);
+int save_snapshot(BAPESSS_System* system, const char* path, uint64_t journal_lsn);
+int load_snapshot(BAPESSS_System* system, const char* path, uint64_t* out_journal_lsn);
+int check_snapshot(const char* path);
+void snapshot_unmap(SnapshotMapping* mapping);
+int journal_start(BAPESSS_System* system, const char* path, uint64_t base_lsn);
+int journal_rebase(BAPESSS_System* system, uint64_t base_lsn, uint64_t keep_from);
+int journal_recover(BAPESSS_System* system, const char* path, uint64_t snapshot_lsn);
+void journal_close(BAPESSS_System* system);
+void journal_append(BAPESSS_System* system, uint32_t type, const void* payload, size_t length,
+                    const void* extra, size_t extra_length);
+int journal_commit(BAPESSS_System* system, int force);
+void journal_change(BAPESSS_System* system, uint32_t type, int booking_id, int value, int64_t time);
+int compact_if_needed(BAPESSS_System* system);
+int snapshot_start_background(BAPESSS_System* system, const char* path);
+int snapshot_poll(BAPESSS_System* system, int wait);
+int release_booking(BAPESSS_System* system, int booking_slot, int status);
+const char* op_result_name(OpResult result);
+int run_batch(FILE* in, FILE* out);
+int run_server(const char* address, int worker_count);
+int execute_command(BAPESSS_System* system, char* line, FILE* out);
 void book_ambulance(BAPESSS_System* system);
 void view_bookings(BAPESSS_System* system);
+void show_booking_details(BAPESSS_System* system, int slot);
+void search_bookings(BAPESSS_System* system);
 void view_ambulances(BAPESSS_System* system);
 void update_booking_status(BAPESSS_System* system);
 void cancel_booking(BAPESSS_System* system);
@@ -65,12 +717,93 @@ void load_data(BAPESSS_System* system);
 int get_choice();
 void clear_input_buffer();
 void get_current_time(char* buffer, int size);
+int64_t current_epoch();
+double monotonic_seconds();
+void format_time(int64_t epoch, char* buffer, int size);
+int64_t parse_time(const char* text);
 int find_available_ambulance(BAPESSS_System* system, int emergency_level);
+int nearest_qualified_ambulance(BAPESSS_System* system, int emergency_level, float loc_x, float loc_y,
+                                float* out_dist2, float* out_seconds);
+int claim_ambulance(BAPESSS_System* system, int slot);
+int claim_available_ambulance(BAPESSS_System* system, int emergency_level);
+int claim_for_booking(BAPESSS_System* system, int emergency_level, int preferred_slot);
+void release_claim(BAPESSS_System* system, int slot);
+void record_claim(BAPESSS_System* system, int slot);
+void fleet_settle(BAPESSS_System* system);
+int unsettled_claims(BAPESSS_System* system);
+void set_ambulance_status(BAPESSS_System* system, int slot, int status);
+void set_ambulance_location(BAPESSS_System* system, int slot, float loc_x, float loc_y);
+int apply_positions(BAPESSS_System* system, PositionUpdate* updates, int count);
+void rebuild_indexes(BAPESSS_System* system);
+void available_insert(BAPESSS_System* system, int slot);
+void available_remove(BAPESSS_System* system, int slot);
+void id_index_init(IdIndex* index);
+void id_index_free(IdIndex* index);
+void id_index_clear(IdIndex* index);
+void id_index_put(IdIndex* index, int id, int slot);
+int id_index_get(const IdIndex* index, int id);
+int find_booking_slot(BAPESSS_System* system, int booking_id);
+int find_ambulance_slot(BAPESSS_System* system, int ambulance_id);
+void pending_init(BAPESSS_System* system);
+void pending_free(BAPESSS_System* system);
+void pending_rebuild(BAPESSS_System* system);
+void pending_push(BAPESSS_System* system, int booking_slot);
+int pending_pop(BAPESSS_System* system);
+void assign_ambulance(BAPESSS_System* system, int booking_slot, int ambulance_slot);
+int serve_pending(BAPESSS_System* system, int ambulance_slot);
+int close_booking(BAPESSS_System* system, int booking_slot, int status);
+void set_booking_status(BAPESSS_System* system, int booking_slot, int status);
+void histogram_bytes(const uint8_t* values, size_t count, int bins, long* out);
+int filter_bytes(const uint8_t* first, const uint8_t* second, int from, int to, int want_first, int want_second,
+                 int* out_slots, int max_out, int* stopped);
+void booking_columns_init(BookingColumns* columns);
+void booking_columns_free(BookingColumns* columns);
+int booking_columns_build(BAPESSS_System* system);
+void counters_recount(BAPESSS_System* system, ReportCounters* out);
+int counters_verify(BAPESSS_System* system);
+void pools_init(AvailabilityPools* pools);
+void pools_free(AvailabilityPools* pools);
+void pools_rebuild(BAPESSS_System* system);
+void pool_insert(BAPESSS_System* system, int slot);
+void pool_remove(BAPESSS_System* system, int slot);
+void grid_init(SpatialGrid* grid);
+void grid_free(SpatialGrid* grid);
+void grid_rebuild(BAPESSS_System* system);
+void grid_insert(BAPESSS_System* system, int slot);
+void grid_remove(BAPESSS_System* system, int slot);
+int grid_k_nearest_qualified(BAPESSS_System* system, float loc_x, float loc_y, int min_type, int k,
+                             int* out_slots, float* out_dist2);
+int grid_k_nearest(BAPESSS_System* system, float loc_x, float loc_y, int k,
+                   int* out_slots, float* out_dist2);
+int grid_within_radius(BAPESSS_System* system, float loc_x, float loc_y, float radius,
+                       int* out_slots, int max_out);
 
 // =============================================
 // MAIN FUNCTION
 // =============================================
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        return run_benchmark(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        FILE* in = stdin;
+        if (argc >= 3 && strcmp(argv[2], "-") != 0) {
+            in = fopen(argv[2], "r");
+            if (in == NULL) {
+                fprintf(stderr, "Error: Could not open command file %s\n", argv[2]);
+                return 1;
+            }
+        }
+        int failures = run_batch(in, stdout);
+        if (in != stdin) {
+            fclose(in);
+        }
+        return failures > 0 ? 2 : 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+        return run_server(argc >= 3 ? argv[2] : NULL, argc >= 4 ? atoi(argv[3]) : 0);
+    }
+    
     printf("========================================\n");
     printf("   BAPESSS AMBULANCE BOOKING SYSTEM\n");
     printf("========================================\n");
@@ -89,9 +822,40 @@ int main() {
         printf("Error: Could not initialize system!\n");
         return 1;
     }
+    printf("System initialized successfully!\n");
     
-    // Add sample data for demonstration
-    add_sample_data(system);
+    int roads = attach_roads(system, ROADS_FILE);
+    if (roads == 0) {
+        printf("Road network loaded: %d junctions, %d road segments\n",
+               system->roads->node_count, system->roads->arc_count);
+    } else if (roads == -2) {
+        printf("Warning: %s could not be read; ambulances are ranked by straight-line distance.\n",
+               ROADS_FILE);
+    }
+    
+    // Recover the saved state (snapshot plus journal), or start from sample data
+    int loaded = read_data_files(system);
+    if (loaded == -3) {
+        printf("Error: the saved changes could not be recovered; not starting.\n");
+        free_system(system);
+        return 1;
+    }
+    if (loaded == 0) {
+        printf("Saved data loaded: %d ambulances, %d bookings", system->ambulance_count, system->booking_count);
+        if (system->journal != NULL && system->journal->replayed > 0) {
+            printf(" (%d journaled changes replayed)", system->journal->replayed);
+        }
+        printf("\n");
+    } else {
+        add_sample_data(system);
+        printf("Sample data loaded successfully!\n");
+        if (loaded == -1) {
+            write_data_files(system); // Start journaling from the sample data
+        } else {
+            printf("Warning: %s is damaged and was left as it is. Changes are not saved until you save.\n",
+                   SNAPSHOT_FILE);
+        }
+    }
     
     int choice;
     do {
@@ -141,18 +905,39 @@ int main() {
             case 11:
                 printf("\nThank you for using BAPESSS Ambulance Service!\n");
                 break;
+            case 12:
+                search_bookings(system);
+                break;
             default:
                 printf("\nInvalid choice! Please try again.\n");
         }
         
+        // Every change made by this action is on disk before the next prompt
+        journal_commit(system, 1);
+        int saved = snapshot_poll(system, 0);
+        if (saved > 0) {
+            printf("\nBackground save finished.\n");
+        } else if (saved < 0) {
+            printf("\nError: Background save failed! The previous save was kept.\n");
+        }
+        compact_if_needed(system);
+        
         printf("\nPress Enter to continue...");
         clear_input_buffer();
         getchar();
         
     } while (choice != 11);
     
+    if (system->saving.pid != 0) {
+        printf("Waiting for the background save to finish...\n");
+        if (snapshot_poll(system, 1) < 0) {
+            printf("Error: Background save failed! The previous save was kept.\n");
+        }
+    }
+    
     // Clean up memory
     free_system(system);
+    printf("System memory freed.\n");
     
     return 0;
 }
@@ -174,25 +959,43 @@ BAPESSS_System* create_system() {
         return NULL;
     }
     
-    // Initial capacities
-    system->ambulance_capacity = 10;
-    system->booking_capacity = 50;
+    // Fleet columns and booking chunks are allocated on demand
+    system->amb_status = NULL;
+    system->amb_type = NULL;
+    system->amb_x = NULL;
+    system->amb_y = NULL;
+    system->amb_details = NULL;
+    system->unsettled = NULL;
+    system->unsettled_count = 0;
+    system->defer_claims = 0;
+    system->ambulance_capacity = 0;
+    system->booking_capacity = 0;
+    system->booking_chunks = NULL;
+    system->chunk_count = 0;
+    system->chunk_capacity = 0;
+    system->mapped_chunks = 0;
+    system->snapshot.base = NULL;
+    system->snapshot.size = 0;
+    system->journal = NULL;
+    system->roads = NULL;
+    archive_init(&system->archive);
+    patient_index_init(&system->patients);
+    active_init(&system->active);
+    booking_columns_init(&system->columns);
+    system->time_ordered = 0;
     
     // Initialize counts
     system->ambulance_count = 0;
     system->booking_count = 0;
     
-    // Allocate memory for arrays
-    system->ambulances = (Ambulance*)malloc(system->ambulance_capacity * sizeof(Ambulance));
-    system->bookings = (Booking*)malloc(system->booking_capacity * sizeof(Booking));
-    
-    if (system->ambulances == NULL || system->bookings == NULL) {
-        printf("Memory allocation failed for arrays!\n");
-        free(system);
-        return NULL;
-    }
+    grid_init(&system->grid);
+    pools_init(&system->pools);
+    id_index_init(&system->booking_index);
+    id_index_init(&system->ambulance_index);
+    strings_init(system);
+    pending_init(system);
+    memset(&system->counters, 0, sizeof(ReportCounters));
     
-    printf("System initialized successfully!\n");
     return system;
 }
 
@@ -201,742 +1004,10799 @@ BAPESSS_System* create_system() {
  */
 void free_system(BAPESSS_System* system) {
     if (system != NULL) {
-        if (system->ambulances != NULL) {
-            free(system->ambulances);
-        }
-        if (system->bookings != NULL) {
-            free(system->bookings);
-        }
+        snapshot_poll(system, 1);
+        journal_close(system);
+        free(system->amb_status);
+        free(system->amb_type);
+        free(system->amb_x);
+        free(system->amb_y);
+        free(system->amb_details);
+        free(system->unsettled);
+        clear_bookings(system);
+        free(system->booking_chunks);
+        grid_free(&system->grid);
+        pools_free(&system->pools);
+        id_index_free(&system->booking_index);
+        id_index_free(&system->ambulance_index);
+        strings_free(system);
+        pending_free(system);
+        road_network_free(system->roads);
+        archive_free(&system->archive);
+        patient_index_free(&system->patients);
+        active_free(&system->active);
+        booking_columns_free(&system->columns);
         free(system);
     }
-    printf("System memory freed.\n");
 }
 
 // =============================================
-// MENU AND DISPLAY FUNCTIONS
+// AGGREGATION KERNELS
 // =============================================
 
+// x86 builds run the column kernels (byte histograms, nearest-unit
+// scans) with SSE2, and with AVX2 when the CPU has it; other builds use
+// the scalar loops
+#if defined(__GNUC__) && defined(__SSE2__)
+#define KERNEL_SSE2 1
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNEL_AVX2 1
+#endif
+
 /**
- * Displays the main menu options
+ * Adds the bytes equal to 0..bins-1 to out, one byte at a time
  */
-void display_menu() {
-    system("clear || cls"); // Clear screen (works for both Linux and Windows)
-    
-    printf("\n=== BAPESSS AMBULANCE BOOKING SYSTEM ===\n");
-    printf("1.  Book an Ambulance\n");
-    printf("2.  View All Bookings\n");
-    printf("3.  View Available Ambulances\n");
-    printf("4.  Update Booking Status\n");
-    printf("5.  Cancel Booking\n");
-    printf("6.  Add New Ambulance\n");
-    printf("7.  Find Nearest Ambulance\n");
-    printf("8.  Generate Report\n");
-    printf("9.  Save Data to File\n");
-    printf("10. Load Data from File\n");
-    printf("11. Exit\n");
-    printf("=======================================\n");
-    printf("Enter your choice (1-11): ");
+static void histogram_bytes_scalar(const uint8_t* values, size_t count, int bins, long* out) {
+    for (size_t i = 0; i < count; i++) {
+        if (values[i] < bins) {
+            out[values[i]]++;
+        }
+    }
 }
 
+#ifdef KERNEL_SSE2
 /**
- * Gets user choice with validation
- * Returns: Integer choice
+ * Adds the bytes equal to 0..bins-1 to out, 16 at a time: each bin keeps
+ * a byte counter per lane, widened before it can wrap
  */
-int get_choice() {
-    int choice;
-    char input[100];
-    
-    if (fgets(input, sizeof(input), stdin) != NULL) {
-        if (sscanf(input, "%d", &choice) == 1) {
-            return choice;
+static void histogram_bytes_sse2(const uint8_t* values, size_t count, int bins, long* out) {
+    size_t i = 0;
+    while (count - i >= 16) {
+        __m128i counters[HISTOGRAM_MAX_BINS];
+        for (int b = 0; b < bins; b++) {
+            counters[b] = _mm_setzero_si128();
+        }
+        size_t end = count - i >= 16 * 255 ? i + 16 * 255 : i + (count - i) / 16 * 16;
+        for (; i < end; i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(values + i));
+            for (int b = 0; b < bins; b++) {
+                counters[b] = _mm_sub_epi8(counters[b], _mm_cmpeq_epi8(block, _mm_set1_epi8((char)b)));
+            }
+        }
+        for (int b = 0; b < bins; b++) {
+            uint64_t sums[2];
+            _mm_storeu_si128((__m128i*)sums, _mm_sad_epu8(counters[b], _mm_setzero_si128()));
+            out[b] += (long)(sums[0] + sums[1]);
         }
     }
-    return -1; // Invalid input
+    histogram_bytes_scalar(values + i, count - i, bins, out);
 }
+#endif
 
+#ifdef KERNEL_AVX2
 /**
- * Clears the input buffer to prevent issues with scanf
+ * The SSE2 kernel on 32-byte blocks
  */
-void clear_input_buffer() {
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF);
+__attribute__((target("avx2")))
+static void histogram_bytes_avx2(const uint8_t* values, size_t count, int bins, long* out) {
+    size_t i = 0;
+    while (count - i >= 32) {
+        __m256i counters[HISTOGRAM_MAX_BINS];
+        for (int b = 0; b < bins; b++) {
+            counters[b] = _mm256_setzero_si256();
+        }
+        size_t end = count - i >= 32 * 255 ? i + 32 * 255 : i + (count - i) / 32 * 32;
+        for (; i < end; i += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i*)(values + i));
+            for (int b = 0; b < bins; b++) {
+                counters[b] = _mm256_sub_epi8(counters[b], _mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)b)));
+            }
+        }
+        for (int b = 0; b < bins; b++) {
+            uint64_t sums[4];
+            _mm256_storeu_si256((__m256i*)sums, _mm256_sad_epu8(counters[b], _mm256_setzero_si256()));
+            out[b] += (long)(sums[0] + sums[1] + sums[2] + sums[3]);
+        }
+    }
+    histogram_bytes_scalar(values + i, count - i, bins, out);
 }
-
-// =============================================
-// SAMPLE DATA FOR DEMONSTRATION
-// =============================================
+#endif
 
 /**
- * Adds sample ambulances and bookings for demonstration
+ * Adds a histogram of a byte column to out: out[v] counts the bytes
+ * equal to v for v below bins (at most HISTOGRAM_MAX_BINS), and
+ * out[bins] every larger byte
  */
-void add_sample_data(BAPESSS_System* system) {
-    // Add sample ambulances
-    Ambulance ambulance1 = {1, "MH01AB1234", "Rajesh Kumar", "9876543210", 2, 0, 12.5, 15.3};
-    Ambulance ambulance2 = {2, "MH01CD5678", "Suresh Patel", "9876543211", 1, 0, 15.2, 18.7};
-    Ambulance ambulance3 = {3, "MH01EF9012", "Amit Sharma", "9876543212", 3, 0, 10.1, 12.5};
+void histogram_bytes(const uint8_t* values, size_t count, int bins, long* out) {
+    long counted = 0;
+    int done = 0;
+    for (int b = 0; b < bins; b++) {
+        counted -= out[b];
+    }
     
-    system->ambulances[0] = ambulance1;
-    system->ambulances[1] = ambulance2;
-    system->ambulances[2] = ambulance3;
-    system->ambulance_count = 3;
+#ifdef KERNEL_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        histogram_bytes_avx2(values, count, bins, out);
+        done = 1;
+    }
+#endif
+#ifdef KERNEL_SSE2
+    if (!done) {
+        histogram_bytes_sse2(values, count, bins, out);
+        done = 1;
+    }
+#endif
+    if (!done) {
+        histogram_bytes_scalar(values, count, bins, out);
+    }
     
-    // Add sample bookings
-    char time_buffer[50];
-    get_current_time(time_buffer, sizeof(time_buffer));
-
-    Booking booking1;
-    booking1.booking_id = 1001;
-    strcpy(booking1.patient_name, "John Doe");
-    strcpy(booking1.patient_contact, "9123456789");
-    strcpy(booking1.pickup_location, "123 Main St, Mumbai");
-    strcpy(booking1.hospital, "Apollo Hospital");
-    booking1.ambulance_id = 1;
-    strcpy(booking1.booking_time, time_buffer);
-    strcpy(booking1.pickup_time, "Not picked up yet");
-    booking1.emergency_level = 2;
-    booking1.status = 1;
+    for (int b = 0; b < bins; b++) {
+        counted += out[b];
+    }
+    out[bins] += (long)count - counted;
+}
 
-    Booking booking2;
-    booking2.booking_id = 1002;
-    strcpy(booking2.patient_name, "Jane Smith");
-    strcpy(booking2.patient_contact, "9123456790");
-    strcpy(booking2.pickup_location, "456 Park Ave, Delhi");
-    strcpy(booking2.hospital, "Fortis Hospital");
-    booking2.ambulance_id = 2;
-    strcpy(booking2.booking_time, time_buffer);
-    strcpy(booking2.pickup_time, "Not picked up yet");
-    booking2.emergency_level = 3;
-    booking2.status = 2;
-    
-    system->bookings[0] = booking1;
-    system->bookings[1] = booking2;
-    system->booking_count = 2;
-    
-    printf("Sample data loaded successfully!\n");
+/**
+ * Writes the slots in [from, to) whose bytes in two columns equal
+ * want_first and want_second (a negative value matches any byte), one
+ * slot at a time
+ * Returns: Number of slots written
+ */
+static int filter_bytes_scalar(const uint8_t* first, const uint8_t* second, int from, int to, int want_first,
+                               int want_second, int* out_slots, int max_out, int* stopped) {
+    int found = 0;
+    int slot = from;
+    for (; slot < to && found < max_out; slot++) {
+        if ((want_first < 0 || first[slot] == want_first) && (want_second < 0 || second[slot] == want_second)) {
+            out_slots[found++] = slot;
+        }
+    }
+    *stopped = slot;
+    return found;
 }
 
-// =============================================
-// CORE BOOKING FUNCTION
-// =============================================
+#ifdef KERNEL_SSE2
+/**
+ * The scalar filter 16 slots at a time: both columns are compared with
+ * the wanted bytes, and the set bits of the combined mask give the slots
+ */
+static int filter_bytes_sse2(const uint8_t* first, const uint8_t* second, int from, int to, int want_first,
+                             int want_second, int* out_slots, int max_out, int* stopped) {
+    __m128i all = _mm_set1_epi8((char)0xFF);
+    __m128i first_value = _mm_set1_epi8((char)want_first);
+    __m128i second_value = _mm_set1_epi8((char)want_second);
+    int found = 0;
+    int slot = from;
+    for (; to - slot >= 16 && found < max_out; slot += 16) {
+        __m128i first_match = want_first < 0 ? all :
+                              _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(first + slot)), first_value);
+        __m128i second_match = want_second < 0 ? all :
+                               _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(second + slot)), second_value);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(first_match, second_match));
+        while (mask != 0 && found < max_out) {
+            out_slots[found++] = slot + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+        if (mask != 0) {
+            *stopped = out_slots[found - 1] + 1; // The page filled up inside this block
+            return found;
+        }
+    }
+    int tail;
+    found += filter_bytes_scalar(first, second, slot, to, want_first, want_second, out_slots + found,
+                                 max_out - found, &tail);
+    *stopped = tail;
+    return found;
+}
+#endif
 
+#ifdef KERNEL_AVX2
 /**
- * Books an ambulance based on user input
+ * The SSE2 filter on 32-slot blocks
  */
-void book_ambulance(BAPESSS_System* system) {
-    printf("\n=== BOOK AMBULANCE ===\n");
-    
-    // Check if we have capacity for new booking
-    if (system->booking_count >= system->booking_capacity) {
-        printf("Error: Booking system is at full capacity!\n");
-        return;
+__attribute__((target("avx2")))
+static int filter_bytes_avx2(const uint8_t* first, const uint8_t* second, int from, int to, int want_first,
+                             int want_second, int* out_slots, int max_out, int* stopped) {
+    __m256i all = _mm256_set1_epi8((char)0xFF);
+    __m256i first_value = _mm256_set1_epi8((char)want_first);
+    __m256i second_value = _mm256_set1_epi8((char)want_second);
+    int found = 0;
+    int slot = from;
+    for (; to - slot >= 32 && found < max_out; slot += 32) {
+        __m256i first_match = want_first < 0 ? all :
+                              _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(first + slot)), first_value);
+        __m256i second_match = want_second < 0 ? all :
+                               _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(second + slot)), second_value);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(first_match, second_match));
+        while (mask != 0 && found < max_out) {
+            out_slots[found++] = slot + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+        if (mask != 0) {
+            *stopped = out_slots[found - 1] + 1;
+            _mm256_zeroupper();
+            return found;
+        }
     }
-    
-    // Get patient details
-    Booking new_booking;
-    
-    // Generate booking ID
-    new_booking.booking_id = 1000 + system->booking_count + 1;
-    
-    printf("Enter patient name: ");
-    clear_input_buffer();
-    fgets(new_booking.patient_name, sizeof(new_booking.patient_name), stdin);
-    new_booking.patient_name[strcspn(new_booking.patient_name, "\n")] = 0;
-    
-    printf("Enter contact number: ");
-    fgets(new_booking.patient_contact, sizeof(new_booking.patient_contact), stdin);
-    new_booking.patient_contact[strcspn(new_booking.patient_contact, "\n")] = 0;
-    
-    printf("Enter pickup location: ");
-    fgets(new_booking.pickup_location, sizeof(new_booking.pickup_location), stdin);
-    new_booking.pickup_location[strcspn(new_booking.pickup_location, "\n")] = 0;
-    
-    printf("Enter hospital name: ");
-    fgets(new_booking.hospital, sizeof(new_booking.hospital), stdin);
-    new_booking.hospital[strcspn(new_booking.hospital, "\n")] = 0;
-    
-    // Get emergency level
-    printf("\nEmergency Level:\n");
-    printf("1. Normal (Non-critical)\n");
-    printf("2. Urgent (Serious but stable)\n");
-    printf("3. Critical (Life-threatening)\n");
-    printf("Select emergency level (1-3): ");
-    scanf("%d", &new_booking.emergency_level);
-    
-    if (new_booking.emergency_level < 1 || new_booking.emergency_level > 3) {
-        printf("Invalid emergency level! Setting to Normal.\n");
-        new_booking.emergency_level = 1;
-    }
-    
-    // Find available ambulance
-    new_booking.ambulance_id = find_available_ambulance(system, new_booking.emergency_level);
-    
-    if (new_booking.ambulance_id == -1) {
-        printf("\nSorry! No ambulances available at the moment.\n");
-        printf("Your request has been queued. We'll notify you when available.\n");
-        new_booking.status = 0; // Pending
-        new_booking.ambulance_id = 0;
-    } else {
-        // Update ambulance status
-        for (int i = 0; i < system->ambulance_count; i++) {
-            if (system->ambulances[i].ambulance_id == new_booking.ambulance_id) {
-                system->ambulances[i].status = 1; // Booked
-                break;
-            }
-        }
-        new_booking.status = 1; // Confirmed
-        printf("\nAmbulance ID %d has been assigned!\n", new_booking.ambulance_id);
+    _mm256_zeroupper();
+    int tail;
+    found += filter_bytes_scalar(first, second, slot, to, want_first, want_second, out_slots + found,
+                                 max_out - found, &tail);
+    *stopped = tail;
+    return found;
+}
+#endif
+
+/**
+ * Finds the slots in [from, to) whose bytes in two columns equal
+ * want_first and want_second, where a negative value matches any byte.
+ * At most max_out slots are written, in order; *stopped is set to the
+ * slot the next search should start at.
+ * Returns: Number of slots written
+ */
+int filter_bytes(const uint8_t* first, const uint8_t* second, int from, int to, int want_first, int want_second,
+                 int* out_slots, int max_out, int* stopped) {
+    if (max_out <= 0 || from >= to) {
+        *stopped = from;
+        return 0;
     }
-    
-    // Set timestamps
-    char time_buffer[50];
-    get_current_time(time_buffer, sizeof(time_buffer));
-    strcpy(new_booking.booking_time, time_buffer);
-    strcpy(new_booking.pickup_time, "Not picked up yet");
-    
-    // Add booking to system
-    system->bookings[system->booking_count] = new_booking;
-    system->booking_count++;
-    
-    printf("\n=== BOOKING CONFIRMED ===\n");
-    printf("Booking ID: %d\n", new_booking.booking_id);
-    printf("Patient: %s\n", new_booking.patient_name);
-    printf("Status: %s\n", new_booking.status == 1 ? "Confirmed" : "Pending");
-    if (new_booking.ambulance_id > 0) {
-        printf("Assigned Ambulance: %d\n", new_booking.ambulance_id);
+#ifdef KERNEL_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return filter_bytes_avx2(first, second, from, to, want_first, want_second, out_slots, max_out, stopped);
     }
+#endif
+#ifdef KERNEL_SSE2
+    return filter_bytes_sse2(first, second, from, to, want_first, want_second, out_slots, max_out, stopped);
+#else
+    return filter_bytes_scalar(first, second, from, to, want_first, want_second, out_slots, max_out, stopped);
+#endif
 }
 
-// =============================================
-// VIEW FUNCTIONS
-// =============================================
+/**
+ * Initializes empty columns
+ */
+void booking_columns_init(BookingColumns* columns) {
+    memset(columns, 0, sizeof(BookingColumns));
+}
 
 /**
- * Displays all bookings
+ * Frees the columns and leaves them empty and unbuilt
  */
-void view_bookings(BAPESSS_System* system) {
-    printf("\n=== ALL BOOKINGS ===\n");
-    printf("Total Bookings: %d\n\n", system->booking_count);
-    
-    if (system->booking_count == 0) {
-        printf("No bookings found.\n");
-        return;
+void booking_columns_free(BookingColumns* columns) {
+    free(columns->status);
+    free(columns->level);
+    booking_columns_init(columns);
+}
+
+/**
+ * Makes room for at least slots entries in both columns
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int booking_columns_reserve(BookingColumns* columns, int slots) {
+    if (slots <= columns->capacity) {
+        return 0;
     }
-    
-    printf("ID    Patient Name         Contact       Status      Ambulance\n");
-    printf("----------------------------------------------------------------\n");
-    
-    for (int i = 0; i < system->booking_count; i++) {
-        char* status_str;
-        switch(system->bookings[i].status) {
-            case 0: status_str = "Pending"; break;
-            case 1: status_str = "Confirmed"; break;
-            case 2: status_str = "Dispatched"; break;
-            case 3: status_str = "Completed"; break;
-            case 4: status_str = "Cancelled"; break;
-            default: status_str = "Unknown";
-        }
-        
-        printf("%-6d%-21s%-14s%-12s%d\n",
-               system->bookings[i].booking_id,
-               system->bookings[i].patient_name,
-               system->bookings[i].patient_contact,
-               status_str,
-               system->bookings[i].ambulance_id);
+    int capacity = columns->capacity > 0 ? columns->capacity : 4096;
+    while (capacity < slots) {
+        capacity = capacity > INT_MAX / 2 ? INT_MAX : capacity * 2;
     }
-    
-    // Option to view detailed booking
-    printf("\nEnter Booking ID to view details (0 to skip): ");
-    int view_id;
-    scanf("%d", &view_id);
-    
-    if (view_id > 0) {
-        for (int i = 0; i < system->booking_count; i++) {
-            if (system->bookings[i].booking_id == view_id) {
-                printf("\n=== BOOKING DETAILS ===\n");
-                printf("Booking ID: %d\n", system->bookings[i].booking_id);
-                printf("Patient: %s\n", system->bookings[i].patient_name);
-                printf("Contact: %s\n", system->bookings[i].patient_contact);
-                printf("Pickup: %s\n", system->bookings[i].pickup_location);
-                printf("Hospital: %s\n", system->bookings[i].hospital);
-                printf("Booking Time: %s\n", system->bookings[i].booking_time);
-                printf("Pickup Time: %s\n", system->bookings[i].pickup_time);
-                
-                char* emergency_str;
-                switch(system->bookings[i].emergency_level) {
-                    case 1: emergency_str = "Normal"; break;
-                    case 2: emergency_str = "Urgent"; break;
-                    case 3: emergency_str = "Critical"; break;
-                    default: emergency_str = "Unknown";
-                }
-                printf("Emergency Level: %s\n", emergency_str);
-                break;
-            }
+    uint8_t* status = (uint8_t*)realloc(columns->status, (size_t)capacity);
+    if (status == NULL) {
+        return -1;
+    }
+    columns->status = status;
+    uint8_t* level = (uint8_t*)realloc(columns->level, (size_t)capacity);
+    if (level == NULL) {
+        return -1;
+    }
+    columns->level = level;
+    columns->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Copies every booking's status and level into the columns the first
+ * time a recount or filter needs them after the bookings were replaced;
+ * from then on append_booking and set_booking_status keep them current
+ * Returns: 0 on success, -1 on allocation failure
+ */
+int booking_columns_build(BAPESSS_System* system) {
+    BookingColumns* columns = &system->columns;
+    if (columns->built) {
+        return 0;
+    }
+    if (booking_columns_reserve(columns, system->booking_count) != 0) {
+        booking_columns_free(columns);
+        return -1;
+    }
+    for (int slot = 0; slot < system->booking_count;) {
+        const BookingRecord* chunk = system->booking_chunks[slot >> BOOKING_CHUNK_SHIFT];
+        int count = system->booking_count - slot < BOOKING_CHUNK_SIZE ? system->booking_count - slot :
+                    BOOKING_CHUNK_SIZE;
+        for (int i = 0; i < count; i++) {
+            columns->status[slot + i] = chunk[i].status;
+            columns->level[slot + i] = chunk[i].emergency_level;
         }
+        slot += count;
     }
+    columns->built = 1;
+    return 0;
 }
 
 /**
- * Displays all ambulances and their status
+ * Adds a new booking to the columns, if they have been built
  */
-void view_ambulances(BAPESSS_System* system) {
-    printf("\n=== AMBULANCE FLEET ===\n");
-    printf("Total Ambulances: %d\n\n", system->ambulance_count);
-    
-    if (system->ambulance_count == 0) {
-        printf("No ambulances registered.\n");
+static void booking_columns_add(BAPESSS_System* system, int slot) {
+    BookingColumns* columns = &system->columns;
+    if (!columns->built) {
         return;
     }
+    if (booking_columns_reserve(columns, slot + 1) != 0) {
+        booking_columns_free(columns); // Rebuilt in full when next needed
+        return;
+    }
+    columns->status[slot] = booking_at(system, slot)->status;
+    columns->level[slot] = booking_at(system, slot)->emergency_level;
+}
+
+/**
+ * Counts booking statuses and emergency levels over slots [from, to),
+ * walking each chunk's records directly. Status and level are counted
+ * together in one table, so each record costs a single increment.
+ */
+static void histogram_bookings(BAPESSS_System* system, int from, int to, ReportCounters* out) {
+    long pairs[BOOKING_STATUSES + 1][EMERGENCY_LEVELS + 2];
+    memset(pairs, 0, sizeof(pairs));
     
-    printf("ID  Vehicle No.   Driver         Contact      Type        Status      Location\n");
-    printf("--------------------------------------------------------------------------------\n");
-    
-    for (int i = 0; i < system->ambulance_count; i++) {
-        char* type_str;
-        switch(system->ambulances[i].type) {
-            case 1: type_str = "Basic"; break;
-            case 2: type_str = "Advanced"; break;
-            case 3: type_str = "Mobile ICU"; break;
-            default: type_str = "Unknown";
+    for (int slot = from; slot < to;) {
+        const BookingRecord* chunk = system->booking_chunks[slot >> BOOKING_CHUNK_SHIFT];
+        int first = slot & (BOOKING_CHUNK_SIZE - 1);
+        int last = to - slot < BOOKING_CHUNK_SIZE - first ? first + (to - slot) : BOOKING_CHUNK_SIZE;
+        for (int i = first; i < last; i++) {
+            unsigned status = chunk[i].status;
+            unsigned level = chunk[i].emergency_level;
+            pairs[status < BOOKING_STATUSES ? status : BOOKING_STATUSES]
+                 [level - 1u < EMERGENCY_LEVELS ? level : EMERGENCY_LEVELS + 1]++;
         }
-        
-        char* status_str;
-        switch(system->ambulances[i].status) {
-            case 0: status_str = "Available"; break;
-            case 1: status_str = "Booked"; break;
-            case 2: status_str = "On Trip"; break;
-            case 3: status_str = "Maintenance"; break;
-            default: status_str = "Unknown";
+        slot += last - first;
+    }
+    
+    for (int status = 0; status <= BOOKING_STATUSES; status++) {
+        for (int level = 1; level <= EMERGENCY_LEVELS + 1; level++) {
+            out->booking_status[status] += (int)pairs[status][level];
+            out->booking_level[level] += (int)pairs[status][level];
         }
-        
-        printf("%-3d%-14s%-15s%-13s%-12s%-12s(%.1f, %.1f)\n",
-               system->ambulances[i].ambulance_id,
-               system->ambulances[i].vehicle_number,
-               system->ambulances[i].driver_name,
-               system->ambulances[i].driver_contact,
-               type_str,
-               status_str,
-               system->ambulances[i].location_x,
-               system->ambulances[i].location_y);
     }
 }
 
-// =============================================
-// UTILITY FUNCTIONS
-// =============================================
+#ifndef _WIN32
+// One thread's share of a booking recount
+typedef struct {
+    BAPESSS_System* system;
+    int from, to;              // Booking slots to count
+    ReportCounters partial;    // This share's counts, merged when the thread is done
+} RecountShare;
 
 /**
- * Gets current time as string
+ * Counts one share of the bookings
  */
-void get_current_time(char* buffer, int size) {
-    time_t rawtime;
-    struct tm* timeinfo;
-    
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    
-    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", timeinfo);
+static void* recount_share(void* arg) {
+    RecountShare* share = (RecountShare*)arg;
+    histogram_bookings(share->system, share->from, share->to, &share->partial);
+    return NULL;
 }
+#endif
 
 /**
- * Finds an available ambulance based on emergency level
- * Returns: Ambulance ID or -1 if none available
+ * Adds the booking status and level counts to out, split into one share
+ * per thread (on chunk boundaries) when thread_count is above 1. Each
+ * thread fills its own partial counters, so they never write to shared
+ * memory.
  */
-int find_available_ambulance(BAPESSS_System* system, int emergency_level) {
-    // First, try to find ambulance matching emergency level requirements
-    for (int i = 0; i < system->ambulance_count; i++) {
-        if (system->ambulances[i].status == 0 &&  // Available
-            system->ambulances[i].type >= emergency_level) { // Type matches or exceeds requirement
-            return system->ambulances[i].ambulance_id;
-        }
-    }
+static void recount_bookings(BAPESSS_System* system, int thread_count, ReportCounters* out) {
+#ifndef _WIN32
+    RecountShare shares[AGGREGATE_MAX_THREADS];
+    pthread_t threads[AGGREGATE_MAX_THREADS];
+    if (thread_count > AGGREGATE_MAX_THREADS) thread_count = AGGREGATE_MAX_THREADS;
+    int chunks = (system->booking_count + BOOKING_CHUNK_SIZE - 1) / BOOKING_CHUNK_SIZE;
+    if (thread_count > chunks) thread_count = chunks;
     
-    // If no exact match, find any available ambulance
-    for (int i = 0; i < system->ambulance_count; i++) {
-        if (system->ambulances[i].status == 0) {
-            return system->ambulances[i].ambulance_id;
+    if (thread_count > 1) {
+        int started = 0;
+        for (int t = 0; t < thread_count; t++) {
+            RecountShare* share = &shares[t];
+            memset(share, 0, sizeof(RecountShare));
+            share->system = system;
+            share->from = (int)((long long)chunks * t / thread_count) * BOOKING_CHUNK_SIZE;
+            share->to = (int)((long long)chunks * (t + 1) / thread_count) * BOOKING_CHUNK_SIZE;
+            if (share->to > system->booking_count) share->to = system->booking_count;
+            if (pthread_create(&threads[t], NULL, recount_share, share) != 0) {
+                recount_share(share); // Count this share here instead
+                continue;
+            }
+            started |= 1 << t;
+        }
+        for (int t = 0; t < thread_count; t++) {
+            if (started & (1 << t)) {
+                pthread_join(threads[t], NULL);
+            }
+            for (int i = 0; i <= BOOKING_STATUSES; i++) {
+                out->booking_status[i] += shares[t].partial.booking_status[i];
+            }
+            for (int i = 0; i <= EMERGENCY_LEVELS + 1; i++) {
+                out->booking_level[i] += shares[t].partial.booking_level[i];
+            }
         }
+        return;
     }
-    
-    return -1; // No ambulance available
+#else
+    (void)thread_count;
+#endif
+    histogram_bookings(system, 0, system->booking_count, out);
+}
+
+/**
+ * Picks the number of threads for recounting a booking store: one for
+ * small stores, otherwise one per core up to AGGREGATE_MAX_THREADS
+ */
+static int recount_threads(int booking_count) {
+#ifndef _WIN32
+    if (booking_count >= AGGREGATE_PARALLEL_MIN) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        return cores < 1 ? 1 : (cores > AGGREGATE_MAX_THREADS ? AGGREGATE_MAX_THREADS : (int)cores);
+    }
+#else
+    (void)booking_count;
+#endif
+    return 1;
 }
 
 // =============================================
-// MANAGEMENT FUNCTIONS
+// REPORT COUNTERS
 // =============================================
 
 /**
- * Updates the status of a booking
+ * Maps a 0-based status to its counter, with one overflow bucket
  */
-void update_booking_status(BAPESSS_System* system) {
-    printf("\n=== UPDATE BOOKING STATUS ===\n");
-    
-    if (system->booking_count == 0) {
-        printf("No bookings to update.\n");
-        return;
-    }
-    
-    int booking_id;
-    printf("Enter Booking ID to update: ");
-    scanf("%d", &booking_id);
+static int status_bucket(int status, int statuses) {
+    return (status >= 0 && status < statuses) ? status : statuses;
+}
+
+/**
+ * Maps a 1-based type or emergency level to its counter, with one overflow bucket
+ */
+static int level_bucket(int level, int levels) {
+    return (level >= 1 && level <= levels) ? level : levels + 1;
+}
+
+/**
+ * Changes a booking's status and keeps the report counters in sync.
+ * Every booking status transition must go through here.
+ */
+void set_booking_status(BAPESSS_System* system, int booking_slot, int status) {
+    BookingRecord* booking = booking_at(system, booking_slot);
+    int was_open = booking->status <= 2;
     
-    // Find the booking
-    int found = -1;
-    for (int i = 0; i < system->booking_count; i++) {
-        if (system->bookings[i].booking_id == booking_id) {
-            found = i;
-            break;
-        }
+    system->counters.booking_status[status_bucket(booking->status, BOOKING_STATUSES)]--;
+    system->counters.booking_status[status_bucket(status, BOOKING_STATUSES)]++;
+    booking->status = (uint8_t)status;
+    if (system->columns.built) {
+        system->columns.status[booking_slot] = (uint8_t)status;
     }
+    active_track(system, booking_slot, was_open);
+}
+
+/**
+ * Counts every status, type and emergency level with full passes over the
+ * fleet and bookings, all with the byte histogram kernel: the fleet
+ * columns, and the bookings' status and level columns (built first if
+ * need be; without memory for them the records are counted across
+ * threads instead)
+ */
+void counters_recount(BAPESSS_System* system, ReportCounters* out) {
+    long counts[HISTOGRAM_MAX_BINS + 1];
+    memset(out, 0, sizeof(ReportCounters));
     
-    if (found == -1) {
-        printf("Booking ID %d not found!\n", booking_id);
-        return;
+    memset(counts, 0, sizeof(counts));
+    histogram_bytes(system->amb_status, (size_t)system->ambulance_count, AMBULANCE_STATUSES, counts);
+    for (int status = 0; status <= AMBULANCE_STATUSES; status++) {
+        out->ambulance_status[status] = (int)counts[status];
     }
     
-    printf("\nCurrent Status: ");
-    switch(system->bookings[found].status) {
-        case 0: printf("Pending\n"); break;
-        case 1: printf("Confirmed\n"); break;
-        case 2: printf("Dispatched\n"); break;
-        case 3: printf("Completed\n"); break;
-        case 4: printf("Cancelled\n"); break;
+    // Type 0 is out of range like the types above AMBULANCE_TYPES
+    memset(counts, 0, sizeof(counts));
+    histogram_bytes(system->amb_type, (size_t)system->ambulance_count, AMBULANCE_TYPES + 1, counts);
+    for (int type = 1; type <= AMBULANCE_TYPES; type++) {
+        out->ambulance_type[type] = (int)counts[type];
     }
+    out->ambulance_type[AMBULANCE_TYPES + 1] = (int)(counts[0] + counts[AMBULANCE_TYPES + 1]);
     
-    printf("\nSelect new status:\n");
-    printf("1. Confirmed\n");
-    printf("2. Dispatched\n");
-    printf("3. Completed\n");
-    printf("4. Cancelled\n");
-    printf("Enter choice (1-4): ");
-    
-    int new_status;
-    char time_buffer[50];
-    scanf("%d", &new_status);
-    
-    if (new_status < 1 || new_status > 4) {
-        printf("Invalid status!\n");
+    if (booking_columns_build(system) != 0) {
+        recount_bookings(system, recount_threads(system->booking_count), out);
         return;
     }
-    
-    // Update status
-    system->bookings[found].status = new_status;
-    
-    // If completed or cancelled, free up the ambulance
-    if (new_status == 3 || new_status == 4) {
-        for (int i = 0; i < system->ambulance_count; i++) {
-            if (system->ambulances[i].ambulance_id == system->bookings[found].ambulance_id) {
-                system->ambulances[i].status = 0; // Available
-                break;
-            }
-        }
+    memset(counts, 0, sizeof(counts));
+    histogram_bytes(system->columns.status, (size_t)system->booking_count, BOOKING_STATUSES, counts);
+    for (int status = 0; status <= BOOKING_STATUSES; status++) {
+        out->booking_status[status] = (int)counts[status];
     }
-    
-    // Update pickup time if dispatched
-    if (new_status == 2) {
-        get_current_time(time_buffer, sizeof(time_buffer));
-        strcpy(system->bookings[found].pickup_time, time_buffer);
+    memset(counts, 0, sizeof(counts));
+    histogram_bytes(system->columns.level, (size_t)system->booking_count, EMERGENCY_LEVELS + 1, counts);
+    for (int level = 1; level <= EMERGENCY_LEVELS; level++) {
+        out->booking_level[level] = (int)counts[level];
     }
-    
-    printf("Booking status updated successfully!\n");
+    out->booking_level[EMERGENCY_LEVELS + 1] = (int)(counts[0] + counts[EMERGENCY_LEVELS + 1]);
 }
 
 /**
- * Cancels a booking
+ * Cross-checks the running counters against a full recount
+ * Returns: 1 if they match, 0 (after printing the difference) if not
  */
-void cancel_booking(BAPESSS_System* system) {
-    printf("\n=== CANCEL BOOKING ===\n");
+int counters_verify(BAPESSS_System* system) {
+    ReportCounters expected;
+    counters_recount(system, &expected);
     
-    if (system->booking_count == 0) {
-        printf("No bookings to cancel.\n");
-        return;
+    if (memcmp(&expected, &system->counters, sizeof(ReportCounters)) == 0) {
+        return 1;
     }
     
-    int booking_id;
-    printf("Enter Booking ID to cancel: ");
-    scanf("%d", &booking_id);
-    
-    // Find the booking
-    int found = -1;
-    for (int i = 0; i < system->booking_count; i++) {
-        if (system->bookings[i].booking_id == booking_id) {
-            found = i;
-            break;
+    const int* want = (const int*)&expected;
+    const int* have = (const int*)&system->counters;
+    for (size_t i = 0; i < sizeof(ReportCounters) / sizeof(int); i++) {
+        if (want[i] != have[i]) {
+            printf("Counter mismatch at %d: running %d, recount %d\n", (int)i, have[i], want[i]);
         }
     }
-    
-    if (found == -1) {
-        printf("Booking ID %d not found!\n", booking_id);
-        return;
-    }
-    
-    printf("\nBooking Details:\n");
-    printf("Patient: %s\n", system->bookings[found].patient_name);
-    printf("Contact: %s\n", system->bookings[found].patient_contact);
-    printf("Pickup: %s\n", system->bookings[found].pickup_location);
-    
-    char confirm;
-    printf("\nAre you sure you want to cancel this booking? (y/n): ");
-    clear_input_buffer();
-    scanf("%c", &confirm);
-    
-    if (confirm == 'y' || confirm == 'Y') {
-        system->bookings[found].status = 4; // Cancelled
-        
-        // Free up the ambulance
-        for (int i = 0; i < system->ambulance_count; i++) {
-            if (system->ambulances[i].ambulance_id == system->bookings[found].ambulance_id) {
-                system->ambulances[i].status = 0; // Available
-                break;
-            }
-        }
-        
-        printf("Booking cancelled successfully!\n");
-    } else {
-        printf("Cancellation aborted.\n");
+    return 0;
+}
+
+// =============================================
+// FLEET STORE
+// =============================================
+
+/**
+ * Grows one fleet column to a new capacity
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int grow_column(void** column, int new_capacity, size_t element_size) {
+    void* grown = realloc(*column, new_capacity * element_size);
+    if (grown == NULL) {
+        return 0;
     }
+    *column = grown;
+    return 1;
 }
 
 /**
- * Adds a new ambulance to the fleet
+ * Appends an ambulance, splitting it into the hot columns and the cold
+ * details table, and adds it to the indexes.
+ * Returns: Slot of the new ambulance, or -1 on allocation failure
  */
-void add_ambulance(BAPESSS_System* system) {
-    printf("\n=== ADD NEW AMBULANCE ===\n");
-    
-    // Check capacity
+int append_ambulance(BAPESSS_System* system, const Ambulance* ambulance) {
     if (system->ambulance_count >= system->ambulance_capacity) {
-        // Resize array
-        system->ambulance_capacity *= 2;
-        system->ambulances = (Ambulance*)realloc(system->ambulances, 
-                                                system->ambulance_capacity * sizeof(Ambulance));
-        if (!system->ambulances) {
-            printf("Error: Memory allocation failed!\n");
-            return;
+        int new_capacity = system->ambulance_capacity > 0 ? system->ambulance_capacity * 2 : 16;
+        if (!grow_column((void**)&system->amb_status, new_capacity, sizeof(unsigned char)) ||
+            !grow_column((void**)&system->amb_type, new_capacity, sizeof(unsigned char)) ||
+            !grow_column((void**)&system->amb_x, new_capacity, sizeof(float)) ||
+            !grow_column((void**)&system->amb_y, new_capacity, sizeof(float)) ||
+            !grow_column((void**)&system->amb_details, new_capacity, sizeof(AmbulanceDetails)) ||
+            !grow_column((void**)&system->unsettled, new_capacity, sizeof(int))) {
+            return -1;
         }
+        system->ambulance_capacity = new_capacity;
     }
     
-    Ambulance new_ambulance;
+    int slot = system->ambulance_count;
+    system->amb_status[slot] = (unsigned char)ambulance->status;
+    system->amb_type[slot] = (unsigned char)ambulance->type;
+    system->amb_x[slot] = ambulance->location_x;
+    system->amb_y[slot] = ambulance->location_y;
     
-    // Generate ID
-    new_ambulance.ambulance_id = system->ambulance_count + 1;
+    AmbulanceDetails* details = &system->amb_details[slot];
+    details->ambulance_id = ambulance->ambulance_id;
+    memcpy(details->vehicle_number, ambulance->vehicle_number, sizeof(details->vehicle_number));
+    memcpy(details->driver_name, ambulance->driver_name, sizeof(details->driver_name));
+    memcpy(details->driver_contact, ambulance->driver_contact, sizeof(details->driver_contact));
     
-    printf("Enter vehicle number: ");
-    clear_input_buffer();
-    fgets(new_ambulance.vehicle_number, sizeof(new_ambulance.vehicle_number), stdin);
-    new_ambulance.vehicle_number[strcspn(new_ambulance.vehicle_number, "\n")] = 0;
+    system->ambulance_count++;
+    id_index_put(&system->ambulance_index, ambulance->ambulance_id, slot);
+    available_insert(system, slot);
     
-    printf("Enter driver name: ");
-    fgets(new_ambulance.driver_name, sizeof(new_ambulance.driver_name), stdin);
-    new_ambulance.driver_name[strcspn(new_ambulance.driver_name, "\n")] = 0;
+    system->counters.ambulance_status[status_bucket(system->amb_status[slot], AMBULANCE_STATUSES)]++;
+    system->counters.ambulance_type[level_bucket(system->amb_type[slot], AMBULANCE_TYPES)]++;
+    return slot;
+}
+
+/**
+ * Copies an ambulance out of the fleet columns into a full record
+ */
+void get_ambulance(BAPESSS_System* system, int slot, Ambulance* out) {
+    AmbulanceDetails* details = &system->amb_details[slot];
+    
+    memset(out, 0, sizeof(Ambulance));
+    out->ambulance_id = details->ambulance_id;
+    memcpy(out->vehicle_number, details->vehicle_number, sizeof(out->vehicle_number));
+    memcpy(out->driver_name, details->driver_name, sizeof(out->driver_name));
+    memcpy(out->driver_contact, details->driver_contact, sizeof(out->driver_contact));
+    out->type = system->amb_type[slot];
+    out->status = system->amb_status[slot];
+    out->location_x = system->amb_x[slot];
+    out->location_y = system->amb_y[slot];
+}
+
+/**
+ * Empties the fleet but keeps the columns allocated
+ */
+void clear_fleet(BAPESSS_System* system) {
+    system->ambulance_count = 0;
+    system->unsettled_count = 0;
+    id_index_clear(&system->ambulance_index);
+    rebuild_indexes(system);
+}
+
+// Nearest-unit kernel: checks slots [from, to) for the query point and
+// replaces *best and *best_slot when it finds a strictly closer unit that
+// is available and of at least min_type
+typedef void (*NearestKernel)(BAPESSS_System* system, int from, int to, float loc_x, float loc_y,
+                              int min_type, float* best, int* best_slot);
+
+/**
+ * Nearest-unit kernel reading one slot at a time
+ */
+static void nearest_block_scalar(BAPESSS_System* system, int from, int to, float loc_x, float loc_y,
+                                 int min_type, float* best, int* best_slot) {
+    const unsigned char* status = system->amb_status;
+    const unsigned char* type = system->amb_type;
+    const float* xs = system->amb_x;
+    const float* ys = system->amb_y;
+    float min_distance = *best;
+    int nearest = *best_slot;
+    
+    for (int i = from; i < to; i++) {
+        if (status[i] == 0 && type[i] >= min_type) {
+            float dx = loc_x - xs[i];
+            float dy = loc_y - ys[i];
+            float distance = dx * dx + dy * dy;
+            if (distance < min_distance) {
+                min_distance = distance;
+                nearest = i;
+            }
+        }
+    }
+    *best = min_distance;
+    *best_slot = nearest;
+}
+
+/**
+ * Folds the per-lane winners of a vector kernel into *best. Lanes cover
+ * slots above any earlier answer, so a tie only goes to a lower lane slot.
+ */
+static void nearest_lanes(const float* distances, const int* slots, int lanes, float* best, int* best_slot) {
+    float lane_best = INFINITY;
+    int lane_slot = -1;
+    for (int j = 0; j < lanes; j++) {
+        if (slots[j] != -1 && (distances[j] < lane_best ||
+                               (distances[j] == lane_best && slots[j] < lane_slot))) {
+            lane_best = distances[j];
+            lane_slot = slots[j];
+        }
+    }
+    if (lane_slot != -1 && lane_best < *best) {
+        *best = lane_best;
+        *best_slot = lane_slot;
+    }
+}
+
+#ifdef KERNEL_SSE2
+/**
+ * Nearest-unit kernel on 4 slots at a time: every lane keeps its own
+ * closest unit and slot, widened from the status and type bytes
+ */
+static void nearest_block_sse2(BAPESSS_System* system, int from, int to, float loc_x, float loc_y,
+                               int min_type, float* best, int* best_slot) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowest_type = _mm_set1_epi32(min_type - 1);
+    const __m128 query_x = _mm_set1_ps(loc_x);
+    const __m128 query_y = _mm_set1_ps(loc_y);
+    __m128 lane_best = _mm_set1_ps(INFINITY);
+    __m128i lane_slot = _mm_set1_epi32(-1);
+    __m128i index = _mm_setr_epi32(from, from + 1, from + 2, from + 3);
+    int i = from;
+    
+    for (; to - i >= 4; i += 4) {
+        int32_t status_bytes, type_bytes;
+        memcpy(&status_bytes, system->amb_status + i, sizeof(int32_t));
+        memcpy(&type_bytes, system->amb_type + i, sizeof(int32_t));
+        __m128i status = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(status_bytes), zero), zero);
+        __m128i type = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(type_bytes), zero), zero);
+        __m128i usable = _mm_and_si128(_mm_cmpeq_epi32(status, zero), _mm_cmpgt_epi32(type, lowest_type));
+        
+        __m128 dx = _mm_sub_ps(query_x, _mm_loadu_ps(system->amb_x + i));
+        __m128 dy = _mm_sub_ps(query_y, _mm_loadu_ps(system->amb_y + i));
+        __m128 distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 closer = _mm_and_ps(_mm_castsi128_ps(usable), _mm_cmplt_ps(distance, lane_best));
+        lane_best = _mm_or_ps(_mm_and_ps(closer, distance), _mm_andnot_ps(closer, lane_best));
+        lane_slot = _mm_or_si128(_mm_and_si128(_mm_castps_si128(closer), index),
+                                 _mm_andnot_si128(_mm_castps_si128(closer), lane_slot));
+        index = _mm_add_epi32(index, _mm_set1_epi32(4));
+    }
+    
+    float distances[4];
+    int slots[4];
+    _mm_storeu_ps(distances, lane_best);
+    _mm_storeu_si128((__m128i*)slots, lane_slot);
+    nearest_lanes(distances, slots, 4, best, best_slot);
+    nearest_block_scalar(system, i, to, loc_x, loc_y, min_type, best, best_slot);
+}
+#endif
+
+#ifdef KERNEL_AVX2
+/**
+ * The SSE2 kernel on 16 slots at a time, as two independent sets of 8
+ * lanes so one set's compare does not wait on the other's
+ */
+__attribute__((target("avx2")))
+static void nearest_block_avx2(BAPESSS_System* system, int from, int to, float loc_x, float loc_y,
+                               int min_type, float* best, int* best_slot) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lowest_type = _mm256_set1_epi32(min_type - 1);
+    const __m256i step = _mm256_set1_epi32(16);
+    const __m256 query_x = _mm256_set1_ps(loc_x);
+    const __m256 query_y = _mm256_set1_ps(loc_y);
+    __m256 lane_best[2] = {_mm256_set1_ps(INFINITY), _mm256_set1_ps(INFINITY)};
+    __m256i lane_slot[2] = {_mm256_set1_epi32(-1), _mm256_set1_epi32(-1)};
+    __m256i index[2];
+    index[0] = _mm256_add_epi32(_mm256_set1_epi32(from), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    index[1] = _mm256_add_epi32(index[0], _mm256_set1_epi32(8));
+    int i = from;
+    
+    for (; to - i >= 16; i += 16) {
+        for (int half = 0; half < 2; half++) {
+            int at = i + 8 * half;
+            __m256i status = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(system->amb_status + at)));
+            __m256i type = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(system->amb_type + at)));
+            __m256i usable = _mm256_and_si256(_mm256_cmpeq_epi32(status, zero),
+                                              _mm256_cmpgt_epi32(type, lowest_type));
+            
+            __m256 dx = _mm256_sub_ps(query_x, _mm256_loadu_ps(system->amb_x + at));
+            __m256 dy = _mm256_sub_ps(query_y, _mm256_loadu_ps(system->amb_y + at));
+            __m256 distance = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            __m256 closer = _mm256_and_ps(_mm256_castsi256_ps(usable),
+                                          _mm256_cmp_ps(distance, lane_best[half], _CMP_LT_OQ));
+            lane_best[half] = _mm256_blendv_ps(lane_best[half], distance, closer);
+            lane_slot[half] = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(lane_slot[half]),
+                                                                   _mm256_castsi256_ps(index[half]), closer));
+            index[half] = _mm256_add_epi32(index[half], step);
+        }
+    }
+    
+    float distances[16];
+    int slots[16];
+    for (int half = 0; half < 2; half++) {
+        _mm256_storeu_ps(distances + 8 * half, lane_best[half]);
+        _mm256_storeu_si256((__m256i*)(slots + 8 * half), lane_slot[half]);
+    }
+    _mm256_zeroupper(); // The scalar tail is SSE code, slow with the upper halves in use
+    nearest_lanes(distances, slots, 16, best, best_slot);
+    nearest_block_scalar(system, i, to, loc_x, loc_y, min_type, best, best_slot);
+}
+#endif
+
+/**
+ * Returns: The widest nearest-unit kernel this CPU runs
+ */
+static NearestKernel nearest_kernel(void) {
+#ifdef KERNEL_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return nearest_block_avx2;
+    }
+#endif
+#ifdef KERNEL_SSE2
+    return nearest_block_sse2;
+#else
+    return nearest_block_scalar;
+#endif
+}
+
+/**
+ * nearest_available_batch with a given kernel
+ */
+static int nearest_batch_with(BAPESSS_System* system, NearestKernel kernel, const float* loc_x,
+                              const float* loc_y, const int* min_type, int count, int* out_slots,
+                              float* out_dist2) {
+    for (int q = 0; q < count; q++) {
+        out_slots[q] = -1;
+        out_dist2[q] = INFINITY;
+    }
+    
+    // Every query of the batch meets a block of units while it is still in cache
+    for (int from = 0; from < system->ambulance_count; from += NEAREST_BLOCK) {
+        int to = system->ambulance_count - from > NEAREST_BLOCK ? from + NEAREST_BLOCK : system->ambulance_count;
+        for (int q = 0; q < count; q++) {
+            int type = min_type != NULL && min_type[q] > 0 ? min_type[q] : 0;
+            kernel(system, from, to, loc_x[q], loc_y[q], type, &out_dist2[q], &out_slots[q]);
+        }
+    }
+    
+    int found = 0;
+    for (int q = 0; q < count; q++) {
+        found += out_slots[q] != -1;
+    }
+    return found;
+}
+
+/**
+ * Finds the nearest available ambulance for each of several locations in
+ * one pass over the hot columns. Only the status, type and location
+ * columns are read, several units per instruction where the CPU allows.
+ * Query q accepts units of at least min_type[q] (every unit if min_type
+ * is NULL); ties go to the lowest slot. Statuses are read without
+ * atomics, so not for use while claims are deferred.
+ * Returns: Number of locations that found a unit (out_slots[q] = slot or
+ * -1, out_dist2[q] = squared distance or infinity)
+ */
+int nearest_available_batch(BAPESSS_System* system, const float* loc_x, const float* loc_y,
+                            const int* min_type, int count, int* out_slots, float* out_dist2) {
+    return nearest_batch_with(system, nearest_kernel(), loc_x, loc_y, min_type, count, out_slots, out_dist2);
+}
+
+/**
+ * Finds the nearest available ambulance of any type by scanning the hot
+ * columns (see nearest_available_batch).
+ * Returns: Ambulance slot, or -1 if none is available
+ */
+int nearest_available_scan(BAPESSS_System* system, float loc_x, float loc_y, float* out_dist2) {
+    int nearest;
+    float min_distance;
+    nearest_available_batch(system, &loc_x, &loc_y, NULL, 1, &nearest, &min_distance);
+    
+    if (out_dist2 != NULL) {
+        *out_dist2 = min_distance;
+    }
+    return nearest;
+}
+
+// =============================================
+// BOOKING STORE
+// =============================================
+
+/**
+ * Returns the booking stored in a slot.
+ * Bookings live in fixed-size chunks, so the pointer stays valid while
+ * the store grows.
+ */
+BookingRecord* booking_at(BAPESSS_System* system, int slot) {
+    return &system->booking_chunks[slot >> BOOKING_CHUNK_SHIFT][slot & (BOOKING_CHUNK_SIZE - 1)];
+}
+
+/**
+ * Appends a booking, allocating a new chunk when the last one is full.
+ * Existing bookings are never copied or moved.
+ * Returns: Slot of the new booking, or -1 on allocation failure
+ */
+int append_booking(BAPESSS_System* system, const Booking* booking) {
+    if (system->booking_count >= system->booking_capacity) {
+        // Only the chunk directory grows; it holds pointers, not records
+        if (system->chunk_count >= system->chunk_capacity) {
+            int new_capacity = system->chunk_capacity > 0 ? system->chunk_capacity * 2 : 8;
+            BookingRecord** chunks = (BookingRecord**)realloc(system->booking_chunks,
+                                                              new_capacity * sizeof(BookingRecord*));
+            if (chunks == NULL) {
+                return -1;
+            }
+            system->booking_chunks = chunks;
+            system->chunk_capacity = new_capacity;
+        }
+        
+        BookingRecord* chunk = (BookingRecord*)malloc(BOOKING_CHUNK_SIZE * sizeof(BookingRecord));
+        if (chunk == NULL) {
+            return -1;
+        }
+        system->booking_chunks[system->chunk_count] = chunk;
+        system->chunk_count++;
+        system->booking_capacity += BOOKING_CHUNK_SIZE;
+    }
+    
+    // Store the strings once and keep only their handles in the record
+    int slot = system->booking_count;
+    BookingRecord* record = booking_at(system, slot);
+    record->booking_id = booking->booking_id;
+    record->ambulance_id = booking->ambulance_id;
+    record->patient_name = arena_add(&system->strings, booking->patient_name);
+    record->patient_contact = arena_add(&system->strings, booking->patient_contact);
+    record->pickup_location = arena_add(&system->strings, booking->pickup_location);
+    record->hospital = intern_string(system, booking->hospital);
+    record->booking_time = parse_time(booking->booking_time);
+    record->pickup_time = parse_time(booking->pickup_time);
+    record->emergency_level = (uint8_t)booking->emergency_level;
+    record->status = (uint8_t)booking->status;
+    system->booking_count++;
+    
+    system->counters.booking_status[status_bucket(record->status, BOOKING_STATUSES)]++;
+    system->counters.booking_level[level_bucket(record->emergency_level, EMERGENCY_LEVELS)]++;
+    id_index_put(&system->booking_index, booking->booking_id, slot);
+    patient_index_add(system, slot);
+    active_track(system, slot, 0);
+    booking_columns_add(system, slot);
+    return slot;
+}
+
+/**
+ * Expands a compact booking back into a full record
+ */
+void get_booking(BAPESSS_System* system, int slot, Booking* out) {
+    BookingRecord* record = booking_at(system, slot);
+    
+    memset(out, 0, sizeof(Booking));
+    out->booking_id = record->booking_id;
+    out->ambulance_id = record->ambulance_id;
+    strncpy(out->patient_name, booking_str(system, record->patient_name), sizeof(out->patient_name) - 1);
+    strncpy(out->patient_contact, booking_str(system, record->patient_contact), sizeof(out->patient_contact) - 1);
+    strncpy(out->pickup_location, booking_str(system, record->pickup_location), sizeof(out->pickup_location) - 1);
+    strncpy(out->hospital, booking_str(system, record->hospital), sizeof(out->hospital) - 1);
+    format_time(record->booking_time, out->booking_time, sizeof(out->booking_time));
+    format_time(record->pickup_time, out->pickup_time, sizeof(out->pickup_time));
+    out->emergency_level = record->emergency_level;
+    out->status = record->status;
+}
+
+/**
+ * Frees every booking chunk, releases the snapshot they were loaded
+ * from and empties the store
+ */
+void clear_bookings(BAPESSS_System* system) {
+    for (int i = system->mapped_chunks; i < system->chunk_count; i++) {
+        free(system->booking_chunks[i]);
+    }
+    system->mapped_chunks = 0;
+    system->chunk_count = 0;
+    system->booking_count = 0;
+    system->booking_capacity = 0;
+    id_index_clear(&system->booking_index);
+    strings_clear(system);
+    memset(system->counters.booking_status, 0, sizeof(system->counters.booking_status));
+    memset(system->counters.booking_level, 0, sizeof(system->counters.booking_level));
+    archive_free(&system->archive);
+    patient_index_free(&system->patients);
+    active_free(&system->active);
+    booking_columns_free(&system->columns);
+    system->time_ordered = 0;
+    snapshot_unmap(&system->snapshot);
+}
+
+// =============================================
+// STRING ARENA AND INTERNING
+// =============================================
+
+/**
+ * Hashes a string (FNV-1a)
+ */
+static uint32_t string_hash(const char* text) {
+    uint32_t hash = 2166136261u;
+    while (*text) {
+        hash ^= (unsigned char)*text++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Creates an empty arena and intern table.
+ * Offset 0 always holds the empty string.
+ */
+void strings_init(BAPESSS_System* system) {
+    memset(&system->strings, 0, sizeof(StringArena));
+    memset(&system->interned, 0, sizeof(InternTable));
+    arena_add(&system->strings, "");
+}
+
+/**
+ * Drops every string but keeps the memory for reuse
+ */
+void strings_clear(BAPESSS_System* system) {
+    system->strings.mapped = NULL;
+    system->strings.mapped_size = 0;
+    system->strings.size = 0;
+    arena_add(&system->strings, "");
+    for (int i = 0; i < system->interned.capacity; i++) {
+        system->interned.refs[i] = 0;
+    }
+    system->interned.count = 0;
+}
+
+/**
+ * Frees the arena and intern table
+ */
+void strings_free(BAPESSS_System* system) {
+    free(system->strings.data);
+    free(system->interned.refs);
+    memset(&system->strings, 0, sizeof(StringArena));
+    memset(&system->interned, 0, sizeof(InternTable));
+}
+
+/**
+ * Copies a string into the arena. Handles are 32-bit offsets, so the
+ * mapped and heap parts together hold at most UINT32_MAX bytes.
+ * Returns: Handle of the copy (0, the empty string, on allocation failure
+ * or once the arena is full)
+ */
+StrRef arena_add(StringArena* arena, const char* text) {
+    uint64_t length = (uint64_t)strlen(text) + 1;
+    
+    if (length == 1 && arena->mapped_size + arena->size > 0) {
+        return 0; // Every empty string shares offset 0
+    }
+    
+    uint64_t needed = (uint64_t)arena->size + length;
+    if ((uint64_t)arena->mapped_size + needed > UINT32_MAX) {
+        printf("Error: String arena is full (4 GB of booking text)!\n");
+        return 0;
+    }
+    if (needed > arena->capacity) {
+        uint64_t new_capacity = arena->capacity > 0 ? arena->capacity : 4096;
+        while (needed > new_capacity) {
+            new_capacity *= 2;
+        }
+        if (new_capacity > UINT32_MAX) {
+            new_capacity = UINT32_MAX;
+        }
+        char* data = (char*)realloc(arena->data, (size_t)new_capacity);
+        if (data == NULL) {
+            printf("Error: Memory allocation failed for string arena!\n");
+            return 0;
+        }
+        arena->data = data;
+        arena->capacity = (uint32_t)new_capacity;
+    }
+    
+    memcpy(arena->data + arena->size, text, (size_t)length);
+    StrRef ref = arena->mapped_size + arena->size;
+    arena->size += (uint32_t)length;
+    return ref;
+}
+
+/**
+ * Returns the text behind a handle. The pointer is only valid until the
+ * next string is added.
+ */
+const char* booking_str(BAPESSS_System* system, StrRef ref) {
+    const StringArena* arena = &system->strings;
+    if (ref < arena->mapped_size) {
+        return arena->mapped + ref;
+    }
+    return arena->data + (ref - arena->mapped_size);
+}
+
+/**
+ * Doubles the intern table and re-inserts all entries
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int intern_grow(BAPESSS_System* system) {
+    InternTable* table = &system->interned;
+    int new_capacity = table->capacity > 0 ? table->capacity * 2 : 256;
+    StrRef* refs = (StrRef*)calloc(new_capacity, sizeof(StrRef));
+    if (refs == NULL) {
+        return 0;
+    }
+    
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->refs[i] == 0) continue;
+        uint32_t pos = string_hash(booking_str(system, table->refs[i])) & (new_capacity - 1);
+        while (refs[pos] != 0) {
+            pos = (pos + 1) & (new_capacity - 1);
+        }
+        refs[pos] = table->refs[i];
+    }
+    
+    free(table->refs);
+    table->refs = refs;
+    table->capacity = new_capacity;
+    return 1;
+}
+
+/**
+ * Stores a string once and returns the same handle for every equal string
+ * Returns: Handle of the interned copy
+ */
+StrRef intern_string(BAPESSS_System* system, const char* text) {
+    InternTable* table = &system->interned;
+    
+    if (text[0] == '\0') {
+        return 0;
+    }
+    if (2 * (table->count + 1) > table->capacity && !intern_grow(system)) {
+        return arena_add(&system->strings, text); // Fall back to an unshared copy
+    }
+    
+    uint32_t pos = string_hash(text) & (table->capacity - 1);
+    while (table->refs[pos] != 0) {
+        if (strcmp(booking_str(system, table->refs[pos]), text) == 0) {
+            return table->refs[pos];
+        }
+        pos = (pos + 1) & (table->capacity - 1);
+    }
+    
+    StrRef ref = arena_add(&system->strings, text);
+    if (ref != 0) {
+        table->refs[pos] = ref;
+        table->count++;
+    }
+    return ref;
+}
+
+// =============================================
+// MENU AND DISPLAY FUNCTIONS
+// =============================================
+
+/**
+ * Displays the main menu options
+ */
+void display_menu() {
+    system("clear || cls"); // Clear screen (works for both Linux and Windows)
+    
+    printf("\n=== BAPESSS AMBULANCE BOOKING SYSTEM ===\n");
+    printf("1.  Book an Ambulance\n");
+    printf("2.  View Bookings\n");
+    printf("3.  View Ambulances\n");
+    printf("4.  Update Booking Status\n");
+    printf("5.  Cancel Booking\n");
+    printf("6.  Add New Ambulance\n");
+    printf("7.  Find Nearest Ambulance\n");
+    printf("8.  Generate Report\n");
+    printf("9.  Save Data to File\n");
+    printf("10. Load Data from File\n");
+    printf("12. Search Bookings by Patient\n");
+    printf("11. Exit\n");
+    printf("=======================================\n");
+    printf("Enter your choice (1-12): ");
+}
+
+/**
+ * Gets user choice with validation
+ * Returns: Integer choice
+ */
+int get_choice() {
+    int choice;
+    char input[100];
+    
+    if (fgets(input, sizeof(input), stdin) != NULL) {
+        if (sscanf(input, "%d", &choice) == 1) {
+            return choice;
+        }
+    }
+    return -1; // Invalid input
+}
+
+/**
+ * Clears the input buffer to prevent issues with scanf
+ */
+void clear_input_buffer() {
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+}
+
+// =============================================
+// SAMPLE DATA FOR DEMONSTRATION
+// =============================================
+
+/**
+ * Adds sample ambulances and bookings for demonstration
+ */
+void add_sample_data(BAPESSS_System* system) {
+    // Add sample ambulances; the first two are held by the sample bookings
+    Ambulance ambulance1 = {1, "MH01AB1234", "Rajesh Kumar", "9876543210", 2, 1, 12.5, 15.3};
+    Ambulance ambulance2 = {2, "MH01CD5678", "Suresh Patel", "9876543211", 1, 2, 15.2, 18.7};
+    Ambulance ambulance3 = {3, "MH01EF9012", "Amit Sharma", "9876543212", 3, 0, 10.1, 12.5};
+    
+    append_ambulance(system, &ambulance1);
+    append_ambulance(system, &ambulance2);
+    append_ambulance(system, &ambulance3);
+    
+    // Add sample bookings
+    char time_buffer[50];
+    get_current_time(time_buffer, sizeof(time_buffer));
+
+    Booking booking1;
+    booking1.booking_id = 1001;
+    strcpy(booking1.patient_name, "John Doe");
+    strcpy(booking1.patient_contact, "9123456789");
+    strcpy(booking1.pickup_location, "123 Main St, Mumbai");
+    strcpy(booking1.hospital, "Apollo Hospital");
+    booking1.ambulance_id = 1;
+    strcpy(booking1.booking_time, time_buffer);
+    strcpy(booking1.pickup_time, "Not picked up yet");
+    booking1.emergency_level = 2;
+    booking1.status = 1;
+
+    Booking booking2;
+    booking2.booking_id = 1002;
+    strcpy(booking2.patient_name, "Jane Smith");
+    strcpy(booking2.patient_contact, "9123456790");
+    strcpy(booking2.pickup_location, "456 Park Ave, Delhi");
+    strcpy(booking2.hospital, "Fortis Hospital");
+    booking2.ambulance_id = 2;
+    strcpy(booking2.booking_time, time_buffer);
+    strcpy(booking2.pickup_time, "Not picked up yet");
+    booking2.emergency_level = 3;
+    booking2.status = 2;
+    
+    append_booking(system, &booking1);
+    append_booking(system, &booking2);
+    
+    rebuild_indexes(system);
+}
+
+// =============================================
+// BOOKING OPERATIONS
+// =============================================
+
+/**
+ * Creates a booking from the patient details in request and assigns an
+ * ambulance, or queues the booking if none is free. Fills in the ID,
+ * ambulance, status and timestamps of the request.
+ * Returns: Slot of the new booking, or -1 on allocation failure
+ */
+int create_booking(BAPESSS_System* system, Booking* request) {
+    return create_booking_with(system, request, -1);
+}
+
+/**
+ * Same as create_booking, but assigns the ambulance in ambulance_slot
+ * when it is still available (-1 lets the usual policy choose, as does
+ * a unit that was taken in the meantime)
+ * Returns: Slot of the new booking, or -1 on allocation failure
+ */
+int create_booking_with(BAPESSS_System* system, Booking* request, int ambulance_slot) {
+    if (request->emergency_level < 1 || request->emergency_level > EMERGENCY_LEVELS) {
+        request->emergency_level = 1;
+    }
+    return create_booking_claimed(system, request,
+                                  claim_for_booking(system, request->emergency_level, ambulance_slot));
+}
+
+/**
+ * Creates a booking for a unit already claimed with claim_for_booking
+ * (-1 queues it), recording the claim once the booking exists. The
+ * server claims before it takes the bookings lock, so bookings race
+ * for units only through the claim itself.
+ * Returns: Slot of the new booking, or -1 on allocation failure (the
+ * claim is then released)
+ */
+int create_booking_claimed(BAPESSS_System* system, Booking* request, int claimed_slot) {
+    if (request->emergency_level < 1 || request->emergency_level > EMERGENCY_LEVELS) {
+        request->emergency_level = 1;
+    }
+    
+    // Generate booking ID
+    request->booking_id = 1000 + system->booking_count + 1;
+    request->ambulance_id = 0;
+    request->status = 0; // Pending until an ambulance is assigned
+    
+    // Timestamps are stored as epoch seconds and only formatted for display
+    request->booking_time[0] = '\0';
+    request->pickup_time[0] = '\0';
+    
+    int slot = append_booking(system, request);
+    if (slot == -1) {
+        release_claim(system, claimed_slot);
+        return -1;
+    }
+    BookingRecord* record = booking_at(system, slot);
+    record->booking_time = current_epoch();
+    
+    int ambulance_slot = claimed_slot;
+    if (ambulance_slot != -1) {
+        record_claim(system, ambulance_slot);
+    }
+    
+    JournalNewBooking logged = {record->booking_time, record->booking_id, record->emergency_level,
+                                ambulance_slot == -1, 0};
+    char strings[sizeof(request->patient_name) + sizeof(request->patient_contact) +
+                 sizeof(request->pickup_location) + sizeof(request->hospital)];
+    int length = snprintf(strings, sizeof(strings), "%s%c%s%c%s%c%s",
+                          booking_str(system, record->patient_name), '\0',
+                          booking_str(system, record->patient_contact), '\0',
+                          booking_str(system, record->pickup_location), '\0',
+                          booking_str(system, record->hospital));
+    journal_append(system, JOURNAL_ADD_BOOKING, &logged, sizeof(logged), strings, length + 1);
+    
+    if (ambulance_slot == -1) {
+        pending_push(system, slot);
+    } else {
+        assign_ambulance(system, slot, ambulance_slot);
+        request->ambulance_id = system->amb_details[ambulance_slot].ambulance_id;
+        request->status = 1; // Confirmed
+    }
+    return slot;
+}
+
+/**
+ * Moves an open booking to a new status (1-4). Completing or cancelling
+ * frees the ambulance for the next waiting booking.
+ * out_served receives the slot of the booking that got the freed
+ * ambulance, or -1.
+ * Returns: OP_OK or the reason the change was refused
+ */
+OpResult change_booking_status(BAPESSS_System* system, int booking_id, int new_status, int* out_served) {
+    *out_served = -1;
+    
+    int found = find_booking_slot(system, booking_id);
+    if (found == -1) {
+        return OP_NOT_FOUND;
+    }
+    if (new_status < 1 || new_status > 4) {
+        return OP_INVALID;
+    }
+    
+    // Closed bookings no longer hold an ambulance, and pending ones have none yet
+    int old_status = booking_at(system, found)->status;
+    if (old_status == 3 || old_status == 4) {
+        return OP_CLOSED;
+    }
+    if (old_status == 0 && new_status != 4) {
+        return OP_UNASSIGNED;
+    }
+    
+    if (new_status == 3 || new_status == 4) {
+        *out_served = close_booking(system, found, new_status);
+        return OP_OK;
+    }
+    
+    set_booking_status(system, found, new_status);
+    
+    // Update pickup time if dispatched
+    int64_t pickup_time = 0;
+    if (new_status == 2) {
+        pickup_time = current_epoch();
+        booking_at(system, found)->pickup_time = pickup_time;
+    }
+    journal_change(system, JOURNAL_STATUS, booking_id, new_status, pickup_time);
+    return OP_OK;
+}
+
+/**
+ * Adds an ambulance to the fleet as available, giving it the next ID.
+ * A waiting booking gets the new ambulance straight away; its slot is
+ * stored in out_served (-1 if none).
+ * Returns: Slot of the new ambulance, or -1 on allocation failure
+ */
+int register_ambulance(BAPESSS_System* system, Ambulance* ambulance, int* out_served) {
+    *out_served = -1;
+    
+    if (ambulance->type < 1 || ambulance->type > AMBULANCE_TYPES) {
+        ambulance->type = 1;
+    }
+    ambulance->ambulance_id = system->ambulance_count + 1;
+    ambulance->status = 0; // Available
+    
+    int slot = append_ambulance(system, ambulance);
+    if (slot != -1) {
+        journal_append(system, JOURNAL_ADD_AMBULANCE, ambulance, sizeof(Ambulance), NULL, 0);
+        *out_served = serve_pending(system, slot);
+    }
+    return slot;
+}
+
+/**
+ * Returns a short machine-readable name for an operation result
+ */
+const char* op_result_name(OpResult result) {
+    switch (result) {
+        case OP_OK: return "ok";
+        case OP_NOT_FOUND: return "not_found";
+        case OP_INVALID: return "invalid";
+        case OP_CLOSED: return "closed";
+        case OP_UNASSIGNED: return "unassigned";
+        case OP_NO_MEMORY: return "no_memory";
+    }
+    return "unknown";
+}
+
+// =============================================
+// CORE BOOKING FUNCTION
+// =============================================
+
+/**
+ * Books an ambulance based on user input
+ */
+void book_ambulance(BAPESSS_System* system) {
+    printf("\n=== BOOK AMBULANCE ===\n");
+    
+    // Get patient details
+    Booking new_booking;
+    
+    printf("Enter patient name: ");
+    clear_input_buffer();
+    fgets(new_booking.patient_name, sizeof(new_booking.patient_name), stdin);
+    new_booking.patient_name[strcspn(new_booking.patient_name, "\n")] = 0;
+    
+    printf("Enter contact number: ");
+    fgets(new_booking.patient_contact, sizeof(new_booking.patient_contact), stdin);
+    new_booking.patient_contact[strcspn(new_booking.patient_contact, "\n")] = 0;
+    
+    printf("Enter pickup location: ");
+    fgets(new_booking.pickup_location, sizeof(new_booking.pickup_location), stdin);
+    new_booking.pickup_location[strcspn(new_booking.pickup_location, "\n")] = 0;
+    
+    printf("Enter hospital name: ");
+    fgets(new_booking.hospital, sizeof(new_booking.hospital), stdin);
+    new_booking.hospital[strcspn(new_booking.hospital, "\n")] = 0;
+    
+    // Get emergency level
+    printf("\nEmergency Level:\n");
+    printf("1. Normal (Non-critical)\n");
+    printf("2. Urgent (Serious but stable)\n");
+    printf("3. Critical (Life-threatening)\n");
+    printf("Select emergency level (1-3): ");
+    scanf("%d", &new_booking.emergency_level);
+    
+    if (new_booking.emergency_level < 1 || new_booking.emergency_level > 3) {
+        printf("Invalid emergency level! Setting to Normal.\n");
+        new_booking.emergency_level = 1;
+    }
+    
+    float loc_x, loc_y;
+    printf("Enter pickup coordinates (X Y): ");
+    int located = scanf("%f %f", &loc_x, &loc_y) == 2;
+    if (!located) {
+        clear_input_buffer();
+        printf("No coordinates given; the first suitable ambulance will be sent.\n");
+    }
+    
+    // Send the nearest unit equipped for the emergency; without one (or
+    // without a location) fall back to any free unit, or queue the call
+    float distance2 = 0, seconds = -1;
+    int nearest = located ? nearest_qualified_ambulance(system, new_booking.emergency_level,
+                                                        loc_x, loc_y, &distance2, &seconds) : -1;
+    int slot = create_booking_with(system, &new_booking, nearest);
+    if (slot == -1) {
+        printf("Error: Memory allocation failed!\n");
+        return;
+    }
+    BookingRecord* booking = booking_at(system, slot);
+    
+    if (booking->status == 0) {
+        printf("\nSorry! No ambulances available at the moment.\n");
+        printf("Your request has been queued and will get the next free ambulance.\n");
+    } else if (nearest != -1 && booking->ambulance_id == system->amb_details[nearest].ambulance_id) {
+        printf("\nAmbulance ID %d has been assigned! It is %.2f units away", booking->ambulance_id, sqrt(distance2));
+        if (seconds >= 0) {
+            printf(", about %.1f minutes by road", seconds / 60);
+        }
+        printf(".\n");
+    } else {
+        printf("\nAmbulance ID %d has been assigned!\n", booking->ambulance_id);
+    }
+    
+    printf("\n=== BOOKING CONFIRMED ===\n");
+    printf("Booking ID: %d\n", booking->booking_id);
+    printf("Patient: %s\n", booking_str(system, booking->patient_name));
+    printf("Status: %s\n", booking->status == 1 ? "Confirmed" : "Pending");
+    if (booking->ambulance_id > 0) {
+        printf("Assigned Ambulance: %d\n", booking->ambulance_id);
+    }
+}
+
+// =============================================
+// VIEW FUNCTIONS
+// =============================================
+
+/**
+ * Formats one row of a booking table
+ */
+static void text_booking_row(TextBuffer* text, BAPESSS_System* system, int slot) {
+    const BookingRecord* record = booking_at(system, slot);
+    char* status_str;
+    switch(record->status) {
+        case 0: status_str = "Pending"; break;
+        case 1: status_str = "Confirmed"; break;
+        case 2: status_str = "Dispatched"; break;
+        case 3: status_str = "Completed"; break;
+        case 4: status_str = "Cancelled"; break;
+        default: status_str = "Unknown";
+    }
+    text_printf(text, "%-6d%-21s%-14s%-12s%d\n", record->booking_id,
+                booking_str(system, record->patient_name),
+                booking_str(system, record->patient_contact),
+                status_str, record->ambulance_id);
+}
+
+/**
+ * Displays bookings a page at a time, optionally only those with one
+ * status (or every open one), one emergency level or a recent booking time
+ */
+void view_bookings(BAPESSS_System* system) {
+    static TextBuffer text;
+    int active = system->counters.booking_status[0] + system->counters.booking_status[1] +
+                 system->counters.booking_status[2];
+    printf("\n=== BOOKINGS ===\n");
+    printf("Total Bookings: %d (%d active)\n\n", system->booking_count, active);
+    
+    if (system->booking_count == 0) {
+        printf("No bookings found.\n");
+        return;
+    }
+    
+    printf("Show: 1. All  2. Active calls  3. Pending  4. Confirmed\n");
+    printf("      5. Dispatched  6. Completed  7. Cancelled\n");
+    printf("Show (1-7, Enter for all): ");
+    int show = get_choice();
+    if (show == -1) {
+        show = 1;
+    }
+    printf("Emergency level (1-3, Enter for any): ");
+    int level = get_choice();
+    if (level == -1) {
+        level = 0;
+    }
+    printf("Booked in the last how many hours (Enter for any time): ");
+    int hours = get_choice();
+    if (show < 1 || show > 7 || level < 0 || level > EMERGENCY_LEVELS || hours < -1) {
+        printf("Invalid choice!\n");
+        return;
+    }
+    
+    BookingFilter filter = {LIST_ANY, level, INT64_MIN, INT64_MAX};
+    if (show == 2) {
+        filter.status = LIST_ACTIVE;
+    } else if (show > 2) {
+        filter.status = show - 3;
+    }
+    if (hours > 0) {
+        filter.from = current_epoch() - (int64_t)hours * 3600;
+    }
+    
+    int slots[LIST_PAGE_SIZE];
+    int after = -1, shown = 0;
+    for (;;) {
+        int found = list_bookings(system, &filter, after, slots, LIST_PAGE_SIZE);
+        if (found < 0) {
+            printf("Error: Memory allocation failed!\n");
+            return;
+        }
+        if (found == 0) {
+            printf(shown == 0 ? "No bookings found.\n" : "No more bookings.\n");
+            return;
+        }
+        
+        text_init(&text, stdout);
+        text_printf(&text, "\nID    Patient Name         Contact       Status      Ambulance\n");
+        text_printf(&text, "----------------------------------------------------------------\n");
+        for (int i = 0; i < found; i++) {
+            text_booking_row(&text, system, slots[i]);
+        }
+        text_flush(&text);
+        after = slots[found - 1];
+        shown += found;
+        
+        if (found < LIST_PAGE_SIZE) {
+            printf("\nEnter a Booking ID for details, or Enter to return: ");
+        } else {
+            printf("\nEnter a Booking ID for details, Enter for the next page, or 0 to return: ");
+        }
+        int view_id = get_choice();
+        if (view_id > 0) {
+            int slot = find_booking_slot(system, view_id);
+            if (slot == -1) {
+                printf("Booking not found!\n");
+            } else {
+                show_booking_details(system, slot);
+            }
+            return;
+        }
+        if (view_id == 0 || found < LIST_PAGE_SIZE) {
+            return;
+        }
+    }
+}
+
+/**
+ * Prints every field of one booking
+ */
+void show_booking_details(BAPESSS_System* system, int slot) {
+    printf("\n=== BOOKING DETAILS ===\n");
+    printf("Booking ID: %d\n", booking_at(system, slot)->booking_id);
+    printf("Patient: %s\n", booking_str(system, booking_at(system, slot)->patient_name));
+    printf("Contact: %s\n", booking_str(system, booking_at(system, slot)->patient_contact));
+    printf("Pickup: %s\n", booking_str(system, booking_at(system, slot)->pickup_location));
+    printf("Hospital: %s\n", booking_str(system, booking_at(system, slot)->hospital));
+    char time_buffer[50];
+    format_time(booking_at(system, slot)->booking_time, time_buffer, sizeof(time_buffer));
+    printf("Booking Time: %s\n", time_buffer);
+    format_time(booking_at(system, slot)->pickup_time, time_buffer, sizeof(time_buffer));
+    printf("Pickup Time: %s\n", time_buffer);
+    if (booking_at(system, slot)->pickup_time != 0) {
+        int64_t response = booking_at(system, slot)->pickup_time - booking_at(system, slot)->booking_time;
+        printf("Response Time: %lld min %lld s\n", (long long)(response / 60), (long long)(response % 60));
+    }
+    
+    char* emergency_str;
+    switch(booking_at(system, slot)->emergency_level) {
+        case 1: emergency_str = "Normal"; break;
+        case 2: emergency_str = "Urgent"; break;
+        case 3: emergency_str = "Critical"; break;
+        default: emergency_str = "Unknown";
+    }
+    printf("Emergency Level: %s\n", emergency_str);
+}
+
+/**
+ * Looks up bookings by patient name or contact number for a caller
+ * phoning back, most recent first
+ */
+void search_bookings(BAPESSS_System* system) {
+    printf("\n=== SEARCH BOOKINGS ===\n");
+    printf("1. Patient name contains\n");
+    printf("2. Patient name starts with\n");
+    printf("3. Contact number starts with\n");
+    printf("Search by (1-3): ");
+    int by = get_choice();
+    if (by < 1 || by > 3) {
+        printf("Invalid choice!\n");
+        return;
+    }
+    SearchMode mode = by == 1 ? SEARCH_NAME : (by == 2 ? SEARCH_NAME_PREFIX : SEARCH_CONTACT);
+    
+    char text[100];
+    printf("Search for: ");
+    if (fgets(text, sizeof(text), stdin) == NULL) {
+        return;
+    }
+    text[strcspn(text, "\n")] = 0;
+    if (strlen(text) < (mode == SEARCH_NAME ? SEARCH_MIN_SUBSTRING : 1)) {
+        printf("Enter at least %d characters.\n", mode == SEARCH_NAME ? SEARCH_MIN_SUBSTRING : 1);
+        return;
+    }
+    
+    int slots[SEARCH_SHOW_COUNT];
+    int found = search_patients(system, mode, text, slots, SEARCH_SHOW_COUNT);
+    if (found < 0) {
+        printf("Error: Memory allocation failed!\n");
+        return;
+    }
+    if (found == 0) {
+        printf("No bookings found.\n");
+        return;
+    }
+    
+    if (found == SEARCH_SHOW_COUNT) {
+        printf("\nMost recent %d matches (narrow the search to see older ones):\n", found);
+    } else {
+        printf("\n%d match%s, most recent first:\n", found, found == 1 ? "" : "es");
+    }
+    static TextBuffer rows;
+    text_init(&rows, stdout);
+    text_printf(&rows, "ID    Patient Name         Contact       Status      Ambulance\n");
+    text_printf(&rows, "----------------------------------------------------------------\n");
+    for (int i = 0; i < found; i++) {
+        text_booking_row(&rows, system, slots[i]);
+    }
+    text_flush(&rows);
+    
+    printf("\nEnter Booking ID to view details (0 to skip): ");
+    int view_id = 0;
+    scanf("%d", &view_id);
+    
+    int slot = view_id > 0 ? find_booking_slot(system, view_id) : -1;
+    if (slot != -1) {
+        show_booking_details(system, slot);
+    }
+}
+
+/**
+ * Displays ambulances and their status a page at a time, optionally only
+ * those with one status or of one type
+ */
+void view_ambulances(BAPESSS_System* system) {
+    static TextBuffer text;
+    printf("\n=== AMBULANCE FLEET ===\n");
+    printf("Total Ambulances: %d (%d available)\n\n", system->ambulance_count, system->counters.ambulance_status[0]);
+    
+    if (system->ambulance_count == 0) {
+        printf("No ambulances registered.\n");
+        return;
+    }
+    
+    printf("Show: 1. All  2. Available  3. Booked  4. On Trip  5. Maintenance\n");
+    printf("Show (1-5, Enter for all): ");
+    int show = get_choice();
+    if (show == -1) {
+        show = 1;
+    }
+    printf("Type (1. Basic 2. Advanced 3. Mobile ICU, Enter for any): ");
+    int type = get_choice();
+    if (type == -1) {
+        type = 0;
+    }
+    if (show < 1 || show > 5 || type < 0 || type > AMBULANCE_TYPES) {
+        printf("Invalid choice!\n");
+        return;
+    }
+    AmbulanceFilter filter = {show == 1 ? LIST_ANY : show - 2, type};
+    
+    int slots[LIST_PAGE_SIZE];
+    int after = -1, shown = 0;
+    for (;;) {
+        int found = list_ambulances(system, &filter, after, slots, LIST_PAGE_SIZE);
+        if (found == 0) {
+            printf(shown == 0 ? "No ambulances found.\n" : "No more ambulances.\n");
+            return;
+        }
+        
+        text_init(&text, stdout);
+        text_printf(&text, "\nID  Vehicle No.   Driver         Contact      Type        Status      Location\n");
+        text_printf(&text, "--------------------------------------------------------------------------------\n");
+        for (int n = 0; n < found; n++) {
+            int i = slots[n];
+            char* type_str;
+            switch(system->amb_type[i]) {
+                case 1: type_str = "Basic"; break;
+                case 2: type_str = "Advanced"; break;
+                case 3: type_str = "Mobile ICU"; break;
+                default: type_str = "Unknown";
+            }
+            
+            char* status_str;
+            switch(system->amb_status[i]) {
+                case 0: status_str = "Available"; break;
+                case 1: status_str = "Booked"; break;
+                case 2: status_str = "On Trip"; break;
+                case 3: status_str = "Maintenance"; break;
+                default: status_str = "Unknown";
+            }
+            
+            text_printf(&text, "%-3d%-14s%-15s%-13s%-12s%-12s(%.1f, %.1f)\n",
+                        system->amb_details[i].ambulance_id,
+                        system->amb_details[i].vehicle_number,
+                        system->amb_details[i].driver_name,
+                        system->amb_details[i].driver_contact,
+                        type_str,
+                        status_str,
+                        system->amb_x[i],
+                        system->amb_y[i]);
+        }
+        text_flush(&text);
+        after = slots[found - 1];
+        shown += found;
+        
+        if (found < LIST_PAGE_SIZE) {
+            return;
+        }
+        printf("\nEnter for the next page, or 0 to return: ");
+        if (get_choice() == 0) {
+            return;
+        }
+    }
+}
+
+// =============================================
+// UTILITY FUNCTIONS
+// =============================================
+
+/**
+ * Gets current time as string
+ */
+void get_current_time(char* buffer, int size) {
+    format_time(current_epoch(), buffer, size);
+}
+
+/**
+ * Returns the current time in seconds since the epoch.
+ * Uses the coarse clock where available, which is read without a system call.
+ */
+int64_t current_epoch() {
+#ifdef CLOCK_REALTIME_COARSE
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &now) == 0) {
+        return (int64_t)now.tv_sec;
+    }
+#endif
+    return (int64_t)time(NULL);
+}
+
+/**
+ * Returns a monotonic timestamp in seconds, for measuring intervals
+ */
+double monotonic_seconds() {
+#ifdef _WIN32
+    return (double)clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+// Per-thread storage: the compiler keyword where there is one, since
+// _Thread_local needs C11
+#if defined(__GNUC__) || defined(__clang__)
+#define THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL // No threads to share the cache with
+#endif
+
+/**
+ * Formats an epoch timestamp for display; 0 means "Not picked up yet".
+ * The last conversion is cached per thread, since listings format the
+ * same second over and over.
+ */
+void format_time(int64_t epoch, char* buffer, int size) {
+    static THREAD_LOCAL int64_t cached_epoch = -1;
+    static THREAD_LOCAL char cached_text[32];
+    
+    if (epoch == 0) {
+        snprintf(buffer, size, "Not picked up yet");
+        return;
+    }
+    
+    if (epoch != cached_epoch) {
+        time_t rawtime = (time_t)epoch;
+        struct tm timeinfo;
+#ifdef _WIN32
+        localtime_s(&timeinfo, &rawtime);
+#else
+        localtime_r(&rawtime, &timeinfo);
+#endif
+        strftime(cached_text, sizeof(cached_text), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        cached_epoch = epoch;
+    }
+    snprintf(buffer, size, "%s", cached_text);
+}
+
+/**
+ * Parses a "YYYY-MM-DD HH:MM:SS" local time as written by format_time
+ * Returns: Seconds since the epoch, or 0 if the text is not a timestamp
+ */
+int64_t parse_time(const char* text) {
+    struct tm timeinfo;
+    memset(&timeinfo, 0, sizeof(timeinfo));
+    
+    if (sscanf(text, "%d-%d-%d %d:%d:%d",
+               &timeinfo.tm_year, &timeinfo.tm_mon, &timeinfo.tm_mday,
+               &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec) != 6) {
+        return 0;
+    }
+    timeinfo.tm_year -= 1900;
+    timeinfo.tm_mon -= 1;
+    timeinfo.tm_isdst = -1;
+    
+    time_t epoch = mktime(&timeinfo);
+    return epoch == (time_t)-1 ? 0 : (int64_t)epoch;
+}
+
+/**
+ * Returns: 1 if the ambulance in a slot is available right now. Pool and
+ * grid entries can lag behind while claims are deferred, so readers
+ * check the status itself.
+ */
+static int still_available(BAPESSS_System* system, int slot) {
+    return __atomic_load_n(&system->amb_status[slot], __ATOMIC_RELAXED) == 0;
+}
+
+/**
+ * Walks the availability pools in dispatch order: the required type and
+ * then the more capable ones, otherwise any available unit. With claim
+ * set, each candidate is claimed, and a claim lost to another caller
+ * moves on to the next candidate.
+ * Returns: Slot of the ambulance found (and claimed), or -1 if none
+ */
+static int pick_available(BAPESSS_System* system, int emergency_level, int claim) {
+    AvailabilityPool* pools = system->pools.by_type;
+    int order[AMBULANCE_TYPES + 1];
+    int types = 0;
+    
+    if (emergency_level < 1) emergency_level = 1;
+    if (emergency_level > AMBULANCE_TYPES) emergency_level = AMBULANCE_TYPES;
+    for (int type = emergency_level; type <= AMBULANCE_TYPES; type++) {
+        order[types++] = type;
+    }
+    for (int type = emergency_level - 1; type >= 0; type--) {
+        order[types++] = type;
+    }
+    
+    // Units at the top of a pool are taken first. Deferred claims leave
+    // taken entries there; claimed_top lets later callers skip them.
+    for (int i = 0; i < types; i++) {
+        AvailabilityPool* pool = &pools[order[i]];
+        int skipped = __atomic_load_n(&pool->claimed_top, __ATOMIC_RELAXED);
+        for (int j = pool->count - 1 - skipped; j >= 0; j--) {
+            int slot = pool->slots[j];
+            if (still_available(system, slot) && (!claim || claim_ambulance(system, slot))) {
+                return slot;
+            }
+            if (j == pool->count - 1 - skipped &&
+                __atomic_compare_exchange_n(&pool->claimed_top, &skipped, skipped + 1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                skipped++;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Finds an available ambulance based on emergency level without taking it.
+ * Prefers a unit whose type meets the requirement, otherwise any available unit.
+ * Runs in constant time using the per-type availability pools.
+ * Returns: Ambulance ID or -1 if none available
+ */
+int find_available_ambulance(BAPESSS_System* system, int emergency_level) {
+    int slot = pick_available(system, emergency_level, 0);
+    return slot != -1 ? system->amb_details[slot].ambulance_id : -1;
+}
+
+/**
+ * Finds the nearest available ambulance whose type meets the emergency
+ * level, using the spatial index. With a road network loaded, nearest
+ * means the shortest drive (see rank_by_eta); otherwise, or if no nearby
+ * qualified unit can reach the location by road, the straight line.
+ * Small fleets are scanned instead of searched by cell.
+ * Does not take the unit. out_dist2 receives the squared straight-line
+ * distance and out_seconds the drive time (-1 if not ranked by road);
+ * either may be NULL.
+ * Returns: Ambulance slot, or -1 if no qualified unit is available
+ */
+int nearest_qualified_ambulance(BAPESSS_System* system, int emergency_level, float loc_x, float loc_y,
+                                float* out_dist2, float* out_seconds) {
+    int slot;
+    float seconds = -1, distance;
+    if (rank_by_eta(system, loc_x, loc_y, emergency_level, 1, &slot, &seconds) == 0) {
+        seconds = -1;
+        // The scan reads statuses without atomics, so not while claims are deferred
+        int scan = system->ambulance_count <= NEAREST_SCAN_FLEET && !system->defer_claims;
+        int found = scan ? nearest_available_batch(system, &loc_x, &loc_y, &emergency_level, 1, &slot, &distance)
+                         : grid_k_nearest_qualified(system, loc_x, loc_y, emergency_level, 1, &slot, &distance);
+        if (found == 0) {
+            return -1;
+        }
+    }
+    if (out_dist2 != NULL) {
+        float dx = loc_x - system->amb_x[slot];
+        float dy = loc_y - system->amb_y[slot];
+        *out_dist2 = dx * dx + dy * dy;
+    }
+    if (out_seconds != NULL) {
+        *out_seconds = seconds;
+    }
+    return slot;
+}
+
+/**
+ * Claims an ambulance for a booking by moving its status from Available
+ * to Booked with one compare-and-swap. Of several callers racing for the
+ * same unit exactly one wins; the others see it taken.
+ * Returns: 1 if this caller claimed it, 0 if it was not available
+ */
+int claim_ambulance(BAPESSS_System* system, int slot) {
+    unsigned char expected = 0;
+    return __atomic_compare_exchange_n(&system->amb_status[slot], &expected, 1, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Removes a claimed ambulance from the dispatch indexes and counts it as
+ * booked. The status itself was set by the claim.
+ */
+static void settle_claim(BAPESSS_System* system, int slot) {
+    system->counters.ambulance_status[0]--;
+    system->counters.ambulance_status[1]++;
+    available_remove(system, slot);
+}
+
+/**
+ * Claims the best available ambulance for an emergency level, trying the
+ * next candidate whenever another caller gets there first. The pools,
+ * grid and counters are updated straight away, or, while claims are
+ * deferred, by the next fleet_settle; until then the claimed unit is
+ * skipped by status.
+ * Returns: Slot of the claimed ambulance, or -1 if none is available
+ */
+int claim_available_ambulance(BAPESSS_System* system, int emergency_level) {
+    int slot = pick_available(system, emergency_level, 1);
+    if (slot != -1) {
+        record_claim(system, slot);
+    }
+    return slot;
+}
+
+/**
+ * Claims a unit for a new booking: the preferred one (-1 for none) if it
+ * is still available, otherwise the best one for the emergency level.
+ * The claim is not recorded; create_booking_claimed does that once the
+ * booking exists, or releases it.
+ * Returns: Slot claimed, or -1 if none is available
+ */
+int claim_for_booking(BAPESSS_System* system, int emergency_level, int preferred_slot) {
+    if (preferred_slot != -1 && claim_ambulance(system, preferred_slot)) {
+        return preferred_slot;
+    }
+    return pick_available(system, emergency_level, 1);
+}
+
+/**
+ * Gives back a claim that was never recorded (-1 is ignored). A pool may
+ * skip the unit until the next fleet_settle; the grid sees it at once.
+ */
+void release_claim(BAPESSS_System* system, int slot) {
+    if (slot != -1) {
+        __atomic_store_n(&system->amb_status[slot], 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Books the index and counter updates of a successful claim: applied now,
+ * or queued for fleet_settle while claims are deferred
+ */
+void record_claim(BAPESSS_System* system, int slot) {
+    if (system->defer_claims) {
+        int index = __atomic_fetch_add(&system->unsettled_count, 1, __ATOMIC_RELAXED);
+        system->unsettled[index] = slot; // Each unit is claimed at most once between settles
+    } else {
+        settle_claim(system, slot);
+    }
+}
+
+/**
+ * Applies the index and counter updates of deferred claims. Must run
+ * before anything else changes the fleet, with no claims in progress.
+ */
+void fleet_settle(BAPESSS_System* system) {
+    for (int i = 0; i < system->unsettled_count; i++) {
+        settle_claim(system, system->unsettled[i]);
+    }
+    system->unsettled_count = 0;
+    for (int type = 0; type <= AMBULANCE_TYPES; type++) {
+        system->pools.by_type[type].claimed_top = 0;
+    }
+}
+
+/**
+ * Returns: Number of claims not settled yet; they still count as
+ * available in the report counters
+ */
+int unsettled_claims(BAPESSS_System* system) {
+    return __atomic_load_n(&system->unsettled_count, __ATOMIC_RELAXED);
+}
+
+// =============================================
+// SPATIAL INDEX
+// =============================================
+
+/**
+ * Returns the pool index for an ambulance type (0 for unknown types).
+ * Grid cells count their units by the same index.
+ */
+static int pool_type(int type) {
+    return (type >= 1 && type <= AMBULANCE_TYPES) ? type : 0;
+}
+
+/**
+ * Changes an ambulance's status and keeps the indexes in sync.
+ * Every status transition must go through here.
+ */
+void set_ambulance_status(BAPESSS_System* system, int slot, int status) {
+    int old_status = system->amb_status[slot];
+    if (old_status == status) {
+        return;
+    }
+    
+    system->amb_status[slot] = status;
+    system->counters.ambulance_status[status_bucket(old_status, AMBULANCE_STATUSES)]--;
+    system->counters.ambulance_status[status_bucket(status, AMBULANCE_STATUSES)]++;
+    
+    if (old_status == 0) {
+        available_remove(system, slot);
+    } else if (status == 0) {
+        available_insert(system, slot);
+    }
+}
+
+/**
+ * Adds an ambulance that just became available to the dispatch indexes
+ */
+void available_insert(BAPESSS_System* system, int slot) {
+    if (system->amb_status[slot] != 0) {
+        return;
+    }
+    grid_insert(system, slot);
+    pool_insert(system, slot);
+}
+
+/**
+ * Removes an ambulance that is no longer available from the dispatch indexes
+ */
+void available_remove(BAPESSS_System* system, int slot) {
+    grid_remove(system, slot);
+    pool_remove(system, slot);
+}
+
+/**
+ * Rebuilds every derived index from the ambulance and booking arrays.
+ * Call after the arrays were filled directly (sample data, load_data).
+ */
+void rebuild_indexes(BAPESSS_System* system) {
+    grid_rebuild(system);
+    pools_rebuild(system);
+    
+    id_index_clear(&system->booking_index);
+    for (int i = 0; i < system->booking_count; i++) {
+        id_index_put(&system->booking_index, booking_at(system, i)->booking_id, i);
+    }
+    id_index_clear(&system->ambulance_index);
+    for (int i = 0; i < system->ambulance_count; i++) {
+        id_index_put(&system->ambulance_index, system->amb_details[i].ambulance_id, i);
+    }
+    
+    pending_rebuild(system);
+    counters_recount(system, &system->counters);
+}
+
+/**
+ * Initializes an empty grid
+ */
+void grid_init(SpatialGrid* grid) {
+    memset(grid, 0, sizeof(SpatialGrid));
+}
+
+/**
+ * Frees all memory held by the grid
+ */
+void grid_free(SpatialGrid* grid) {
+    if (grid->cells != NULL) {
+        for (int i = 0; i < grid->cols * grid->rows; i++) {
+            free(grid->cells[i].slots);
+        }
+        free(grid->cells);
+    }
+    free(grid->outliers.slots);
+    free(grid->cell_of);
+    free(grid->pos_in_cell);
+    grid_init(grid);
+}
+
+/**
+ * Makes sure the per-slot arrays can hold every ambulance slot
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int grid_reserve_slots(SpatialGrid* grid, int slots) {
+    if (slots <= grid->slot_capacity) {
+        return 1;
+    }
+    
+    int new_capacity = grid->slot_capacity > 0 ? grid->slot_capacity : 16;
+    while (new_capacity < slots) {
+        new_capacity *= 2;
+    }
+    
+    int* cell_of = (int*)realloc(grid->cell_of, new_capacity * sizeof(int));
+    if (cell_of == NULL) {
+        return 0;
+    }
+    grid->cell_of = cell_of;
+    
+    int* pos_in_cell = (int*)realloc(grid->pos_in_cell, new_capacity * sizeof(int));
+    if (pos_in_cell == NULL) {
+        return 0;
+    }
+    grid->pos_in_cell = pos_in_cell;
+    
+    for (int i = grid->slot_capacity; i < new_capacity; i++) {
+        grid->cell_of[i] = -1;
+    }
+    grid->slot_capacity = new_capacity;
+    return 1;
+}
+
+/**
+ * Returns the grid cell column/row containing a coordinate, clamped to the grid
+ */
+static int grid_col(const SpatialGrid* grid, float loc_x) {
+    int col = (int)floorf((loc_x - grid->min_x) / grid->cell_size);
+    if (col < 0) return 0;
+    if (col >= grid->cols) return grid->cols - 1;
+    return col;
+}
+
+static int grid_row(const SpatialGrid* grid, float loc_y) {
+    int row = (int)floorf((loc_y - grid->min_y) / grid->cell_size);
+    if (row < 0) return 0;
+    if (row >= grid->rows) return grid->rows - 1;
+    return row;
+}
+
+/**
+ * Returns: 1 if a location lies inside the area the grid's cells cover
+ */
+static int grid_covers(const SpatialGrid* grid, float loc_x, float loc_y) {
+    return loc_x >= grid->min_x && loc_x <= grid->max_x && loc_y >= grid->min_y && loc_y <= grid->max_y;
+}
+
+/**
+ * Returns: The cell behind a cell_of value (the outliers for GRID_OUTLIER_CELL)
+ */
+static GridCell* grid_cell(SpatialGrid* grid, int cell_index) {
+    return cell_index == GRID_OUTLIER_CELL ? &grid->outliers : &grid->cells[cell_index];
+}
+
+/**
+ * Returns: The k-th smallest of values (0-based), which are reordered
+ */
+static float nth_smallest(float* values, int count, int k) {
+    int low = 0, high = count - 1;
+    while (low < high) {
+        float pivot = values[low + (high - low) / 2];
+        int i = low, j = high;
+        while (i <= j) {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i <= j) {
+                float swap = values[i];
+                values[i++] = values[j];
+                values[j--] = swap;
+            }
+        }
+        if (k <= j) {
+            high = j;
+        } else if (k >= i) {
+            low = i;
+        } else {
+            break;
+        }
+    }
+    return values[k];
+}
+
+/**
+ * Puts the box around the fleet's locations in min/max, leaving out the
+ * GRID_OUTLIER_SHARE-th of units furthest out on each side, so a few
+ * bad fixes do not stretch it. Small fleets use the full box.
+ */
+static void grid_bounds(BAPESSS_System* system, float* min_x, float* min_y, float* max_x, float* max_y) {
+    int count = system->ambulance_count;
+    int trim = count / GRID_OUTLIER_SHARE;
+    float* values = trim > 0 ? (float*)malloc((size_t)count * sizeof(float)) : NULL;
+    if (values != NULL) {
+        memcpy(values, system->amb_x, (size_t)count * sizeof(float));
+        *min_x = nth_smallest(values, count, trim);
+        *max_x = nth_smallest(values, count, count - 1 - trim);
+        memcpy(values, system->amb_y, (size_t)count * sizeof(float));
+        *min_y = nth_smallest(values, count, trim);
+        *max_y = nth_smallest(values, count, count - 1 - trim);
+        free(values);
+        return;
+    }
+    
+    *min_x = *min_y = *max_x = *max_y = 0;
+    for (int i = 0; i < count; i++) {
+        float x = system->amb_x[i];
+        float y = system->amb_y[i];
+        if (i == 0 || x < *min_x) *min_x = x;
+        if (i == 0 || y < *min_y) *min_y = y;
+        if (i == 0 || x > *max_x) *max_x = x;
+        if (i == 0 || y > *max_y) *max_y = y;
+    }
+}
+
+static void grid_place(BAPESSS_System* system, int slot);
+
+/**
+ * Sizes the grid to the current fleet and re-inserts all available ambulances.
+ * The bounding box covers the fleet, bar its furthest outliers, so that
+ * units becoming available later rarely fall outside it; units that do
+ * are kept with the outliers.
+ */
+void grid_rebuild(BAPESSS_System* system) {
+    SpatialGrid* grid = &system->grid;
+    
+    // Drop the old cells but keep the per-slot arrays
+    if (grid->cells != NULL) {
+        for (int i = 0; i < grid->cols * grid->rows; i++) {
+            free(grid->cells[i].slots);
+        }
+        free(grid->cells);
+        grid->cells = NULL;
+    }
+    free(grid->outliers.slots);
+    memset(&grid->outliers, 0, sizeof(GridCell));
+    
+    float min_x, min_y, max_x, max_y;
+    grid_bounds(system, &min_x, &min_y, &max_x, &max_y);
+    
+    // Pad the box so small movements don't force another rebuild
+    float width = max_x - min_x;
+    float height = max_y - min_y;
+    if (width < 1.0f) width = 1.0f;
+    if (height < 1.0f) height = 1.0f;
+    min_x -= width * GRID_PADDING;
+    min_y -= height * GRID_PADDING;
+    width *= 1.0f + 2 * GRID_PADDING;
+    height *= 1.0f + 2 * GRID_PADDING;
+    
+    // Pick a cell size that gives a few ambulances per cell, without letting
+    // a long thin fleet produce more cells than ambulances
+    int target_cells = system->ambulance_count / GRID_AMBULANCES_PER_CELL;
+    if (target_cells < 1) target_cells = 1;
+    float cell_size = sqrtf(width * height / target_cells);
+    float longest = width > height ? width : height;
+    if (cell_size < longest / target_cells) {
+        cell_size = longest / target_cells;
+    }
+    
+    grid->min_x = min_x;
+    grid->min_y = min_y;
+    grid->max_x = min_x + width;
+    grid->max_y = min_y + height;
+    grid->cell_size = cell_size;
+    grid->cols = (int)ceilf(width / cell_size);
+    grid->rows = (int)ceilf(height / cell_size);
+    if (grid->cols < 1) grid->cols = 1;
+    if (grid->rows < 1) grid->rows = 1;
+    grid->sized_for = system->ambulance_count;
+    
+    grid->cells = (GridCell*)calloc(grid->cols * grid->rows, sizeof(GridCell));
+    if (grid->cells == NULL || !grid_reserve_slots(grid, system->ambulance_count)) {
+        printf("Error: Memory allocation failed for spatial index!\n");
+        grid_free(grid);
+        return;
+    }
+    
+    for (int i = 0; i < grid->slot_capacity; i++) {
+        grid->cell_of[i] = -1;
+    }
+    for (int i = 0; i < system->ambulance_count; i++) {
+        if (system->amb_status[i] == 0) {
+            grid_place(system, i);
+        }
+    }
+    grid->outlier_limit = GRID_OUTLIER_SLACK + 2 * grid->outliers.count +
+                          system->ambulance_count / GRID_OUTLIER_SHARE;
+}
+
+/**
+ * Adds an available ambulance to the grid.
+ * Rebuilds the grid if the fleet has outgrown the cell size, or if the
+ * ambulance lies outside it and there are already too many outliers
+ * (the fleet has moved rather than a few units reporting bad fixes).
+ */
+void grid_insert(BAPESSS_System* system, int slot) {
+    SpatialGrid* grid = &system->grid;
+    
+    if (grid->cells == NULL ||
+        (!grid_covers(grid, system->amb_x[slot], system->amb_y[slot]) &&
+         grid->outliers.count >= grid->outlier_limit) ||
+        system->ambulance_count > 2 * grid->sized_for + GRID_AMBULANCES_PER_CELL) {
+        grid_rebuild(system); // Re-inserts this slot as well
+        return;
+    }
+    grid_place(system, slot);
+}
+
+/**
+ * Adds an available ambulance to its cell, or to the outliers if it lies
+ * outside the grid, without checking whether the grid still fits
+ */
+static void grid_place(BAPESSS_System* system, int slot) {
+    SpatialGrid* grid = &system->grid;
+    float x = system->amb_x[slot];
+    float y = system->amb_y[slot];
+    
+    if (!grid_reserve_slots(grid, slot + 1)) {
+        printf("Error: Memory allocation failed for spatial index!\n");
+        return;
+    }
+    if (grid->cell_of[slot] != -1) {
+        return; // Already indexed
+    }
+    
+    int cell_index = grid_covers(grid, x, y) ? grid_row(grid, y) * grid->cols + grid_col(grid, x) :
+                     GRID_OUTLIER_CELL;
+    GridCell* cell = grid_cell(grid, cell_index);
+    
+    if (cell->count >= cell->capacity) {
+        int new_capacity = cell->capacity > 0 ? cell->capacity * 2 : 4;
+        int* slots = (int*)realloc(cell->slots, new_capacity * sizeof(int));
+        if (slots == NULL) {
+            printf("Error: Memory allocation failed for spatial index!\n");
+            return;
+        }
+        cell->slots = slots;
+        cell->capacity = new_capacity;
+    }
+    
+    cell->slots[cell->count] = slot;
+    grid->cell_of[slot] = cell_index;
+    grid->pos_in_cell[slot] = cell->count;
+    cell->count++;
+    cell->type_count[pool_type(system->amb_type[slot])]++;
+}
+
+/**
+ * Removes an ambulance from the grid in O(1)
+ */
+void grid_remove(BAPESSS_System* system, int slot) {
+    SpatialGrid* grid = &system->grid;
+    
+    if (grid->cells == NULL || slot >= grid->slot_capacity || grid->cell_of[slot] == -1) {
+        return;
+    }
+    
+    GridCell* cell = grid_cell(grid, grid->cell_of[slot]);
+    int pos = grid->pos_in_cell[slot];
+    
+    // Move the last entry of the cell into the freed position
+    int last = cell->slots[cell->count - 1];
+    cell->slots[pos] = last;
+    grid->pos_in_cell[last] = pos;
+    cell->count--;
+    cell->type_count[pool_type(system->amb_type[slot])]--;
+    
+    grid->cell_of[slot] = -1;
+}
+
+/**
+ * Moves an ambulance to a new location and keeps the grid in sync. A
+ * unit that stays inside its cell only has its coordinates rewritten,
+ * one that crosses into another cell is moved between the two in O(1),
+ * and one leaving the grid's box joins the outliers (rebuilding the grid
+ * only once there are too many of them).
+ */
+void set_ambulance_location(BAPESSS_System* system, int slot, float loc_x, float loc_y) {
+    SpatialGrid* grid = &system->grid;
+    int indexed = grid->cells != NULL && slot < grid->slot_capacity && grid->cell_of[slot] != -1;
+    
+    system->amb_x[slot] = loc_x;
+    system->amb_y[slot] = loc_y;
+    if (!indexed) {
+        return;
+    }
+    if (grid_covers(grid, loc_x, loc_y) &&
+        grid_row(grid, loc_y) * grid->cols + grid_col(grid, loc_x) == grid->cell_of[slot]) {
+        return; // Still in the same cell
+    }
+    grid_remove(system, slot);
+    grid_insert(system, slot);
+}
+
+/**
+ * Applies GPS position reports in order, so a later report for the same
+ * unit wins. Reports for unknown units or with coordinates that are not
+ * finite are skipped. Positions are not journaled: after a restart a
+ * unit is where the last snapshot put it until it reports again.
+ * Returns: Number of reports applied
+ */
+int apply_positions(BAPESSS_System* system, PositionUpdate* updates, int count) {
+    int applied = 0;
+    for (int i = 0; i < count; i++) {
+        PositionUpdate* update = &updates[i];
+        int slot = find_ambulance_slot(system, update->ambulance_id);
+        update->applied = slot != -1 && isfinite(update->loc_x) && isfinite(update->loc_y);
+        if (update->applied) {
+            set_ambulance_location(system, slot, update->loc_x, update->loc_y);
+            applied++;
+        }
+    }
+    return applied;
+}
+
+/**
+ * Finds the k nearest available ambulances by searching rings of cells
+ * outwards from the query point until no closer unit can exist.
+ * Results are sorted by distance.
+ * Returns: Number of ambulances found (at most k)
+ */
+int grid_k_nearest(BAPESSS_System* system, float loc_x, float loc_y, int k,
+                   int* out_slots, float* out_dist2) {
+    return grid_k_nearest_qualified(system, loc_x, loc_y, 0, k, out_slots, out_dist2);
+}
+
+/**
+ * Returns: 1 if a grid cell may hold an ambulance of at least min_type.
+ * Units of unknown type are always counted, since their type may be
+ * higher than any known one.
+ */
+static int cell_may_qualify(const GridCell* cell, int min_type) {
+    if (min_type <= 1) {
+        return cell->count > 0;
+    }
+    int count = cell->type_count[0];
+    for (int type = min_type; type <= AMBULANCE_TYPES; type++) {
+        count += cell->type_count[type];
+    }
+    return count > 0;
+}
+
+/**
+ * Adds the qualifying available units of one cell to the sorted list of
+ * the k nearest found so far
+ * Returns: New number of units in the list
+ */
+static int cell_k_nearest(BAPESSS_System* system, const GridCell* cell, float loc_x, float loc_y, int min_type,
+                          int k, int found, int* out_slots, float* out_dist2) {
+    for (int j = 0; j < cell->count; j++) {
+        int slot = cell->slots[j];
+        if (system->amb_type[slot] < min_type || !still_available(system, slot)) continue;
+        float dx = loc_x - system->amb_x[slot];
+        float dy = loc_y - system->amb_y[slot];
+        float distance = dx * dx + dy * dy;
+        
+        if (found == k && distance >= out_dist2[k - 1]) continue;
+        
+        // Insert into the sorted result list
+        int pos = found < k ? found++ : k - 1;
+        while (pos > 0 && out_dist2[pos - 1] > distance) {
+            out_slots[pos] = out_slots[pos - 1];
+            out_dist2[pos] = out_dist2[pos - 1];
+            pos--;
+        }
+        out_slots[pos] = slot;
+        out_dist2[pos] = distance;
+    }
+    return found;
+}
+
+/**
+ * Same as grid_k_nearest, counting only ambulances whose type is at
+ * least min_type (0 accepts every unit). Cells without such a unit are
+ * passed over using their per-type counts, so a scarce type costs one
+ * check per cell instead of a look at every unit. The outliers are
+ * checked first, so the rings stop as soon as no cell can do better.
+ * Returns: Number of ambulances found (at most k)
+ */
+int grid_k_nearest_qualified(BAPESSS_System* system, float loc_x, float loc_y, int min_type, int k,
+                             int* out_slots, float* out_dist2) {
+    SpatialGrid* grid = &system->grid;
+    if (k <= 0 || grid->cells == NULL) {
+        return 0;
+    }
+    
+    int found = cell_may_qualify(&grid->outliers, min_type) ?
+                cell_k_nearest(system, &grid->outliers, loc_x, loc_y, min_type, k, 0, out_slots, out_dist2) : 0;
+    int center_col = grid_col(grid, loc_x);
+    int center_row = grid_row(grid, loc_y);
+    
+    int max_ring = center_col;
+    if (grid->cols - 1 - center_col > max_ring) max_ring = grid->cols - 1 - center_col;
+    if (center_row > max_ring) max_ring = center_row;
+    if (grid->rows - 1 - center_row > max_ring) max_ring = grid->rows - 1 - center_row;
+    
+    for (int ring = 0; ring <= max_ring; ring++) {
+        for (int row = center_row - ring; row <= center_row + ring; row++) {
+            if (row < 0 || row >= grid->rows) continue;
+            
+            // Top and bottom rows of the ring are scanned fully, the rest only at both ends
+            int full_row = (row == center_row - ring || row == center_row + ring);
+            int step = full_row || ring == 0 ? 1 : 2 * ring;
+            
+            for (int col = center_col - ring; col <= center_col + ring; col += step) {
+                if (col < 0 || col >= grid->cols) continue;
+                
+                GridCell* cell = &grid->cells[row * grid->cols + col];
+                if (!cell_may_qualify(cell, min_type)) continue;
+                found = cell_k_nearest(system, cell, loc_x, loc_y, min_type, k, found, out_slots, out_dist2);
+            }
+        }
+        
+        if (found == k) {
+            // Distance from the query to the nearest unsearched cell; sides
+            // that already reach the grid edge have nothing beyond them
+            float bound = INFINITY;
+            float left = grid->min_x + (center_col - ring) * grid->cell_size;
+            float right = grid->min_x + (center_col + ring + 1) * grid->cell_size;
+            float bottom = grid->min_y + (center_row - ring) * grid->cell_size;
+            float top = grid->min_y + (center_row + ring + 1) * grid->cell_size;
+            if (center_col - ring > 0 && loc_x - left < bound) bound = loc_x - left;
+            if (center_col + ring < grid->cols - 1 && right - loc_x < bound) bound = right - loc_x;
+            if (center_row - ring > 0 && loc_y - bottom < bound) bound = loc_y - bottom;
+            if (center_row + ring < grid->rows - 1 && top - loc_y < bound) bound = top - loc_y;
+            if (bound < 0) bound = 0;
+            
+            if (bound * bound >= out_dist2[k - 1]) {
+                break;
+            }
+        }
+    }
+    
+    return found;
+}
+
+/**
+ * Counts the available units of one cell within a radius, writing their
+ * slots after the found so far while there is room
+ * Returns: New total
+ */
+static int cell_within_radius(BAPESSS_System* system, const GridCell* cell, float loc_x, float loc_y,
+                              float radius2, int* out_slots, int max_out, int found) {
+    for (int j = 0; j < cell->count; j++) {
+        int slot = cell->slots[j];
+        if (!still_available(system, slot)) continue;
+        float dx = loc_x - system->amb_x[slot];
+        float dy = loc_y - system->amb_y[slot];
+        if (dx * dx + dy * dy <= radius2) {
+            if (found < max_out) {
+                out_slots[found] = slot;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+/**
+ * Finds all available ambulances within a radius of the query point.
+ * At most max_out slots are written to out_slots.
+ * Returns: Total number of ambulances within the radius
+ */
+int grid_within_radius(BAPESSS_System* system, float loc_x, float loc_y, float radius,
+                       int* out_slots, int max_out) {
+    SpatialGrid* grid = &system->grid;
+    if (grid->cells == NULL || radius < 0) {
+        return 0;
+    }
+    
+    int first_col = grid_col(grid, loc_x - radius);
+    int last_col = grid_col(grid, loc_x + radius);
+    int first_row = grid_row(grid, loc_y - radius);
+    int last_row = grid_row(grid, loc_y + radius);
+    float radius2 = radius * radius;
+    int found = cell_within_radius(system, &grid->outliers, loc_x, loc_y, radius2, out_slots, max_out, 0);
+    
+    for (int row = first_row; row <= last_row; row++) {
+        for (int col = first_col; col <= last_col; col++) {
+            found = cell_within_radius(system, &grid->cells[row * grid->cols + col], loc_x, loc_y, radius2,
+                                       out_slots, max_out, found);
+        }
+    }
+    
+    return found;
+}
+
+// =============================================
+// ID INDEXES
+// =============================================
+
+/**
+ * Spreads consecutive IDs over the whole table (Fibonacci hashing)
+ */
+static unsigned int id_hash(int id, int capacity) {
+    return ((unsigned int)id * 2654435761u) & (unsigned int)(capacity - 1);
+}
+
+/**
+ * Initializes an empty index
+ */
+void id_index_init(IdIndex* index) {
+    memset(index, 0, sizeof(IdIndex));
+}
+
+/**
+ * Frees all memory held by the index
+ */
+void id_index_free(IdIndex* index) {
+    if (!index->mapped) {
+        free(index->keys);
+        free(index->slots);
+    }
+    id_index_init(index);
+}
+
+/**
+ * Removes every entry but keeps the table allocated.
+ * A table used from a snapshot is dropped instead of written over.
+ */
+void id_index_clear(IdIndex* index) {
+    if (index->mapped) {
+        id_index_init(index);
+        return;
+    }
+    for (int i = 0; i < index->capacity; i++) {
+        index->keys[i] = ID_INDEX_EMPTY;
+    }
+    index->count = 0;
+}
+
+/**
+ * Doubles the table and re-inserts all entries
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int id_index_grow(IdIndex* index) {
+    int new_capacity = index->capacity > 0 ? index->capacity * 2 : 64;
+    int* keys = (int*)malloc(new_capacity * sizeof(int));
+    int* slots = (int*)malloc(new_capacity * sizeof(int));
+    if (keys == NULL || slots == NULL) {
+        free(keys);
+        free(slots);
+        return 0;
+    }
+    for (int i = 0; i < new_capacity; i++) {
+        keys[i] = ID_INDEX_EMPTY;
+    }
+    
+    for (int i = 0; i < index->capacity; i++) {
+        if (index->keys[i] == ID_INDEX_EMPTY) continue;
+        unsigned int pos = id_hash(index->keys[i], new_capacity);
+        while (keys[pos] != ID_INDEX_EMPTY) {
+            pos = (pos + 1) & (new_capacity - 1);
+        }
+        keys[pos] = index->keys[i];
+        slots[pos] = index->slots[i];
+    }
+    
+    if (!index->mapped) {
+        free(index->keys);
+        free(index->slots);
+    }
+    index->keys = keys;
+    index->slots = slots;
+    index->capacity = new_capacity;
+    index->mapped = 0;
+    return 1;
+}
+
+/**
+ * Maps an ID to a slot, replacing any previous slot for the same ID
+ */
+void id_index_put(IdIndex* index, int id, int slot) {
+    // Keep the table at most half full so probe sequences stay short
+    if (2 * (index->count + 1) > index->capacity && !id_index_grow(index)) {
+        printf("Error: Memory allocation failed for ID index!\n");
+        return;
+    }
+    
+    unsigned int pos = id_hash(id, index->capacity);
+    while (index->keys[pos] != ID_INDEX_EMPTY && index->keys[pos] != id) {
+        pos = (pos + 1) & (index->capacity - 1);
+    }
+    if (index->keys[pos] == ID_INDEX_EMPTY) {
+        index->keys[pos] = id;
+        index->count++;
+    }
+    index->slots[pos] = slot;
+}
+
+/**
+ * Looks up the slot for an ID
+ * Returns: Slot, or -1 if the ID is not in the index
+ */
+int id_index_get(const IdIndex* index, int id) {
+    if (index->capacity == 0 || id == ID_INDEX_EMPTY) {
+        return -1;
+    }
+    
+    unsigned int pos = id_hash(id, index->capacity);
+    while (index->keys[pos] != ID_INDEX_EMPTY) {
+        if (index->keys[pos] == id) {
+            return index->slots[pos];
+        }
+        pos = (pos + 1) & (index->capacity - 1);
+    }
+    return -1;
+}
+
+/**
+ * Finds a booking by ID
+ * Returns: Slot in the booking store, or -1 if not found
+ */
+int find_booking_slot(BAPESSS_System* system, int booking_id) {
+    return id_index_get(&system->booking_index, booking_id);
+}
+
+/**
+ * Finds an ambulance by ID
+ * Returns: Ambulance slot, or -1 if not found
+ */
+int find_ambulance_slot(BAPESSS_System* system, int ambulance_id) {
+    return id_index_get(&system->ambulance_index, ambulance_id);
+}
+
+// =============================================
+// PENDING BOOKINGS
+// =============================================
+
+/**
+ * Returns the queue index for an emergency level, treating unknown levels as Normal
+ */
+static int pending_level(int emergency_level) {
+    return (emergency_level >= 1 && emergency_level <= EMERGENCY_LEVELS) ? emergency_level : 1;
+}
+
+/**
+ * Initializes the empty queues
+ */
+void pending_init(BAPESSS_System* system) {
+    memset(system->pending, 0, sizeof(system->pending));
+}
+
+/**
+ * Frees the queues
+ */
+void pending_free(BAPESSS_System* system) {
+    for (int level = 0; level <= EMERGENCY_LEVELS; level++) {
+        free(system->pending[level].slots);
+    }
+    pending_init(system);
+}
+
+/**
+ * Re-queues every pending booking in booking order
+ */
+void pending_rebuild(BAPESSS_System* system) {
+    for (int level = 0; level <= EMERGENCY_LEVELS; level++) {
+        system->pending[level].head = 0;
+        system->pending[level].count = 0;
+    }
+    for (int i = 0; i < system->booking_count; i++) {
+        if (booking_at(system, i)->status == 0) {
+            pending_push(system, i);
+        }
+    }
+}
+
+/**
+ * Queues a pending booking behind the others of its emergency level in O(1)
+ */
+void pending_push(BAPESSS_System* system, int booking_slot) {
+    PendingQueue* queue = &system->pending[pending_level(booking_at(system, booking_slot)->emergency_level)];
+    
+    if (queue->count >= queue->capacity) {
+        int new_capacity = queue->capacity > 0 ? queue->capacity * 2 : 16;
+        int* slots = (int*)malloc(new_capacity * sizeof(int));
+        if (slots == NULL) {
+            printf("Error: Memory allocation failed for pending queue!\n");
+            return;
+        }
+        // Unwrap the ring buffer into the new array
+        for (int i = 0; i < queue->count; i++) {
+            slots[i] = queue->slots[(queue->head + i) & (queue->capacity - 1)];
+        }
+        free(queue->slots);
+        queue->slots = slots;
+        queue->head = 0;
+        queue->capacity = new_capacity;
+    }
+    
+    queue->slots[(queue->head + queue->count) & (queue->capacity - 1)] = booking_slot;
+    queue->count++;
+}
+
+/**
+ * Takes the highest-priority pending booking: highest emergency level
+ * first, then longest waiting. Bookings cancelled while queued are
+ * skipped here instead of being searched for at cancellation.
+ * Returns: Booking slot, or -1 if nothing is waiting
+ */
+int pending_pop(BAPESSS_System* system) {
+    for (int level = EMERGENCY_LEVELS; level >= 1; level--) {
+        PendingQueue* queue = &system->pending[level];
+        while (queue->count > 0) {
+            int booking_slot = queue->slots[queue->head];
+            queue->head = (queue->head + 1) & (queue->capacity - 1);
+            queue->count--;
+            if (booking_at(system, booking_slot)->status == 0) {
+                return booking_slot;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Gives an ambulance to a booking and confirms the booking. The
+ * ambulance is either available or already claimed for this booking.
+ */
+void assign_ambulance(BAPESSS_System* system, int booking_slot, int ambulance_slot) {
+    BookingRecord* booking = booking_at(system, booking_slot);
+    
+    set_ambulance_status(system, ambulance_slot, 1); // Booked
+    booking->ambulance_id = system->amb_details[ambulance_slot].ambulance_id;
+    set_booking_status(system, booking_slot, 1); // Confirmed
+    journal_change(system, JOURNAL_ASSIGN, booking->booking_id, booking->ambulance_id, 0);
+}
+
+/**
+ * Hands an available ambulance to the highest-priority waiting booking
+ * Returns: Slot of the booking that got the ambulance, or -1 if none
+ */
+int serve_pending(BAPESSS_System* system, int ambulance_slot) {
+    if (ambulance_slot == -1 || system->amb_status[ambulance_slot] != 0) {
+        return -1;
+    }
+    
+    int booking_slot = pending_pop(system);
+    if (booking_slot != -1) {
+        assign_ambulance(system, booking_slot, ambulance_slot);
+    }
+    return booking_slot;
+}
+
+/**
+ * Completes or cancels a booking and frees the ambulance it held
+ * Returns: Slot of the freed ambulance, or -1 if it held none
+ */
+int release_booking(BAPESSS_System* system, int booking_slot, int status) {
+    BookingRecord* booking = booking_at(system, booking_slot);
+    int was_active = booking->status == 1 || booking->status == 2;
+    
+    set_booking_status(system, booking_slot, status);
+    journal_change(system, JOURNAL_CLOSE, booking->booking_id, status, 0);
+    archive_add(system, booking_slot);
+    if (!was_active) {
+        return -1; // A pending booking holds no ambulance
+    }
+    
+    int ambulance_slot = find_ambulance_slot(system, booking->ambulance_id);
+    if (ambulance_slot == -1) {
+        return -1;
+    }
+    set_ambulance_status(system, ambulance_slot, 0); // Available
+    return ambulance_slot;
+}
+
+/**
+ * Completes or cancels an open booking and frees its ambulance, which
+ * goes straight to the next waiting booking if there is one.
+ * Returns: Slot of the booking that got the ambulance, or -1 if none
+ */
+int close_booking(BAPESSS_System* system, int booking_slot, int status) {
+    int ambulance_slot = release_booking(system, booking_slot, status);
+    if (ambulance_slot == -1) {
+        return -1;
+    }
+    return serve_pending(system, ambulance_slot);
+}
+
+// =============================================
+// AVAILABILITY POOLS
+// =============================================
+
+/**
+ * Initializes empty pools
+ */
+void pools_init(AvailabilityPools* pools) {
+    memset(pools, 0, sizeof(AvailabilityPools));
+}
+
+/**
+ * Frees all memory held by the pools
+ */
+void pools_free(AvailabilityPools* pools) {
+    for (int type = 0; type <= AMBULANCE_TYPES; type++) {
+        free(pools->by_type[type].slots);
+    }
+    free(pools->pos);
+    pools_init(pools);
+}
+
+/**
+ * Refills the pools from the status of every ambulance
+ */
+void pools_rebuild(BAPESSS_System* system) {
+    AvailabilityPools* pools = &system->pools;
+    
+    for (int type = 0; type <= AMBULANCE_TYPES; type++) {
+        pools->by_type[type].count = 0;
+        pools->by_type[type].claimed_top = 0;
+    }
+    for (int i = 0; i < pools->slot_capacity; i++) {
+        pools->pos[i] = -1;
+    }
+    for (int i = 0; i < system->ambulance_count; i++) {
+        if (system->amb_status[i] == 0) {
+            pool_insert(system, i);
+        }
+    }
+}
+
+/**
+ * Adds an available ambulance to the pool of its type in O(1)
+ */
+void pool_insert(BAPESSS_System* system, int slot) {
+    AvailabilityPools* pools = &system->pools;
+    
+    if (slot >= pools->slot_capacity) {
+        int new_capacity = pools->slot_capacity > 0 ? pools->slot_capacity : 16;
+        while (new_capacity <= slot) {
+            new_capacity *= 2;
+        }
+        int* pos = (int*)realloc(pools->pos, new_capacity * sizeof(int));
+        if (pos == NULL) {
+            printf("Error: Memory allocation failed for availability pools!\n");
+            return;
+        }
+        for (int i = pools->slot_capacity; i < new_capacity; i++) {
+            pos[i] = -1;
+        }
+        pools->pos = pos;
+        pools->slot_capacity = new_capacity;
+    }
+    if (pools->pos[slot] != -1) {
+        return; // Already in a pool
+    }
+    
+    AvailabilityPool* pool = &pools->by_type[pool_type(system->amb_type[slot])];
+    if (pool->count >= pool->capacity) {
+        int new_capacity = pool->capacity > 0 ? pool->capacity * 2 : 8;
+        int* slots = (int*)realloc(pool->slots, new_capacity * sizeof(int));
+        if (slots == NULL) {
+            printf("Error: Memory allocation failed for availability pools!\n");
+            return;
+        }
+        pool->slots = slots;
+        pool->capacity = new_capacity;
+    }
+    
+    pool->slots[pool->count] = slot;
+    pools->pos[slot] = pool->count;
+    pool->count++;
+}
+
+/**
+ * Removes an ambulance from its pool in O(1)
+ */
+void pool_remove(BAPESSS_System* system, int slot) {
+    AvailabilityPools* pools = &system->pools;
+    
+    if (slot >= pools->slot_capacity || pools->pos[slot] == -1) {
+        return;
+    }
+    
+    AvailabilityPool* pool = &pools->by_type[pool_type(system->amb_type[slot])];
+    int pos = pools->pos[slot];
+    
+    // Move the last entry of the pool into the freed position
+    int last = pool->slots[pool->count - 1];
+    pool->slots[pos] = last;
+    pools->pos[last] = pos;
+    pool->count--;
+    
+    pools->pos[slot] = -1;
+}
+
+// =============================================
+// ROAD NETWORK
+// =============================================
+
+/**
+ * Pushes a node onto a search heap, growing it as needed
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int road_heap_push(RoadScratch* scratch, float key, float cost, int node) {
+    if (scratch->heap_size == scratch->heap_capacity) {
+        int capacity = scratch->heap_capacity > 0 ? scratch->heap_capacity * 2 : 1024;
+        RoadHeapEntry* heap = (RoadHeapEntry*)realloc(scratch->heap, capacity * sizeof(RoadHeapEntry));
+        if (heap == NULL) {
+            return 0;
+        }
+        scratch->heap = heap;
+        scratch->heap_capacity = capacity;
+    }
+    RoadHeapEntry* heap = scratch->heap;
+    int pos = scratch->heap_size++;
+    while (pos > 0 && heap[(pos - 1) / 2].key > key) {
+        heap[pos] = heap[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+    heap[pos].key = key;
+    heap[pos].cost = cost;
+    heap[pos].node = node;
+    return 1;
+}
+
+/**
+ * Removes and returns the entry with the smallest key
+ */
+static RoadHeapEntry road_heap_pop(RoadScratch* scratch) {
+    RoadHeapEntry* heap = scratch->heap;
+    RoadHeapEntry top = heap[0];
+    RoadHeapEntry last = heap[--scratch->heap_size];
+    int size = scratch->heap_size;
+    int pos = 0;
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= size) break;
+        if (child + 1 < size && heap[child + 1].key < heap[child].key) child++;
+        if (heap[child].key >= last.key) break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    if (size > 0) {
+        heap[pos] = last;
+    }
+    return top;
+}
+
+/**
+ * Prepares scratch space for a new search over a network: every node's
+ * time becomes unknown without touching the per-node arrays
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int road_scratch_begin(const RoadNetwork* roads, RoadScratch* scratch) {
+    if (scratch->cost == NULL) {
+        scratch->cost = (float*)malloc((size_t)roads->node_count * sizeof(float));
+        scratch->stamp = (uint32_t*)calloc((size_t)roads->node_count, sizeof(uint32_t));
+        if (scratch->cost == NULL || scratch->stamp == NULL) {
+            free(scratch->cost);
+            free(scratch->stamp);
+            scratch->cost = NULL;
+            scratch->stamp = NULL;
+            return 0;
+        }
+    }
+    if (++scratch->search == 0) {
+        // Stamps wrapped around; old ones could look current
+        memset(scratch->stamp, 0, (size_t)roads->node_count * sizeof(uint32_t));
+        scratch->search = 1;
+    }
+    scratch->heap_size = 0;
+    return 1;
+}
+
+/**
+ * Frees the memory held by scratch space
+ */
+static void road_scratch_free(RoadScratch* scratch) {
+    free(scratch->cost);
+    free(scratch->stamp);
+    free(scratch->heap);
+    memset(scratch, 0, sizeof(RoadScratch));
+}
+
+/**
+ * Takes free scratch space from the network's pool. Queries running at
+ * the same time each get their own.
+ * Returns: The scratch space, or NULL if all of it is in use
+ */
+static RoadScratch* road_scratch_acquire(RoadNetwork* roads) {
+    for (int i = 0; i < ROAD_SCRATCH_SLOTS; i++) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&roads->scratch[i].in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return &roads->scratch[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Returns scratch space taken with road_scratch_acquire to the pool
+ */
+static void road_scratch_release(RoadScratch* scratch) {
+    __atomic_store_n(&scratch->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Dijkstra from one node over every reachable node, following arcs
+ * backwards when reverse is set. Writes the travel time of every node
+ * (INFINITY if unreachable) to out[node * stride].
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int road_dijkstra_all(const RoadNetwork* roads, RoadScratch* scratch, int source, int reverse,
+                             float* out, int stride) {
+    const int* start = reverse ? roads->in_start : roads->out_start;
+    const int* next = reverse ? roads->in_node : roads->out_node;
+    const float* seconds = reverse ? roads->in_seconds : roads->out_seconds;
+
+    if (!road_scratch_begin(roads, scratch)) {
+        return -1;
+    }
+    for (int v = 0; v < roads->node_count; v++) {
+        out[(size_t)v * stride] = INFINITY;
+    }
+    scratch->cost[source] = 0;
+    scratch->stamp[source] = scratch->search;
+    if (!road_heap_push(scratch, 0, 0, source)) {
+        return -1;
+    }
+    while (scratch->heap_size > 0) {
+        RoadHeapEntry top = road_heap_pop(scratch);
+        int v = top.node;
+        if (top.cost > scratch->cost[v] || out[(size_t)v * stride] != INFINITY) {
+            continue; // Stale entry
+        }
+        out[(size_t)v * stride] = top.cost;
+        for (int a = start[v]; a < start[v + 1]; a++) {
+            int w = next[a];
+            float cost = top.cost + seconds[a];
+            if (scratch->stamp[w] != scratch->search || cost < scratch->cost[w]) {
+                scratch->stamp[w] = scratch->search;
+                scratch->cost[w] = cost;
+                if (!road_heap_push(scratch, cost, cost, w)) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Lower bound on the travel time from one node to another from the
+ * landmark times (triangle inequality both ways round each landmark)
+ * Returns: Seconds, never more than the true travel time
+ */
+static float road_lower_bound(const RoadNetwork* roads, int from, int to) {
+    const float* from_to = roads->to_landmark + (size_t)from * roads->landmark_count;
+    const float* from_from = roads->from_landmark + (size_t)from * roads->landmark_count;
+    const float* to_to = roads->to_landmark + (size_t)to * roads->landmark_count;
+    const float* to_from = roads->from_landmark + (size_t)to * roads->landmark_count;
+    float bound = 0;
+    
+    for (int i = 0; i < roads->landmark_count; i++) {
+        // d(from, to) >= d(from, L) - d(to, L) and >= d(L, to) - d(L, from)
+        if (to_to[i] != INFINITY) {
+            float b = from_to[i] - to_to[i];
+            if (b > bound) bound = b;
+        }
+        if (from_from[i] != INFINITY) {
+            float b = to_from[i] - from_from[i];
+            if (b > bound) bound = b;
+        }
+    }
+    return bound; // INFINITY when a landmark shows no path can exist
+}
+
+/**
+ * A* search for the travel time between two nodes, guided by the
+ * landmark lower bounds (ALT). Gives up once every remaining path is
+ * known to take at least limit seconds.
+ * Returns: Travel time in seconds, or INFINITY if there is no path
+ * shorter than limit (or on allocation failure)
+ */
+static float road_search(const RoadNetwork* roads, RoadScratch* scratch, int source, int target, float limit) {
+    if (source == target) {
+        return 0;
+    }
+    if (!road_scratch_begin(roads, scratch)) {
+        return INFINITY;
+    }
+    float estimate = road_lower_bound(roads, source, target);
+    if (estimate >= limit) {
+        return INFINITY;
+    }
+    scratch->cost[source] = 0;
+    scratch->stamp[source] = scratch->search;
+    road_heap_push(scratch, estimate, 0, source);
+    
+    while (scratch->heap_size > 0) {
+        RoadHeapEntry top = road_heap_pop(scratch);
+        if (top.key >= limit) {
+            break;
+        }
+        int v = top.node;
+        if (top.cost > scratch->cost[v]) {
+            continue; // Stale entry
+        }
+        if (v == target) {
+            return top.cost;
+        }
+        for (int a = roads->out_start[v]; a < roads->out_start[v + 1]; a++) {
+            int w = roads->out_node[a];
+            float cost = top.cost + roads->out_seconds[a];
+            if (scratch->stamp[w] != scratch->search || cost < scratch->cost[w]) {
+                scratch->stamp[w] = scratch->search;
+                scratch->cost[w] = cost;
+                float key = cost + road_lower_bound(roads, w, target);
+                if (key < limit && !road_heap_push(scratch, key, cost, w)) {
+                    return INFINITY;
+                }
+            }
+        }
+    }
+    return INFINITY;
+}
+
+/**
+ * Snaps a location to the nearest junction of the road network by
+ * searching rings of snapping cells outwards from it
+ * Returns: Node index, or -1 if the network has no nodes
+ */
+int road_snap(const RoadNetwork* roads, float loc_x, float loc_y) {
+    if (roads->node_count == 0) {
+        return -1;
+    }
+    int center_col = (int)floorf((loc_x - roads->min_x) / roads->cell_size);
+    int center_row = (int)floorf((loc_y - roads->min_y) / roads->cell_size);
+    if (center_col < 0) center_col = 0;
+    if (center_col >= roads->cols) center_col = roads->cols - 1;
+    if (center_row < 0) center_row = 0;
+    if (center_row >= roads->rows) center_row = roads->rows - 1;
+    int max_ring = roads->cols > roads->rows ? roads->cols : roads->rows;
+    
+    int nearest = -1;
+    float best = INFINITY;
+    for (int ring = 0; ring <= max_ring; ring++) {
+        for (int row = center_row - ring; row <= center_row + ring; row++) {
+            if (row < 0 || row >= roads->rows) continue;
+            int full_row = (row == center_row - ring || row == center_row + ring);
+            int step = full_row || ring == 0 ? 1 : 2 * ring;
+            for (int col = center_col - ring; col <= center_col + ring; col += step) {
+                if (col < 0 || col >= roads->cols) continue;
+                int cell = row * roads->cols + col;
+                for (int i = roads->cell_start[cell]; i < roads->cell_start[cell + 1]; i++) {
+                    int v = roads->cell_node[i];
+                    float dx = loc_x - roads->node_x[v];
+                    float dy = loc_y - roads->node_y[v];
+                    float distance = dx * dx + dy * dy;
+                    if (distance < best) {
+                        best = distance;
+                        nearest = v;
+                    }
+                }
+            }
+        }
+        // Cells beyond this ring are at least ring cells away in every direction
+        float reach = ring * roads->cell_size;
+        if (nearest != -1 && reach * reach >= best) {
+            break;
+        }
+    }
+    return nearest;
+}
+
+/**
+ * Frees a road network
+ */
+void road_network_free(RoadNetwork* roads) {
+    if (roads == NULL) {
+        return;
+    }
+    free(roads->node_x);
+    free(roads->node_y);
+    free(roads->out_start);
+    free(roads->out_node);
+    free(roads->out_seconds);
+    free(roads->in_start);
+    free(roads->in_node);
+    free(roads->in_seconds);
+    free(roads->from_landmark);
+    free(roads->to_landmark);
+    free(roads->cell_start);
+    free(roads->cell_node);
+    for (int i = 0; i < ROAD_SCRATCH_SLOTS; i++) {
+        road_scratch_free(&roads->scratch[i]);
+    }
+    free(roads);
+}
+
+/**
+ * Sorts arcs by their first node into compressed rows
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int road_build_rows(int node_count, int arc_count, const int* first, const int* second,
+                           const float* seconds, int** out_start, int** out_node, float** out_seconds) {
+    int* start = (int*)calloc((size_t)node_count + 1, sizeof(int));
+    int* node = (int*)malloc(((size_t)arc_count + 1) * sizeof(int));
+    float* cost = (float*)malloc(((size_t)arc_count + 1) * sizeof(float));
+    if (start == NULL || node == NULL || cost == NULL) {
+        free(start);
+        free(node);
+        free(cost);
+        return 0;
+    }
+    for (int a = 0; a < arc_count; a++) {
+        start[first[a] + 1]++;
+    }
+    for (int v = 0; v < node_count; v++) {
+        start[v + 1] += start[v];
+    }
+    for (int a = 0; a < arc_count; a++) {
+        int pos = start[first[a]]++;
+        node[pos] = second[a];
+        cost[pos] = seconds[a];
+    }
+    for (int v = node_count; v > 0; v--) {
+        start[v] = start[v - 1]; // Undo the shift left by the fill
+    }
+    start[0] = 0;
+    *out_start = start;
+    *out_node = node;
+    *out_seconds = cost;
+    return 1;
+}
+
+/**
+ * Buckets the nodes into a uniform grid for road_snap
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int road_build_cells(RoadNetwork* roads) {
+    float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for (int v = 0; v < roads->node_count; v++) {
+        if (roads->node_x[v] < min_x) min_x = roads->node_x[v];
+        if (roads->node_x[v] > max_x) max_x = roads->node_x[v];
+        if (roads->node_y[v] < min_y) min_y = roads->node_y[v];
+        if (roads->node_y[v] > max_y) max_y = roads->node_y[v];
+    }
+    float width = max_x - min_x, height = max_y - min_y;
+    if (width <= 0) width = 1;
+    if (height <= 0) height = 1;
+    int target_cells = roads->node_count / ROAD_NODES_PER_CELL;
+    if (target_cells < 1) target_cells = 1;
+    float cell_size = sqrtf(width * height / target_cells);
+    float longest = width > height ? width : height;
+    if (cell_size < longest / target_cells) {
+        cell_size = longest / target_cells;
+    }
+    roads->min_x = min_x;
+    roads->min_y = min_y;
+    roads->cell_size = cell_size;
+    roads->cols = (int)(width / cell_size) + 1;
+    roads->rows = (int)(height / cell_size) + 1;
+    
+    int cells = roads->cols * roads->rows;
+    int* cell_of = (int*)malloc((size_t)roads->node_count * sizeof(int));
+    roads->cell_start = (int*)calloc((size_t)cells + 1, sizeof(int));
+    roads->cell_node = (int*)malloc((size_t)roads->node_count * sizeof(int));
+    if (cell_of == NULL || roads->cell_start == NULL || roads->cell_node == NULL) {
+        free(cell_of);
+        return 0;
+    }
+    for (int v = 0; v < roads->node_count; v++) {
+        int col = (int)((roads->node_x[v] - min_x) / cell_size);
+        int row = (int)((roads->node_y[v] - min_y) / cell_size);
+        if (col >= roads->cols) col = roads->cols - 1;
+        if (row >= roads->rows) row = roads->rows - 1;
+        cell_of[v] = row * roads->cols + col;
+        roads->cell_start[cell_of[v] + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        roads->cell_start[c + 1] += roads->cell_start[c];
+    }
+    for (int v = 0; v < roads->node_count; v++) {
+        roads->cell_node[roads->cell_start[cell_of[v]]++] = v;
+    }
+    for (int c = cells; c > 0; c--) {
+        roads->cell_start[c] = roads->cell_start[c - 1];
+    }
+    roads->cell_start[0] = 0;
+    free(cell_of);
+    return 1;
+}
+
+/**
+ * Picks the landmarks and stores the travel times from and to each of
+ * them for every node. Each landmark is the node farthest (by the times
+ * found so far) from the landmarks already chosen, which spreads them
+ * around the edge of the network where their bounds are tightest.
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int road_build_landmarks(RoadNetwork* roads) {
+    int count = roads->node_count < ROAD_LANDMARKS ? roads->node_count : ROAD_LANDMARKS;
+    size_t cells = (size_t)roads->node_count * count;
+    roads->from_landmark = (float*)malloc((cells > 0 ? cells : 1) * sizeof(float));
+    roads->to_landmark = (float*)malloc((cells > 0 ? cells : 1) * sizeof(float));
+    float* nearest = (float*)malloc(((size_t)roads->node_count + 1) * sizeof(float));
+    if (roads->from_landmark == NULL || roads->to_landmark == NULL || nearest == NULL) {
+        free(nearest);
+        return -1;
+    }
+    roads->landmark_count = count;
+    
+    RoadScratch* scratch = &roads->scratch[0];
+    for (int v = 0; v < roads->node_count; v++) {
+        nearest[v] = INFINITY;
+    }
+    
+    // Start from the node farthest from an arbitrary one
+    int landmark = 0;
+    if (count > 0) {
+        if (road_dijkstra_all(roads, scratch, 0, 0, roads->from_landmark, count) != 0) {
+            free(nearest);
+            return -1;
+        }
+        float farthest = -1;
+        for (int v = 0; v < roads->node_count; v++) {
+            float t = roads->from_landmark[(size_t)v * count];
+            if (t != INFINITY && t > farthest) {
+                farthest = t;
+                landmark = v;
+            }
+        }
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (road_dijkstra_all(roads, scratch, landmark, 0, roads->from_landmark + i, count) != 0 ||
+            road_dijkstra_all(roads, scratch, landmark, 1, roads->to_landmark + i, count) != 0) {
+            free(nearest);
+            return -1;
+        }
+        // Next landmark: the reachable node farthest from all chosen so far
+        float farthest = -1;
+        for (int v = 0; v < roads->node_count; v++) {
+            float t = roads->from_landmark[(size_t)v * count + i];
+            if (t < nearest[v]) nearest[v] = t;
+            if (nearest[v] != INFINITY && nearest[v] > farthest) {
+                farthest = nearest[v];
+                landmark = v;
+            }
+        }
+    }
+    free(nearest);
+    return 0;
+}
+
+/**
+ * Loads a road graph. The file uses the DIMACS shortest-path layout:
+ *   c <comment>
+ *   p sp <nodes> <arcs>        (optional)
+ *   v <node> <x> <y>           junction location, nodes numbered from 1
+ *   a <from> <to> <seconds>    one-way road segment and its drive time
+ * A two-way road is two arcs. Every node up to the highest number needs
+ * a v line.
+ * Returns: 0 on success (*out set), -1 if the file cannot be opened,
+ * -2 if it is malformed or memory ran out
+ */
+int road_network_load(const char* path, RoadNetwork** out) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    
+    int node_capacity = 0, arc_capacity = 0, node_count = 0, arc_count = 0;
+    float* xs = NULL;
+    float* ys = NULL;
+    unsigned char* located = NULL;
+    int* arc_from = NULL;
+    int* arc_to = NULL;
+    float* arc_seconds = NULL;
+    int result = -2;
+    char line[256];
+    
+    while (fgets(line, sizeof(line), file) != NULL) {
+        long first, second;
+        float a, b;
+        char* p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == 'v' && sscanf(p + 1, "%ld %f %f", &first, &a, &b) == 3) {
+            if (first < 1 || first > ROAD_MAX_NODES) goto done;
+            if (first > node_capacity) {
+                int capacity = node_capacity > 0 ? node_capacity : 1024;
+                while (capacity < first) capacity *= 2;
+                float* new_xs = (float*)realloc(xs, capacity * sizeof(float));
+                if (new_xs != NULL) xs = new_xs;
+                float* new_ys = (float*)realloc(ys, capacity * sizeof(float));
+                if (new_ys != NULL) ys = new_ys;
+                unsigned char* new_located = (unsigned char*)realloc(located, capacity);
+                if (new_xs == NULL || new_ys == NULL || new_located == NULL) goto done;
+                located = new_located;
+                memset(located + node_capacity, 0, capacity - node_capacity);
+                node_capacity = capacity;
+            }
+            xs[first - 1] = a;
+            ys[first - 1] = b;
+            located[first - 1] = 1;
+            if (first > node_count) node_count = (int)first;
+        } else if (*p == 'a' && sscanf(p + 1, "%ld %ld %f", &first, &second, &a) == 3) {
+            if (first < 1 || second < 1 || first > ROAD_MAX_NODES || second > ROAD_MAX_NODES ||
+                !(a >= 0) || a == INFINITY) {
+                goto done;
+            }
+            if (arc_count == arc_capacity) {
+                int capacity = arc_capacity > 0 ? arc_capacity * 2 : 4096;
+                int* new_from = (int*)realloc(arc_from, capacity * sizeof(int));
+                if (new_from != NULL) arc_from = new_from;
+                int* new_to = (int*)realloc(arc_to, capacity * sizeof(int));
+                if (new_to != NULL) arc_to = new_to;
+                float* new_seconds = (float*)realloc(arc_seconds, capacity * sizeof(float));
+                if (new_from == NULL || new_to == NULL || new_seconds == NULL) goto done;
+                arc_seconds = new_seconds;
+                arc_capacity = capacity;
+            }
+            arc_from[arc_count] = (int)first - 1;
+            arc_to[arc_count] = (int)second - 1;
+            arc_seconds[arc_count++] = a;
+        } else if (*p != 'c' && *p != 'p' && *p != '\n' && *p != '\r' && *p != '\0') {
+            goto done; // Not a line this format has
+        }
+    }
+    if (node_count == 0) {
+        goto done;
+    }
+    for (int v = 0; v < node_count; v++) {
+        if (!located[v]) {
+            goto done; // Junction without a location
+        }
+    }
+    for (int i = 0; i < arc_count; i++) {
+        if (arc_from[i] >= node_count || arc_to[i] >= node_count) {
+            goto done;
+        }
+    }
+    
+    RoadNetwork* roads = (RoadNetwork*)calloc(1, sizeof(RoadNetwork));
+    if (roads == NULL) {
+        goto done;
+    }
+    roads->node_count = node_count;
+    roads->arc_count = arc_count;
+    roads->node_x = xs;
+    roads->node_y = ys;
+    xs = ys = NULL;
+    if (!road_build_rows(node_count, arc_count, arc_from, arc_to, arc_seconds,
+                         &roads->out_start, &roads->out_node, &roads->out_seconds) ||
+        !road_build_rows(node_count, arc_count, arc_to, arc_from, arc_seconds,
+                         &roads->in_start, &roads->in_node, &roads->in_seconds) ||
+        !road_build_cells(roads) || road_build_landmarks(roads) != 0) {
+        road_network_free(roads);
+        goto done;
+    }
+    *out = roads;
+    result = 0;
+    
+done:
+    fclose(file);
+    free(xs);
+    free(ys);
+    free(located);
+    free(arc_from);
+    free(arc_to);
+    free(arc_seconds);
+    return result;
+}
+
+/**
+ * Loads the road graph at path, if there is one, for ranking ambulances
+ * by drive time. Replaces any graph loaded before.
+ * Returns: 0 on success, -1 if there is no such file, -2 if it is
+ * malformed or memory ran out
+ */
+int attach_roads(BAPESSS_System* system, const char* path) {
+    RoadNetwork* roads = NULL;
+    int result = road_network_load(path, &roads);
+    if (result == 0) {
+        road_network_free(system->roads);
+        system->roads = roads;
+    }
+    return result;
+}
+
+/**
+ * Ranks the available ambulances of at least min_type near a location
+ * by drive time over the road network. The ROAD_CANDIDATES nearest by
+ * straight line are considered; they are searched in order of their
+ * landmark lower bound, and a unit whose bound cannot beat the k-th
+ * best time found is never searched. Results are sorted by drive time
+ * (between the junctions nearest to the unit and to the location).
+ * Units the road network cannot bring there are left out.
+ * Returns: Number of ambulances ranked (at most k), or 0 without a
+ * road network
+ */
+int rank_by_eta(BAPESSS_System* system, float loc_x, float loc_y, int min_type, int k,
+                int* out_slots, float* out_seconds) {
+    RoadNetwork* roads = system->roads;
+    if (roads == NULL || k <= 0) {
+        return 0;
+    }
+    if (k > ROAD_CANDIDATES) {
+        k = ROAD_CANDIDATES;
+    }
+
+    int candidates[ROAD_CANDIDATES];
+    float distances[ROAD_CANDIDATES];
+    int nodes[ROAD_CANDIDATES];
+    float bounds[ROAD_CANDIDATES];
+    int count = grid_k_nearest_qualified(system, loc_x, loc_y, min_type, ROAD_CANDIDATES,
+                                         candidates, distances);
+    int target = road_snap(roads, loc_x, loc_y);
+
+    // Candidates in order of their lower bound
+    for (int i = 0; i < count; i++) {
+        int slot = candidates[i];
+        int node = road_snap(roads, system->amb_x[slot], system->amb_y[slot]);
+        float bound = road_lower_bound(roads, node, target);
+        int pos = i;
+        while (pos > 0 && bounds[pos - 1] > bound) {
+            candidates[pos] = candidates[pos - 1];
+            nodes[pos] = nodes[pos - 1];
+            bounds[pos] = bounds[pos - 1];
+            pos--;
+        }
+        candidates[pos] = slot;
+        nodes[pos] = node;
+        bounds[pos] = bound;
+    }
+
+    RoadScratch* scratch = road_scratch_acquire(roads);
+    RoadScratch spare;
+    if (scratch == NULL) {
+        memset(&spare, 0, sizeof(RoadScratch)); // Every pooled one is busy
+        scratch = &spare;
+    }
+
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        float limit = found == k ? out_seconds[k - 1] : INFINITY;
+        if (bounds[i] >= limit) {
+            break; // Neither this unit nor any later one can make the list
+        }
+        float seconds = road_search(roads, scratch, nodes[i], target, limit);
+        if (seconds >= limit) {
+            continue;
+        }
+        int pos = found < k ? found++ : k - 1;
+        while (pos > 0 && out_seconds[pos - 1] > seconds) {
+            out_slots[pos] = out_slots[pos - 1];
+            out_seconds[pos] = out_seconds[pos - 1];
+            pos--;
+        }
+        out_slots[pos] = candidates[i];
+        out_seconds[pos] = seconds;
+    }
+
+    if (scratch == &spare) {
+        road_scratch_free(&spare);
+    } else {
+        road_scratch_release(scratch);
+    }
+    return found;
+}
+
+// =============================================
+// BATCH ASSIGNMENT
+// =============================================
+
+// Binary min-heap entry of the assignment search
+typedef struct {
+    double key;                // Reduced path length to the column
+    int column;
+} AssignHeapEntry;
+
+/**
+ * Pushes an entry onto the heap
+ */
+static void assign_heap_push(AssignHeapEntry* heap, int* size, double key, int column) {
+    int pos = (*size)++;
+    while (pos > 0 && heap[(pos - 1) / 2].key > key) {
+        heap[pos] = heap[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+    heap[pos].key = key;
+    heap[pos].column = column;
+}
+
+/**
+ * Removes and returns the entry with the smallest key
+ */
+static AssignHeapEntry assign_heap_pop(AssignHeapEntry* heap, int* size) {
+    AssignHeapEntry top = heap[0];
+    AssignHeapEntry last = heap[--(*size)];
+    int pos = 0;
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= *size) break;
+        if (child + 1 < *size && heap[child + 1].key < heap[child].key) child++;
+        if (heap[child].key >= last.key) break;
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    if (*size > 0) {
+        heap[pos] = last;
+    }
+    return top;
+}
+
+/**
+ * Minimum-cost assignment of rows to columns over a sparse cost list:
+ * row r may take column edge_column[e] at cost edge_cost[e] for e in
+ * edge_start[r] .. edge_start[r + 1] - 1. This is the Hungarian method
+ * in its shortest-augmenting-path form: each row in turn is added along
+ * the cheapest path of reassignments (Dijkstra on reduced costs), and
+ * the row and column potentials keep every reduced cost non-negative.
+ * A row with no augmenting path is left out; that never costs another
+ * row its assignment. Columns such a search reached can never lead to a
+ * free column again and are not searched after that, so a batch with
+ * more rows than columns stays cheap. The row potentials are copied to
+ * out_row_potential if it is not NULL; the column potentials never rise
+ * above zero.
+ * Returns: Number of rows assigned (match_row[r] = column or -1), or -1
+ * on allocation failure
+ */
+static int solve_assignment(int rows, int columns, const int* edge_start, const int* edge_column,
+                            const double* edge_cost, int* match_row, double* out_row_potential) {
+    int edges = edge_start[rows];
+    double* u = (double*)calloc((size_t)rows, sizeof(double));
+    double* row_dist = (double*)malloc((size_t)rows * sizeof(double));
+    int* visited_rows = (int*)malloc((size_t)rows * sizeof(int));
+    double* v = (double*)calloc((size_t)columns, sizeof(double));
+    double* dist = (double*)malloc((size_t)columns * sizeof(double));
+    int* pred = (int*)malloc((size_t)columns * sizeof(int));
+    int* match_column = (int*)malloc((size_t)columns * sizeof(int));
+    int* seen = (int*)calloc((size_t)columns, sizeof(int));
+    int* done = (int*)calloc((size_t)columns, sizeof(int));
+    int* done_list = (int*)malloc((size_t)columns * sizeof(int));
+    char* dead = (char*)calloc((size_t)columns + 1, 1);
+    AssignHeapEntry* heap = (AssignHeapEntry*)malloc(((size_t)edges + 1) * sizeof(AssignHeapEntry));
+    int assigned = -1;
+    
+    if (u == NULL || row_dist == NULL || visited_rows == NULL || v == NULL || dist == NULL ||
+        pred == NULL || match_column == NULL || seen == NULL || done == NULL || done_list == NULL ||
+        dead == NULL || heap == NULL) {
+        goto cleanup;
+    }
+    
+    assigned = 0;
+    for (int r = 0; r < rows; r++) match_row[r] = -1;
+    for (int c = 0; c < columns; c++) match_column[c] = -1;
+    
+    for (int source = 0; source < rows; source++) {
+        int stamp = source + 1; // Marks seen/done for this search without clearing the arrays
+        int heap_size = 0, row_count = 0, done_count = 0;
+        int sink = -1;
+        double length = 0;
+        
+        int row = source;
+        double base = 0;
+        row_dist[row] = 0;
+        visited_rows[row_count++] = row;
+        for (;;) {
+            // Relax the edges of the row just reached
+            for (int e = edge_start[row]; e < edge_start[row + 1]; e++) {
+                int c = edge_column[e];
+                if (done[c] == stamp || dead[c]) continue;
+                double candidate = base + edge_cost[e] - u[row] - v[c];
+                if (seen[c] != stamp || candidate < dist[c]) {
+                    seen[c] = stamp;
+                    dist[c] = candidate;
+                    pred[c] = row;
+                    assign_heap_push(heap, &heap_size, candidate, c);
+                }
+            }
+            
+            // Settle the closest column; a free one ends the search
+            int column = -1;
+            while (heap_size > 0) {
+                AssignHeapEntry top = assign_heap_pop(heap, &heap_size);
+                if (done[top.column] != stamp && top.key <= dist[top.column]) {
+                    column = top.column;
+                    break;
+                }
+            }
+            if (column == -1) {
+                break; // No unit left that this row can take
+            }
+            done[column] = stamp;
+            done_list[done_count++] = column;
+            if (match_column[column] == -1) {
+                sink = column;
+                length = dist[column];
+                break;
+            }
+            row = match_column[column];
+            base = dist[column];
+            row_dist[row] = base;
+            visited_rows[row_count++] = row;
+        }
+        if (sink == -1) {
+            for (int i = 0; i < done_count; i++) {
+                dead[done_list[i]] = 1;
+            }
+            continue;
+        }
+        
+        // Shift the potentials so the path found has reduced cost zero
+        for (int i = 0; i < row_count; i++) {
+            u[visited_rows[i]] += length - row_dist[visited_rows[i]];
+        }
+        for (int i = 0; i < done_count; i++) {
+            v[done_list[i]] -= length - dist[done_list[i]];
+        }
+        
+        // Flip the path: every row on it moves to the column it was reached through
+        for (int column = sink;;) {
+            int owner = pred[column];
+            int previous = match_row[owner];
+            match_row[owner] = column;
+            match_column[column] = owner;
+            if (owner == source) break;
+            column = previous;
+        }
+        assigned++;
+    }
+    
+cleanup:
+    if (assigned >= 0 && out_row_potential != NULL) {
+        memcpy(out_row_potential, u, (size_t)rows * sizeof(double));
+    }
+    free(u);
+    free(row_dist);
+    free(visited_rows);
+    free(v);
+    free(dist);
+    free(pred);
+    free(match_column);
+    free(seen);
+    free(done);
+    free(done_list);
+    free(dead);
+    free(heap);
+    return assigned;
+}
+
+/**
+ * Orders the calls of a batch as rows of the assignment: most urgent
+ * level first, then arrival, so units that run short go to those first
+ */
+static void assign_row_order(const DispatchCall* calls, int count, int* order) {
+    int rows = 0;
+    for (int level = EMERGENCY_LEVELS; level >= 0; level--) {
+        for (int i = 0; i < count; i++) {
+            int call_level = calls[i].request.emergency_level;
+            if (call_level < 0) call_level = 0;
+            if (call_level > EMERGENCY_LEVELS) call_level = EMERGENCY_LEVELS;
+            if (call_level == level) order[rows++] = i;
+        }
+    }
+}
+
+/**
+ * Chooses units for a batch of calls jointly: every call gets an available
+ * unit of at least its emergency level, and the total distance driven is
+ * as small as possible. Only the nearest qualified units of each call are
+ * considered. All the lists are widened while some call is left without a
+ * unit and could still have one, and a call's own list is widened while
+ * its row potential exceeds the distance to its farthest candidate: with
+ * every unit left out at least that far and column potentials never
+ * above zero, a solve that passes this check is also optimal over the
+ * whole fleet. When units run short, calls of a higher emergency level
+ * are served first. Nothing is claimed here.
+ * Returns: Number of calls given a unit (out_slots[i] = ambulance slot or
+ * -1), or -1 on allocation failure
+ */
+int plan_batch_assignment(BAPESSS_System* system, const DispatchCall* calls, int count, int* out_slots) {
+    for (int i = 0; i < count; i++) {
+        out_slots[i] = -1;
+    }
+    if (count == 0 || system->ambulance_count == 0) {
+        return 0;
+    }
+    
+    int* column_of = (int*)malloc((size_t)system->ambulance_count * sizeof(int));
+    int* order = (int*)malloc((size_t)count * sizeof(int));
+    int* match_row = (int*)malloc((size_t)count * sizeof(int));
+    int* row_k = (int*)malloc((size_t)count * sizeof(int));
+    double* potential = (double*)malloc((size_t)count * sizeof(double));
+    if (column_of == NULL || order == NULL || match_row == NULL || row_k == NULL || potential == NULL) {
+        free(column_of);
+        free(order);
+        free(match_row);
+        free(row_k);
+        free(potential);
+        return -1;
+    }
+    memset(column_of, 0xFF, (size_t)system->ambulance_count * sizeof(int)); // All -1
+    
+    // Available units of at least each level (unknown types may be any)
+    int available_at_least[EMERGENCY_LEVELS + 1];
+    for (int level = 0; level <= EMERGENCY_LEVELS; level++) {
+        available_at_least[level] = system->pools.by_type[0].count;
+        for (int type = level > 1 ? level : 1; type <= AMBULANCE_TYPES; type++) {
+            available_at_least[level] += system->pools.by_type[type].count;
+        }
+    }
+    
+    assign_row_order(calls, count, order);
+    
+    // Candidates asked for per call, rows in priority order
+    for (int r = 0; r < count; r++) {
+        row_k[r] = ASSIGN_CANDIDATES < system->ambulance_count ? ASSIGN_CANDIDATES : system->ambulance_count;
+    }
+    
+    int assigned = -1;
+    for (;;) {
+        size_t total_k = 0;
+        int max_k = 0;
+        for (int r = 0; r < count; r++) {
+            total_k += (size_t)row_k[r];
+            max_k = row_k[r] > max_k ? row_k[r] : max_k;
+        }
+        int* edge_start = (int*)malloc(((size_t)count + 1) * sizeof(int));
+        int* edge_column = (int*)malloc((total_k + 1) * sizeof(int));
+        double* edge_cost = (double*)malloc((total_k + 1) * sizeof(double));
+        int* slots = (int*)malloc(((size_t)max_k + 1) * sizeof(int));
+        float* dist2 = (float*)malloc(((size_t)max_k + 1) * sizeof(float));
+        int* column_slot = (int*)malloc((total_k + 1) * sizeof(int));
+        if (edge_start == NULL || edge_column == NULL || edge_cost == NULL || slots == NULL ||
+            dist2 == NULL || column_slot == NULL) {
+            free(edge_start); free(edge_column); free(edge_cost);
+            free(slots); free(dist2); free(column_slot);
+            assigned = -1;
+            break;
+        }
+        
+        // Candidate units of every call, numbered as columns in order of first use
+        int columns = 0, edges = 0, widen_all = 0, widened = 0;
+        for (int r = 0; r < count; r++) {
+            const DispatchCall* call = &calls[order[r]];
+            edge_start[r] = edges;
+            int found = grid_k_nearest_qualified(system, call->loc_x, call->loc_y,
+                                                 call->request.emergency_level, row_k[r], slots, dist2);
+            for (int j = 0; j < found; j++) {
+                if (column_of[slots[j]] == -1) {
+                    column_of[slots[j]] = columns;
+                    column_slot[columns++] = slots[j];
+                }
+                edge_column[edges] = column_of[slots[j]];
+                edge_cost[edges++] = sqrt((double)dist2[j]);
+            }
+        }
+        edge_start[count] = edges;
+        
+        // Units of at least each level already in the problem; once every
+        // available one is, a wider search cannot find another
+        int seen_at_least[EMERGENCY_LEVELS + 1] = {0};
+        for (int c = 0; c < columns; c++) {
+            int type = system->amb_type[column_slot[c]];
+            for (int level = 0; level <= EMERGENCY_LEVELS && level <= type; level++) {
+                seen_at_least[level]++;
+            }
+        }
+        
+        assigned = solve_assignment(count, columns, edge_start, edge_column, edge_cost, match_row, potential);
+        for (int r = 0; assigned >= 0 && r < count; r++) {
+            int column = match_row[r];
+            out_slots[order[r]] = column != -1 ? column_slot[column] : -1;
+            // A call that saw all its candidates taken might find a unit further out
+            if (column == -1 && edge_start[r + 1] - edge_start[r] == row_k[r]) {
+                int level = calls[order[r]].request.emergency_level;
+                level = level < 0 ? 0 : (level > EMERGENCY_LEVELS ? EMERGENCY_LEVELS : level);
+                widen_all = widen_all || seen_at_least[level] < available_at_least[level];
+            }
+        }
+        for (int r = 0; assigned >= 0 && r < count; r++) {
+            // Lists that came back short already hold every qualified unit
+            if (edge_start[r + 1] - edge_start[r] < row_k[r] || row_k[r] == system->ambulance_count) {
+                continue;
+            }
+            // Every unit left out is at least as far as the last candidate
+            double farthest = edge_cost[edge_start[r + 1] - 1];
+            int uncertified = match_row[r] != -1 && potential[r] > farthest + 1e-9 * (1.0 + farthest);
+            if (widen_all || uncertified) {
+                row_k[r] = row_k[r] < system->ambulance_count / 4 ? row_k[r] * 4 : system->ambulance_count;
+                widened = 1;
+            }
+        }
+        for (int c = 0; c < columns; c++) {
+            column_of[column_slot[c]] = -1;
+        }
+        free(edge_start); free(edge_column); free(edge_cost);
+        free(slots); free(dist2); free(column_slot);
+        
+        if (assigned < 0 || !widened) {
+            break;
+        }
+    }
+    
+    free(column_of);
+    free(order);
+    free(match_row);
+    free(row_k);
+    free(potential);
+    return assigned;
+}
+
+/**
+ * Books a batch of calls that arrived together, assigning units jointly
+ * with plan_batch_assignment instead of one call at a time. Calls the
+ * plan could not serve with a qualified unit go through the usual
+ * single-call policy after the planned calls are booked, so its fallback
+ * cannot take a planned unit. Each call's request is filled in as by
+ * create_booking and its distance set to the distance to the unit (-1 if
+ * queued).
+ * Returns: Number of calls booked; on allocation failure the calls not
+ * booked have booking ID 0
+ */
+int dispatch_batch(BAPESSS_System* system, DispatchCall* calls, int count) {
+    int* planned = (int*)malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    if (planned != NULL && plan_batch_assignment(system, calls, count, planned) < 0) {
+        free(planned);
+        planned = NULL; // Without a plan every call is booked on its own
+    }
+    
+    int booked = 0;
+    for (int i = 0; i < count; i++) {
+        calls[i].request.booking_id = 0;
+        calls[i].distance = -1;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < count; i++) {
+            int slot = planned != NULL ? planned[i] : -1;
+            if ((pass == 0) != (slot != -1)) {
+                continue;
+            }
+            if (create_booking_with(system, &calls[i].request, slot) == -1) {
+                calls[i].request.booking_id = 0;
+                continue;
+            }
+            booked++;
+            
+            if (calls[i].request.ambulance_id != 0) {
+                slot = find_ambulance_slot(system, calls[i].request.ambulance_id);
+                float dx = calls[i].loc_x - system->amb_x[slot];
+                float dy = calls[i].loc_y - system->amb_y[slot];
+                calls[i].distance = sqrtf(dx * dx + dy * dy);
+            }
+        }
+    }
+    free(planned);
+    return booked;
+}
+
+// =============================================
+// MANAGEMENT FUNCTIONS
+// =============================================
+
+/**
+ * Updates the status of a booking
+ */
+void update_booking_status(BAPESSS_System* system) {
+    printf("\n=== UPDATE BOOKING STATUS ===\n");
+    
+    if (system->booking_count == 0) {
+        printf("No bookings to update.\n");
+        return;
+    }
+    
+    int booking_id;
+    printf("Enter Booking ID to update: ");
+    scanf("%d", &booking_id);
+    
+    // Find the booking
+    int found = find_booking_slot(system, booking_id);
+    
+    if (found == -1) {
+        printf("Booking ID %d not found!\n", booking_id);
+        return;
+    }
+    
+    printf("\nCurrent Status: ");
+    switch(booking_at(system, found)->status) {
+        case 0: printf("Pending\n"); break;
+        case 1: printf("Confirmed\n"); break;
+        case 2: printf("Dispatched\n"); break;
+        case 3: printf("Completed\n"); break;
+        case 4: printf("Cancelled\n"); break;
+    }
+    
+    printf("\nSelect new status:\n");
+    printf("1. Confirmed\n");
+    printf("2. Dispatched\n");
+    printf("3. Completed\n");
+    printf("4. Cancelled\n");
+    printf("Enter choice (1-4): ");
+    
+    int new_status;
+    scanf("%d", &new_status);
+    
+    if (new_status < 1 || new_status > 4) {
+        printf("Invalid status!\n");
+        return;
+    }
+    
+    // If completed or cancelled, the ambulance goes to the next waiting call
+    int served;
+    OpResult result = change_booking_status(system, booking_id, new_status, &served);
+    
+    if (result == OP_CLOSED) {
+        printf("Booking is already closed!\n");
+        return;
+    }
+    if (result == OP_UNASSIGNED) {
+        printf("Booking is still waiting for an ambulance; it can only be cancelled.\n");
+        return;
+    }
+    if (served != -1) {
+        printf("Ambulance ID %d reassigned to pending booking %d.\n",
+               booking_at(system, served)->ambulance_id, booking_at(system, served)->booking_id);
+    }
+    
+    printf("Booking status updated successfully!\n");
+}
+
+/**
+ * Cancels a booking
+ */
+void cancel_booking(BAPESSS_System* system) {
+    printf("\n=== CANCEL BOOKING ===\n");
+    
+    if (system->booking_count == 0) {
+        printf("No bookings to cancel.\n");
+        return;
+    }
+    
+    int booking_id;
+    printf("Enter Booking ID to cancel: ");
+    scanf("%d", &booking_id);
+    
+    // Find the booking
+    int found = find_booking_slot(system, booking_id);
+    
+    if (found == -1) {
+        printf("Booking ID %d not found!\n", booking_id);
+        return;
+    }
+    if (booking_at(system, found)->status == 3 || booking_at(system, found)->status == 4) {
+        printf("Booking is already closed!\n");
+        return;
+    }
+    
+    printf("\nBooking Details:\n");
+    printf("Patient: %s\n", booking_str(system, booking_at(system, found)->patient_name));
+    printf("Contact: %s\n", booking_str(system, booking_at(system, found)->patient_contact));
+    printf("Pickup: %s\n", booking_str(system, booking_at(system, found)->pickup_location));
+    
+    char confirm;
+    printf("\nAre you sure you want to cancel this booking? (y/n): ");
+    clear_input_buffer();
+    scanf("%c", &confirm);
+    
+    if (confirm == 'y' || confirm == 'Y') {
+        // Cancel and free up the ambulance for the next waiting call
+        int served;
+        change_booking_status(system, booking_id, 4, &served);
+        
+        printf("Booking cancelled successfully!\n");
+        if (served != -1) {
+            printf("Ambulance ID %d reassigned to pending booking %d.\n",
+                   booking_at(system, served)->ambulance_id, booking_at(system, served)->booking_id);
+        }
+    } else {
+        printf("Cancellation aborted.\n");
+    }
+}
+
+/**
+ * Adds a new ambulance to the fleet
+ */
+void add_ambulance(BAPESSS_System* system) {
+    printf("\n=== ADD NEW AMBULANCE ===\n");
+    
+    Ambulance new_ambulance;
+    
+    printf("Enter vehicle number: ");
+    clear_input_buffer();
+    fgets(new_ambulance.vehicle_number, sizeof(new_ambulance.vehicle_number), stdin);
+    new_ambulance.vehicle_number[strcspn(new_ambulance.vehicle_number, "\n")] = 0;
+    
+    printf("Enter driver name: ");
+    fgets(new_ambulance.driver_name, sizeof(new_ambulance.driver_name), stdin);
+    new_ambulance.driver_name[strcspn(new_ambulance.driver_name, "\n")] = 0;
+    
+    printf("Enter driver contact: ");
+    fgets(new_ambulance.driver_contact, sizeof(new_ambulance.driver_contact), stdin);
+    new_ambulance.driver_contact[strcspn(new_ambulance.driver_contact, "\n")] = 0;
+    
+    printf("\nSelect ambulance type:\n");
+    printf("1. Basic Life Support\n");
+    printf("2. Advanced Life Support\n");
+    printf("3. Mobile ICU\n");
+    printf("Enter type (1-3): ");
+    scanf("%d", &new_ambulance.type);
+    
+    if (new_ambulance.type < 1 || new_ambulance.type > 3) {
+        printf("Invalid type! Setting to Basic.\n");
+        new_ambulance.type = 1;
+    }
+    
+    printf("Enter current location (X Y coordinates): ");
+    scanf("%f %f", &new_ambulance.location_x, &new_ambulance.location_y);
+    
+    // Add to system
+    int served;
+    if (register_ambulance(system, &new_ambulance, &served) == -1) {
+        printf("Error: Memory allocation failed!\n");
+        return;
+    }
+    
+    printf("\nAmbulance added successfully!\n");
+    printf("Ambulance ID: %d\n", new_ambulance.ambulance_id);
+    
+    if (served != -1) {
+        printf("Assigned to pending booking %d.\n", booking_at(system, served)->booking_id);
+    }
+}
+
+/**
+ * Finds the nearest available ambulances using the spatial index
+ */
+void find_nearest_ambulance(BAPESSS_System* system, float loc_x, float loc_y) {
+    printf("\n=== FINDING NEAREST AMBULANCE ===\n");
+    printf("Your location: (%.2f, %.2f)\n", loc_x, loc_y);
+    
+    // With a road network the units are ranked by drive time instead of distance
+    int nearest[NEAREST_SHOW_COUNT];
+    float distances[NEAREST_SHOW_COUNT];
+    float seconds[NEAREST_SHOW_COUNT];
+    int found = rank_by_eta(system, loc_x, loc_y, 0, NEAREST_SHOW_COUNT, nearest, seconds);
+    int by_road = found > 0;
+    if (by_road) {
+        for (int i = 0; i < found; i++) {
+            float dx = loc_x - system->amb_x[nearest[i]];
+            float dy = loc_y - system->amb_y[nearest[i]];
+            distances[i] = dx * dx + dy * dy;
+        }
+    } else {
+        found = grid_k_nearest(system, loc_x, loc_y, NEAREST_SHOW_COUNT, nearest, distances);
+    }
+    
+    if (found > 0) {
+        AmbulanceDetails* details = &system->amb_details[nearest[0]];
+        printf("\nNearest available ambulance found%s:\n", by_road ? " (by drive time)" : "");
+        printf("Ambulance ID: %d\n", details->ambulance_id);
+        printf("Vehicle: %s\n", details->vehicle_number);
+        printf("Driver: %s\n", details->driver_name);
+        printf("Contact: %s\n", details->driver_contact);
+        printf("Distance: %.2f units\n", sqrt(distances[0]));
+        if (by_road) {
+            printf("Drive time: %.1f minutes\n", seconds[0] / 60);
+        }
+        printf("Location: (%.2f, %.2f)\n", system->amb_x[nearest[0]], system->amb_y[nearest[0]]);
+        
+        if (found > 1) {
+            printf("\nOther nearby ambulances:\n");
+            for (int i = 1; i < found; i++) {
+                printf("  Ambulance ID %d - %.2f units", system->amb_details[nearest[i]].ambulance_id,
+                       sqrt(distances[i]));
+                if (by_road) {
+                    printf(", %.1f minutes", seconds[i] / 60);
+                }
+                printf("\n");
+            }
+        }
+        
+        printf("\nAvailable ambulances within %.1f units: %d\n", NEARBY_RADIUS,
+               grid_within_radius(system, loc_x, loc_y, NEARBY_RADIUS, NULL, 0));
+    } else {
+        printf("\nNo available ambulances found near your location.\n");
+    }
+}
+
+// =============================================
+// TRIP ARCHIVE
+// =============================================
+
+/**
+ * Initializes an empty archive
+ */
+void archive_init(TripArchive* archive) {
+    memset(archive, 0, sizeof(TripArchive));
+}
+
+/**
+ * Frees every day of the archive and leaves it empty and unbuilt
+ */
+void archive_free(TripArchive* archive) {
+    for (int i = 0; i < archive->day_count; i++) {
+        TripDay* day = &archive->days[i];
+        free(day->booked_at);
+        free(day->level);
+        free(day->status);
+        free(day->ambulance_id);
+        free(day->response);
+    }
+    free(archive->days);
+    archive_init(archive);
+}
+
+/**
+ * Returns the day since the epoch (UTC) a time falls on
+ */
+static int64_t trip_day(int64_t time) {
+    return time >= 0 ? time / ARCHIVE_DAY_SECONDS : -((ARCHIVE_DAY_SECONDS - 1 - time) / ARCHIVE_DAY_SECONDS);
+}
+
+/**
+ * Finds the archive day for a day number, adding an empty one in order
+ * if there is none. Trips nearly always close on their newest day, so
+ * the search starts from the end.
+ * Returns: The day, or NULL on allocation failure
+ */
+static TripDay* archive_day(TripArchive* archive, int64_t day_number) {
+    int low = 0, high = archive->day_count;
+    if (high > 0 && archive->days[high - 1].day == day_number) {
+        return &archive->days[high - 1];
+    }
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (archive->days[mid].day < day_number) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < archive->day_count && archive->days[low].day == day_number) {
+        return &archive->days[low];
+    }
+    
+    if (archive->day_count == archive->day_capacity) {
+        int capacity = archive->day_capacity > 0 ? archive->day_capacity * 2 : 64;
+        TripDay* days = (TripDay*)realloc(archive->days, capacity * sizeof(TripDay));
+        if (days == NULL) {
+            return NULL;
+        }
+        archive->days = days;
+        archive->day_capacity = capacity;
+    }
+    memmove(&archive->days[low + 1], &archive->days[low], (archive->day_count - low) * sizeof(TripDay));
+    archive->day_count++;
+    
+    TripDay* day = &archive->days[low];
+    memset(day, 0, sizeof(TripDay));
+    day->day = day_number;
+    return day;
+}
+
+/**
+ * Grows every column of a day to hold at least one more trip
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int trip_day_reserve(TripDay* day) {
+    if (day->count < day->capacity) {
+        return 1;
+    }
+    int capacity = day->capacity > 0 ? day->capacity * 2 : 64;
+    int64_t* booked_at = (int64_t*)realloc(day->booked_at, capacity * sizeof(int64_t));
+    if (booked_at != NULL) day->booked_at = booked_at;
+    uint8_t* level = (uint8_t*)realloc(day->level, capacity);
+    if (level != NULL) day->level = level;
+    uint8_t* status = (uint8_t*)realloc(day->status, capacity);
+    if (status != NULL) day->status = status;
+    int32_t* ambulance_id = (int32_t*)realloc(day->ambulance_id, capacity * sizeof(int32_t));
+    if (ambulance_id != NULL) day->ambulance_id = ambulance_id;
+    int32_t* response = (int32_t*)realloc(day->response, capacity * sizeof(int32_t));
+    if (response != NULL) day->response = response;
+    if (booked_at == NULL || level == NULL || status == NULL || ambulance_id == NULL || response == NULL) {
+        return 0;
+    }
+    day->capacity = capacity;
+    return 1;
+}
+
+/**
+ * Adds one closed booking to the columns and zone map of the day it was
+ * booked on
+ * Returns: 0 on success, -1 on allocation failure
+ */
+int archive_append(TripArchive* archive, const BookingRecord* record) {
+    TripDay* day = archive_day(archive, trip_day(record->booking_time));
+    if (day == NULL || !trip_day_reserve(day)) {
+        return -1;
+    }
+    
+    int64_t response = record->pickup_time != 0 ? record->pickup_time - record->booking_time : -1;
+    if (response > INT32_MAX) response = INT32_MAX;
+    if (response < -1) response = -1; // Clock went backwards; treat as never picked up
+    int i = day->count++;
+    day->booked_at[i] = record->booking_time;
+    day->level[i] = record->emergency_level;
+    day->status[i] = record->status;
+    day->ambulance_id[i] = record->ambulance_id;
+    day->response[i] = (int32_t)response;
+    
+    if (i == 0 || record->booking_time < day->min_time) day->min_time = record->booking_time;
+    if (i == 0 || record->booking_time > day->max_time) day->max_time = record->booking_time;
+    if (i == 0 || record->ambulance_id < day->min_ambulance) day->min_ambulance = record->ambulance_id;
+    if (i == 0 || record->ambulance_id > day->max_ambulance) day->max_ambulance = record->ambulance_id;
+    int closed = record->status == 3 ? 0 : 1;
+    int level = level_bucket(record->emergency_level, EMERGENCY_LEVELS);
+    day->trips[closed][level]++;
+    if (response >= 0) {
+        day->answered[closed][level]++;
+        day->response_sum[closed][level] += response;
+        if (response > day->response_max[closed][level]) {
+            day->response_max[closed][level] = (int32_t)response;
+        }
+    }
+    archive->trip_count++;
+    return 0;
+}
+
+/**
+ * Fills the archive from every completed and cancelled booking the
+ * first time it is needed after the bookings were replaced; from then
+ * on release_booking keeps it up to date
+ * Returns: 0 on success, -1 on allocation failure
+ */
+int archive_build(BAPESSS_System* system) {
+    TripArchive* archive = &system->archive;
+    if (archive->built) {
+        return 0;
+    }
+    archive_free(archive);
+    for (int i = 0; i < system->booking_count; i++) {
+        const BookingRecord* record = booking_at(system, i);
+        if ((record->status == 3 || record->status == 4) && archive_append(archive, record) != 0) {
+            archive_free(archive);
+            return -1;
+        }
+    }
+    archive->built = 1;
+    return 0;
+}
+
+/**
+ * Records a booking that was just completed or cancelled, if the archive
+ * has been built
+ */
+void archive_add(BAPESSS_System* system, int booking_slot) {
+    if (system->archive.built && archive_append(&system->archive, booking_at(system, booking_slot)) != 0) {
+        archive_free(&system->archive); // Rebuilt in full by the next query
+    }
+}
+
+/**
+ * Checks a day's zone map against a filter
+ * Returns: 0 if no trip of the day can match, 1 if some may, 2 if every
+ * trip of the day is inside the time window and the filter only asks for
+ * what the zone map counts
+ */
+static int trip_day_covers(const TripDay* day, const TripFilter* filter) {
+    if (day->count == 0 || day->max_time < filter->from || day->min_time >= filter->to) {
+        return 0;
+    }
+    if (filter->ambulance_id != 0 &&
+        (filter->ambulance_id < day->min_ambulance || filter->ambulance_id > day->max_ambulance)) {
+        return 0;
+    }
+    if (filter->level != 0) {
+        int level = level_bucket(filter->level, EMERGENCY_LEVELS);
+        int closed_from = filter->status == 4 ? 1 : 0, closed_to = filter->status == 3 ? 0 : 1;
+        int trips = 0;
+        for (int closed = closed_from; closed <= closed_to; closed++) {
+            trips += day->trips[closed][level];
+        }
+        if (trips == 0) {
+            return 0;
+        }
+    }
+    return day->min_time >= filter->from && day->max_time < filter->to && filter->ambulance_id == 0 ? 2 : 1;
+}
+
+/**
+ * Totals the archived trips matching a filter. Days outside the window
+ * or without a matching trip are skipped on their zone maps, days wholly
+ * inside it are totalled from their zone maps, and only the edge days
+ * have their columns read - and only the columns the filter needs.
+ */
+void archive_query(const TripArchive* archive, const TripFilter* filter, TripStats* out) {
+    int64_t response_sum = 0;
+    memset(out, 0, sizeof(TripStats));
+    
+    for (int d = 0; d < archive->day_count; d++) {
+        const TripDay* day = &archive->days[d];
+        int covers = trip_day_covers(day, filter);
+        if (covers == 0) {
+            out->days_skipped++;
+            continue;
+        }
+        if (covers == 2) {
+            out->days_summarized++;
+            for (int closed = 0; closed < 2; closed++) {
+                if ((filter->status == 3 && closed == 1) || (filter->status == 4 && closed == 0)) {
+                    continue;
+                }
+                for (int level = 1; level <= EMERGENCY_LEVELS + 1; level++) {
+                    if (filter->level != 0 && level != level_bucket(filter->level, EMERGENCY_LEVELS)) {
+                        continue;
+                    }
+                    out->trips += day->trips[closed][level];
+                    out->answered += day->answered[closed][level];
+                    response_sum += day->response_sum[closed][level];
+                    if (day->response_max[closed][level] > out->max_response) {
+                        out->max_response = day->response_max[closed][level];
+                    }
+                }
+            }
+            continue;
+        }
+    
+        out->days_scanned++;
+        for (int i = 0; i < day->count; i++) {
+            if (day->booked_at[i] < filter->from || day->booked_at[i] >= filter->to ||
+                (filter->level != 0 && day->level[i] != filter->level) ||
+                (filter->status != 0 && day->status[i] != filter->status) ||
+                (filter->ambulance_id != 0 && day->ambulance_id[i] != filter->ambulance_id)) {
+                continue;
+            }
+            out->trips++;
+            int32_t response = day->response[i];
+            if (response >= 0) {
+                out->answered++;
+                response_sum += response;
+                if (response > out->max_response) {
+                    out->max_response = response;
+                }
+            }
+        }
+    }
+    out->mean_response = out->answered > 0 ? (double)response_sum / out->answered : 0;
+}
+
+/**
+ * Counts the archived trips matching a filter in bucket_count buckets of
+ * bucket_seconds, the first starting at filter->from (filter->to is
+ * ignored). A day that falls inside one bucket is added from its zone
+ * map unless the filter needs a column.
+ * Returns: Number of trips counted
+ */
+long archive_volume(const TripArchive* archive, const TripFilter* filter, int64_t bucket_seconds,
+                    long* counts, int bucket_count) {
+    TripFilter window = *filter;
+    window.to = filter->from + bucket_seconds * bucket_count;
+    long total = 0;
+    memset(counts, 0, bucket_count * sizeof(long));
+    
+    for (int d = 0; d < archive->day_count; d++) {
+        const TripDay* day = &archive->days[d];
+        int covers = trip_day_covers(day, &window);
+        if (covers == 0) {
+            continue;
+        }
+        int first = (int)((day->min_time - window.from) / bucket_seconds);
+        if (covers == 2 && first == (int)((day->max_time - window.from) / bucket_seconds)) {
+            for (int closed = 0; closed < 2; closed++) {
+                if ((filter->status == 3 && closed == 1) || (filter->status == 4 && closed == 0)) {
+                    continue;
+                }
+                for (int level = 1; level <= EMERGENCY_LEVELS + 1; level++) {
+                    if (filter->level == 0 || level == level_bucket(filter->level, EMERGENCY_LEVELS)) {
+                        counts[first] += day->trips[closed][level];
+                        total += day->trips[closed][level];
+                    }
+                }
+            }
+            continue;
+        }
+        for (int i = 0; i < day->count; i++) {
+            if (day->booked_at[i] < window.from || day->booked_at[i] >= window.to ||
+                (filter->level != 0 && day->level[i] != filter->level) ||
+                (filter->status != 0 && day->status[i] != filter->status) ||
+                (filter->ambulance_id != 0 && day->ambulance_id[i] != filter->ambulance_id)) {
+                continue;
+            }
+            counts[(day->booked_at[i] - window.from) / bucket_seconds]++;
+            total++;
+        }
+    }
+    return total;
+}
+
+// =============================================
+// PATIENT SEARCH
+// =============================================
+
+/**
+ * Initializes an empty index
+ */
+void patient_index_init(PatientIndex* index) {
+    memset(index, 0, sizeof(PatientIndex));
+}
+
+/**
+ * Frees every list of the index and leaves it empty and unbuilt
+ */
+void patient_index_free(PatientIndex* index) {
+    for (int i = 0; i < index->gram_count; i++) {
+        free(index->postings[i].slots);
+    }
+    free(index->postings);
+    free(index->keys);
+    free(index->lists);
+    patient_index_init(index);
+}
+
+/**
+ * Lists the grams of a name or contact, one per character of the text,
+ * lowercased. A name gram is the three-character window ending on the
+ * character, after two start marks, so the first n grams are those of
+ * any n-character prefix; with inner set, only windows wholly inside the
+ * text are listed: those a name containing the text must hold. A contact
+ * gram is a hash (FNV-1a) of the prefix ending on the character, up to
+ * SEARCH_CONTACT_PREFIX characters, so the last gram alone finds the
+ * contacts that may start with the text.
+ * Returns: Number of grams written (at most max_out)
+ */
+static int search_grams(const char* text, int contact, int inner, uint32_t* out, int max_out) {
+    unsigned char window[3] = {1, 1, 1}; // Start marks
+    uint32_t hash = 2166136261u;
+    int count = 0;
+    
+    for (int i = 0; text[i] != '\0' && count < max_out; i++) {
+        unsigned char c = (unsigned char)tolower((unsigned char)text[i]);
+        if (contact) {
+            if (i == SEARCH_CONTACT_PREFIX) {
+                break;
+            }
+            hash = (hash ^ c) * 16777619u;
+            out[count++] = SEARCH_GRAM_CONTACT | (hash & ~SEARCH_GRAM_CONTACT);
+            continue;
+        }
+        window[0] = window[1];
+        window[1] = window[2];
+        window[2] = c;
+        if (!inner || i >= SEARCH_MIN_SUBSTRING - 1) {
+            out[count++] = (uint32_t)window[0] << 16 | (uint32_t)window[1] << 8 | window[2];
+        }
+    }
+    return count;
+}
+
+/**
+ * Finds the list of a gram, adding an empty one if asked to
+ * Returns: Index into postings, or -1 if the gram has no list (or on
+ * allocation failure when adding)
+ */
+static int patient_gram_list(PatientIndex* index, uint32_t gram, int add) {
+    if (index->table_capacity > 0) {
+        unsigned int mask = (unsigned int)index->table_capacity - 1;
+        for (unsigned int i = (gram * 2654435761u) & mask;; i = (i + 1) & mask) {
+            if (index->keys[i] == gram) {
+                return index->lists[i];
+            }
+            if (index->keys[i] == 0) {
+                break;
+            }
+        }
+    }
+    if (!add) {
+        return -1;
+    }
+    
+    // Keep the table at most half full
+    if (2 * (index->gram_count + 1) > index->table_capacity) {
+        int capacity = index->table_capacity > 0 ? index->table_capacity * 2 : 1024;
+        uint32_t* keys = (uint32_t*)calloc((size_t)capacity, sizeof(uint32_t));
+        int* lists = (int*)malloc((size_t)capacity * sizeof(int));
+        if (keys == NULL || lists == NULL) {
+            free(keys);
+            free(lists);
+            return -1;
+        }
+        for (int i = 0; i < index->table_capacity; i++) {
+            if (index->keys[i] != 0) {
+                unsigned int j = (index->keys[i] * 2654435761u) & (unsigned int)(capacity - 1);
+                while (keys[j] != 0) {
+                    j = (j + 1) & (unsigned int)(capacity - 1);
+                }
+                keys[j] = index->keys[i];
+                lists[j] = index->lists[i];
+            }
+        }
+        free(index->keys);
+        free(index->lists);
+        index->keys = keys;
+        index->lists = lists;
+        index->table_capacity = capacity;
+    }
+    if (index->gram_count == index->posting_capacity) {
+        int capacity = index->posting_capacity > 0 ? index->posting_capacity * 2 : 1024;
+        PatientPostings* postings = (PatientPostings*)realloc(index->postings, capacity * sizeof(PatientPostings));
+        if (postings == NULL) {
+            return -1;
+        }
+        index->postings = postings;
+        index->posting_capacity = capacity;
+    }
+    
+    unsigned int mask = (unsigned int)index->table_capacity - 1;
+    unsigned int i = (gram * 2654435761u) & mask;
+    while (index->keys[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    index->keys[i] = gram;
+    index->lists[i] = index->gram_count;
+    memset(&index->postings[index->gram_count], 0, sizeof(PatientPostings));
+    return index->gram_count++;
+}
+
+/**
+ * Adds a booking to the lists of every gram of its patient name and
+ * contact. Bookings must be added in slot order.
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int patient_index_append(BAPESSS_System* system, int booking_slot) {
+    PatientIndex* index = &system->patients;
+    const BookingRecord* record = booking_at(system, booking_slot);
+    uint32_t grams[SEARCH_MAX_GRAMS];
+    int count = search_grams(booking_str(system, record->patient_name), 0, 0, grams, SEARCH_MAX_GRAMS);
+    count += search_grams(booking_str(system, record->patient_contact), 1, 0, grams + count,
+                          SEARCH_MAX_GRAMS - count);
+    
+    for (int i = 0; i < count; i++) {
+        int list = patient_gram_list(index, grams[i], 1);
+        if (list == -1) {
+            return -1;
+        }
+        PatientPostings* postings = &index->postings[list];
+        if (postings->count > 0 && postings->slots[postings->count - 1] == booking_slot) {
+            continue; // Gram seen earlier in the same name
+        }
+        if (postings->count == postings->capacity) {
+            int capacity = postings->capacity > 0 ? postings->capacity * 2 : 4;
+            int32_t* slots = (int32_t*)realloc(postings->slots, capacity * sizeof(int32_t));
+            if (slots == NULL) {
+                return -1;
+            }
+            postings->slots = slots;
+            postings->capacity = capacity;
+        }
+        postings->slots[postings->count++] = booking_slot;
+        index->entries++;
+    }
+    return 0;
+}
+
+/**
+ * Fills the index from every booking the first time a search needs it
+ * after the bookings were replaced; from then on append_booking keeps it
+ * up to date. Kept off the load path, so a snapshot still opens at once.
+ * Returns: 0 on success, -1 on allocation failure
+ */
+int patient_index_build(BAPESSS_System* system) {
+    PatientIndex* index = &system->patients;
+    if (index->built) {
+        return 0;
+    }
+    patient_index_free(index);
+    for (int i = 0; i < system->booking_count; i++) {
+        if (patient_index_append(system, i) != 0) {
+            patient_index_free(index);
+            return -1;
+        }
+    }
+    index->built = 1;
+    return 0;
+}
+
+/**
+ * Records a booking that was just added, if the index has been built
+ */
+void patient_index_add(BAPESSS_System* system, int booking_slot) {
+    if (system->patients.built && patient_index_append(system, booking_slot) != 0) {
+        patient_index_free(&system->patients); // Rebuilt in full by the next search
+    }
+}
+
+/**
+ * Returns: 1 if a stored name or contact matches the search text,
+ * ignoring case
+ */
+static int search_matches(const char* value, const char* text, SearchMode mode) {
+    size_t length = strlen(text);
+    size_t last = mode == SEARCH_NAME ? strlen(value) : 0;
+    
+    for (size_t start = 0; start <= last; start++) {
+        size_t i = 0;
+        while (i < length && value[start + i] != '\0' &&
+               tolower((unsigned char)value[start + i]) == tolower((unsigned char)text[i])) {
+            i++;
+        }
+        if (i == length) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns: Number of entries of slots[0 .. end) not above target. The
+ * search gallops down from end, since the answer is usually near it.
+ */
+static int postings_upto(const int32_t* slots, int end, int32_t target) {
+    int low = end - 1, high = end, step = 1;
+    while (low >= 0 && slots[low] > target) {
+        high = low;
+        low -= step;
+        step *= 2;
+    }
+    low = low < 0 ? 0 : low + 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (slots[mid] <= target) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Finds bookings by patient: names containing or starting with the text,
+ * or contacts starting with it, ignoring case. The grams of the text are
+ * looked up and their lists intersected, newest booking first; each
+ * booking in all lists is then checked against its text.
+ * SEARCH_NAME needs at least SEARCH_MIN_SUBSTRING characters and the
+ * prefix searches one; shorter text matches nothing. Builds the index on
+ * the first search after a load; once it is built, only reads the system
+ * (the server builds it first under the exclusive lock, see server_search).
+ * Returns: Number of bookings found, most recent first (at most max_out),
+ * or -1 on allocation failure
+ */
+int search_patients(BAPESSS_System* system, SearchMode mode, const char* text, int* out_slots, int max_out) {
+    PatientIndex* index = &system->patients;
+    if (strlen(text) < (mode == SEARCH_NAME ? SEARCH_MIN_SUBSTRING : 1) || max_out <= 0) {
+        return 0;
+    }
+    if (patient_index_build(system) != 0) {
+        return -1;
+    }
+    
+    uint32_t grams[SEARCH_MAX_GRAMS];
+    int count = search_grams(text, mode == SEARCH_CONTACT, mode == SEARCH_NAME, grams, SEARCH_MAX_GRAMS);
+    if (mode == SEARCH_CONTACT) {
+        grams[0] = grams[count - 1]; // Hash of the text, or of its indexed prefix
+        count = 1;
+    } else if (text[count + (mode == SEARCH_NAME ? SEARCH_MIN_SUBSTRING - 1 : 0)] != '\0') {
+        return 0; // Longer than any name stored
+    }
+    
+    // Lists of the grams, shortest first, each with the end of its unread part
+    const PatientPostings* lists[SEARCH_MAX_GRAMS];
+    int ends[SEARCH_MAX_GRAMS];
+    for (int i = 0; i < count; i++) {
+        int list = patient_gram_list(index, grams[i], 0);
+        if (list == -1) {
+            return 0;
+        }
+        const PatientPostings* postings = &index->postings[list];
+        int j = i;
+        while (j > 0 && lists[j - 1]->count > postings->count) {
+            lists[j] = lists[j - 1];
+            ends[j] = ends[j - 1];
+            j--;
+        }
+        lists[j] = postings;
+        ends[j] = postings->count;
+    }
+    
+    // Leapfrog down the lists: each one in turn lowers the candidate to
+    // its newest booking not above it, until every list holds it
+    int found = 0;
+    int32_t target = INT32_MAX;
+    while (found < max_out) {
+        for (int i = 0, agreed = 0; agreed < count; i = (i + 1) % count) {
+            ends[i] = postings_upto(lists[i]->slots, ends[i], target);
+            if (ends[i] == 0) {
+                return found;
+            }
+            int32_t slot = lists[i]->slots[ends[i] - 1];
+            agreed = slot == target ? agreed + 1 : 1;
+            target = slot;
+        }
+        
+        const BookingRecord* record = booking_at(system, target);
+        StrRef value = mode == SEARCH_CONTACT ? record->patient_contact : record->patient_name;
+        if (search_matches(booking_str(system, value), text, mode)) {
+            out_slots[found++] = target;
+        }
+        target--;
+    }
+    return found;
+}
+
+// =============================================
+// LISTINGS
+// =============================================
+
+/**
+ * Initializes an empty set
+ */
+void active_init(ActiveBookings* active) {
+    memset(active, 0, sizeof(ActiveBookings));
+}
+
+/**
+ * Frees the set and leaves it empty and unbuilt
+ */
+void active_free(ActiveBookings* active) {
+    free(active->slots);
+    active_init(active);
+}
+
+/**
+ * Returns: Index of the first open booking at or after a slot
+ */
+static int active_position(const ActiveBookings* active, int slot) {
+    int low = 0, high = active->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (active->slots[mid] < slot) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Adds a booking that became open, keeping slot order. New bookings
+ * have the highest slot and go on the end.
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int active_insert(ActiveBookings* active, int slot) {
+    if (active->count == active->capacity) {
+        int capacity = active->capacity > 0 ? active->capacity * 2 : 64;
+        int* slots = (int*)realloc(active->slots, capacity * sizeof(int));
+        if (slots == NULL) {
+            return -1;
+        }
+        active->slots = slots;
+        active->capacity = capacity;
+    }
+    int position = active_position(active, slot);
+    memmove(&active->slots[position + 1], &active->slots[position], (active->count - position) * sizeof(int));
+    active->slots[position] = slot;
+    active->count++;
+    return 0;
+}
+
+/**
+ * Fills the set from every open booking the first time a listing needs
+ * it after the bookings were replaced; from then on every status change
+ * keeps it up to date
+ * Returns: 0 on success, -1 on allocation failure
+ */
+int active_build(BAPESSS_System* system) {
+    ActiveBookings* active = &system->active;
+    if (active->built) {
+        return 0;
+    }
+    active_free(active);
+    for (int i = 0; i < system->booking_count; i++) {
+        if (booking_at(system, i)->status <= 2 && active_insert(active, i) != 0) {
+            active_free(active);
+            return -1;
+        }
+    }
+    active->built = 1;
+    return 0;
+}
+
+/**
+ * Moves a booking in or out of the set after its status changed (or it
+ * was added, with was_open 0), if the set has been built
+ */
+void active_track(BAPESSS_System* system, int booking_slot, int was_open) {
+    ActiveBookings* active = &system->active;
+    int is_open = booking_at(system, booking_slot)->status <= 2;
+    if (!active->built || is_open == was_open) {
+        return;
+    }
+    if (is_open) {
+        if (active_insert(active, booking_slot) != 0) {
+            active_free(active); // Rebuilt in full by the next listing
+        }
+        return;
+    }
+    int position = active_position(active, booking_slot);
+    if (position < active->count && active->slots[position] == booking_slot) {
+        active->count--;
+        memmove(&active->slots[position], &active->slots[position + 1], (active->count - position) * sizeof(int));
+    }
+}
+
+/**
+ * Returns: 1 if a booking passes a listing filter
+ */
+static int booking_listed(const BookingRecord* record, const BookingFilter* filter) {
+    if (filter->status == LIST_ACTIVE ? record->status > 2 :
+        (filter->status != LIST_ANY && record->status != filter->status)) {
+        return 0;
+    }
+    return (filter->level == 0 || record->emergency_level == filter->level) &&
+           record->booking_time >= filter->from && record->booking_time < filter->to;
+}
+
+/**
+ * Returns: First slot whose booking time is at or after from, among the
+ * leading bookings that are in time order (bookings are appended as
+ * they come in, so normally all of them). The ordered prefix is
+ * extended over bookings added since the last call.
+ */
+static int first_booking_since(BAPESSS_System* system, int64_t from) {
+    int ordered = system->time_ordered > 0 ? system->time_ordered : (system->booking_count > 0);
+    while (ordered < system->booking_count &&
+           booking_at(system, ordered)->booking_time >= booking_at(system, ordered - 1)->booking_time) {
+        ordered++;
+    }
+    system->time_ordered = ordered;
+    
+    int low = 0, high = ordered;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (booking_at(system, mid)->booking_time < from) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/**
+ * Lists the bookings passing a filter in booking order, starting after a
+ * slot (-1 to start at the first). Listings of open bookings only read
+ * the set of open ones, so they cost nothing for the closed history, and
+ * listings of a recent time window start at the window instead of the
+ * first booking. Other listings match status and level with the filter
+ * kernel over the booking columns. A full page may be followed by more:
+ * the next one starts after the last slot returned.
+ * Returns: Number of slots written (at most max_out), or -1 on
+ * allocation failure
+ */
+int list_bookings(BAPESSS_System* system, const BookingFilter* filter, int after_slot, int* out_slots, int max_out) {
+    int found = 0;
+    if (filter->status == LIST_ACTIVE || (filter->status >= 0 && filter->status <= 2)) {
+        if (active_build(system) != 0) {
+            return -1;
+        }
+        const ActiveBookings* active = &system->active;
+        for (int i = active_position(active, after_slot + 1); i < active->count && found < max_out; i++) {
+            if (booking_listed(booking_at(system, active->slots[i]), filter)) {
+                out_slots[found++] = active->slots[i];
+            }
+        }
+        return found;
+    }
+    
+    int start = after_slot + 1;
+    if (filter->from != INT64_MIN) {
+        int first = first_booking_since(system, filter->from);
+        start = first > start ? first : start;
+    }
+    
+    // Status and level are matched in the columns; candidates are checked in full
+    if (booking_columns_build(system) == 0) {
+        int want_status = filter->status >= 0 ? filter->status : -1;
+        int want_level = filter->level > 0 ? filter->level : -1;
+        int candidates[LIST_MAX_PAGE];
+        while (start < system->booking_count && found < max_out) {
+            int batch = max_out - found < LIST_MAX_PAGE ? max_out - found : LIST_MAX_PAGE;
+            int matched = filter_bytes(system->columns.status, system->columns.level, start, system->booking_count,
+                                       want_status, want_level, candidates, batch, &start);
+            for (int i = 0; i < matched; i++) {
+                if (booking_listed(booking_at(system, candidates[i]), filter)) {
+                    out_slots[found++] = candidates[i];
+                }
+            }
+        }
+        return found;
+    }
+    
+    for (int slot = start; slot < system->booking_count && found < max_out; slot++) {
+        if (booking_listed(booking_at(system, slot), filter)) {
+            out_slots[found++] = slot;
+        }
+    }
+    return found;
+}
+
+/**
+ * Lists the ambulances passing a filter in fleet order, starting after a
+ * slot (-1 to start at the first), reading the status and type columns.
+ * Statuses are read atomically, since claims may be made alongside.
+ * Returns: Number of slots written (at most max_out)
+ */
+int list_ambulances(BAPESSS_System* system, const AmbulanceFilter* filter, int after_slot, int* out_slots,
+                    int max_out) {
+    int found = 0;
+    for (int slot = after_slot + 1; slot < system->ambulance_count && found < max_out; slot++) {
+        int status = __atomic_load_n(&system->amb_status[slot], __ATOMIC_RELAXED);
+        if ((filter->status == LIST_ANY || status == filter->status) &&
+            (filter->type == 0 || system->amb_type[slot] == filter->type)) {
+            out_slots[found++] = slot;
+        }
+    }
+    return found;
+}
+
+/**
+ * Starts an empty buffer that writes to out
+ */
+void text_init(TextBuffer* text, FILE* out) {
+    text->out = out;
+    text->used = 0;
+}
+
+/**
+ * Formats text onto the end of the buffer, writing the buffer out first
+ * if it would not fit. Text longer than the buffer is cut short.
+ */
+void text_printf(TextBuffer* text, const char* format, ...) {
+    va_list args;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_start(args, format);
+        int length = vsnprintf(text->data + text->used, TEXT_BUFFER_SIZE - text->used, format, args);
+        va_end(args);
+        if (length < 0) {
+            return;
+        }
+        if ((size_t)length < TEXT_BUFFER_SIZE - text->used) {
+            text->used += (size_t)length;
+            return;
+        }
+        if (attempt == 0 && text->used > 0) {
+            text_flush(text); // Retry on an empty buffer
+        } else {
+            text->used = TEXT_BUFFER_SIZE - 1;
+        }
+    }
+}
+
+/**
+ * Writes out everything in the buffer with one write
+ */
+void text_flush(TextBuffer* text) {
+    if (text->used > 0) {
+        fwrite(text->data, 1, text->used, text->out);
+        fflush(text->out);
+        text->used = 0;
+    }
+}
+
+// =============================================
+// REPORT AND DATA PERSISTENCE
+// =============================================
+
+/**
+ * Generates a system report
+ */
+void generate_report(BAPESSS_System* system) {
+    printf("\n=== SYSTEM REPORT ===\n");
+    printf("Generated on: ");
+    char time_buffer[50];
+    get_current_time(time_buffer, sizeof(time_buffer));
+    printf("%s\n\n", time_buffer);
+    
+    printf("Fleet Summary:\n");
+    printf("Total Ambulances: %d\n", system->ambulance_count);
+    
+#ifdef BAPESSS_DEBUG
+    // Debug builds check the running counters against a full recount
+    if (!counters_verify(system)) {
+        printf("Warning: report counters were out of sync!\n");
+    }
+#endif
+    
+    // Counters are kept up to date at every state change
+    const ReportCounters* counters = &system->counters;
+    int available = counters->ambulance_status[0];
+    int booked = counters->ambulance_status[1];
+    int on_trip = counters->ambulance_status[2];
+    int maintenance = counters->ambulance_status[3];
+    int basic = counters->ambulance_type[1];
+    int advanced = counters->ambulance_type[2];
+    int icu = counters->ambulance_type[3];
+    
+    printf("  Available: %d\n", available);
+    printf("  Booked: %d\n", booked);
+    printf("  On Trip: %d\n", on_trip);
+    printf("  Maintenance: %d\n", maintenance);
+    
+    printf("\nAmbulance Types:\n");
+    printf("  Basic: %d\n", basic);
+    printf("  Advanced: %d\n", advanced);
+    printf("  Mobile ICU: %d\n", icu);
+    
+    printf("\nBooking Summary:\n");
+    printf("Total Bookings: %d\n", system->booking_count);
+    
+    int pending = counters->booking_status[0];
+    int confirmed = counters->booking_status[1];
+    int dispatched = counters->booking_status[2];
+    int completed = counters->booking_status[3];
+    int cancelled = counters->booking_status[4];
+    int normal = counters->booking_level[1];
+    int urgent = counters->booking_level[2];
+    int critical = counters->booking_level[3];
+    
+    printf("  Pending: %d\n", pending);
+    printf("  Confirmed: %d\n", confirmed);
+    printf("  Dispatched: %d\n", dispatched);
+    printf("  Completed: %d\n", completed);
+    printf("  Cancelled: %d\n", cancelled);
+    
+    printf("\nEmergency Levels:\n");
+    printf("  Normal: %d\n", normal);
+    printf("  Urgent: %d\n", urgent);
+    printf("  Critical: %d\n", critical);
+    
+    printf("\nUtilization Rate: %.1f%%\n", 
+           system->ambulance_count > 0 ? 
+           (float)(booked + on_trip) / system->ambulance_count * 100 : 0);
+    
+    // Time-window figures come from the trip archive rather than the counters
+    if (archive_build(system) == 0) {
+        TripFilter filter = {current_epoch() - 24 * 3600, INT64_MAX, 0, 0, 0};
+        TripStats day, critical;
+        archive_query(&system->archive, &filter, &day);
+        filter.level = 3;
+        archive_query(&system->archive, &filter, &critical);
+        
+        printf("\nLast 24 Hours (calls since closed):\n");
+        printf("  Closed: %ld (%ld picked up)\n", day.trips, day.answered);
+        printf("  Critical: %ld (%ld picked up)\n", critical.trips, critical.answered);
+        if (day.answered > 0) {
+            int mean = (int)(day.mean_response + 0.5);
+            printf("  Average Response: %d min %d s (longest %d min)\n",
+                   mean / 60, mean % 60, day.max_response / 60);
+        }
+    }
+}
+
+/**
+ * Saves system data to files
+ */
+void save_data(BAPESSS_System* system) {
+    int result = write_data_files(system);
+    if (result < 0) {
+        printf("Error writing %s! The previous save was kept.\n", SNAPSHOT_FILE);
+        return;
+    }
+    if (result > 0) {
+        printf("Saving in the background; you can keep working.\n");
+        return;
+    }
+    printf("Data saved successfully!\n");
+}
+
+/**
+ * Loads system data from files
+ */
+void load_data(BAPESSS_System* system) {
+    int result = read_data_files(system);
+    if (result == -2) {
+        printf("Error: %s is truncated, corrupt or from another version; nothing was loaded!\n",
+               SNAPSHOT_FILE);
+        return;
+    }
+    if (result == -3) {
+        printf("Error: %s could not be replayed; the data shown is incomplete and not saved!\n", JOURNAL_FILE);
+        return;
+    }
+    if (result != 0) {
+        printf("No saved data found or error opening files!\n");
+        return;
+    }
+    printf("Data loaded successfully!\n");
+    printf("Ambulances: %d, Bookings: %d\n", system->ambulance_count, system->booking_count);
+}
+
+/**
+ * Saves the fleet and bookings as a snapshot and restarts the journal on
+ * top of it. This is also how the journal is compacted. While journaling
+ * the snapshot is written in the background; otherwise it is written
+ * here and a new journal is started.
+ * Returns: 1 if a background save was started, 0 if the snapshot was
+ * written, -1 if it could not be
+ */
+int write_data_files(BAPESSS_System* system) {
+    snapshot_poll(system, 1); // One snapshot at a time
+    if (system->journal != NULL && !system->journal->failed) {
+        return snapshot_start_background(system, SNAPSHOT_FILE);
+    }
+    
+    uint64_t lsn = 0;
+    if (system->journal != NULL) {
+        journal_commit(system, 1);
+        lsn = system->journal->next_lsn - 1;
+    }
+    if (save_snapshot(system, SNAPSHOT_FILE, lsn) != 0) {
+        return -1;
+    }
+    // The snapshot holds everything now; a failed restart only stops journaling
+    journal_start(system, JOURNAL_FILE, lsn);
+    return 0;
+}
+
+/**
+ * Replaces the fleet and bookings with the saved data: the snapshot plus
+ * the journal written since, or the older ambulances.dat and bookings.dat
+ * (converted to a snapshot so later changes can be journaled)
+ * Returns: 0 on success, -1 if nothing could be opened, -2 if the
+ * snapshot is damaged, -3 if the journal holds a change that could not
+ * be replayed (the state is then incomplete and nothing is journaled)
+ */
+int read_data_files(BAPESSS_System* system) {
+    // Stop journaling while the state is replaced; resume if nothing was loaded
+    snapshot_poll(system, 1);
+    journal_commit(system, 1);
+    Journal* journal = system->journal;
+    system->journal = NULL;
+    
+    uint64_t lsn = 0;
+    int result = load_snapshot(system, SNAPSHOT_FILE, &lsn);
+    int from_snapshot = result == 0;
+    if (result == -1) {
+        result = read_legacy_files(system);
+    }
+    system->journal = journal;
+    if (result != 0) {
+        return result;
+    }
+    
+    journal_close(system);
+    if (from_snapshot) {
+        if (journal_recover(system, JOURNAL_FILE, lsn) == -2) {
+            return -3;
+        }
+    } else {
+        write_data_files(system);
+    }
+    return 0;
+}
+
+/**
+ * Replaces the fleet and bookings with the contents of ambulances.dat and
+ * bookings.dat, the format written before snapshots
+ * Returns: 0 on success, -1 if the files could not be opened
+ */
+int read_legacy_files(BAPESSS_System* system) {
+    FILE *amb_file = fopen("ambulances.dat", "rb");
+    FILE *book_file = fopen("bookings.dat", "rb");
+    
+    if (!amb_file || !book_file) {
+        if (amb_file) fclose(amb_file);
+        if (book_file) fclose(book_file);
+        return -1;
+    }
+    
+    // Free existing data
+    clear_fleet(system);
+    clear_bookings(system);
+    
+    // Load ambulances, splitting each record into the fleet columns
+    int ambulance_total = 0;
+    fread(&ambulance_total, sizeof(int), 1, amb_file);
+    Ambulance ambulance;
+    for (int i = 0; i < ambulance_total && fread(&ambulance, sizeof(Ambulance), 1, amb_file) == 1; i++) {
+        if (append_ambulance(system, &ambulance) == -1) {
+            printf("Error: Memory allocation failed!\n");
+            break;
+        }
+    }
+    
+    // Load bookings into freshly allocated chunks
+    int booking_total = 0;
+    fread(&booking_total, sizeof(int), 1, book_file);
+    Booking record;
+    for (int i = 0; i < booking_total && fread(&record, sizeof(Booking), 1, book_file) == 1; i++) {
+        if (append_booking(system, &record) == -1) {
+            printf("Error: Memory allocation failed!\n");
+            break;
+        }
+    }
+    
+    fclose(amb_file);
+    fclose(book_file);
+    
+    rebuild_indexes(system);
+    return 0;
+}
+
+// =============================================
+// SNAPSHOT FILES
+// =============================================
+
+// Running checksum over a byte stream that may arrive in pieces of any size
+typedef struct {
+    uint64_t hash;
+    uint64_t length;           // Bytes seen so far
+    unsigned char carry[8];    // Bytes of an unfinished 8-byte word
+    int carry_bytes;
+} Checksum;
+
+// Sequential snapshot writer that checksums each section as it goes
+typedef struct {
+    FILE* file;
+    uint64_t offset;           // Bytes written so far
+    uint64_t synced;           // Offset at the last fsync
+    Checksum sum;              // Checksum of the current section
+    int failed;                // Set by the first failed write
+} SnapshotWriter;
+
+/**
+ * Starts an empty checksum
+ */
+static void checksum_init(Checksum* sum) {
+    sum->hash = 14695981039346656037ULL;
+    sum->length = 0;
+    sum->carry_bytes = 0;
+}
+
+/**
+ * Mixes one 8-byte word into the checksum (FNV-1a over words). Each step
+ * is a bijection, so any single changed word changes the result.
+ */
+static void checksum_word(Checksum* sum, const unsigned char* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    sum->hash = (sum->hash ^ word) * 1099511628211ULL;
+}
+
+/**
+ * Adds bytes to the checksum. Splitting the input differently gives the
+ * same result.
+ */
+static void checksum_update(Checksum* sum, const void* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    sum->length += length;
+    
+    // Complete a word left over from the previous piece
+    while (sum->carry_bytes > 0 && length > 0) {
+        sum->carry[sum->carry_bytes++] = *bytes++;
+        length--;
+        if (sum->carry_bytes == 8) {
+            checksum_word(sum, sum->carry);
+            sum->carry_bytes = 0;
+        }
+    }
+    for (; length >= 8; bytes += 8, length -= 8) {
+        checksum_word(sum, bytes);
+    }
+    while (length > 0) {
+        sum->carry[sum->carry_bytes++] = *bytes++;
+        length--;
+    }
+}
+
+/**
+ * Returns: Checksum of all bytes added
+ */
+static uint64_t checksum_final(Checksum* sum) {
+    if (sum->carry_bytes > 0) {
+        memset(sum->carry + sum->carry_bytes, 0, 8 - sum->carry_bytes);
+        checksum_word(sum, sum->carry);
+        sum->carry_bytes = 0;
+    }
+    return (sum->hash ^ sum->length) * 1099511628211ULL;
+}
+
+/**
+ * Returns: Checksum of one contiguous block
+ */
+static uint64_t checksum_block(const void* data, size_t length) {
+    Checksum sum;
+    checksum_init(&sum);
+    checksum_update(&sum, data, length);
+    return checksum_final(&sum);
+}
+
+/**
+ * Appends bytes to the snapshot file and the current section checksum
+ */
+static void snapshot_write(SnapshotWriter* writer, const void* data, size_t length) {
+    if (writer->failed || length == 0) {
+        return;
+    }
+    if (fwrite(data, 1, length, writer->file) != length) {
+        writer->failed = 1;
+        return;
+    }
+    checksum_update(&writer->sum, data, length);
+    writer->offset += length;
+    
+    // Sync as we go: one fsync of the whole file at the end would queue
+    // journal commits behind hundreds of megabytes of writeback
+    if (writer->offset - writer->synced >= SNAPSHOT_SYNC_BYTES) {
+        writer->synced = writer->offset;
+#ifndef _WIN32
+        if (fflush(writer->file) != 0 || fsync(fileno(writer->file)) != 0) {
+            writer->failed = 1;
+        }
+#endif
+    }
+}
+
+/**
+ * Pads the file to the next aligned offset and starts a section there
+ */
+static void snapshot_begin_section(SnapshotWriter* writer, SnapshotSection* section,
+                                   uint32_t id, uint32_t record_size) {
+    static const unsigned char zeros[SNAPSHOT_ALIGNMENT] = {0};
+    snapshot_write(writer, zeros, (SNAPSHOT_ALIGNMENT - writer->offset % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT);
+    
+    checksum_init(&writer->sum);
+    section->id = id;
+    section->record_size = record_size;
+    section->offset = writer->offset;
+}
+
+/**
+ * Records the length and checksum of the section just written
+ */
+static void snapshot_end_section(SnapshotWriter* writer, SnapshotSection* section) {
+    section->length = writer->offset - section->offset;
+    section->checksum = checksum_final(&writer->sum);
+}
+
+/**
+ * Writes a section holding one array
+ */
+static void snapshot_write_array(SnapshotWriter* writer, SnapshotSection* section, uint32_t id,
+                                 uint32_t record_size, const void* data, size_t count) {
+    snapshot_begin_section(writer, section, id, record_size);
+    snapshot_write(writer, data, count * record_size);
+    snapshot_end_section(writer, section);
+}
+
+/**
+ * Writes the whole system state to a snapshot. The data goes to a
+ * temporary file that replaces the old snapshot only once it is complete,
+ * so a failed save never damages the previous one.
+ * Returns: 0 on success, -1 on any write error
+ */
+int save_snapshot(BAPESSS_System* system, const char* path, uint64_t journal_lsn) {
+    char temp_path[512];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    
+    SnapshotWriter writer;
+    memset(&writer, 0, sizeof(SnapshotWriter));
+    writer.file = fopen(temp_path, "wb");
+    if (writer.file == NULL) {
+        return -1;
+    }
+    
+    // Header and section table are filled in once the sections are written
+    SnapshotHeader header;
+    SnapshotSection sections[SECTION_COUNT];
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memset(sections, 0, sizeof(sections));
+    snapshot_write(&writer, &header, sizeof(SnapshotHeader));
+    snapshot_write(&writer, sections, sizeof(sections));
+    
+    int n = system->ambulance_count;
+    SnapshotSection* section = sections;
+    snapshot_write_array(&writer, section++, SECTION_AMB_STATUS, sizeof(unsigned char), system->amb_status, n);
+    snapshot_write_array(&writer, section++, SECTION_AMB_TYPE, sizeof(unsigned char), system->amb_type, n);
+    snapshot_write_array(&writer, section++, SECTION_AMB_X, sizeof(float), system->amb_x, n);
+    snapshot_write_array(&writer, section++, SECTION_AMB_Y, sizeof(float), system->amb_y, n);
+    snapshot_write_array(&writer, section++, SECTION_AMB_DETAILS, sizeof(AmbulanceDetails), system->amb_details, n);
+    
+    // Bookings are written chunk by chunk as one contiguous array
+    snapshot_begin_section(&writer, section, SECTION_BOOKINGS, sizeof(BookingRecord));
+    for (int first = 0; first < system->booking_count; first += BOOKING_CHUNK_SIZE) {
+        int count = system->booking_count - first;
+        if (count > BOOKING_CHUNK_SIZE) count = BOOKING_CHUNK_SIZE;
+        snapshot_write(&writer, booking_at(system, first), count * sizeof(BookingRecord));
+    }
+    snapshot_end_section(&writer, section++);
+    
+    // Mapped and heap strings join up so handles stay valid
+    snapshot_begin_section(&writer, section, SECTION_STRINGS, sizeof(char));
+    snapshot_write(&writer, system->strings.mapped, system->strings.mapped_size);
+    snapshot_write(&writer, system->strings.data, system->strings.size);
+    snapshot_end_section(&writer, section++);
+    
+    snapshot_write_array(&writer, section++, SECTION_INTERN, sizeof(StrRef),
+                         system->interned.refs, system->interned.capacity);
+    snapshot_write_array(&writer, section++, SECTION_BOOKING_KEYS, sizeof(int),
+                         system->booking_index.keys, system->booking_index.capacity);
+    snapshot_write_array(&writer, section++, SECTION_BOOKING_SLOTS, sizeof(int),
+                         system->booking_index.slots, system->booking_index.capacity);
+    
+    // Queues in FIFO order, leaving out bookings cancelled while queued
+    int32_t queued[EMERGENCY_LEVELS + 1];
+    for (int level = 0; level <= EMERGENCY_LEVELS; level++) {
+        PendingQueue* queue = &system->pending[level];
+        queued[level] = 0;
+        for (int i = 0; i < queue->count; i++) {
+            int slot = queue->slots[(queue->head + i) & (queue->capacity - 1)];
+            queued[level] += booking_at(system, slot)->status == 0;
+        }
+    }
+    snapshot_begin_section(&writer, section, SECTION_PENDING, sizeof(int32_t));
+    snapshot_write(&writer, queued, sizeof(queued));
+    for (int level = 0; level <= EMERGENCY_LEVELS; level++) {
+        PendingQueue* queue = &system->pending[level];
+        for (int i = 0; i < queue->count; i++) {
+            int32_t slot = queue->slots[(queue->head + i) & (queue->capacity - 1)];
+            if (booking_at(system, slot)->status == 0) {
+                snapshot_write(&writer, &slot, sizeof(slot));
+            }
+        }
+    }
+    snapshot_end_section(&writer, section++);
+    
+    snapshot_write_array(&writer, section++, SECTION_COUNTERS, sizeof(ReportCounters), &system->counters, 1);
+    
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.header_size = sizeof(SnapshotHeader);
+    header.section_count = SECTION_COUNT;
+    header.file_size = writer.offset;
+    header.ambulance_count = system->ambulance_count;
+    header.booking_count = system->booking_count;
+    header.booking_index_count = system->booking_index.count;
+    header.intern_count = system->interned.count;
+    header.journal_lsn = journal_lsn;
+    
+    Checksum sum;
+    checksum_init(&sum);
+    checksum_update(&sum, &header, sizeof(SnapshotHeader));
+    checksum_update(&sum, sections, sizeof(sections));
+    header.table_checksum = checksum_final(&sum);
+    
+    if (!writer.failed && fseek(writer.file, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(SnapshotHeader), 1, writer.file) == 1 &&
+        fwrite(sections, sizeof(sections), 1, writer.file) == 1 &&
+        fflush(writer.file) == 0) {
+#ifndef _WIN32
+        writer.failed = fsync(fileno(writer.file)) != 0;
+#endif
+    } else {
+        writer.failed = 1;
+    }
+    
+    if (fclose(writer.file) != 0 || writer.failed) {
+        remove(temp_path);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(path); // rename does not replace an existing file here
+#endif
+    if (rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Makes a snapshot file's contents addressable. On POSIX systems the
+ * file is mapped privately, so pages are read on first use and writes to
+ * loaded records stay in memory. Elsewhere the file is read into memory.
+ * Returns: 0 on success, -1 if the file cannot be opened, -2 if it is empty
+ */
+static int snapshot_map(const char* path, SnapshotMapping* mapping) {
+    mapping->base = NULL;
+    mapping->size = 0;
+    
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    _fseeki64(file, 0, SEEK_END);
+    long long size = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(file);
+        return -2;
+    }
+    unsigned char* data = (unsigned char*)malloc((size_t)size);
+    if (data == NULL || fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        fclose(file);
+        return -2;
+    }
+    fclose(file);
+    mapping->base = data;
+    mapping->size = (size_t)size;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return -2;
+    }
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -2;
+    }
+    mapping->base = (unsigned char*)data;
+    mapping->size = (size_t)info.st_size;
+#endif
+    return 0;
+}
+
+/**
+ * Releases a snapshot mapping, if any
+ */
+void snapshot_unmap(SnapshotMapping* mapping) {
+    if (mapping->base == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    free(mapping->base);
+#else
+    munmap(mapping->base, mapping->size);
+#endif
+    mapping->base = NULL;
+    mapping->size = 0;
+}
+
+/**
+ * Returns: 1 if value is zero or a power of two
+ */
+static int is_power_of_two(uint64_t value) {
+    return (value & (value - 1)) == 0;
+}
+
+/**
+ * Returns: 1 for sections that grow with the booking history
+ */
+static int is_history_section(uint32_t id) {
+    return id == SECTION_BOOKINGS || id == SECTION_STRINGS ||
+           id == SECTION_BOOKING_KEYS || id == SECTION_BOOKING_SLOTS;
+}
+
+/**
+ * Checks a mapped snapshot before anything is loaded from it: header,
+ * byte order, version, file size (truncation), section bounds, alignment,
+ * record layouts and checksums. Reading every page of a multi-GB history
+ * would defeat loading it in place, so the history sections' checksums
+ * are only compared when full_check is set.
+ * Fills by_id with the section of each ID.
+ * Returns: 1 if the snapshot can be used, 0 otherwise
+ */
+static int snapshot_validate(const SnapshotMapping* mapping, const SnapshotSection** by_id, int full_check) {
+    if (mapping->size < sizeof(SnapshotHeader)) {
+        return 0;
+    }
+    
+    SnapshotHeader header;
+    memcpy(&header, mapping->base, sizeof(SnapshotHeader));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.byte_order != SNAPSHOT_BYTE_ORDER || header.version != SNAPSHOT_VERSION ||
+        header.header_size != sizeof(SnapshotHeader) || header.file_size != mapping->size ||
+        header.section_count > SNAPSHOT_MAX_SECTIONS ||
+        sizeof(SnapshotHeader) + header.section_count * sizeof(SnapshotSection) > mapping->size ||
+        header.ambulance_count < 0 || header.booking_count < 0 ||
+        header.booking_index_count < 0 || header.intern_count < 0) {
+        return 0;
+    }
+    
+    const SnapshotSection* table = (const SnapshotSection*)(mapping->base + sizeof(SnapshotHeader));
+    Checksum sum;
+    checksum_init(&sum);
+    header.table_checksum = 0;
+    checksum_update(&sum, &header, sizeof(SnapshotHeader));
+    checksum_update(&sum, table, header.section_count * sizeof(SnapshotSection));
+    if (checksum_final(&sum) != ((const SnapshotHeader*)mapping->base)->table_checksum) {
+        return 0;
+    }
+    
+    // Expected element size and count of each section (-1: any count)
+    uint64_t ambulances = (uint64_t)header.ambulance_count;
+    struct { uint32_t record_size; int64_t count; } expected[SECTION_COUNT + 1] = {
+        {0, 0},
+        {sizeof(unsigned char), (int64_t)ambulances},
+        {sizeof(unsigned char), (int64_t)ambulances},
+        {sizeof(float), (int64_t)ambulances},
+        {sizeof(float), (int64_t)ambulances},
+        {sizeof(AmbulanceDetails), (int64_t)ambulances},
+        {sizeof(BookingRecord), header.booking_count},
+        {sizeof(char), -1},
+        {sizeof(StrRef), -1},
+        {sizeof(int), -1},
+        {sizeof(int), -1},
+        {sizeof(int32_t), -1},
+        {sizeof(ReportCounters), 1},
+    };
+    
+    for (int id = 0; id <= SECTION_COUNT; id++) {
+        by_id[id] = NULL;
+    }
+    for (uint32_t i = 0; i < header.section_count; i++) {
+        const SnapshotSection* section = &table[i];
+        if (section->id < 1 || section->id > SECTION_COUNT || by_id[section->id] != NULL ||
+            section->record_size != expected[section->id].record_size ||
+            section->offset % SNAPSHOT_ALIGNMENT != 0 || section->offset > mapping->size ||
+            section->length > mapping->size - section->offset ||
+            section->length % section->record_size != 0 ||
+            (expected[section->id].count >= 0 &&
+             section->length != (uint64_t)expected[section->id].count * section->record_size) ||
+            ((full_check || !is_history_section(section->id)) &&
+             checksum_block(mapping->base + section->offset, section->length) != section->checksum)) {
+            return 0;
+        }
+        by_id[section->id] = section;
+    }
+    for (int id = 1; id <= SECTION_COUNT; id++) {
+        if (by_id[id] == NULL) {
+            return 0;
+        }
+    }
+    
+    // Structural checks on the variable-length sections
+    const SnapshotSection* strings = by_id[SECTION_STRINGS];
+    uint64_t intern_capacity = by_id[SECTION_INTERN]->length / sizeof(StrRef);
+    uint64_t index_capacity = by_id[SECTION_BOOKING_KEYS]->length / sizeof(int);
+    if (strings->length == 0 || strings->length > UINT32_MAX ||
+        mapping->base[strings->offset] != '\0' ||
+        mapping->base[strings->offset + strings->length - 1] != '\0' ||
+        !is_power_of_two(intern_capacity) || intern_capacity > INT_MAX ||
+        (uint64_t)header.intern_count > intern_capacity / 2 ||
+        !is_power_of_two(index_capacity) || index_capacity > INT_MAX ||
+        by_id[SECTION_BOOKING_SLOTS]->length != by_id[SECTION_BOOKING_KEYS]->length ||
+        (uint64_t)header.booking_index_count > index_capacity / 2) {
+        return 0;
+    }
+    
+    const SnapshotSection* pending = by_id[SECTION_PENDING];
+    const int32_t* queued = (const int32_t*)(mapping->base + pending->offset);
+    uint64_t entries = pending->length / sizeof(int32_t);
+    uint64_t total = EMERGENCY_LEVELS + 1;
+    if (entries < total) {
+        return 0;
+    }
+    for (int level = 0; level <= EMERGENCY_LEVELS; level++) {
+        if (queued[level] < 0) {
+            return 0;
+        }
+        total += (uint64_t)queued[level];
+    }
+    if (total != entries) {
+        return 0;
+    }
+    for (uint64_t i = EMERGENCY_LEVELS + 1; i < entries; i++) {
+        if (queued[i] < 0 || queued[i] >= header.booking_count) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Verifies every checksum of a snapshot file without loading it
+ * Returns: 0 if the file is intact, -1 if it cannot be opened, -2 if it
+ * is damaged
+ */
+int check_snapshot(const char* path) {
+    SnapshotMapping mapping;
+    int result = snapshot_map(path, &mapping);
+    if (result != 0) {
+        return result;
+    }
+    
+    const SnapshotSection* by_id[SECTION_COUNT + 1];
+    result = snapshot_validate(&mapping, by_id, 1) ? 0 : -2;
+    snapshot_unmap(&mapping);
+    return result;
+}
+
+/**
+ * Replaces the fleet and bookings with a snapshot and reports the last
+ * journal record it includes. Bookings, their
+ * strings and the booking ID index are used straight from the file
+ * instead of being copied, so loading takes the same short time however
+ * long the history is. Only the fleet, the intern table, the last
+ * partly filled booking chunk and the queues are copied.
+ * Returns: 0 on success, -1 if the file cannot be opened or memory runs
+ * out, -2 if it is truncated, corrupt or from another version. Nothing
+ * is changed unless 0 is returned.
+ */
+int load_snapshot(BAPESSS_System* system, const char* path, uint64_t* out_journal_lsn) {
+    SnapshotMapping mapping;
+    int result = snapshot_map(path, &mapping);
+    if (result != 0) {
+        return result;
+    }
+    
+    const SnapshotSection* by_id[SECTION_COUNT + 1];
+    if (!snapshot_validate(&mapping, by_id, 0)) {
+        snapshot_unmap(&mapping);
+        return -2;
+    }
+    const SnapshotHeader* header = (const SnapshotHeader*)mapping.base;
+    
+    // Full booking chunks are used in place; the last one is copied so it can
+    // grow. Allocate it and the chunk directory before dropping current data.
+    int booking_count = header->booking_count;
+    int full_chunks = booking_count >> BOOKING_CHUNK_SHIFT;
+    int total_chunks = (booking_count + BOOKING_CHUNK_SIZE - 1) >> BOOKING_CHUNK_SHIFT;
+    BookingRecord* last_chunk = NULL;
+    if (total_chunks > full_chunks) {
+        last_chunk = (BookingRecord*)malloc(BOOKING_CHUNK_SIZE * sizeof(BookingRecord));
+    }
+    if (total_chunks > system->chunk_capacity) {
+        BookingRecord** chunks = (BookingRecord**)realloc(system->booking_chunks,
+                                                          total_chunks * sizeof(BookingRecord*));
+        if (chunks != NULL) {
+            system->booking_chunks = chunks;
+            system->chunk_capacity = total_chunks;
+        }
+    }
+    if ((total_chunks > full_chunks && last_chunk == NULL) || total_chunks > system->chunk_capacity) {
+        printf("Error: Memory allocation failed!\n");
+        free(last_chunk);
+        snapshot_unmap(&mapping);
+        return -1;
+    }
+    
+    // Free existing data; bookings first so the fleet reset has none to scan
+    clear_bookings(system);
+    clear_fleet(system);
+    
+    // Fleet: small, copied into the columns
+    const unsigned char* status = mapping.base + by_id[SECTION_AMB_STATUS]->offset;
+    const unsigned char* type = mapping.base + by_id[SECTION_AMB_TYPE]->offset;
+    const float* xs = (const float*)(mapping.base + by_id[SECTION_AMB_X]->offset);
+    const float* ys = (const float*)(mapping.base + by_id[SECTION_AMB_Y]->offset);
+    const AmbulanceDetails* details = (const AmbulanceDetails*)(mapping.base + by_id[SECTION_AMB_DETAILS]->offset);
+    for (int i = 0; i < header->ambulance_count; i++) {
+        Ambulance ambulance;
+        memset(&ambulance, 0, sizeof(Ambulance));
+        ambulance.ambulance_id = details[i].ambulance_id;
+        memcpy(ambulance.vehicle_number, details[i].vehicle_number, sizeof(ambulance.vehicle_number));
+        memcpy(ambulance.driver_name, details[i].driver_name, sizeof(ambulance.driver_name));
+        memcpy(ambulance.driver_contact, details[i].driver_contact, sizeof(ambulance.driver_contact));
+        ambulance.type = type[i];
+        ambulance.status = status[i];
+        ambulance.location_x = xs[i];
+        ambulance.location_y = ys[i];
+        if (append_ambulance(system, &ambulance) == -1) {
+            printf("Error: Memory allocation failed!\n");
+            break;
+        }
+    }
+    
+    // Bookings
+    BookingRecord* records = (BookingRecord*)(mapping.base + by_id[SECTION_BOOKINGS]->offset);
+    for (int c = 0; c < full_chunks; c++) {
+        system->booking_chunks[c] = records + ((size_t)c << BOOKING_CHUNK_SHIFT);
+    }
+    if (last_chunk != NULL) {
+        memcpy(last_chunk, records + ((size_t)full_chunks << BOOKING_CHUNK_SHIFT),
+               (booking_count - (full_chunks << BOOKING_CHUNK_SHIFT)) * sizeof(BookingRecord));
+        system->booking_chunks[full_chunks] = last_chunk;
+    }
+    system->chunk_count = total_chunks;
+    system->mapped_chunks = full_chunks;
+    system->booking_capacity = total_chunks << BOOKING_CHUNK_SHIFT;
+    system->booking_count = booking_count;
+    booking_columns_free(&system->columns); // Built empty by the fleet reset above
+    
+    // Strings are read in place; new ones go to the heap part of the arena
+    system->strings.mapped = (const char*)(mapping.base + by_id[SECTION_STRINGS]->offset);
+    system->strings.mapped_size = (uint32_t)by_id[SECTION_STRINGS]->length;
+    system->strings.size = 0;
+    
+    // The intern table is small and gets written to, so it is copied
+    InternTable* interned = &system->interned;
+    int intern_capacity = (int)(by_id[SECTION_INTERN]->length / sizeof(StrRef));
+    if (intern_capacity > interned->capacity) {
+        StrRef* refs = (StrRef*)realloc(interned->refs, intern_capacity * sizeof(StrRef));
+        if (refs == NULL) {
+            intern_capacity = 0;
+        } else {
+            interned->refs = refs;
+            interned->capacity = intern_capacity;
+        }
+    }
+    if (intern_capacity > 0) {
+        memcpy(interned->refs, mapping.base + by_id[SECTION_INTERN]->offset, intern_capacity * sizeof(StrRef));
+        for (int i = intern_capacity; i < interned->capacity; i++) {
+            interned->refs[i] = 0;
+        }
+        // A larger existing table would need rehashing; use the saved size
+        interned->capacity = intern_capacity;
+        interned->count = header->intern_count;
+    }
+    
+    // The booking ID index is used in place until it has to grow
+    IdIndex* index = &system->booking_index;
+    id_index_free(index);
+    index->keys = (int*)(mapping.base + by_id[SECTION_BOOKING_KEYS]->offset);
+    index->slots = (int*)(mapping.base + by_id[SECTION_BOOKING_SLOTS]->offset);
+    index->capacity = (int)(by_id[SECTION_BOOKING_KEYS]->length / sizeof(int));
+    index->count = header->booking_index_count;
+    index->mapped = 1;
+    if (index->capacity == 0) {
+        id_index_init(index);
+    }
+    
+    // Queues keep their saved order
+    const int32_t* queued = (const int32_t*)(mapping.base + by_id[SECTION_PENDING]->offset);
+    const int32_t* slots = queued + EMERGENCY_LEVELS + 1;
+    for (int level = 0; level <= EMERGENCY_LEVELS; level++) {
+        for (int i = 0; i < queued[level]; i++, slots++) {
+            if (*slots < system->booking_count) {
+                pending_push(system, *slots);
+            }
+        }
+    }
+    
+    memcpy(&system->counters, mapping.base + by_id[SECTION_COUNTERS]->offset, sizeof(ReportCounters));
+    if (out_journal_lsn != NULL) {
+        *out_journal_lsn = header->journal_lsn;
+    }
+    system->snapshot = mapping;
+    return 0;
+}
+
+// =============================================
+// JOURNAL
+// =============================================
+
+/**
+ * Creates the in-memory side of a journal whose file is open for appending
+ * Returns: The journal, or NULL on allocation failure (the file is closed)
+ */
+static Journal* journal_new(FILE* file, const char* path, uint64_t next_lsn, uint64_t file_size) {
+    Journal* journal = (Journal*)calloc(1, sizeof(Journal));
+    unsigned char* buffer = (unsigned char*)malloc(JOURNAL_BUFFER_SIZE);
+    if (journal == NULL || buffer == NULL) {
+        free(journal);
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    journal->file = file;
+    snprintf(journal->path, sizeof(journal->path), "%s", path);
+    journal->buffer = buffer;
+    journal->capacity = JOURNAL_BUFFER_SIZE;
+    journal->next_lsn = next_lsn;
+    journal->durable_lsn = next_lsn - 1;
+    journal->file_size = file_size;
+    return journal;
+}
+
+/**
+ * Forces written data to disk
+ * Returns: 0 on success, -1 on error
+ */
+static int sync_file(FILE* file) {
+    if (fflush(file) != 0) {
+        return -1;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file));
+#else
+    return fsync(fileno(file));
+#endif
+}
+
+/**
+ * Cuts a file down to a given size
+ * Returns: 0 on success, -1 on error
+ */
+static int truncate_file(const char* path, uint64_t size) {
+#ifdef _WIN32
+    FILE* file = fopen(path, "r+b");
+    if (file == NULL) {
+        return -1;
+    }
+    int result = _chsize_s(_fileno(file), (long long)size) == 0 ? 0 : -1;
+    fclose(file);
+    return result;
+#else
+    return truncate(path, (off_t)size);
+#endif
+}
+
+/**
+ * Returns: Checksum of a journal file header's fields before the checksum
+ */
+static uint64_t journal_header_checksum(const JournalFileHeader* header) {
+    return checksum_block(header, offsetof(JournalFileHeader, checksum));
+}
+
+/**
+ * Returns: Checksum of a record header (with its checksum field zero)
+ * followed by its payload, given in up to two pieces
+ */
+static uint64_t journal_record_checksum(JournalRecordHeader header, const void* payload, size_t length,
+                                        const void* extra, size_t extra_length) {
+    Checksum sum;
+    header.checksum = 0;
+    checksum_init(&sum);
+    checksum_update(&sum, &header, sizeof(JournalRecordHeader));
+    checksum_update(&sum, payload, length);
+    checksum_update(&sum, extra, extra_length);
+    return checksum_final(&sum);
+}
+
+/**
+ * Hands the buffered records to the file
+ */
+static void journal_write_buffer(Journal* journal) {
+    if (journal->used > 0 && !journal->failed &&
+        fwrite(journal->buffer, 1, journal->used, journal->file) != journal->used) {
+        journal->failed = 1;
+    }
+    journal->used = 0;
+}
+
+/**
+ * Writes the header of a journal whose first record follows base_lsn
+ * Returns: 0 on success, -1 on a write error
+ */
+static int journal_write_header(FILE* file, uint64_t base_lsn) {
+    JournalFileHeader header;
+    memset(&header, 0, sizeof(JournalFileHeader));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.base_lsn = base_lsn;
+    header.checksum = journal_header_checksum(&header);
+    return fwrite(&header, sizeof(JournalFileHeader), 1, file) == 1 ? 0 : -1;
+}
+
+/**
+ * Starts a new, empty journal on top of the snapshot with the given LSN
+ * and starts logging to it. The file is replaced atomically, so a crash
+ * leaves either the old journal or the new one.
+ * Returns: 0 on success, -1 if the journal could not be created
+ */
+int journal_start(BAPESSS_System* system, const char* path, uint64_t base_lsn) {
+    journal_close(system);
+    
+    char temp_path[512];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    
+    int failed = journal_write_header(file, base_lsn) != 0 || sync_file(file) != 0;
+    if (fclose(file) != 0 || failed) {
+        remove(temp_path);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(path); // rename does not replace an existing file here
+#endif
+    if (rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return -1;
+    }
+    
+    file = fopen(path, "ab");
+    if (file == NULL) {
+        return -1;
+    }
+    system->journal = journal_new(file, path, base_lsn + 1, sizeof(JournalFileHeader));
+    return system->journal != NULL ? 0 : -1;
+}
+
+/**
+ * Restarts the journal on top of a snapshot that holds every record up
+ * to base_lsn, keeping the records from byte keep_from on (those logged
+ * after the snapshot was taken). The old journal stays in place until the
+ * new one replaces it, so a crash at any point loses nothing.
+ * Returns: 0 on success, -1 if the journal was left as it was
+ */
+int journal_rebase(BAPESSS_System* system, uint64_t base_lsn, uint64_t keep_from) {
+    Journal* journal = system->journal;
+    if (journal == NULL || journal_commit(system, 1) != 0) {
+        return -1;
+    }
+    
+    char temp_path[512];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", journal->path);
+    FILE* in = fopen(journal->path, "rb");
+    FILE* out = fopen(temp_path, "wb");
+    int failed = in == NULL || out == NULL || fseek(in, (long)keep_from, SEEK_SET) != 0 ||
+                 journal_write_header(out, base_lsn) != 0;
+    
+    // The buffer is empty after the commit; copy through it
+    uint64_t size = sizeof(JournalFileHeader);
+    while (!failed) {
+        size_t count = fread(journal->buffer, 1, journal->capacity, in);
+        if (count == 0) {
+            failed = ferror(in);
+            break;
+        }
+        failed = fwrite(journal->buffer, 1, count, out) != count;
+        size += count;
+    }
+    failed = failed || sync_file(out) != 0;
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (out != NULL && fclose(out) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        remove(temp_path);
+        return -1;
+    }
+    
+    // Closed first so the rename also works where open files cannot be replaced
+    fclose(journal->file);
+#ifdef _WIN32
+    remove(journal->path);
+#endif
+    int renamed = rename(temp_path, journal->path) == 0;
+    journal->file = fopen(journal->path, "ab");
+    if (journal->file == NULL) {
+        free(journal->buffer);
+        free(journal);
+        system->journal = NULL;
+        return -1;
+    }
+    if (!renamed) {
+        remove(temp_path);
+        return -1;
+    }
+    journal->file_size = size;
+    return 0;
+}
+
+/**
+ * Applies one journal record to the system. Records hold the effects of
+ * a change (which ambulance went where), not the request, so replay does
+ * not depend on the dispatch rules in force when it runs.
+ * Returns: 1 on success, 0 if the record is malformed or does not fit
+ * the current state
+ */
+static int journal_apply(BAPESSS_System* system, uint32_t type, const unsigned char* payload, uint32_t length) {
+    if (type == JOURNAL_ADD_BOOKING) {
+        JournalNewBooking logged;
+        if (length < sizeof(JournalNewBooking) + 4 || payload[length - 1] != '\0') {
+            return 0;
+        }
+        memcpy(&logged, payload, sizeof(JournalNewBooking));
+        
+        Booking booking;
+        memset(&booking, 0, sizeof(Booking));
+        char* fields[4] = {booking.patient_name, booking.patient_contact, booking.pickup_location, booking.hospital};
+        size_t sizes[4] = {sizeof(booking.patient_name), sizeof(booking.patient_contact),
+                           sizeof(booking.pickup_location), sizeof(booking.hospital)};
+        const char* text = (const char*)payload + sizeof(JournalNewBooking);
+        const char* end = (const char*)payload + length;
+        for (int i = 0; i < 4; i++) {
+            if (text >= end) {
+                return 0;
+            }
+            snprintf(fields[i], sizes[i], "%s", text);
+            text += strlen(text) + 1;
+        }
+        booking.booking_id = logged.booking_id;
+        booking.emergency_level = logged.emergency_level;
+        
+        int slot = append_booking(system, &booking);
+        if (slot == -1) {
+            return 0;
+        }
+        booking_at(system, slot)->booking_time = logged.booking_time;
+        if (logged.queued) {
+            pending_push(system, slot);
+        }
+        return 1;
+    }
+    
+    if (type == JOURNAL_ADD_AMBULANCE) {
+        Ambulance ambulance;
+        if (length != sizeof(Ambulance)) {
+            return 0;
+        }
+        memcpy(&ambulance, payload, sizeof(Ambulance));
+        return append_ambulance(system, &ambulance) != -1;
+    }
+    
+    JournalChange change;
+    if (length != sizeof(JournalChange)) {
+        return 0;
+    }
+    memcpy(&change, payload, sizeof(JournalChange));
+    int slot = find_booking_slot(system, change.booking_id);
+    if (slot == -1) {
+        return 0;
+    }
+    
+    switch (type) {
+        case JOURNAL_ASSIGN: {
+            int ambulance_slot = find_ambulance_slot(system, change.value);
+            if (ambulance_slot == -1) {
+                return 0;
+            }
+            assign_ambulance(system, slot, ambulance_slot);
+            return 1;
+        }
+        case JOURNAL_STATUS:
+            set_booking_status(system, slot, change.value);
+            if (change.time != 0) {
+                booking_at(system, slot)->pickup_time = change.time;
+            }
+            return 1;
+        case JOURNAL_CLOSE:
+            // The ambulance is only freed; if it went to a waiting call, an ASSIGN follows
+            release_booking(system, slot, change.value);
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Replays the journal written on top of a snapshot that was just loaded,
+ * then keeps logging to it. Records the snapshot already holds are
+ * skipped. Replay stops at the first torn, damaged or out-of-sequence
+ * record, and the file is cut there so new records follow the last good
+ * one. A journal that does not belong to the snapshot is replaced.
+ * An intact record that cannot be applied (out of memory, or not
+ * fitting the state) stops replay without touching the file, since the
+ * records after it are still good.
+ * Returns: Number of records replayed, -1 if journaling could not resume,
+ * or -2 if a record could not be applied (the journal is left as it is
+ * and journaling stays off)
+ */
+int journal_recover(BAPESSS_System* system, const char* path, uint64_t snapshot_lsn) {
+    journal_close(system);
+    
+    FILE* file = fopen(path, "rb");
+    JournalFileHeader header;
+    if (file == NULL || fread(&header, sizeof(JournalFileHeader), 1, file) != 1 ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != JOURNAL_VERSION || header.byte_order != SNAPSHOT_BYTE_ORDER ||
+        header.checksum != journal_header_checksum(&header) || header.base_lsn > snapshot_lsn) {
+        if (file != NULL) {
+            fclose(file);
+            printf("Warning: %s does not match the snapshot and was replaced.\n", path);
+        }
+        return journal_start(system, path, snapshot_lsn);
+    }
+    
+    unsigned char* payload = (unsigned char*)malloc(JOURNAL_MAX_RECORD);
+    if (payload == NULL) {
+        fclose(file);
+        return -1;
+    }
+    
+    uint64_t last_lsn = header.base_lsn;
+    uint64_t valid_end = sizeof(JournalFileHeader);
+    int replayed = 0, failed = 0;
+    JournalRecordHeader record;
+    while (fread(&record, sizeof(JournalRecordHeader), 1, file) == 1) {
+        if (record.lsn != last_lsn + 1 || record.length > JOURNAL_MAX_RECORD ||
+            fread(payload, 1, record.length, file) != record.length ||
+            journal_record_checksum(record, payload, record.length, NULL, 0) != record.checksum) {
+            break;
+        }
+        if (record.lsn > snapshot_lsn) {
+            if (!journal_apply(system, record.type, payload, record.length)) {
+                failed = 1;
+                break;
+            }
+            replayed++;
+        }
+        last_lsn = record.lsn;
+        valid_end += sizeof(JournalRecordHeader) + record.length;
+    }
+    free(payload);
+    fclose(file);
+    if (failed) {
+        printf("Error: change %llu in %s could not be replayed; the journal was left as it is.\n",
+               (unsigned long long)(last_lsn + 1), path);
+        return -2;
+    }
+    
+    // A journal ending before the snapshot was already folded into it
+    if (last_lsn < snapshot_lsn) {
+        return journal_start(system, path, snapshot_lsn) == 0 ? 0 : -1;
+    }
+    
+    if (truncate_file(path, valid_end) != 0 || (file = fopen(path, "ab")) == NULL) {
+        return -1;
+    }
+    system->journal = journal_new(file, path, last_lsn + 1, valid_end);
+    if (system->journal == NULL) {
+        return -1;
+    }
+    system->journal->replayed = replayed;
+    return replayed;
+}
+
+/**
+ * Makes every logged change durable and stops journaling
+ */
+void journal_close(BAPESSS_System* system) {
+    Journal* journal = system->journal;
+    if (journal == NULL) {
+        return;
+    }
+    journal_commit(system, 1);
+    fclose(journal->file);
+    free(journal->buffer);
+    free(journal);
+    system->journal = NULL;
+}
+
+/**
+ * Logs one change. The record is buffered and becomes durable at the
+ * next journal_commit that syncs. Does nothing when not journaling.
+ */
+void journal_append(BAPESSS_System* system, uint32_t type, const void* payload, size_t length,
+                    const void* extra, size_t extra_length) {
+    Journal* journal = system->journal;
+    if (journal == NULL) {
+        return;
+    }
+    
+    JournalRecordHeader header;
+    header.type = type;
+    header.length = (uint32_t)(length + extra_length);
+    header.lsn = journal->next_lsn;
+    header.checksum = journal_record_checksum(header, payload, length, extra, extra_length);
+    
+    size_t total = sizeof(JournalRecordHeader) + header.length;
+    if (journal->used + total > journal->capacity) {
+        journal_write_buffer(journal);
+    }
+    memcpy(journal->buffer + journal->used, &header, sizeof(JournalRecordHeader));
+    memcpy(journal->buffer + journal->used + sizeof(JournalRecordHeader), payload, length);
+    if (extra_length > 0) {
+        memcpy(journal->buffer + journal->used + sizeof(JournalRecordHeader) + length, extra, extra_length);
+    }
+    journal->used += total;
+    journal->file_size += total;
+    journal->next_lsn++;
+    if (journal->unsynced++ == 0) {
+        journal->oldest_unsynced = monotonic_seconds();
+    }
+}
+
+/**
+ * Logs a change to a booking
+ */
+void journal_change(BAPESSS_System* system, uint32_t type, int booking_id, int value, int64_t time) {
+    if (system->journal != NULL) {
+        JournalChange change = {time, booking_id, value};
+        journal_append(system, type, &change, sizeof(JournalChange), NULL, 0);
+    }
+}
+
+/**
+ * Group commit: writes and fsyncs the logged records once enough of them
+ * have built up or the oldest has waited long enough, so one fsync covers
+ * many changes. force syncs whatever is pending.
+ * Returns: 0 on success (or nothing to do), -1 if the journal could not be written
+ */
+int journal_commit(BAPESSS_System* system, int force) {
+    Journal* journal = system->journal;
+    if (journal == NULL) {
+        return 0;
+    }
+    if (journal->unsynced == 0) {
+        return journal->failed ? -1 : 0;
+    }
+    if (!force && journal->unsynced < JOURNAL_GROUP_RECORDS &&
+        monotonic_seconds() - journal->oldest_unsynced < JOURNAL_GROUP_DELAY) {
+        return 0;
+    }
+    
+    int failed_before = journal->failed;
+    journal_write_buffer(journal);
+    if (!journal->failed && sync_file(journal->file) != 0) {
+        journal->failed = 1;
+    }
+    journal->syncs++;
+    journal->unsynced = 0;
+    if (journal->failed) {
+        if (!failed_before) {
+            printf("Error: Could not write the journal; recent changes may not survive a crash!\n");
+        }
+        return -1;
+    }
+    journal->durable_lsn = journal->next_lsn - 1;
+    return 0;
+}
+
+/**
+ * Folds the journal into a new snapshot once it has grown large, unless
+ * one is already being written
+ * Returns: 1 if a snapshot was started or written, 0 otherwise
+ */
+int compact_if_needed(BAPESSS_System* system) {
+    if (system->journal == NULL || system->journal->file_size < JOURNAL_COMPACT_BYTES ||
+        system->saving.pid != 0) {
+        return 0;
+    }
+    return write_data_files(system) >= 0;
+}
+
+// =============================================
+// BACKGROUND SNAPSHOTS
+// =============================================
+
+/**
+ * Writes a snapshot of the current state from a forked child, so
+ * dispatch carries on while it is written: the child sees the memory as
+ * it was at the fork and the kernel copies pages only as the parent
+ * changes them. The child publishes the file by rename. The journal is
+ * left alone until snapshot_poll sees the child succeed. Where fork is
+ * not available the snapshot is written here instead.
+ * Returns: 1 if the child was started, 0 if the snapshot was written
+ * here, -1 on failure
+ */
+int snapshot_start_background(BAPESSS_System* system, const char* path) {
+    Journal* journal = system->journal;
+    if (journal == NULL || system->saving.pid != 0 || journal_commit(system, 1) != 0) {
+        return -1;
+    }
+    uint64_t lsn = journal->next_lsn - 1;
+    
+#ifndef _WIN32
+    fflush(stdout); // Output still buffered would otherwise belong to both processes
+    pid_t pid = fork();
+    if (pid == 0) {
+        // _exit skips atexit handlers and stdio flushes that belong to the parent
+        _exit(save_snapshot(system, path, lsn) == 0 ? 0 : 1);
+    }
+    if (pid > 0) {
+        system->saving.pid = (long)pid;
+        system->saving.lsn = lsn;
+        system->saving.journal_offset = journal->file_size;
+        system->saving.started = monotonic_seconds();
+        return 1;
+    }
+#endif
+    
+    if (save_snapshot(system, path, lsn) != 0) {
+        return -1;
+    }
+    journal_rebase(system, lsn, journal->file_size);
+    return 0;
+}
+
+/**
+ * Checks on the background snapshot. When it has been written, the
+ * records it holds are dropped from the journal. wait blocks until the
+ * child has finished.
+ * Returns: 1 if it finished successfully, -1 if it failed, 0 if none is
+ * running or it is still being written
+ */
+int snapshot_poll(BAPESSS_System* system, int wait) {
+    if (system->saving.pid == 0) {
+        return 0;
+    }
+#ifndef _WIN32
+    int status = 0;
+    pid_t done;
+    do {
+        done = waitpid((pid_t)system->saving.pid, &status, wait ? 0 : WNOHANG);
+    } while (done == -1 && errno == EINTR);
+    if (done == 0) {
+        return 0;
+    }
+    system->saving.pid = 0;
+    if (done == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    // The old journal stays valid if this fails; it is only longer than needed
+    journal_rebase(system, system->saving.lsn, system->saving.journal_offset);
+    return 1;
+#else
+    (void)wait;
+    system->saving.pid = 0;
+    return 0;
+#endif
+}
+
+// =============================================
+// BATCH MODE
+// =============================================
+
+#define BATCH_MAX_FIELDS 8           // Fields per command line, including the command
+#define BATCH_MAX_LINE 1024          // Longest accepted command line
+#define BATCH_MAX_NEAREST 32         // Largest k accepted by the nearest command
+
+/**
+ * Splits a command line on '|' in place, dropping the line ending
+ * Returns: Number of fields
+ */
+static int split_fields(char* line, char** fields, int max_fields) {
+    int count = 0;
+    char* field = line;
+    
+    line[strcspn(line, "\r\n")] = '\0';
+    while (count < max_fields) {
+        fields[count++] = field;
+        char* bar = strchr(field, '|');
+        if (bar == NULL) {
+            break;
+        }
+        *bar = '\0';
+        field = bar + 1;
+    }
+    return count;
+}
+
+/**
+ * Parses a whole field as an integer
+ * Returns: 1 on success, 0 if the field is not a number
+ */
+static int parse_int_field(const char* field, int* out) {
+    char* end;
+    long value = strtol(field, &end, 10);
+    if (end == field || *end != '\0' || value < INT_MIN || value > INT_MAX) {
+        return 0;
+    }
+    *out = (int)value;
+    return 1;
+}
+
+/**
+ * Parses a listing status field: "all", "active" where allowed, or a
+ * status number below limit
+ * Returns: 1 on success, 0 if the field is not a status
+ */
+static int parse_list_status(const char* field, int limit, int allow_active, int* out) {
+    if (strcmp(field, "all") == 0) {
+        *out = LIST_ANY;
+        return 1;
+    }
+    if (allow_active && strcmp(field, "active") == 0) {
+        *out = LIST_ACTIVE;
+        return 1;
+    }
+    return parse_int_field(field, out) && *out >= 0 && *out < limit;
+}
+
+/**
+ * Parses a whole field as a float
+ * Returns: 1 on success, 0 if the field is not a number
+ */
+static int parse_float_field(const char* field, float* out) {
+    char* end;
+    float value = strtof(field, &end);
+    if (end == field || *end != '\0') {
+        return 0;
+    }
+    *out = value;
+    return 1;
+}
+
+/**
+ * Copies a field into a fixed-size buffer, truncating if needed
+ */
+static void copy_field(char* dest, size_t size, const char* field) {
+    snprintf(dest, size, "%s", field);
+}
+
+/**
+ * Returns: 1 if the command name of a line (length characters) is name
+ */
+static int command_is(const char* line, size_t length, const char* name) {
+    return strlen(name) == length && strncmp(line, name, length) == 0;
+}
+
+/**
+ * Parses the fields of a call|name|contact|pickup|hospital|level|x|y line
+ * Returns: 1 on success, 0 if the line is not a well-formed call
+ */
+static int parse_call(char** fields, int count, DispatchCall* call) {
+    Booking* request = &call->request;
+    
+    if (count != 8 || strcmp(fields[0], "call") != 0 ||
+        !parse_int_field(fields[5], &request->emergency_level) ||
+        !parse_float_field(fields[6], &call->loc_x) || !parse_float_field(fields[7], &call->loc_y)) {
+        return 0;
+    }
+    copy_field(request->patient_name, sizeof(request->patient_name), fields[1]);
+    copy_field(request->patient_contact, sizeof(request->patient_contact), fields[2]);
+    copy_field(request->pickup_location, sizeof(request->pickup_location), fields[3]);
+    copy_field(request->hospital, sizeof(request->hospital), fields[4]);
+    return 1;
+}
+
+/**
+ * Writes the result line of one call of a batch dispatch
+ * Returns: Length of the line (truncated to fit size)
+ */
+static int format_call_reply(char* buffer, size_t size, const DispatchCall* call, int booked) {
+    int length;
+    if (!booked) {
+        length = snprintf(buffer, size, "error call %s\n", op_result_name(OP_NO_MEMORY));
+    } else {
+        length = snprintf(buffer, size, "ok call id=%d status=%d ambulance=%d distance=%.2f\n",
+                          call->request.booking_id, call->request.status,
+                          call->request.ambulance_id, call->distance);
+    }
+    return length < (int)size ? length : (int)size - 1;
+}
+
+/**
+ * Parses the fields of a pos|ambulance_id|x|y line
+ * Returns: 1 on success, 0 if the line is not a well-formed position report
+ *          with finite coordinates
+ */
+static int parse_position(char** fields, int count, PositionUpdate* update) {
+    return count == 4 && strcmp(fields[0], "pos") == 0 &&
+           parse_int_field(fields[1], &update->ambulance_id) &&
+           parse_float_field(fields[2], &update->loc_x) && parse_float_field(fields[3], &update->loc_y) &&
+           isfinite(update->loc_x) && isfinite(update->loc_y);
+}
+
+/**
+ * Writes the result line of one applied position report
+ * Returns: Length of the line
+ */
+static int format_position_reply(char* buffer, size_t size, const PositionUpdate* update) {
+    int length;
+    if (!update->applied) {
+        length = snprintf(buffer, size, "error pos %s\n", op_result_name(OP_NOT_FOUND));
+    } else {
+        length = snprintf(buffer, size, "ok pos id=%d\n", update->ambulance_id);
+    }
+    return length < (int)size ? length : (int)size - 1;
+}
+
+/**
+ * Applies the position reports collected by run_batch together and
+ * writes their result lines in order
+ * Returns: Number of reports that failed
+ */
+static int flush_positions(BAPESSS_System* system, PositionUpdate* updates, int count, FILE* out) {
+    char reply[64];
+    int applied = apply_positions(system, updates, count);
+    for (int i = 0; i < count; i++) {
+        format_position_reply(reply, sizeof(reply), &updates[i]);
+        fputs(reply, out);
+    }
+    return count - applied;
+}
+
+/**
+ * Dispatches the calls collected by run_batch together and writes their
+ * result lines in order
+ * Returns: Number of calls that failed
+ */
+static int flush_calls(BAPESSS_System* system, DispatchCall* calls, int count, FILE* out) {
+    char reply[128];
+    int booked = dispatch_batch(system, calls, count);
+    for (int i = 0; i < count; i++) {
+        format_call_reply(reply, sizeof(reply), &calls[i], calls[i].request.booking_id != 0);
+        fputs(reply, out);
+    }
+    return count - booked;
+}
+
+// A book command between claiming its unit and creating its booking
+typedef struct {
+    Booking request;
+    int located;               // Pickup coordinates were given
+    float loc_x, loc_y;
+    int nearest;               // Nearest qualified unit when located, else -1
+    float seconds;             // Drive time to it, or -1
+    int claimed;               // Unit claimed for the booking, or -1
+} BookCommand;
+
+/**
+ * First half of book: parses the fields and claims a unit, the nearest
+ * qualified one when the pickup is located. Only reads the fleet apart
+ * from the claim itself.
+ * Returns: 1 if the fields were valid, 0 after writing a usage error
+ */
+static int book_claim(BAPESSS_System* system, char** fields, int count, BookCommand* book, FILE* out) {
+    Booking* request = &book->request;
+    book->located = count == 8;
+    if ((count != 6 && count != 8) || !parse_int_field(fields[5], &request->emergency_level) ||
+        (book->located && (!parse_float_field(fields[6], &book->loc_x) ||
+                           !parse_float_field(fields[7], &book->loc_y)))) {
+        fprintf(out, "error book usage\n");
+        return 0;
+    }
+    copy_field(request->patient_name, sizeof(request->patient_name), fields[1]);
+    copy_field(request->patient_contact, sizeof(request->patient_contact), fields[2]);
+    copy_field(request->pickup_location, sizeof(request->pickup_location), fields[3]);
+    copy_field(request->hospital, sizeof(request->hospital), fields[4]);
+    if (request->emergency_level < 1 || request->emergency_level > EMERGENCY_LEVELS) {
+        request->emergency_level = 1;
+    }
+    
+    book->seconds = -1;
+    book->nearest = book->located ? nearest_qualified_ambulance(system, request->emergency_level, book->loc_x,
+                                                                book->loc_y, NULL, &book->seconds) : -1;
+    book->claimed = claim_for_booking(system, request->emergency_level, book->nearest);
+    return 1;
+}
+
+/**
+ * Second half of book: creates the booking for the claimed unit and
+ * writes the result line
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int book_create(BAPESSS_System* system, BookCommand* book, FILE* out) {
+    Booking* request = &book->request;
+    if (create_booking_claimed(system, request, book->claimed) == -1) {
+        fprintf(out, "error book %s\n", op_result_name(OP_NO_MEMORY));
+        return 0;
+    }
+    fprintf(out, "ok book id=%d status=%d ambulance=%d",
+            request->booking_id, request->status, request->ambulance_id);
+    if (book->located && book->claimed != -1) {
+        float dx = book->loc_x - system->amb_x[book->claimed];
+        float dy = book->loc_y - system->amb_y[book->claimed];
+        fprintf(out, " distance=%.2f", sqrtf(dx * dx + dy * dy));
+        if (book->seconds >= 0 && book->claimed == book->nearest) {
+            fprintf(out, " eta=%.0f", book->seconds);
+        }
+    }
+    fputc('\n', out);
+    return 1;
+}
+
+/**
+ * Runs one batch command and writes one result line:
+ *   ok <command> key=value ...
+ *   error <command> <reason>
+ *
+ * Commands (fields separated by '|'):
+ *   book|name|contact|pickup|hospital|level[|x|y]
+ *   call|name|contact|pickup|hospital|level|x|y
+ *   cancel|booking_id
+ *   update|booking_id|status
+ *   add|vehicle|driver|contact|type|x|y
+ *   pos|ambulance_id|x|y
+ *   nearest|x|y[|k]
+ *   find|booking_id
+ *   trips|hours[|level[|status]]
+ *   volume|hours|bucket_minutes[|level]
+ *   search|name|text[|limit]     (also search|prefix|... and search|contact|...)
+ *   bookings[|status[|level[|hours[|after_id[|limit]]]]]   (status all, active or 0-4)
+ *   ambulances[|status[|type[|after_id[|limit]]]]          (status all or 0-3)
+ *   report
+ *   save
+ *   load
+ *   check
+ *   sample
+ * Returns: 1 if the command succeeded, 0 otherwise
+ */
+int execute_command(BAPESSS_System* system, char* line, FILE* out) {
+    char* fields[BATCH_MAX_FIELDS];
+    int count = split_fields(line, fields, BATCH_MAX_FIELDS);
+    const char* command = fields[0];
+    
+    if (strcmp(command, "book") == 0) {
+        BookCommand book;
+        return book_claim(system, fields, count, &book, out) && book_create(system, &book, out);
+    }
+    
+    if (strcmp(command, "call") == 0) {
+        // Normally collected by the caller and dispatched together; alone it is a batch of one
+        DispatchCall call;
+        if (!parse_call(fields, count, &call)) {
+            fprintf(out, "error call usage\n");
+            return 0;
+        }
+        return flush_calls(system, &call, 1, out) == 0;
+    }
+    
+    if (strcmp(command, "cancel") == 0 || strcmp(command, "update") == 0) {
+        int cancel = command[0] == 'c';
+        int booking_id, new_status = 4;
+        if (count != (cancel ? 2 : 3) || !parse_int_field(fields[1], &booking_id) ||
+            (!cancel && !parse_int_field(fields[2], &new_status))) {
+            fprintf(out, "error %s usage\n", command);
+            return 0;
+        }
+        
+        int served;
+        OpResult result = change_booking_status(system, booking_id, new_status, &served);
+        if (result != OP_OK) {
+            fprintf(out, "error %s %s\n", command, op_result_name(result));
+            return 0;
+        }
+        fprintf(out, "ok %s id=%d status=%d", command, booking_id, new_status);
+        if (served != -1) {
+            fprintf(out, " reassigned_booking=%d reassigned_ambulance=%d",
+                    booking_at(system, served)->booking_id, booking_at(system, served)->ambulance_id);
+        }
+        fputc('\n', out);
+        return 1;
+    }
+    
+    if (strcmp(command, "pos") == 0) {
+        PositionUpdate update;
+        if (!parse_position(fields, count, &update)) {
+            fprintf(out, "error pos usage\n");
+            return 0;
+        }
+        char reply[64];
+        apply_positions(system, &update, 1);
+        format_position_reply(reply, sizeof(reply), &update);
+        fputs(reply, out);
+        return update.applied;
+    }
+    
+    if (strcmp(command, "add") == 0) {
+        Ambulance ambulance;
+        memset(&ambulance, 0, sizeof(Ambulance));
+        if (count != 7 || !parse_int_field(fields[4], &ambulance.type) ||
+            !parse_float_field(fields[5], &ambulance.location_x) ||
+            !parse_float_field(fields[6], &ambulance.location_y)) {
+            fprintf(out, "error add usage\n");
+            return 0;
+        }
+        copy_field(ambulance.vehicle_number, sizeof(ambulance.vehicle_number), fields[1]);
+        copy_field(ambulance.driver_name, sizeof(ambulance.driver_name), fields[2]);
+        copy_field(ambulance.driver_contact, sizeof(ambulance.driver_contact), fields[3]);
+        
+        int served;
+        if (register_ambulance(system, &ambulance, &served) == -1) {
+            fprintf(out, "error add %s\n", op_result_name(OP_NO_MEMORY));
+            return 0;
+        }
+        fprintf(out, "ok add id=%d", ambulance.ambulance_id);
+        if (served != -1) {
+            fprintf(out, " assigned_booking=%d", booking_at(system, served)->booking_id);
+        }
+        fputc('\n', out);
+        return 1;
+    }
+    
+    if (strcmp(command, "nearest") == 0) {
+        float loc_x, loc_y;
+        int k = 1;
+        if ((count != 3 && count != 4) || !parse_float_field(fields[1], &loc_x) ||
+            !parse_float_field(fields[2], &loc_y) ||
+            (count == 4 && (!parse_int_field(fields[3], &k) || k < 1 || k > BATCH_MAX_NEAREST))) {
+            fprintf(out, "error nearest usage\n");
+            return 0;
+        }
+        
+        // Ranked by drive time when there is a road network
+        int nearest[BATCH_MAX_NEAREST];
+        float distances[BATCH_MAX_NEAREST];
+        float seconds[BATCH_MAX_NEAREST];
+        int found = rank_by_eta(system, loc_x, loc_y, 0, k, nearest, seconds);
+        int by_road = found > 0;
+        if (by_road) {
+            for (int i = 0; i < found; i++) {
+                float dx = loc_x - system->amb_x[nearest[i]];
+                float dy = loc_y - system->amb_y[nearest[i]];
+                distances[i] = dx * dx + dy * dy;
+            }
+        } else {
+            found = grid_k_nearest(system, loc_x, loc_y, k, nearest, distances);
+        }
+        
+        fprintf(out, "ok nearest count=%d ids=", found);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", system->amb_details[nearest[i]].ambulance_id);
+        }
+        fprintf(out, " distances=");
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%.2f" : "%.2f", sqrt(distances[i]));
+        }
+        if (by_road) {
+            fprintf(out, " etas=");
+            for (int i = 0; i < found; i++) {
+                fprintf(out, i > 0 ? ",%.0f" : "%.0f", seconds[i]);
+            }
+        }
+        fputc('\n', out);
+        return 1;
+    }
+    
+    if (strcmp(command, "find") == 0) {
+        int booking_id;
+        if (count != 2 || !parse_int_field(fields[1], &booking_id)) {
+            fprintf(out, "error find usage\n");
+            return 0;
+        }
+        int slot = find_booking_slot(system, booking_id);
+        if (slot == -1) {
+            fprintf(out, "error find %s\n", op_result_name(OP_NOT_FOUND));
+            return 0;
+        }
+        const BookingRecord* record = booking_at(system, slot);
+        fprintf(out, "ok find id=%d status=%d ambulance=%d level=%d\n",
+                record->booking_id, record->status, record->ambulance_id, record->emergency_level);
+        return 1;
+    }
+    
+    if (strcmp(command, "report") == 0) {
+        const ReportCounters* counters = &system->counters;
+        int claimed = unsettled_claims(system);
+        fprintf(out, "ok report ambulances=%d available=%d booked=%d on_trip=%d maintenance=%d "
+                "basic=%d advanced=%d icu=%d bookings=%d pending=%d confirmed=%d dispatched=%d "
+                "completed=%d cancelled=%d normal=%d urgent=%d critical=%d\n",
+                system->ambulance_count,
+                counters->ambulance_status[0] - claimed, counters->ambulance_status[1] + claimed,
+                counters->ambulance_status[2], counters->ambulance_status[3],
+                counters->ambulance_type[1], counters->ambulance_type[2], counters->ambulance_type[3],
+                system->booking_count,
+                counters->booking_status[0], counters->booking_status[1], counters->booking_status[2],
+                counters->booking_status[3], counters->booking_status[4],
+                counters->booking_level[1], counters->booking_level[2], counters->booking_level[3]);
+        return 1;
+    }
+    
+    if (strcmp(command, "save") == 0) {
+        int result = write_data_files(system);
+        if (result < 0) {
+            fprintf(out, "error save io\n");
+            return 0;
+        }
+        fprintf(out, "ok save ambulances=%d bookings=%d background=%d\n",
+                system->ambulance_count, system->booking_count, result > 0);
+        return 1;
+    }
+    
+    if (strcmp(command, "load") == 0) {
+        int result = read_data_files(system);
+        if (result != 0) {
+            fprintf(out, "error load %s\n", result == -2 ? "corrupt" : (result == -3 ? "journal" : "io"));
+            return 0;
+        }
+        fprintf(out, "ok load ambulances=%d bookings=%d\n", system->ambulance_count, system->booking_count);
+        return 1;
+    }
+    
+    if (strcmp(command, "trips") == 0) {
+        TripFilter filter = {0, INT64_MAX, 0, 0, 0};
+        int hours;
+        if (count < 2 || count > 4 || !parse_int_field(fields[1], &hours) || hours < 1 ||
+            (count >= 3 && (!parse_int_field(fields[2], &filter.level) ||
+                            filter.level < 0 || filter.level > EMERGENCY_LEVELS)) ||
+            (count == 4 && (!parse_int_field(fields[3], &filter.status) ||
+                            (filter.status != 0 && filter.status != 3 && filter.status != 4)))) {
+            fprintf(out, "error trips usage\n");
+            return 0;
+        }
+        if (archive_build(system) != 0) {
+            fprintf(out, "error trips %s\n", op_result_name(OP_NO_MEMORY));
+            return 0;
+        }
+        filter.from = current_epoch() - (int64_t)hours * 3600;
+        TripStats stats;
+        archive_query(&system->archive, &filter, &stats);
+        fprintf(out, "ok trips count=%ld answered=%ld mean_response=%.0f max_response=%d\n",
+                stats.trips, stats.answered, stats.mean_response, stats.max_response);
+        return 1;
+    }
+    
+    if (strcmp(command, "volume") == 0) {
+        TripFilter filter = {0, 0, 0, 0, 0};
+        int hours, minutes;
+        if (count < 3 || count > 4 || !parse_int_field(fields[1], &hours) || hours < 1 ||
+            !parse_int_field(fields[2], &minutes) || minutes < 1 ||
+            (count == 4 && (!parse_int_field(fields[3], &filter.level) ||
+                            filter.level < 0 || filter.level > EMERGENCY_LEVELS))) {
+            fprintf(out, "error volume usage\n");
+            return 0;
+        }
+        int64_t bucket = (int64_t)minutes * 60;
+        int64_t buckets = ((int64_t)hours * 3600 + bucket - 1) / bucket;
+        if (buckets > ARCHIVE_MAX_BUCKETS) {
+            fprintf(out, "error volume too_many_buckets\n");
+            return 0;
+        }
+        if (archive_build(system) != 0) {
+            fprintf(out, "error volume %s\n", op_result_name(OP_NO_MEMORY));
+            return 0;
+        }
+        
+        // Buckets are aligned to their size; the last one holds the current time
+        long counts[ARCHIVE_MAX_BUCKETS];
+        filter.from = (current_epoch() / bucket + 1 - buckets) * bucket;
+        long total = archive_volume(&system->archive, &filter, bucket, counts, (int)buckets);
+        fprintf(out, "ok volume total=%ld from=%lld counts=", total, (long long)filter.from);
+        for (int i = 0; i < buckets; i++) {
+            fprintf(out, i > 0 ? ",%ld" : "%ld", counts[i]);
+        }
+        fputc('\n', out);
+        return 1;
+    }
+    
+    if (strcmp(command, "search") == 0) {
+        SearchMode mode = SEARCH_NAME;
+        int limit = SEARCH_SHOW_COUNT;
+        if ((count != 3 && count != 4) ||
+            (strcmp(fields[1], "name") != 0 && strcmp(fields[1], "prefix") != 0 &&
+             strcmp(fields[1], "contact") != 0) ||
+            (count == 4 && (!parse_int_field(fields[3], &limit) || limit < 1 || limit > SEARCH_MAX_RESULTS))) {
+            fprintf(out, "error search usage\n");
+            return 0;
+        }
+        if (strcmp(fields[1], "prefix") == 0) mode = SEARCH_NAME_PREFIX;
+        if (strcmp(fields[1], "contact") == 0) mode = SEARCH_CONTACT;
+        if (strlen(fields[2]) < (mode == SEARCH_NAME ? SEARCH_MIN_SUBSTRING : 1)) {
+            fprintf(out, "error search too_short\n");
+            return 0;
+        }
+        
+        int slots[SEARCH_MAX_RESULTS];
+        int found = search_patients(system, mode, fields[2], slots, limit);
+        if (found < 0) {
+            fprintf(out, "error search %s\n", op_result_name(OP_NO_MEMORY));
+            return 0;
+        }
+        fprintf(out, "ok search count=%d ids=", found);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", booking_at(system, slots[i])->booking_id);
+        }
+        fputc('\n', out);
+        return 1;
+    }
+    
+    if (strcmp(command, "bookings") == 0) {
+        BookingFilter filter = {LIST_ANY, 0, INT64_MIN, INT64_MAX};
+        int hours = 0, after_id = 0, limit = LIST_PAGE_SIZE;
+        if (count > 6 ||
+            (count >= 2 && !parse_list_status(fields[1], BOOKING_STATUSES, 1, &filter.status)) ||
+            (count >= 3 && (!parse_int_field(fields[2], &filter.level) ||
+                            filter.level < 0 || filter.level > EMERGENCY_LEVELS)) ||
+            (count >= 4 && (!parse_int_field(fields[3], &hours) || hours < 0)) ||
+            (count >= 5 && (!parse_int_field(fields[4], &after_id) || after_id < 0)) ||
+            (count == 6 && (!parse_int_field(fields[5], &limit) || limit < 1 || limit > LIST_MAX_PAGE))) {
+            fprintf(out, "error bookings usage\n");
+            return 0;
+        }
+        int after = after_id > 0 ? find_booking_slot(system, after_id) : -1;
+        if (after_id > 0 && after == -1) {
+            fprintf(out, "error bookings not_found\n");
+            return 0;
+        }
+        if (hours > 0) {
+            filter.from = current_epoch() - (int64_t)hours * 3600;
+        }
+        
+        int slots[LIST_MAX_PAGE];
+        int found = list_bookings(system, &filter, after, slots, limit);
+        if (found < 0) {
+            fprintf(out, "error bookings %s\n", op_result_name(OP_NO_MEMORY));
+            return 0;
+        }
+        // A full page gives the cursor for the next one
+        fprintf(out, "ok bookings count=%d next=%d ids=", found,
+                found == limit ? booking_at(system, slots[found - 1])->booking_id : 0);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", booking_at(system, slots[i])->booking_id);
+        }
+        fputs(" statuses=", out);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", booking_at(system, slots[i])->status);
+        }
+        fputs(" levels=", out);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", booking_at(system, slots[i])->emergency_level);
+        }
+        fputs(" ambulances=", out);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", booking_at(system, slots[i])->ambulance_id);
+        }
+        fputc('\n', out);
+        return 1;
+    }
+    
+    if (strcmp(command, "ambulances") == 0) {
+        AmbulanceFilter filter = {LIST_ANY, 0};
+        int after_id = 0, limit = LIST_PAGE_SIZE;
+        if (count > 5 ||
+            (count >= 2 && !parse_list_status(fields[1], AMBULANCE_STATUSES, 0, &filter.status)) ||
+            (count >= 3 && (!parse_int_field(fields[2], &filter.type) ||
+                            filter.type < 0 || filter.type > AMBULANCE_TYPES)) ||
+            (count >= 4 && (!parse_int_field(fields[3], &after_id) || after_id < 0)) ||
+            (count == 5 && (!parse_int_field(fields[4], &limit) || limit < 1 || limit > LIST_MAX_PAGE))) {
+            fprintf(out, "error ambulances usage\n");
+            return 0;
+        }
+        int after = after_id > 0 ? find_ambulance_slot(system, after_id) : -1;
+        if (after_id > 0 && after == -1) {
+            fprintf(out, "error ambulances not_found\n");
+            return 0;
+        }
+        
+        int slots[LIST_MAX_PAGE];
+        int found = list_ambulances(system, &filter, after, slots, limit);
+        fprintf(out, "ok ambulances count=%d next=%d ids=", found,
+                found == limit ? system->amb_details[slots[found - 1]].ambulance_id : 0);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", system->amb_details[slots[i]].ambulance_id);
+        }
+        fputs(" statuses=", out);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", __atomic_load_n(&system->amb_status[slots[i]], __ATOMIC_RELAXED));
+        }
+        fputs(" types=", out);
+        for (int i = 0; i < found; i++) {
+            fprintf(out, i > 0 ? ",%d" : "%d", system->amb_type[slots[i]]);
+        }
+        fputc('\n', out);
+        return 1;
+    }
+    
+    if (strcmp(command, "check") == 0) {
+        int result = check_snapshot(SNAPSHOT_FILE);
+        if (result != 0) {
+            fprintf(out, "error check %s\n", result == -2 ? "corrupt" : "io");
+            return 0;
+        }
+        fprintf(out, "ok check\n");
+        return 1;
+    }
+    
+    if (strcmp(command, "sample") == 0) {
+        add_sample_data(system);
+        if (system->journal != NULL) {
+            write_data_files(system); // Sample data is not journaled; fold it into a snapshot
+        }
+        fprintf(out, "ok sample ambulances=%d bookings=%d\n", system->ambulance_count, system->booking_count);
+        return 1;
+    }
+    
+    fprintf(out, "error %s unknown_command\n", command);
+    return 0;
+}
+
+/**
+ * Runs commands from a stream until end of input, one result line per
+ * command, on top of the saved state (recovered first, as the menu and
+ * the server do, so a save cannot drop what an earlier run saved). With
+ * nothing saved yet, an empty snapshot is written so every change is
+ * journaled from the first command.
+ * Blank lines and lines starting with '#' are skipped. There is no
+ * screen clearing or prompting, and output is fully buffered.
+ * Consecutive call commands are dispatched together (up to
+ * ASSIGN_MAX_CALLS at a time) when the run of calls ends, and
+ * consecutive pos reports are applied together the same way.
+ * Returns: Number of commands that failed
+ */
+int run_batch(FILE* in, FILE* out) {
+    BAPESSS_System* system = create_system();
+    DispatchCall* calls = (DispatchCall*)malloc(ASSIGN_MAX_CALLS * sizeof(DispatchCall));
+    PositionUpdate* positions = (PositionUpdate*)malloc(POSITION_MAX_BATCH * sizeof(PositionUpdate));
+    if (system == NULL || calls == NULL || positions == NULL) {
+        fprintf(out, "error init no_memory\n");
+        free(calls);
+        free(positions);
+        free_system(system);
+        return 1;
+    }
+    
+    static char out_buffer[1 << 16];
+    setvbuf(out, out_buffer, _IOFBF, sizeof(out_buffer));
+    int loaded = read_data_files(system);
+    if (loaded == -2 || loaded == -3) {
+        fprintf(out, "error init %s\n", loaded == -2 ? "corrupt" : "journal");
+        free(calls);
+        free(positions);
+        free_system(system);
+        return 1;
+    }
+    if (loaded == -1) {
+        write_data_files(system); // Start journaling from an empty system
+    }
+    if (attach_roads(system, ROADS_FILE) == -2) {
+        fprintf(stderr, "Warning: %s could not be read; ranking by straight-line distance.\n", ROADS_FILE);
+    }
+    
+    char line[BATCH_MAX_LINE];
+    int failures = 0, call_count = 0, position_count = 0;
+    for (;;) {
+        int more = fgets(line, sizeof(line), in) != NULL;
+        if (more && (line[0] == '\n' || line[0] == '\r' || line[0] == '#' || line[0] == '\0')) {
+            continue;
+        }
+        if (more && command_is(line, strcspn(line, "|\r\n"), "pos")) {
+            char copy[BATCH_MAX_LINE];
+            char* fields[BATCH_MAX_FIELDS];
+            memcpy(copy, line, sizeof(line));
+            int count = split_fields(copy, fields, BATCH_MAX_FIELDS);
+            if (parse_position(fields, count, &positions[position_count])) {
+                if (call_count > 0) {
+                    failures += flush_calls(system, calls, call_count, out);
+                    call_count = 0;
+                    journal_commit(system, 0);
+                }
+                if (++position_count == POSITION_MAX_BATCH) {
+                    failures += flush_positions(system, positions, position_count, out);
+                    position_count = 0;
+                }
+                continue;
+            }
+        }
+        if (position_count > 0) {
+            failures += flush_positions(system, positions, position_count, out);
+            position_count = 0;
+        }
+        if (more && command_is(line, strcspn(line, "|\r\n"), "call")) {
+            char copy[BATCH_MAX_LINE];
+            char* fields[BATCH_MAX_FIELDS];
+            memcpy(copy, line, sizeof(line));
+            int count = split_fields(copy, fields, BATCH_MAX_FIELDS);
+            if (parse_call(fields, count, &calls[call_count])) {
+                if (++call_count < ASSIGN_MAX_CALLS) {
+                    continue;
+                }
+                failures += flush_calls(system, calls, call_count, out);
+                call_count = 0;
+                journal_commit(system, 0);
+                continue;
+            }
+        }
+        if (call_count > 0) {
+            failures += flush_calls(system, calls, call_count, out);
+            call_count = 0;
+        }
+        if (!more) {
+            break;
+        }
+        if (!execute_command(system, line, out)) {
+            failures++;
+        }
+        journal_commit(system, 0);
+        if (snapshot_poll(system, 0) < 0) {
+            fprintf(out, "error save background\n");
+            failures++;
+        }
+        compact_if_needed(system);
+    }
+    
+    journal_commit(system, 1);
+    if (snapshot_poll(system, 1) < 0) {
+        fprintf(out, "error save background\n");
+        failures++;
+    }
+    fflush(out);
+    free(calls);
+    free(positions);
+    free_system(system);
+    return failures;
+}
+
+// =============================================
+// DISPATCH SERVER
+// =============================================
+#define SERVER_SOCKET "bapesss.sock"  // Default Unix-domain socket
+#define SERVER_MAX_CLIENTS 1024      // Connections served at once
+#define SERVER_MAX_WORKERS 64        // Largest worker pool
+#define SERVER_INPUT_SIZE (4 * BATCH_MAX_LINE) // Received bytes buffered per client
+#define SERVER_REPLY_SIZE (16 * BATCH_MAX_LINE) // Longest reply to one command (a full volume reply)
+#define SERVER_HOUSEKEEPING 0.005    // Seconds between group commits and background save checks
+#define SERVER_DISPATCH_WINDOW 0.010 // Seconds calls are collected before being dispatched together
+
+#ifndef _WIN32
+// Store locks a command needs. Locks are always taken fleet first.
+// Bookings claim ambulances under the shared fleet lock alone (claims
+// are atomic and their index updates deferred), then take the bookings
+// lock exclusively to add the booking and change the pending queues.
+enum {
+    LOCK_FLEET_READ = 1,       // Ambulance columns, grid, pools, pending queues
+    LOCK_FLEET_WRITE = 2,
+    LOCK_BOOKINGS_READ = 4,    // Booking chunks, index, strings, journal
+    LOCK_BOOKINGS_WRITE = 8
+};
+
+// One client connection. A client has at most one command with the
+// workers at a time, so its replies come back in order.
+typedef struct {
+    int fd;                    // Socket
+    char input[SERVER_INPUT_SIZE]; // Received bytes not yet run as commands
+    size_t input_used;
+    char line[BATCH_MAX_LINE]; // Command owned by a worker while busy
+    char* output;              // Replies not yet sent
+    size_t output_used;
+    size_t output_sent;
+    size_t output_capacity;
+    int busy;                  // A worker is running this client's command
+    int collected;             // Calls of this client waiting in the dispatch window
+    int reported;              // Position reports of this client waiting to be applied
+    int eof;                   // Peer has sent everything; close once answered
+    int closing;               // Connection failed; close once idle
+} ServerClient;
+
+// Event loop, worker pool and the locks that let commands run in parallel
+typedef struct {
+    BAPESSS_System* system;
+    pthread_rwlock_t fleet_lock;    // See LOCK_FLEET_*
+    pthread_rwlock_t bookings_lock; // See LOCK_BOOKINGS_*; journal writers hold it exclusively
+    pthread_mutex_t lock;      // Job queue, client busy flags and reply buffers
+    pthread_cond_t work_ready; // Signalled when a job is queued or the server stops
+    ServerClient* clients[SERVER_MAX_CLIENTS];
+    int client_count;
+    ServerClient* jobs[SERVER_MAX_CLIENTS]; // Ring of clients whose command is waiting for a worker
+    int job_head;
+    int job_count;
+    pthread_t workers[SERVER_MAX_WORKERS];
+    int worker_count;
+    int listener;              // Listening socket
+    int wake_pipe[2];          // Workers write a byte here when a reply is ready
+    char socket_path[108];     // Unix socket to remove on close, empty for TCP
+    int stopping;              // Set to shut the loop and workers down
+    long commands;             // Commands run
+    long failures;             // Commands that failed
+    DispatchCall* window;      // Calls collected by the event loop for one batch dispatch
+    ServerClient* window_clients[ASSIGN_MAX_CALLS]; // Client of each collected call
+    int window_count;
+    double window_opened;      // When the first collected call arrived
+    PositionUpdate* positions; // Position reports collected by the event loop
+    ServerClient* position_clients[POSITION_MAX_BATCH]; // Client of each collected report
+    int position_count;
+} DispatchServer;
+
+static volatile sig_atomic_t server_interrupted = 0;
+
+/**
+ * Signal handler for --serve: asks the event loop to shut down
+ */
+static void server_on_signal(int signal_number) {
+    (void)signal_number;
+    server_interrupted = 1;
+}
+
+/**
+ * Picks the store locks for a command line. Queries share their locks;
+ * confirming or dispatching a booking does not touch the fleet, and a
+ * new booking only claims a unit, so both run alongside nearest-ambulance
+ * searches. Anything that can free or add an ambulance takes both locks
+ * exclusively.
+ * Returns: Set of LOCK_* flags
+ */
+static int server_command_locks(const char* line) {
+    size_t length = strcspn(line, "|\r\n");
+    
+    if (command_is(line, length, "book")) {
+        return LOCK_FLEET_READ | LOCK_BOOKINGS_WRITE; // The bookings lock only once claimed (server_book)
+    }
+    if (command_is(line, length, "call")) {
+        return LOCK_FLEET_WRITE | LOCK_BOOKINGS_WRITE; // Only malformed calls reach the workers
+    }
+    if (command_is(line, length, "nearest")) {
+        return LOCK_FLEET_READ;
+    }
+    if (command_is(line, length, "pos")) {
+        return LOCK_FLEET_WRITE;
+    }
+    if (command_is(line, length, "find")) {
+        return LOCK_BOOKINGS_READ;
+    }
+    if (command_is(line, length, "trips") || command_is(line, length, "volume")) {
+        return LOCK_BOOKINGS_WRITE; // The first query after a load builds the archive
+    }
+    if (command_is(line, length, "search")) {
+        return LOCK_BOOKINGS_READ; // The index is built beforehand (server_search)
+    }
+    if (command_is(line, length, "bookings")) {
+        return LOCK_BOOKINGS_WRITE; // The first listing after a load builds the open set
+    }
+    if (command_is(line, length, "ambulances")) {
+        return LOCK_FLEET_READ;
+    }
+    if (command_is(line, length, "report")) {
+        return LOCK_FLEET_READ | LOCK_BOOKINGS_READ;
+    }
+    if (command_is(line, length, "update") && line[length] == '|') {
+        const char* status = strchr(line + length + 1, '|');
+        int new_status = status != NULL ? atoi(status + 1) : 0;
+        if (new_status == 1 || new_status == 2) {
+            return LOCK_BOOKINGS_WRITE;
+        }
+    }
+    return LOCK_FLEET_WRITE | LOCK_BOOKINGS_WRITE;
+}
+
+/**
+ * Takes the store locks of a command, fleet first so two commands never
+ * wait on each other in a cycle. Exclusive fleet access first applies
+ * the claims made under the shared lock.
+ */
+static void server_lock(DispatchServer* server, int locks) {
+    if (locks & LOCK_FLEET_WRITE) {
+        pthread_rwlock_wrlock(&server->fleet_lock);
+        fleet_settle(server->system);
+    } else if (locks & LOCK_FLEET_READ) {
+        pthread_rwlock_rdlock(&server->fleet_lock);
+    }
+    if (locks & LOCK_BOOKINGS_WRITE) {
+        pthread_rwlock_wrlock(&server->bookings_lock);
+    } else if (locks & LOCK_BOOKINGS_READ) {
+        pthread_rwlock_rdlock(&server->bookings_lock);
+    }
+}
+
+/**
+ * Releases the store locks taken by server_lock
+ */
+static void server_unlock(DispatchServer* server, int locks) {
+    if (locks & (LOCK_BOOKINGS_WRITE | LOCK_BOOKINGS_READ)) {
+        pthread_rwlock_unlock(&server->bookings_lock);
+    }
+    if (locks & (LOCK_FLEET_WRITE | LOCK_FLEET_READ)) {
+        pthread_rwlock_unlock(&server->fleet_lock);
+    }
+}
+
+/**
+ * Runs a book command in two steps: its unit is claimed under the shared
+ * fleet lock alone, so bookings race only on the compare-and-swap, and
+ * the bookings lock is taken just to add the booking
+ * Returns: 1 if the command succeeded, 0 otherwise
+ */
+static int server_book(DispatchServer* server, char* line, FILE* out) {
+    char* fields[BATCH_MAX_FIELDS];
+    int count = split_fields(line, fields, BATCH_MAX_FIELDS);
+    BookCommand book;
+    
+    server_lock(server, LOCK_FLEET_READ);
+    int ok = book_claim(server->system, fields, count, &book, out);
+    if (ok) {
+        pthread_rwlock_wrlock(&server->bookings_lock);
+        ok = book_create(server->system, &book, out);
+        journal_commit(server->system, 0);
+        pthread_rwlock_unlock(&server->bookings_lock);
+    }
+    server_unlock(server, LOCK_FLEET_READ);
+    return ok;
+}
+
+/**
+ * Runs a search under the shared bookings lock. The first search after a
+ * load builds the patient index first, holding the lock exclusively just
+ * for that, so later searches run side by side.
+ * Returns: 1 if the command succeeded, 0 otherwise
+ */
+static int server_search(DispatchServer* server, char* line, FILE* out) {
+    BAPESSS_System* system = server->system;
+    server_lock(server, LOCK_BOOKINGS_READ);
+    while (!system->patients.built) {
+        server_unlock(server, LOCK_BOOKINGS_READ);
+        server_lock(server, LOCK_BOOKINGS_WRITE);
+        int built = patient_index_build(system) == 0;
+        server_unlock(server, LOCK_BOOKINGS_WRITE);
+        if (!built) {
+            fprintf(out, "error search %s\n", op_result_name(OP_NO_MEMORY));
+            return 0;
+        }
+        server_lock(server, LOCK_BOOKINGS_READ); // A load in between empties it again
+    }
+    int ok = execute_command(system, line, out);
+    server_unlock(server, LOCK_BOOKINGS_READ);
+    return ok;
+}
+
+/**
+ * Queues reply bytes for a client. Called with server->lock held.
+ * Returns: 1 on success, 0 on allocation failure
+ */
+static int client_queue_output(ServerClient* client, const char* data, size_t length) {
+    if (client->output_used + length > client->output_capacity) {
+        size_t capacity = client->output_capacity > 0 ? client->output_capacity * 2 : SERVER_REPLY_SIZE;
+        while (capacity < client->output_used + length) {
+            capacity *= 2;
+        }
+        char* output = (char*)realloc(client->output, capacity);
+        if (output == NULL) {
+            return 0;
+        }
+        client->output = output;
+        client->output_capacity = capacity;
+    }
+    memcpy(client->output + client->output_used, data, length);
+    client->output_used += length;
+    return 1;
+}
+
+/**
+ * Worker thread: runs queued commands under the locks they need and
+ * hands the replies back to the event loop
+ */
+static void* server_worker(void* arg) {
+    DispatchServer* server = (DispatchServer*)arg;
+    char reply[SERVER_REPLY_SIZE];
+    FILE* out = fmemopen(reply, sizeof(reply), "w");
+    if (out == NULL) {
+        return NULL;
+    }
+    
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->job_count == 0 && !server->stopping) {
+            pthread_cond_wait(&server->work_ready, &server->lock);
+        }
+        if (server->job_count == 0) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        ServerClient* client = server->jobs[server->job_head];
+        server->job_head = (server->job_head + 1) % SERVER_MAX_CLIENTS;
+        server->job_count--;
+        pthread_mutex_unlock(&server->lock);
+        
+        int locks = server_command_locks(client->line);
+        int ok;
+        rewind(out);
+        size_t name_length = strcspn(client->line, "|\r\n");
+        if (command_is(client->line, name_length, "book")) {
+            ok = server_book(server, client->line, out);
+        } else if (command_is(client->line, name_length, "search")) {
+            ok = server_search(server, client->line, out);
+        } else {
+            server_lock(server, locks);
+            ok = execute_command(server->system, client->line, out);
+            if (locks & LOCK_BOOKINGS_WRITE) {
+                journal_commit(server->system, 0);
+            }
+            server_unlock(server, locks);
+        }
+        fflush(out);
+        long length = ftell(out);
+        if (length < 0 || length >= (long)sizeof(reply)) {
+            length = 0; // Cannot happen with the replies execute_command writes
+        }
+        
+        pthread_mutex_lock(&server->lock);
+        if (!client_queue_output(client, reply, (size_t)length)) {
+            client->closing = 1;
+        }
+        client->busy = 0;
+        server->commands++;
+        server->failures += !ok;
+        pthread_mutex_unlock(&server->lock);
+        
+        // A full pipe means the loop is awake already
+        char wake = 0;
+        if (write(server->wake_pipe[1], &wake, 1) < 0) {
+            continue;
+        }
+    }
+    
+    fclose(out);
+    return NULL;
+}
+
+/**
+ * Opens the listening socket: TCP on localhost when address is a port
+ * number, otherwise a Unix-domain socket at that path
+ * Returns: The socket, or -1 on failure
+ */
+static int server_listen(DispatchServer* server, const char* address) {
+    int fd;
+    int is_port = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+    
+    if (is_port) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)atoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+            bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd != -1) close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        unlink(address); // Left behind by a server that did not shut down cleanly
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        strcpy(server->socket_path, address);
+    }
+    
+    if (listen(fd, 128) != 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Creates a server for a system, listening on address with worker_count
+ * worker threads. The event loop is run by server_loop.
+ * Returns: The server, or NULL on failure
+ */
+static DispatchServer* server_open(BAPESSS_System* system, const char* address, int worker_count) {
+    DispatchServer* server = (DispatchServer*)calloc(1, sizeof(DispatchServer));
+    if (server == NULL) {
+        return NULL;
+    }
+    server->system = system;
+    server->window = (DispatchCall*)malloc(ASSIGN_MAX_CALLS * sizeof(DispatchCall));
+    server->positions = (PositionUpdate*)malloc(POSITION_MAX_BATCH * sizeof(PositionUpdate));
+    server->listener = server->window != NULL && server->positions != NULL ?
+                       server_listen(server, address) : -1;
+    if (server->listener == -1 || pipe(server->wake_pipe) != 0) {
+        if (server->listener != -1) close(server->listener);
+        free(server->window);
+        free(server->positions);
+        free(server);
+        return NULL;
+    }
+    fcntl(server->wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(server->wake_pipe[1], F_SETFL, O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN); // A client hanging up shows as a failed send instead
+    
+    system->defer_claims = 1;
+    pthread_rwlock_init(&server->fleet_lock, NULL);
+    pthread_rwlock_init(&server->bookings_lock, NULL);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->work_ready, NULL);
+    
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > SERVER_MAX_WORKERS) worker_count = SERVER_MAX_WORKERS;
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&server->workers[i], NULL, server_worker, server) != 0) {
+            break;
+        }
+        server->worker_count++;
+    }
+    return server;
+}
+
+/**
+ * Accepts every waiting connection
+ */
+static void server_accept(DispatchServer* server) {
+    for (;;) {
+        int fd = accept(server->listener, NULL, NULL);
+        if (fd == -1) {
+            return;
+        }
+        ServerClient* client = NULL;
+        if (server->client_count < SERVER_MAX_CLIENTS && fcntl(fd, F_SETFL, O_NONBLOCK) == 0) {
+            client = (ServerClient*)calloc(1, sizeof(ServerClient));
+        }
+        if (client == NULL) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        server->clients[server->client_count++] = client;
+    }
+}
+
+/**
+ * Reads what a client has sent. Called with server->lock held.
+ */
+static void client_receive(ServerClient* client) {
+    while (!client->closing && !client->eof && client->input_used < sizeof(client->input)) {
+        ssize_t count = recv(client->fd, client->input + client->input_used,
+                             sizeof(client->input) - client->input_used, 0);
+        if (count > 0) {
+            client->input_used += (size_t)count;
+        } else if (count == 0) {
+            // End the last line if the peer did not
+            client->eof = 1;
+            if (client->input_used > 0 && client->input[client->input_used - 1] != '\n' &&
+                client->input_used < sizeof(client->input)) {
+                client->input[client->input_used++] = '\n';
+            }
+            break;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            client->closing = 1;
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * Sends as much of a client's queued replies as the socket takes.
+ * Called with server->lock held.
+ */
+static void client_send(ServerClient* client) {
+    while (client->output_sent < client->output_used) {
+        ssize_t count = send(client->fd, client->output + client->output_sent,
+                             client->output_used - client->output_sent, 0);
+        if (count > 0) {
+            client->output_sent += (size_t)count;
+        } else if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        } else {
+            client->closing = 1;
+            client->output_sent = client->output_used; // Nobody to send the rest to
+        }
+    }
+    client->output_used = 0;
+    client->output_sent = 0;
+}
+
+/**
+ * Adds the call in a client's line to the dispatch window instead of
+ * queuing it for a worker
+ * Returns: 1 if the line was a well-formed call and the window had room
+ */
+static int client_collect_call(DispatchServer* server, ServerClient* client) {
+    char copy[BATCH_MAX_LINE];
+    char* fields[BATCH_MAX_FIELDS];
+    if (server->window_count == ASSIGN_MAX_CALLS || client->reported > 0 ||
+        !command_is(client->line, strcspn(client->line, "|\r\n"), "call")) {
+        return 0;
+    }
+    memcpy(copy, client->line, sizeof(copy));
+    int count = split_fields(copy, fields, BATCH_MAX_FIELDS);
+    if (!parse_call(fields, count, &server->window[server->window_count])) {
+        return 0; // A worker answers with the usage error
+    }
+    if (server->window_count == 0) {
+        server->window_opened = monotonic_seconds();
+    }
+    server->window_clients[server->window_count++] = client;
+    client->collected++;
+    return 1;
+}
+
+/**
+ * Adds the position report in a client's line to the reports the event
+ * loop applies next, unless the client still has calls in the window
+ * Returns: 1 if the line was a well-formed report and there was room
+ */
+static int client_collect_position(DispatchServer* server, ServerClient* client) {
+    char copy[BATCH_MAX_LINE];
+    char* fields[BATCH_MAX_FIELDS];
+    if (server->position_count == POSITION_MAX_BATCH || client->collected > 0 ||
+        !command_is(client->line, strcspn(client->line, "|\r\n"), "pos")) {
+        return 0;
+    }
+    memcpy(copy, client->line, sizeof(copy));
+    int count = split_fields(copy, fields, BATCH_MAX_FIELDS);
+    if (!parse_position(fields, count, &server->positions[server->position_count])) {
+        return 0;
+    }
+    server->position_clients[server->position_count++] = client;
+    client->reported++;
+    return 1;
+}
+
+/**
+ * Applies the collected position reports and queues their replies. The
+ * exclusive fleet lock is taken for POSITION_CHUNK reports at a time, so
+ * nearest-ambulance queries and bookings run between the chunks instead
+ * of waiting for the whole batch. Called from the event loop without
+ * server->lock held.
+ */
+static void server_flush_positions(DispatchServer* server) {
+    for (int done = 0; done < server->position_count; done += POSITION_CHUNK) {
+        int chunk = server->position_count - done;
+        if (chunk > POSITION_CHUNK) chunk = POSITION_CHUNK;
+        server_lock(server, LOCK_FLEET_WRITE);
+        apply_positions(server->system, server->positions + done, chunk);
+        server_unlock(server, LOCK_FLEET_WRITE);
+    }
+    
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < server->position_count; i++) {
+        char reply[64];
+        ServerClient* client = server->position_clients[i];
+        int length = format_position_reply(reply, sizeof(reply), &server->positions[i]);
+        if (!client_queue_output(client, reply, (size_t)length)) {
+            client->closing = 1;
+        }
+        client->reported--;
+        server->commands++;
+        server->failures += !server->positions[i].applied;
+    }
+    pthread_mutex_unlock(&server->lock);
+    server->position_count = 0;
+}
+
+/**
+ * Dispatches the collected calls together and queues their replies.
+ * Called from the event loop without server->lock held.
+ */
+static void server_flush_calls(DispatchServer* server) {
+    if (server->window_count == 0) {
+        return;
+    }
+    server_lock(server, LOCK_FLEET_WRITE | LOCK_BOOKINGS_WRITE);
+    dispatch_batch(server->system, server->window, server->window_count);
+    journal_commit(server->system, 0);
+    server_unlock(server, LOCK_FLEET_WRITE | LOCK_BOOKINGS_WRITE);
+    
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < server->window_count; i++) {
+        char reply[128];
+        ServerClient* client = server->window_clients[i];
+        int booked = server->window[i].request.booking_id != 0;
+        int length = format_call_reply(reply, sizeof(reply), &server->window[i], booked);
+        if (!client_queue_output(client, reply, (size_t)length)) {
+            client->closing = 1;
+        }
+        client->collected--;
+        server->commands++;
+        server->failures += !booked;
+    }
+    pthread_mutex_unlock(&server->lock);
+    server->window_count = 0;
+}
+
+/**
+ * Hands a client's next complete command line to the workers, skipping
+ * blank and comment lines as batch mode does. Calls go to the dispatch
+ * window and position reports to the next batch of reports instead; any
+ * other command waits until the client's collected lines have been
+ * answered. Called with server->lock held and the client idle.
+ */
+static void client_dispatch(DispatchServer* server, ServerClient* client) {
+    while (!client->busy) {
+        char* end = (char*)memchr(client->input, '\n', client->input_used);
+        if (end == NULL) {
+            if (client->input_used == sizeof(client->input) && client->collected == 0 &&
+                client->reported == 0) {
+                // A line longer than the buffer can never complete
+                client->input_used = 0;
+                if (!client_queue_output(client, "error line too_long\n", 20)) {
+                    client->closing = 1;
+                }
+            }
+            return;
+        }
+        
+        size_t length = (size_t)(end - client->input) + 1;
+        int skip = client->input[0] == '\n' || client->input[0] == '\r' || client->input[0] == '#';
+        int collected = 0;
+        if (!skip && length < sizeof(client->line)) {
+            memcpy(client->line, client->input, length);
+            client->line[length] = '\0';
+            collected = client_collect_call(server, client) || client_collect_position(server, client);
+        }
+        if (!skip && !collected && (client->collected > 0 || client->reported > 0)) {
+            return; // Replies must not overtake the lines still collected
+        }
+        client->input_used -= length;
+        memmove(client->input, client->input + length, client->input_used);
+        
+        if (!skip && !collected && length >= sizeof(client->line)) {
+            skip = 1;
+            if (!client_queue_output(client, "error line too_long\n", 20)) {
+                client->closing = 1;
+            }
+        }
+        if (!skip && !collected) {
+            client->busy = 1;
+            server->jobs[(server->job_head + server->job_count) % SERVER_MAX_CLIENTS] = client;
+            server->job_count++;
+            pthread_cond_signal(&server->work_ready);
+        }
+    }
+}
+
+/**
+ * Asks the event loop and the workers to stop. Safe from any thread.
+ */
+static void server_stop(DispatchServer* server) {
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_cond_broadcast(&server->work_ready);
+    pthread_mutex_unlock(&server->lock);
+    
+    char wake = 0;
+    if (write(server->wake_pipe[1], &wake, 1) < 0) {
+        return; // A full pipe means the loop is awake already
+    }
+}
+
+/**
+ * Runs the event loop until server_stop is called (or SIGINT/SIGTERM for
+ * --serve): accepts connections, reads commands, queues them for the
+ * workers and sends replies. Calls are collected for up to
+ * SERVER_DISPATCH_WINDOW and dispatched together; position reports are
+ * applied on the next pass through the loop. Between events it does
+ * the time-based group commit and checks on background saves.
+ */
+static void server_loop(DispatchServer* server) {
+    static struct pollfd fds[SERVER_MAX_CLIENTS + 2];
+    static ServerClient* polled[SERVER_MAX_CLIENTS + 2];
+    double last_housekeeping = monotonic_seconds();
+    
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        int stopping = server->stopping;
+        pthread_mutex_unlock(&server->lock);
+        if (stopping || server_interrupted) {
+            break;
+        }
+        
+        int count = 0;
+        fds[count].fd = server->listener;
+        fds[count++].events = POLLIN;
+        fds[count].fd = server->wake_pipe[0];
+        fds[count++].events = POLLIN;
+        
+        pthread_mutex_lock(&server->lock);
+        for (int i = 0; i < server->client_count; i++) {
+            ServerClient* client = server->clients[i];
+            short events = 0;
+            if (!client->closing && !client->eof && client->input_used < sizeof(client->input)) {
+                events |= POLLIN;
+            }
+            if (client->output_sent < client->output_used) events |= POLLOUT;
+            if (events != 0) {
+                polled[count] = client;
+                fds[count].fd = client->fd;
+                fds[count++].events = events;
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+        
+        double wait = server->position_count > 0 ? 0 : SERVER_HOUSEKEEPING;
+        if (server->window_count > 0) {
+            double left = server->window_opened + SERVER_DISPATCH_WINDOW - monotonic_seconds();
+            wait = left < wait ? (left > 0 ? left : 0) : wait;
+        }
+        int ready = poll(fds, (nfds_t)count, (int)(wait * 1000) + 1);
+        if (ready == -1 && errno != EINTR) {
+            break;
+        }
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            char drain[256];
+            while (read(server->wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            server_accept(server);
+        }
+        
+        pthread_mutex_lock(&server->lock);
+        for (int i = 2; ready > 0 && i < count; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                client_receive(polled[i]);
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+        
+        if (server->window_count == ASSIGN_MAX_CALLS ||
+            (server->window_count > 0 &&
+             monotonic_seconds() - server->window_opened >= SERVER_DISPATCH_WINDOW)) {
+            server_flush_calls(server);
+        }
+        server_flush_positions(server);
+        
+        pthread_mutex_lock(&server->lock);
+        // Send replies, start next commands and drop finished connections
+        for (int i = 0; i < server->client_count; i++) {
+            ServerClient* client = server->clients[i];
+            client_send(client);
+            if (!client->closing) {
+                client_dispatch(server, client);
+                client_send(client);
+            }
+            if (!client->busy && client->collected == 0 && client->reported == 0 &&
+                (client->closing || (client->eof && client->output_used == 0))) {
+                close(client->fd);
+                free(client->output);
+                free(client);
+                server->clients[i--] = server->clients[--server->client_count];
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+        
+        if (monotonic_seconds() - last_housekeeping >= SERVER_HOUSEKEEPING) {
+            server_lock(server, LOCK_FLEET_WRITE | LOCK_BOOKINGS_WRITE);
+            journal_commit(server->system, 0);
+            int saved = snapshot_poll(server->system, 0);
+            if (saved < 0) {
+                printf("Error: Background save failed! The previous save was kept.\n");
+            }
+            compact_if_needed(server->system);
+            server_unlock(server, LOCK_FLEET_WRITE | LOCK_BOOKINGS_WRITE);
+            last_housekeeping = monotonic_seconds();
+        }
+    }
+}
+
+/**
+ * Stops the workers, closes every connection and the listening socket,
+ * and frees the server. Commands already queued are run first.
+ */
+static void server_close(DispatchServer* server) {
+    server_stop(server);
+    for (int i = 0; i < server->worker_count; i++) {
+        pthread_join(server->workers[i], NULL);
+    }
+    server_flush_calls(server);
+    server_flush_positions(server);
+    fleet_settle(server->system);
+    server->system->defer_claims = 0;
+    
+    for (int i = 0; i < server->client_count; i++) {
+        client_send(server->clients[i]); // Best effort for replies still queued
+        close(server->clients[i]->fd);
+        free(server->clients[i]->output);
+        free(server->clients[i]);
+    }
+    close(server->listener);
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+    if (server->socket_path[0] != '\0') {
+        unlink(server->socket_path);
+    }
+    journal_commit(server->system, 1);
+    
+    pthread_rwlock_destroy(&server->fleet_lock);
+    pthread_rwlock_destroy(&server->bookings_lock);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->work_ready);
+    free(server->window);
+    free(server->positions);
+    free(server);
+}
+#endif
+
+/**
+ * Entry point for "--serve [address] [workers]". Recovers the saved state
+ * like the interactive mode, then serves the batch command protocol to
+ * any number of clients, one reply line per command line, until
+ * interrupted. address is a Unix socket path or a localhost TCP port
+ * (NULL for SERVER_SOCKET); worker_count below 1 means one per core.
+ * Returns: Process exit code
+ */
+int run_server(const char* address, int worker_count) {
+#ifdef _WIN32
+    (void)address;
+    (void)worker_count;
+    printf("Error: Server mode needs POSIX sockets and threads, which this build does not have.\n");
+    return 1;
+#else
+    if (address == NULL) {
+        address = SERVER_SOCKET;
+    }
+    if (worker_count < 1) {
+        worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    int loaded = read_data_files(system);
+    if (loaded == -2) {
+        printf("Error: %s is truncated, corrupt or from another version; not serving.\n", SNAPSHOT_FILE);
+        free_system(system);
+        return 1;
+    }
+    if (loaded == -3) {
+        printf("Error: %s could not be replayed; not serving.\n", JOURNAL_FILE);
+        free_system(system);
+        return 1;
+    }
+    if (loaded == -1) {
+        write_data_files(system); // Start journaling from an empty system
+    }
+    int roads = attach_roads(system, ROADS_FILE);
+    if (roads == -2) {
+        printf("Warning: %s could not be read; ranking by straight-line distance.\n", ROADS_FILE);
+    }
+    
+    DispatchServer* server = server_open(system, address, worker_count);
+    if (server == NULL) {
+        printf("Error: Could not listen on %s!\n", address);
+        free_system(system);
+        return 1;
+    }
+    signal(SIGINT, server_on_signal);
+    signal(SIGTERM, server_on_signal);
+    printf("Serving %d ambulances and %d bookings on %s with %d workers",
+           system->ambulance_count, system->booking_count, address, server->worker_count);
+    if (system->roads != NULL) {
+        printf(", %d road junctions", system->roads->node_count);
+    }
+    printf("\n");
+    fflush(stdout);
+    
+    server_loop(server);
+    long commands = server->commands;
+    long failures = server->failures;
+    server_close(server);
+    printf("Server stopped after %ld commands (%ld failed)\n", commands, failures);
+    free_system(system);
+    return 0;
+#endif
+}
+
+// =============================================
+// BENCHMARKS
+// =============================================
+
+/**
+ * Returns the next value of a xorshift64 generator. rand() is too narrow
+ * on some platforms to pick among millions of bookings.
+ */
+static uint64_t bench_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/**
+ * Registers a benchmark fleet spread over the 0-100 area, every unit
+ * available. Types cycle through basic, advanced and ICU, or, given
+ * type_percent, are drawn with those shares (type_percent[type - 1]).
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int bench_fill_fleet(BAPESSS_System* system, int fleet_size, const int* type_percent, uint64_t* rng) {
+    for (int i = 0; i < fleet_size; i++) {
+        Ambulance ambulance;
+        memset(&ambulance, 0, sizeof(Ambulance));
+        snprintf(ambulance.vehicle_number, sizeof(ambulance.vehicle_number), "MH01ZZ%04d", i);
+        snprintf(ambulance.driver_name, sizeof(ambulance.driver_name), "Driver %d", i);
+        snprintf(ambulance.driver_contact, sizeof(ambulance.driver_contact), "98%08d", i);
+        ambulance.type = 1 + i % AMBULANCE_TYPES;
+        if (type_percent != NULL) {
+            int roll = (int)(bench_random(rng) % 100);
+            for (ambulance.type = 1; ambulance.type < AMBULANCE_TYPES &&
+                 roll >= type_percent[ambulance.type - 1]; ambulance.type++) {
+                roll -= type_percent[ambulance.type - 1];
+            }
+        }
+        ambulance.location_x = (float)(bench_random(rng) % 100000) / 1000.0f;
+        ambulance.location_y = (float)(bench_random(rng) % 100000) / 1000.0f;
+        int served;
+        if (register_ambulance(system, &ambulance, &served) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Adds a fleet and a booking history to a benchmark system. Most calls
+ * are closed as they are made so ambulances keep cycling and few stay
+ * queued.
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int bench_fill(BAPESSS_System* system, int fleet_size, int booking_count, uint64_t* rng) {
+    if (bench_fill_fleet(system, fleet_size, NULL, rng) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < booking_count; i++) {
+        Booking request;
+        snprintf(request.patient_name, sizeof(request.patient_name), "Patient %d", i);
+        snprintf(request.patient_contact, sizeof(request.patient_contact), "97%08d", i);
+        snprintf(request.pickup_location, sizeof(request.pickup_location), "Sector %d", i % 500);
+        snprintf(request.hospital, sizeof(request.hospital), "Hospital %d", i % 20);
+        request.emergency_level = 1 + (int)(bench_random(rng) % EMERGENCY_LEVELS);
+        if (create_booking(system, &request) == -1) {
+            return -1;
+        }
+        int served;
+        if (request.status == 1 && bench_random(rng) % 4 != 0) {
+            change_booking_status(system, request.booking_id, 3, &served);
+        } else if (request.status == 0 && bench_random(rng) % 100 != 0) {
+            change_booking_status(system, request.booking_id, 4, &served);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compares fleet scans over the old array-of-structs layout with scans
+ * over the hot fleet columns. Both scans compute the same answers.
+ */
+static int run_fleet_benchmark(int fleet_size) {
+    BAPESSS_System* system = create_system();
+    Ambulance* legacy = (Ambulance*)malloc(fleet_size * sizeof(Ambulance));
+    if (system == NULL || legacy == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        free(legacy);
+        free_system(system);
+        return 1;
+    }
+    
+    // The same fleet in both layouts, in every status
+    uint64_t rng = 0x2A2A2A2A2A2A2A2AULL;
+    if (bench_fill_fleet(system, fleet_size, NULL, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free(legacy);
+        free_system(system);
+        return 1;
+    }
+    for (int i = 0; i < fleet_size; i++) {
+        set_ambulance_status(system, i, (int)(bench_random(&rng) % AMBULANCE_STATUSES));
+        get_ambulance(system, i, &legacy[i]);
+    }
+    
+    int repeats = 200000000 / fleet_size;
+    if (repeats < 10) repeats = 10;
+    long checksum_legacy = 0, checksum_columns = 0;
+    
+    // Report-style scan: status and type histograms
+    double start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        int counts[8] = {0};
+        for (int i = 0; i < fleet_size; i++) {
+            counts[legacy[i].status & 3]++;
+            counts[4 + (legacy[i].type & 3)]++;
+        }
+        checksum_legacy += counts[0] + counts[5];
+    }
+    double legacy_report = (monotonic_seconds() - start) / repeats;
+    
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        int counts[8] = {0};
+        for (int i = 0; i < fleet_size; i++) {
+            counts[system->amb_status[i] & 3]++;
+            counts[4 + (system->amb_type[i] & 3)]++;
+        }
+        checksum_columns += counts[0] + counts[5];
+    }
+    double columns_report = (monotonic_seconds() - start) / repeats;
+    
+    // Dispatch-style scan: nearest available unit
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        float qx = (float)(r % 100), qy = (float)((r * 7) % 100);
+        int nearest = -1;
+        float min_distance = INFINITY;
+        for (int i = 0; i < fleet_size; i++) {
+            if (legacy[i].status == 0) {
+                float dx = qx - legacy[i].location_x;
+                float dy = qy - legacy[i].location_y;
+                float distance = dx * dx + dy * dy;
+                if (distance < min_distance) {
+                    min_distance = distance;
+                    nearest = i;
+                }
+            }
+        }
+        checksum_legacy += nearest;
+    }
+    double legacy_nearest = (monotonic_seconds() - start) / repeats;
+    
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        float qx = (float)(r % 100), qy = (float)((r * 7) % 100);
+        checksum_columns += nearest_available_scan(system, qx, qy, NULL);
+    }
+    double columns_nearest = (monotonic_seconds() - start) / repeats;
+    
+    printf("Fleet scan benchmark: %d ambulances, %d repeats\n", fleet_size, repeats);
+    printf("%-16s %14s %14s %10s\n", "scan", "structs (us)", "columns (us)", "speedup");
+    printf("%-16s %14.2f %14.2f %9.1fx\n", "report counts",
+           legacy_report * 1e6, columns_report * 1e6, legacy_report / columns_report);
+    printf("%-16s %14.2f %14.2f %9.1fx\n", "nearest unit",
+           legacy_nearest * 1e6, columns_nearest * 1e6, legacy_nearest / columns_nearest);
+    printf("Checksums: %s\n", checksum_legacy == checksum_columns ? "match" : "MISMATCH");
+    
+    free(legacy);
+    free_system(system);
+    return checksum_legacy == checksum_columns ? 0 : 1;
+}
+
+#define LATENCY_SUB_BITS 5                          // 32 sub-buckets per power of two (~3% precision)
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+
+// Operations driven by the load benchmark, in call-mix order
+enum { LOAD_BOOK, LOAD_UPDATE, LOAD_NEAREST, LOAD_FIND, LOAD_REPORT, LOAD_OPERATIONS };
+
+// Log-linear latency histogram for one operation
+typedef struct {
+    const char* name;
+    int mix_percent;           // Share of the call mix
+    long count;
+    double total_seconds;
+    double max_seconds;
+    long buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+/**
+ * Adds one timed call to a histogram. Values below 32ns get exact buckets;
+ * above that each power of two is split into 32 buckets.
+ */
+static void latency_record(LatencyHistogram* histogram, double seconds) {
+    uint64_t ns = (uint64_t)(seconds * 1e9);
+    int bucket = (int)ns;
+    
+    if (ns >= LATENCY_SUB_BUCKETS) {
+        int shift = 0;
+        while ((ns >> shift) >= 2 * LATENCY_SUB_BUCKETS) {
+            shift++;
+        }
+        bucket = (shift + 1) * LATENCY_SUB_BUCKETS + (int)((ns >> shift) - LATENCY_SUB_BUCKETS);
+    }
+    
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->total_seconds += seconds;
+    if (seconds > histogram->max_seconds) {
+        histogram->max_seconds = seconds;
+    }
+}
+
+/**
+ * Returns the latency in microseconds below which the given fraction of
+ * calls fell (upper edge of the bucket holding that rank)
+ */
+static double latency_percentile(const LatencyHistogram* histogram, double fraction) {
+    long rank = (long)ceil(fraction * histogram->count);
+    long seen = 0;
+    
+    if (rank < 1) rank = 1;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) {
+            if (bucket < LATENCY_SUB_BUCKETS) {
+                return (bucket + 1) / 1000.0;
+            }
+            int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+            int sub = bucket % LATENCY_SUB_BUCKETS;
+            return (double)((uint64_t)(LATENCY_SUB_BUCKETS + sub + 1) << shift) / 1000.0;
+        }
+    }
+    return histogram->max_seconds * 1e6;
+}
+
+/**
+ * Nearest available unit of at least min_type by a full scan of the
+ * status, type and location columns: the baseline for the indexed query
+ * Returns: Ambulance slot, or -1 if none qualifies
+ */
+static int nearest_qualified_scan(BAPESSS_System* system, int min_type, float loc_x, float loc_y,
+                                  float* out_dist2) {
+    int nearest = -1;
+    float min_distance = INFINITY;
+    for (int i = 0; i < system->ambulance_count; i++) {
+        if (system->amb_status[i] == 0 && system->amb_type[i] >= min_type) {
+            float dx = loc_x - system->amb_x[i];
+            float dy = loc_y - system->amb_y[i];
+            float distance = dx * dx + dy * dy;
+            if (distance < min_distance) {
+                min_distance = distance;
+                nearest = i;
+            }
+        }
+    }
+    *out_dist2 = min_distance;
+    return nearest;
+}
+
+/**
+ * Times nearest_qualified_ambulance against a full column scan for each
+ * emergency level on a fleet where advanced and ICU units are scarce,
+ * and checks that both find a unit at the same distance
+ */
+static int run_qualified_benchmark(int fleet_size) {
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    
+    static const int scarce_types[AMBULANCE_TYPES] = {75, 22, 3}; // 3% Mobile ICU
+    uint64_t rng = 0x853C49E6748FEA9BULL;
+    if (bench_fill_fleet(system, fleet_size, scarce_types, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free_system(system);
+        return 1;
+    }
+    for (int i = 0; i < fleet_size; i++) {
+        if (bench_random(&rng) % 2 != 0) {
+            set_ambulance_status(system, i, 1);
+        }
+    }
+    
+    int queries = 20000;
+    int scan_queries = (int)(200000000LL / fleet_size);
+    if (scan_queries < 100) scan_queries = 100;
+    if (scan_queries > queries) scan_queries = queries;
+    long mismatches = 0;
+    
+    printf("Nearest qualified ambulance: %d units (75%% basic, 22%% advanced, 3%% ICU), half available\n",
+           fleet_size);
+    printf("%-8s %14s %14s %10s\n", "level", "scan (us)", "index (us)", "speedup");
+    for (int level = 1; level <= EMERGENCY_LEVELS; level++) {
+        uint64_t query_rng = 0x9E3779B97F4A7C15ULL + level;
+        double start = monotonic_seconds();
+        volatile long sink = 0;
+        for (int q = 0; q < scan_queries; q++) {
+            float loc_x = (float)(bench_random(&query_rng) % 100000) / 1000.0f;
+            float loc_y = (float)(bench_random(&query_rng) % 100000) / 1000.0f;
+            float distance;
+            sink += nearest_qualified_scan(system, level, loc_x, loc_y, &distance);
+        }
+        double scan_seconds = (monotonic_seconds() - start) / scan_queries;
+        
+        query_rng = 0x9E3779B97F4A7C15ULL + level;
+        start = monotonic_seconds();
+        for (int q = 0; q < queries; q++) {
+            float loc_x = (float)(bench_random(&query_rng) % 100000) / 1000.0f;
+            float loc_y = (float)(bench_random(&query_rng) % 100000) / 1000.0f;
+            float distance;
+            sink -= nearest_qualified_ambulance(system, level, loc_x, loc_y, &distance, NULL);
+        }
+        double index_seconds = (monotonic_seconds() - start) / queries;
+        
+        // Same queries again, answers compared (slots may differ on ties)
+        query_rng = 0x9E3779B97F4A7C15ULL + level;
+        for (int q = 0; q < scan_queries; q++) {
+            float loc_x = (float)(bench_random(&query_rng) % 100000) / 1000.0f;
+            float loc_y = (float)(bench_random(&query_rng) % 100000) / 1000.0f;
+            float scan_distance, index_distance = INFINITY;
+            int scanned = nearest_qualified_scan(system, level, loc_x, loc_y, &scan_distance);
+            int indexed = nearest_qualified_ambulance(system, level, loc_x, loc_y, &index_distance, NULL);
+            mismatches += (scanned == -1) != (indexed == -1) ||
+                          (indexed != -1 && (index_distance != scan_distance ||
+                                             system->amb_type[indexed] < level ||
+                                             system->amb_status[indexed] != 0));
+        }
+        printf("%-8d %14.2f %14.2f %9.0fx\n", level, scan_seconds * 1e6, index_seconds * 1e6,
+               scan_seconds / index_seconds);
+    }
+    printf("Answers differing from the scan: %ld\n", mismatches);
+    
+    free_system(system);
+    return mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * Times the nearest-unit kernels on a call burst, one query at a time
+ * and in batches, against the scalar column scan and the grid search,
+ * and checks that every kernel returns the scan's unit
+ */
+static int run_nearest_benchmark(int fleet_size, int burst) {
+    BAPESSS_System* system = create_system();
+    int queries = (int)(400000000LL / fleet_size);
+    if (queries < 1000) queries = 1000;
+    if (queries > 200000) queries = 200000;
+    queries = (queries + burst - 1) / burst * burst;
+    float* loc_x = (float*)malloc((size_t)queries * sizeof(float));
+    float* loc_y = (float*)malloc((size_t)queries * sizeof(float));
+    int* levels = (int*)malloc((size_t)queries * sizeof(int));
+    int* expected = (int*)malloc((size_t)queries * sizeof(int));
+    int* slots = (int*)malloc((size_t)queries * sizeof(int));
+    float* distances = (float*)malloc((size_t)queries * sizeof(float));
+    if (system == NULL || loc_x == NULL || loc_y == NULL || levels == NULL || expected == NULL ||
+        slots == NULL || distances == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        free(loc_x); free(loc_y); free(levels); free(expected); free(slots); free(distances);
+        free_system(system);
+        return 1;
+    }
+    
+    static const int scarce_types[AMBULANCE_TYPES] = {75, 22, 3};
+    uint64_t rng = 0x2545F4914F6CDD1DULL;
+    if (bench_fill_fleet(system, fleet_size, scarce_types, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free(loc_x); free(loc_y); free(levels); free(expected); free(slots); free(distances);
+        free_system(system);
+        return 1;
+    }
+    for (int i = 0; i < fleet_size; i++) {
+        if (bench_random(&rng) % 2 != 0) {
+            set_ambulance_status(system, i, 1);
+        }
+    }
+    for (int q = 0; q < queries; q++) {
+        loc_x[q] = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        loc_y[q] = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        levels[q] = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+    }
+    
+    double start = monotonic_seconds();
+    for (int q = 0; q < queries; q++) {
+        expected[q] = nearest_qualified_scan(system, levels[q], loc_x[q], loc_y[q], &distances[q]);
+    }
+    double scan_seconds = (monotonic_seconds() - start) / queries;
+    
+    long mismatches = 0;
+    start = monotonic_seconds();
+    for (int q = 0; q < queries; q++) {
+        grid_k_nearest_qualified(system, loc_x[q], loc_y[q], levels[q], 1, &slots[q], &distances[q]);
+    }
+    double grid_seconds = (monotonic_seconds() - start) / queries;
+    for (int q = 0; q < queries; q++) {
+        float scan_distance;
+        nearest_qualified_scan(system, levels[q], loc_x[q], loc_y[q], &scan_distance);
+        mismatches += expected[q] != -1 && distances[q] != scan_distance; // Ties may pick another slot
+    }
+    
+    printf("Nearest qualified unit: %d units, %d queries, bursts of %d\n", fleet_size, queries, burst);
+    printf("%-14s %16s %16s\n", "kernel", "single (ns)", "batched (ns)");
+    printf("%-14s %16.1f\n", "scan loop", scan_seconds * 1e9);
+    printf("%-14s %16.1f\n", "grid search", grid_seconds * 1e9);
+    
+    const char* names[3] = {"scalar", "SSE2", "AVX2"};
+    NearestKernel kernels[3] = {nearest_block_scalar, NULL, NULL};
+#ifdef KERNEL_SSE2
+    kernels[1] = nearest_block_sse2;
+#endif
+#ifdef KERNEL_AVX2
+    if (__builtin_cpu_supports("avx2")) kernels[2] = nearest_block_avx2;
+#endif
+    for (int k = 0; k < 3; k++) {
+        if (kernels[k] == NULL) {
+            continue;
+        }
+        start = monotonic_seconds();
+        for (int q = 0; q < queries; q++) {
+            nearest_batch_with(system, kernels[k], &loc_x[q], &loc_y[q], &levels[q], 1, &slots[q], &distances[q]);
+        }
+        double single_seconds = (monotonic_seconds() - start) / queries;
+        for (int q = 0; q < queries; q++) {
+            mismatches += slots[q] != expected[q];
+        }
+        
+        start = monotonic_seconds();
+        for (int q = 0; q < queries; q += burst) {
+            nearest_batch_with(system, kernels[k], &loc_x[q], &loc_y[q], &levels[q], burst, &slots[q],
+                               &distances[q]);
+        }
+        double batched_seconds = (monotonic_seconds() - start) / queries;
+        for (int q = 0; q < queries; q++) {
+            mismatches += slots[q] != expected[q];
+        }
+        printf("%-14s %16.1f %16.1f  (%.1fx the scan loop)\n", names[k], single_seconds * 1e9,
+               batched_seconds * 1e9, scan_seconds / batched_seconds);
+    }
+    printf("Answers differing from the scan: %ld\n", mismatches);
+    
+    free(loc_x); free(loc_y); free(levels); free(expected); free(slots); free(distances);
+    free_system(system);
+    return mismatches == 0 ? 0 : 1;
+}
+
+#ifdef _WIN32
+#define BENCH_NULL_DEVICE "NUL"
+#else
+#define BENCH_NULL_DEVICE "/dev/null"
+#endif
+
+/**
+ * Points stdout at the null device, so operations that print can be
+ * timed as they run without flooding the terminal
+ * Returns: Descriptor of the real stdout for bench_restore_stdout, or -1
+ * if stdout was left as it was
+ */
+static int bench_mute_stdout(void) {
+    fflush(stdout);
+    FILE* null_device = fopen(BENCH_NULL_DEVICE, "w");
+    if (null_device == NULL) {
+        return -1;
+    }
+    int saved = dup(fileno(stdout));
+    if (saved != -1 && dup2(fileno(null_device), fileno(stdout)) == -1) {
+        close(saved);
+        saved = -1;
+    }
+    fclose(null_device);
+    return saved;
+}
+
+/**
+ * Points stdout back at the descriptor saved by bench_mute_stdout
+ */
+static void bench_restore_stdout(int saved) {
+    if (saved == -1) {
+        return;
+    }
+    fflush(stdout);
+    dup2(saved, fileno(stdout));
+    close(saved);
+}
+
+/**
+ * Drives the booking operations with a dispatcher-like call mix until
+ * booking_target bookings exist, timing every call. Each booking is
+ * dispatched and completed by later updates, so ambulances cycle back
+ * into the pool and queued calls get served as they would in service.
+ * The nearest-unit and report screens run in full, printing to the null
+ * device.
+ */
+static int run_load_benchmark(int fleet_size, int booking_target) {
+    static LatencyHistogram histograms[LOAD_OPERATIONS] = {
+        {"book_ambulance", 25, 0, 0, 0, {0}},
+        {"update_status", 55, 0, 0, 0, {0}},
+        {"find_nearest", 12, 0, 0, 0, {0}},
+        {"find_available", 6, 0, 0, 0, {0}},
+        {"generate_report", 2, 0, 0, 0, {0}},
+    };
+    static const char* hospitals[] = {"City Hospital", "General Hospital", "St. Mary's", "Apollo", "Lilavati"};
+    
+    BAPESSS_System* system = create_system();
+    int* open = (int*)malloc(fleet_size * sizeof(int)); // Slots of bookings holding an ambulance
+    if (system == NULL || open == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        free(open);
+        free_system(system);
+        return 1;
+    }
+    
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    if (bench_fill_fleet(system, fleet_size, NULL, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free(open);
+        free_system(system);
+        return 1;
+    }
+    
+    int open_count = 0;
+    long operations = 0;
+    volatile long sink = 0;
+    int saved_stdout = bench_mute_stdout();
+    double run_start = monotonic_seconds();
+    
+    while (system->booking_count < booking_target) {
+        int roll = (int)(bench_random(&rng) % 100);
+        int op = 0;
+        while (op < LOAD_OPERATIONS - 1 && roll >= histograms[op].mix_percent) {
+            roll -= histograms[op].mix_percent;
+            op++;
+        }
+        if (op == LOAD_UPDATE && open_count == 0) {
+            op = LOAD_BOOK;
+        }
+        
+        // Inputs are prepared outside the timed region
+        Booking request;
+        int pick = 0, new_status = 0, served = -1;
+        float loc_x = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        float loc_y = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        int level = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+        
+        if (op == LOAD_BOOK) {
+            long n = system->booking_count;
+            snprintf(request.patient_name, sizeof(request.patient_name), "Patient %ld", n);
+            snprintf(request.patient_contact, sizeof(request.patient_contact), "97%08ld", n % 100000000);
+            snprintf(request.pickup_location, sizeof(request.pickup_location), "Sector %ld", n % 500);
+            snprintf(request.hospital, sizeof(request.hospital), "%s", hospitals[n % 5]);
+            request.emergency_level = level;
+        } else if (op == LOAD_UPDATE) {
+            pick = (int)(bench_random(&rng) % open_count);
+            new_status = booking_at(system, open[pick])->status == 1 ? 2 : 3;
+        }
+        
+        double start = monotonic_seconds();
+        switch (op) {
+            case LOAD_BOOK: {
+                int slot = create_booking(system, &request);
+                if (slot != -1 && request.status == 1) {
+                    open[open_count++] = slot;
+                }
+                break;
+            }
+            case LOAD_UPDATE:
+                change_booking_status(system, booking_at(system, open[pick])->booking_id, new_status, &served);
+                break;
+            case LOAD_NEAREST:
+                find_nearest_ambulance(system, loc_x, loc_y);
+                break;
+            case LOAD_FIND:
+                sink += find_available_ambulance(system, level);
+                break;
+            case LOAD_REPORT:
+                generate_report(system);
+                break;
+        }
+        latency_record(&histograms[op], monotonic_seconds() - start);
+        operations++;
+        
+        // Completed bookings release their ambulance, possibly to a queued call
+        if (op == LOAD_UPDATE && new_status == 3) {
+            open[pick] = open[--open_count];
+            if (served != -1) {
+                open[open_count++] = served;
+            }
+        }
+    }
+    double run_seconds = monotonic_seconds() - run_start;
+    bench_restore_stdout(saved_stdout);
     
-    printf("Enter driver contact: ");
-    fgets(new_ambulance.driver_contact, sizeof(new_ambulance.driver_contact), stdin);
-    new_ambulance.driver_contact[strcspn(new_ambulance.driver_contact, "\n")] = 0;
+    printf("Load benchmark: %d ambulances, %d bookings, %ld operations in %.2f s (%.0f ops/s overall)\n",
+           fleet_size, system->booking_count, operations, run_seconds, operations / run_seconds);
+    printf("%-16s %5s %10s %12s %10s %10s %10s %10s\n",
+           "operation", "mix", "calls", "ops/s", "p50 (us)", "p99 (us)", "p999 (us)", "max (us)");
+    for (int op = 0; op < LOAD_OPERATIONS; op++) {
+        LatencyHistogram* histogram = &histograms[op];
+        if (histogram->count == 0) {
+            continue;
+        }
+        printf("%-16s %4d%% %10ld %12.0f %10.2f %10.2f %10.2f %10.2f\n",
+               histogram->name, histogram->mix_percent, histogram->count,
+               histogram->count / histogram->total_seconds,
+               latency_percentile(histogram, 0.50), latency_percentile(histogram, 0.99),
+               latency_percentile(histogram, 0.999), histogram->max_seconds * 1e6);
+    }
+    printf("Open bookings at end: %d, queued: %d\n", open_count, system->counters.booking_status[0]);
     
-    printf("\nSelect ambulance type:\n");
-    printf("1. Basic Life Support\n");
-    printf("2. Advanced Life Support\n");
-    printf("3. Mobile ICU\n");
-    printf("Enter type (1-3): ");
-    scanf("%d", &new_ambulance.type);
+    int consistent = counters_verify(system);
+    printf("Report counters: %s\n", consistent ? "consistent" : "MISMATCH");
+    
+    free(open);
+    free_system(system);
+    return consistent ? 0 : 1;
+}
+
+/**
+ * Saves a synthetic history as a snapshot and times loading it back.
+ * Loading maps the file instead of copying records, so it should take
+ * about the same time for any history length. Spot-checks the reloaded
+ * bookings against the originals.
+ */
+static int run_snapshot_benchmark(int booking_count) {
+    const char* path = "bench.snap";
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    if (bench_fill(system, 1000, booking_count, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free_system(system);
+        return 1;
+    }
+    
+    double start = monotonic_seconds();
+    int saved = save_snapshot(system, path, 0);
+    double save_seconds = monotonic_seconds() - start;
+    if (saved != 0) {
+        printf("Error: Could not write %s!\n", path);
+        free_system(system);
+        return 1;
+    }
+    
+    BAPESSS_System* loaded = create_system();
+    start = monotonic_seconds();
+    int result = loaded != NULL ? load_snapshot(loaded, path, NULL) : -1;
+    double load_seconds = monotonic_seconds() - start;
+    
+    start = monotonic_seconds();
+    int intact = check_snapshot(path) == 0;
+    double check_seconds = monotonic_seconds() - start;
+    
+    int mismatches = 0;
+    if (result == 0) {
+        for (int i = 0; i < 1000; i++) {
+            int slot = (int)(bench_random(&rng) % system->booking_count);
+            Booking expected, actual;
+            get_booking(system, slot, &expected);
+            get_booking(loaded, find_booking_slot(loaded, expected.booking_id), &actual);
+            mismatches += memcmp(&expected, &actual, sizeof(Booking)) != 0;
+        }
+        mismatches += !counters_verify(loaded);
+    }
+    
+    printf("Snapshot benchmark: %d bookings, %.1f MB\n", system->booking_count,
+           loaded != NULL ? loaded->snapshot.size / 1e6 : 0.0);
+    printf("  save: %.3f s\n", save_seconds);
+    printf("  load: %.3f s (%s)\n", load_seconds, result == 0 ? "ok" : "FAILED");
+    printf("  full checksum check: %.3f s (%s)\n", check_seconds, intact ? "ok" : "FAILED");
+    printf("  spot checks: %s\n", mismatches == 0 ? "match" : "MISMATCH");
+    
+    free_system(loaded);
+    free_system(system);
+    remove(path);
+    return result == 0 && intact && mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * Runs a journaled booking workload twice: with group commit, and with an
+ * fsync after every operation. Then recovers a fresh system from the
+ * snapshot and journal and checks that it matches the live one.
+ */
+static int run_journal_benchmark(int operations) {
+    const char* snapshot_path = "bench.snap";
+    const char* journal_path = "bench.journal";
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    if (bench_fill(system, 1000, 0, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free_system(system);
+        return 1;
+    }
+    if (save_snapshot(system, snapshot_path, 0) != 0 || journal_start(system, journal_path, 0) != 0) {
+        printf("Error: Could not create %s and %s!\n", snapshot_path, journal_path);
+        free_system(system);
+        return 1;
+    }
+    
+    // Group commit first, then one fsync per operation on a smaller run
+    for (int force = 0; force <= 1; force++) {
+        int count = force ? (operations < 2000 ? operations : 2000) : operations;
+        long syncs_before = system->journal->syncs;
+        double start = monotonic_seconds();
+        for (int i = 0; i < count; i++) {
+            Booking request;
+            snprintf(request.patient_name, sizeof(request.patient_name), "Patient %d", system->booking_count);
+            snprintf(request.patient_contact, sizeof(request.patient_contact), "97%08d", i);
+            snprintf(request.pickup_location, sizeof(request.pickup_location), "Sector %d", i % 500);
+            snprintf(request.hospital, sizeof(request.hospital), "Hospital %d", i % 20);
+            request.emergency_level = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+            create_booking(system, &request);
+            
+            int served;
+            int target = 1001 + (int)(bench_random(&rng) % system->booking_count);
+            change_booking_status(system, target, 2 + (int)(bench_random(&rng) % 3), &served);
+            journal_commit(system, force);
+        }
+        journal_commit(system, 1);
+        double seconds = monotonic_seconds() - start;
+        long syncs = system->journal->syncs - syncs_before;
+        printf("%-20s %8d ops %8.3f s %10.0f ops/s %8ld fsyncs (%.1f ops per fsync)\n",
+               force ? "fsync per operation" : "group commit", count, seconds, count / seconds,
+               syncs, syncs > 0 ? (double)count / syncs : 0.0);
+    }
+    uint64_t journal_size = system->journal->file_size;
+    journal_close(system);
+    
+    // Recover into a fresh system and compare
+    BAPESSS_System* recovered = create_system();
+    uint64_t lsn = 0;
+    double start = monotonic_seconds();
+    int ok = recovered != NULL && load_snapshot(recovered, snapshot_path, &lsn) == 0 &&
+             journal_recover(recovered, journal_path, lsn) >= 0;
+    double recover_seconds = monotonic_seconds() - start;
+    
+    int mismatches = 0;
+    if (ok) {
+        mismatches += recovered->booking_count != system->booking_count;
+        mismatches += memcmp(&recovered->counters, &system->counters, sizeof(ReportCounters)) != 0;
+        for (int i = 0; i < system->booking_count && mismatches == 0; i++) {
+            Booking expected, actual;
+            get_booking(system, i, &expected);
+            get_booking(recovered, i, &actual);
+            mismatches += memcmp(&expected, &actual, sizeof(Booking)) != 0;
+        }
+        for (int i = 0; i < system->ambulance_count && mismatches == 0; i++) {
+            mismatches += system->amb_status[i] != recovered->amb_status[i];
+        }
+    }
+    printf("Recovery: %d records (%.1f MB) replayed in %.3f s, state %s\n",
+           ok ? recovered->journal->replayed : 0, journal_size / 1e6, recover_seconds,
+           ok && mismatches == 0 ? "matches" : "MISMATCH");
+    
+    free_system(recovered);
+    free_system(system);
+    remove(snapshot_path);
+    remove(journal_path);
+    return ok && mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * Runs one dispatch step: a new call, then a status change on a random
+ * earlier booking, logged with group commit. The in-memory work and the
+ * commits that reach the disk are timed separately.
+ */
+static void bench_dispatch_step(BAPESSS_System* system, uint64_t* rng, LatencyHistogram* dispatch,
+                                LatencyHistogram* commits) {
+    Booking request;
+    snprintf(request.patient_name, sizeof(request.patient_name), "Patient %d", system->booking_count);
+    snprintf(request.patient_contact, sizeof(request.patient_contact), "97%08d", system->booking_count);
+    snprintf(request.pickup_location, sizeof(request.pickup_location), "Sector %d", system->booking_count % 500);
+    snprintf(request.hospital, sizeof(request.hospital), "Hospital %d", system->booking_count % 20);
+    request.emergency_level = 1 + (int)(bench_random(rng) % EMERGENCY_LEVELS);
+    int target = 1001 + (int)(bench_random(rng) % system->booking_count);
+    int status = 2 + (int)(bench_random(rng) % 3);
+    
+    double start = monotonic_seconds();
+    create_booking(system, &request);
+    int served;
+    change_booking_status(system, target, status, &served);
+    double end = monotonic_seconds();
+    latency_record(dispatch, end - start);
+    
+    long syncs = system->journal->syncs;
+    journal_commit(system, 0);
+    if (system->journal->syncs != syncs) {
+        latency_record(commits, monotonic_seconds() - end);
+    }
+}
+
+/**
+ * Measures dispatch latency with no snapshot running, then while a
+ * snapshot of a large history is written in the background, and compares
+ * both with the stall of writing it inline. Finally recovers a fresh
+ * system from the snapshot and journal and checks it against the live one.
+ */
+static int run_background_benchmark(int booking_count) {
+    const char* snapshot_path = "bench.snap";
+    const char* journal_path = "bench.journal";
+    static LatencyHistogram phases[4] = {
+        {"idle dispatch", 0, 0, 0, 0, {0}},
+        {"idle commit", 0, 0, 0, 0, {0}},
+        {"saving dispatch", 0, 0, 0, 0, {0}},
+        {"saving commit", 0, 0, 0, 0, {0}},
+    };
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    if (bench_fill(system, 1000, booking_count, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free_system(system);
+        return 1;
+    }
+    double start = monotonic_seconds();
+    int saved = save_snapshot(system, snapshot_path, 0);
+    double inline_seconds = monotonic_seconds() - start;
+    if (saved != 0 || journal_start(system, journal_path, 0) != 0) {
+        printf("Error: Could not create %s and %s!\n", snapshot_path, journal_path);
+        free_system(system);
+        return 1;
+    }
+    
+    for (int i = 0; i < 200000; i++) {
+        bench_dispatch_step(system, &rng, &phases[0], &phases[1]);
+    }
+    
+    start = monotonic_seconds();
+    int started = snapshot_start_background(system, snapshot_path);
+    double fork_seconds = monotonic_seconds() - start;
+    int result = started;
+    while (result == 1) {
+        bench_dispatch_step(system, &rng, &phases[2], &phases[3]);
+        result = snapshot_poll(system, 0) == 0 ? 1 : 0;
+    }
+    double background_seconds = monotonic_seconds() - start;
+    // Keep going a little so the rebased journal holds records past the snapshot
+    for (int i = 0; i < 1000; i++) {
+        bench_dispatch_step(system, &rng, &phases[2], &phases[3]);
+    }
+    journal_commit(system, 1);
+    
+    printf("Background snapshot benchmark: %d bookings\n", booking_count);
+    printf("  inline save stalls dispatch for %.3f s\n", inline_seconds);
+    printf("  background save: %.3f s, start (fork) %.3f ms, %s\n", background_seconds,
+           fork_seconds * 1e3, started == 1 ? "forked" : started == 0 ? "written inline" : "FAILED");
+    printf("%-16s %10s %10s %10s %10s %10s\n", "", "calls", "p50 us", "p99 us", "p99.9 us", "max us");
+    for (int i = 0; i < 4; i++) {
+        printf("%-16s %10ld %10.2f %10.2f %10.2f %10.1f\n", phases[i].name, phases[i].count,
+               latency_percentile(&phases[i], 0.50), latency_percentile(&phases[i], 0.99),
+               latency_percentile(&phases[i], 0.999), phases[i].max_seconds * 1e6);
+    }
+    
+    // Recover into a fresh system and compare
+    BAPESSS_System* recovered = create_system();
+    uint64_t lsn = 0;
+    int ok = started >= 0 && recovered != NULL && load_snapshot(recovered, snapshot_path, &lsn) == 0 &&
+             journal_recover(recovered, journal_path, lsn) >= 0;
+    int mismatches = 0;
+    if (ok) {
+        mismatches += recovered->booking_count != system->booking_count;
+        mismatches += memcmp(&recovered->counters, &system->counters, sizeof(ReportCounters)) != 0;
+        for (int i = 0; i < 1000 && mismatches == 0; i++) {
+            int slot = (int)(bench_random(&rng) % system->booking_count);
+            Booking expected, actual;
+            get_booking(system, slot, &expected);
+            get_booking(recovered, slot, &actual);
+            mismatches += memcmp(&expected, &actual, sizeof(Booking)) != 0;
+        }
+    }
+    printf("Recovery: snapshot at record %llu plus %d journaled records, state %s\n",
+           (unsigned long long)lsn, ok ? recovered->journal->replayed : 0,
+           ok && mismatches == 0 ? "matches" : "MISMATCH");
+    
+    free_system(recovered);
+    free_system(system);
+    remove(snapshot_path);
+    remove(journal_path);
+    return ok && mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * Counts ambulances held by more than one open booking, or held by one
+ * while marked available
+ * Returns: Number of such ambulances, or -1 on allocation failure
+ */
+static int count_double_assignments(BAPESSS_System* system) {
+    int* holders = (int*)calloc((size_t)system->ambulance_count + 1, sizeof(int));
+    if (holders == NULL) {
+        return -1;
+    }
+    int doubled = 0;
+    for (int i = 0; i < system->booking_count; i++) {
+        BookingRecord* record = booking_at(system, i);
+        if (record->status != 1 && record->status != 2) {
+            continue;
+        }
+        int slot = find_ambulance_slot(system, record->ambulance_id);
+        if (slot == -1 || ++holders[slot] > 1 || system->amb_status[slot] == 0) {
+            doubled++;
+        }
+    }
+    free(holders);
+    return doubled;
+}
+
+/**
+ * Picks the nearest qualified unit for each call in arrival order, as a
+ * dispatcher taking calls one at a time would
+ * Returns: Number of calls given a unit
+ */
+static int greedy_assignment(BAPESSS_System* system, const DispatchCall* calls, int count, int* out_slots) {
+    char* taken = (char*)calloc((size_t)system->ambulance_count + 1, 1);
+    int* slots = (int*)malloc((size_t)system->ambulance_count * sizeof(int));
+    float* dist2 = (float*)malloc((size_t)system->ambulance_count * sizeof(float));
+    int assigned = 0;
+    
+    for (int i = 0; i < count; i++) {
+        out_slots[i] = -1;
+        for (int k = ASSIGN_CANDIDATES; taken != NULL && slots != NULL && dist2 != NULL; k *= 4) {
+            if (k > system->ambulance_count) k = system->ambulance_count;
+            int found = grid_k_nearest_qualified(system, calls[i].loc_x, calls[i].loc_y,
+                                                 calls[i].request.emergency_level, k, slots, dist2);
+            for (int j = 0; j < found && out_slots[i] == -1; j++) {
+                if (!taken[slots[j]]) out_slots[i] = slots[j];
+            }
+            if (out_slots[i] != -1 || found < k || k == system->ambulance_count) break;
+        }
+        if (out_slots[i] != -1) {
+            taken[out_slots[i]] = 1;
+            assigned++;
+        }
+    }
+    free(taken);
+    free(slots);
+    free(dist2);
+    return assigned;
+}
+
+/**
+ * Solves a batch over every available qualified unit of every call, with
+ * the rows in the order plan_batch_assignment uses, as a reference for
+ * its narrower candidate lists. Only for small batches.
+ * Returns: Number of calls given a unit, or -1 on allocation failure
+ */
+static int dense_assignment(BAPESSS_System* system, const DispatchCall* calls, int count, int* out_slots) {
+    int units = system->ambulance_count;
+    int* order = (int*)malloc(((size_t)count + 1) * sizeof(int));
+    int* match_row = (int*)malloc(((size_t)count + 1) * sizeof(int));
+    int* edge_start = (int*)malloc(((size_t)count + 1) * sizeof(int));
+    int* edge_column = (int*)malloc(((size_t)count * units + 1) * sizeof(int));
+    double* edge_cost = (double*)malloc(((size_t)count * units + 1) * sizeof(double));
+    int* slots = (int*)malloc(((size_t)units + 1) * sizeof(int));
+    float* dist2 = (float*)malloc(((size_t)units + 1) * sizeof(float));
+    int assigned = -1;
+    
+    if (order != NULL && match_row != NULL && edge_start != NULL && edge_column != NULL &&
+        edge_cost != NULL && slots != NULL && dist2 != NULL) {
+        // Columns are the ambulance slots themselves
+        assign_row_order(calls, count, order);
+        int edges = 0;
+        for (int r = 0; r < count; r++) {
+            const DispatchCall* call = &calls[order[r]];
+            edge_start[r] = edges;
+            int found = grid_k_nearest_qualified(system, call->loc_x, call->loc_y,
+                                                 call->request.emergency_level, units, slots, dist2);
+            for (int j = 0; j < found; j++) {
+                edge_column[edges] = slots[j];
+                edge_cost[edges++] = sqrt((double)dist2[j]);
+            }
+        }
+        edge_start[count] = edges;
+        assigned = solve_assignment(count, units, edge_start, edge_column, edge_cost, match_row, NULL);
+        for (int r = 0; assigned >= 0 && r < count; r++) {
+            out_slots[order[r]] = match_row[r];
+        }
+    }
+    free(order); free(match_row); free(edge_start); free(edge_column);
+    free(edge_cost); free(slots); free(dist2);
+    return assigned;
+}
+
+/**
+ * Sums the distances of a set of assignments and checks them: every
+ * unit must be qualified for its call and used at most once
+ * Returns: 1 if the assignments are valid
+ */
+static int assignment_total(BAPESSS_System* system, const DispatchCall* calls, int count,
+                            const int* slots, double* total) {
+    char* used = (char*)calloc((size_t)system->ambulance_count + 1, 1);
+    int valid = used != NULL;
+    *total = 0;
+    for (int i = 0; valid && i < count; i++) {
+        int slot = slots[i];
+        if (slot == -1) continue;
+        valid = !used[slot] && system->amb_type[slot] >= calls[i].request.emergency_level;
+        used[slot] = 1;
+        double dx = calls[i].loc_x - system->amb_x[slot];
+        double dy = calls[i].loc_y - system->amb_y[slot];
+        *total += sqrt(dx * dx + dy * dy);
+    }
+    free(used);
+    return valid;
+}
+
+/**
+ * Compares one-at-a-time nearest-unit dispatch with the joint assignment
+ * of plan_batch_assignment on a burst of calls, then books the burst
+ * with dispatch_batch and checks the bookings
+ */
+static int run_assign_benchmark(int call_count, int fleet_size) {
+    BAPESSS_System* system = create_system();
+    DispatchCall* calls = (DispatchCall*)calloc((size_t)call_count, sizeof(DispatchCall));
+    int* greedy = (int*)malloc((size_t)call_count * sizeof(int));
+    int* joint = (int*)malloc((size_t)call_count * sizeof(int));
+    uint64_t rng = 0x2545F4914F6CDD1DULL;
+    if (system == NULL || calls == NULL || greedy == NULL || joint == NULL ||
+        bench_fill(system, fleet_size, 0, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free(calls); free(greedy); free(joint);
+        free_system(system);
+        return 1;
+    }
+    for (int i = 0; i < call_count; i++) {
+        Booking* request = &calls[i].request;
+        snprintf(request->patient_name, sizeof(request->patient_name), "Patient %d", i);
+        snprintf(request->patient_contact, sizeof(request->patient_contact), "97%08d", i);
+        snprintf(request->pickup_location, sizeof(request->pickup_location), "Sector %d", i % 500);
+        snprintf(request->hospital, sizeof(request->hospital), "Hospital %d", i % 20);
+        request->emergency_level = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+        calls[i].loc_x = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        calls[i].loc_y = (float)(bench_random(&rng) % 100000) / 1000.0f;
+    }
+    
+    double start = monotonic_seconds();
+    int greedy_served = greedy_assignment(system, calls, call_count, greedy);
+    double greedy_seconds = monotonic_seconds() - start;
+    start = monotonic_seconds();
+    int joint_served = plan_batch_assignment(system, calls, call_count, joint);
+    double joint_seconds = monotonic_seconds() - start;
+    
+    double greedy_total, joint_total;
+    int valid = assignment_total(system, calls, call_count, greedy, &greedy_total);
+    valid = assignment_total(system, calls, call_count, joint, &joint_total) && valid;
+    
+    start = monotonic_seconds();
+    int booked = dispatch_batch(system, calls, call_count);
+    double dispatch_seconds = monotonic_seconds() - start;
+    int matches_plan = booked == call_count, fallback = 0;
+    for (int i = 0; i < call_count; i++) {
+        int slot = calls[i].request.ambulance_id != 0 ?
+                   find_ambulance_slot(system, calls[i].request.ambulance_id) : -1;
+        matches_plan = matches_plan && (joint[i] == -1 || slot == joint[i]);
+        fallback += joint[i] == -1 && slot != -1;
+    }
+    int doubled = count_double_assignments(system);
+    
+    // Small crowded bursts: calls packed into a few km, so their nearest
+    // candidate lists overlap, each planned and solved densely
+    int dense_trials = 300, dense_differ = 0;
+    for (int t = 0; t < dense_trials && valid; t++) {
+        BAPESSS_System* small = create_system();
+        int units = 10 + (int)(bench_random(&rng) % 60);
+        int burst = 2 + (int)(bench_random(&rng) % 40);
+        if (small == NULL || bench_fill(small, units, 0, &rng) != 0) {
+            free_system(small);
+            valid = 0;
+            break;
+        }
+        float center_x = (float)(bench_random(&rng) % 80000) / 1000.0f + 10.0f;
+        float center_y = (float)(bench_random(&rng) % 80000) / 1000.0f + 10.0f;
+        for (int i = 0; i < burst; i++) {
+            calls[i].request.emergency_level = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+            calls[i].loc_x = center_x + (float)(bench_random(&rng) % 6000) / 1000.0f;
+            calls[i].loc_y = center_y + (float)(bench_random(&rng) % 6000) / 1000.0f;
+        }
+        double planned_total, dense_total;
+        int planned = plan_batch_assignment(small, calls, burst, joint);
+        int dense = dense_assignment(small, calls, burst, greedy);
+        valid = planned >= 0 && dense >= 0 && valid &&
+                assignment_total(small, calls, burst, joint, &planned_total) &&
+                assignment_total(small, calls, burst, greedy, &dense_total);
+        if (valid && (planned != dense || fabs(planned_total - dense_total) > 1e-6 * (1.0 + dense_total))) {
+            dense_differ++;
+        }
+        free_system(small);
+    }
+    
+    printf("Batch assignment: %d calls, %d ambulances\n", call_count, fleet_size);
+    printf("%-20s %8s %14s %12s %10s\n", "policy", "served", "total distance", "mean", "time (ms)");
+    printf("%-20s %8d %14.1f %12.3f %10.2f\n", "nearest, in order", greedy_served, greedy_total,
+           greedy_served > 0 ? greedy_total / greedy_served : 0, greedy_seconds * 1e3);
+    printf("%-20s %8d %14.1f %12.3f %10.2f\n", "joint (Hungarian)", joint_served, joint_total,
+           joint_served > 0 ? joint_total / joint_served : 0, joint_seconds * 1e3);
+    if (greedy_total > 0) {
+        printf("Joint plan drives %.1f%% less in total\n", 100.0 * (1.0 - joint_total / greedy_total));
+    }
+    printf("dispatch_batch booked %d calls in %.2f ms (%d given a lower type by the single-call "
+           "fallback); plan followed: %s, ambulances held by two open bookings: %d, assignments %s\n",
+           booked, dispatch_seconds * 1e3, fallback, matches_plan ? "yes" : "NO",
+           doubled, valid ? "valid" : "INVALID");
+    printf("Small crowded bursts whose plan differs from a dense solve: %d of %d\n",
+           dense_differ, dense_trials);
+    
+    free(calls);
+    free(greedy);
+    free(joint);
+    free_system(system);
+    return valid && matches_plan && doubled == 0 && dense_differ == 0 &&
+           joint_served >= greedy_served ? 0 : 1;
+}
+
+/**
+ * Writes a synthetic city of side x side junctions over the 0-100 area
+ * (1 unit = 1 km) as a road file: local streets with an arterial on
+ * every 8th line and an expressway on every 64th, some local streets
+ * missing and some one-way
+ * Returns: 0 on success, -1 if the file could not be written
+ */
+static int write_bench_city(const char* path, int side, uint64_t* rng) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    float spacing = 100.0f / (side - 1);
+    fprintf(file, "c synthetic city for --bench eta\np sp %d %d\n", side * side, 4 * side * (side - 1));
+    for (int row = 0; row < side; row++) {
+        for (int col = 0; col < side; col++) {
+            float jitter_x = ((float)(bench_random(rng) % 1000) / 1000.0f - 0.5f) * 0.4f * spacing;
+            float jitter_y = ((float)(bench_random(rng) % 1000) / 1000.0f - 0.5f) * 0.4f * spacing;
+            fprintf(file, "v %d %.4f %.4f\n", row * side + col + 1,
+                    col * spacing + jitter_x, row * spacing + jitter_y);
+        }
+    }
+    for (int row = 0; row < side; row++) {
+        for (int col = 0; col < side; col++) {
+            for (int dir = 0; dir < 2; dir++) {
+                int next_row = row + dir, next_col = col + 1 - dir;
+                if (next_row >= side || next_col >= side) continue;
+                int line = dir == 0 ? row : col; // The street this segment runs along
+                float kmh = line % 64 == 0 ? 90.0f : (line % 8 == 0 ? 50.0f : 25.0f);
+                int local = kmh < 30.0f;
+                if (local && bench_random(rng) % 100 < 8) continue; // Missing street
+                float seconds = spacing / kmh * 3600.0f * (0.8f + (float)(bench_random(rng) % 400) / 1000.0f);
+                int from = row * side + col + 1, to = next_row * side + next_col + 1;
+                int one_way = local && bench_random(rng) % 100 < 10;
+                if (!one_way || bench_random(rng) % 2 == 0) {
+                    fprintf(file, "a %d %d %.2f\n", from, to, seconds);
+                }
+                if (!one_way || from % 2 == 0) {
+                    fprintf(file, "a %d %d %.2f\n", to, from, seconds);
+                }
+            }
+        }
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+/**
+ * Times ranking ambulances by drive time on a synthetic city. A sample
+ * of queries is checked against a full Dijkstra search from the patient
+ * over the whole graph and against picking the straight-line nearest
+ * unit.
+ */
+static int run_eta_benchmark(int side, int fleet_size) {
+    static LatencyHistogram query = {"rank_by_eta", 100, 0, 0, 0, {0}};
+    const char* path = "bench.roads";
+    uint64_t rng = 0x6A09E667F3BCC909ULL;
+    
+    double start = monotonic_seconds();
+    if (write_bench_city(path, side, &rng) != 0) {
+        printf("Error: Could not write %s!\n", path);
+        return 1;
+    }
+    double write_seconds = monotonic_seconds() - start;
+    
+    BAPESSS_System* system = create_system();
+    start = monotonic_seconds();
+    int loaded = system != NULL ? attach_roads(system, path) : -2;
+    double load_seconds = monotonic_seconds() - start;
+    remove(path);
+    if (loaded != 0 || bench_fill(system, fleet_size, 0, &rng) != 0) {
+        printf("Error: Could not load the road network!\n");
+        free_system(system);
+        return 1;
+    }
+    RoadNetwork* roads = system->roads;
+    
+    int* unit_node = (int*)malloc((size_t)fleet_size * sizeof(int));
+    float* times = (float*)malloc((size_t)roads->node_count * sizeof(float));
+    if (unit_node == NULL || times == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        free(unit_node);
+        free(times);
+        free_system(system);
+        return 1;
+    }
+    for (int i = 0; i < fleet_size; i++) {
+        unit_node[i] = road_snap(roads, system->amb_x[i], system->amb_y[i]);
+    }
+    
+    int queries = 5000, checked = 200;
+    long agree = 0, unranked = 0, straight_differs = 0, straight_stranded = 0;
+    double straight_extra = 0, full_seconds = 0;
+    RoadScratch scratch;
+    memset(&scratch, 0, sizeof(RoadScratch));
+    
+    for (int q = 0; q < queries; q++) {
+        float loc_x = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        float loc_y = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        int level = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+        int slot;
+        float seconds;
+    
+        double begin = monotonic_seconds();
+        int found = rank_by_eta(system, loc_x, loc_y, level, 1, &slot, &seconds);
+        latency_record(&query, monotonic_seconds() - begin);
+        unranked += found == 0;
+        if (q >= checked) {
+            continue;
+        }
+    
+        // Every unit's drive time from one search backwards from the patient
+        begin = monotonic_seconds();
+        road_dijkstra_all(roads, &scratch, road_snap(roads, loc_x, loc_y), 1, times, 1);
+        full_seconds += monotonic_seconds() - begin;
+        float best = INFINITY;
+        for (int i = 0; i < fleet_size; i++) {
+            if (system->amb_type[i] >= level && times[unit_node[i]] < best) {
+                best = times[unit_node[i]];
+            }
+        }
+        agree += found == 1 ? fabsf(seconds - best) <= 1e-3f * (best + 1) : best == INFINITY;
+    
+        int straight;
+        float distance;
+        grid_k_nearest_qualified(system, loc_x, loc_y, level, 1, &straight, &distance);
+        float straight_time = times[unit_node[straight]];
+        if (found == 1 && straight != slot) {
+            straight_differs++;
+            if (straight_time == INFINITY) {
+                straight_stranded++; // Behind a one-way street with no way out
+            } else {
+                straight_extra += straight_time - seconds;
+            }
+        }
+    }
+    
+    printf("Road ETA benchmark: %d junctions, %d road segments, %d ambulances\n",
+           roads->node_count, roads->arc_count, fleet_size);
+    printf("  file written in %.2f s, loaded with %d landmarks in %.2f s\n",
+           write_seconds, roads->landmark_count, load_seconds);
+    printf("  rank_by_eta (nearest qualified by drive time): mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           query.total_seconds / query.count * 1e6, latency_percentile(&query, 0.50),
+           latency_percentile(&query, 0.99), query.max_seconds * 1e6);
+    printf("  full Dijkstra from the patient: mean %.1f ms\n", full_seconds / checked * 1e3);
+    printf("  same drive time as the full search: %ld of %d (no unit reachable: %ld of %d queries)\n",
+           agree, checked, unranked, queries);
+    long compared = straight_differs - straight_stranded;
+    printf("  straight-line nearest is a different unit in %ld of %d calls, %.1f s slower on average there",
+           straight_differs, checked, compared > 0 ? straight_extra / compared : 0.0);
+    if (straight_stranded > 0) {
+        printf(" (%ld could not reach the patient)", straight_stranded);
+    }
+    printf("\n");
+    
+    road_scratch_free(&scratch);
+    free(unit_node);
+    free(times);
+    free_system(system);
+    return agree >= checked * 95 / 100 ? 0 : 1;
+}
+
+/**
+ * Totals the trips matching a filter by reading whole booking records,
+ * as a query over the row store would: the baseline for archive_query
+ */
+static void trip_rows_query(const BookingRecord* rows, int count, const TripFilter* filter, TripStats* out) {
+    int64_t response_sum = 0;
+    memset(out, 0, sizeof(TripStats));
+    for (int i = 0; i < count; i++) {
+        const BookingRecord* row = &rows[i];
+        if ((row->status != 3 && row->status != 4) ||
+            row->booking_time < filter->from || row->booking_time >= filter->to ||
+            (filter->level != 0 && row->emergency_level != filter->level) ||
+            (filter->status != 0 && row->status != filter->status) ||
+            (filter->ambulance_id != 0 && row->ambulance_id != filter->ambulance_id)) {
+            continue;
+        }
+        out->trips++;
+        if (row->pickup_time != 0) {
+            int response = (int)(row->pickup_time - row->booking_time);
+            out->answered++;
+            response_sum += response;
+            if (response > out->max_response) {
+                out->max_response = response;
+            }
+        }
+    }
+    out->mean_response = out->answered > 0 ? (double)response_sum / out->answered : 0;
+}
+
+/**
+ * Times time-window queries over the trip archive against the same
+ * queries over booking records, on a synthetic history of closed trips
+ * spread evenly over the given number of days up to now
+ */
+static int run_archive_benchmark(int trip_count, int days) {
+    BookingRecord* rows = (BookingRecord*)calloc((size_t)trip_count, sizeof(BookingRecord));
+    long* counts = (long*)malloc(ARCHIVE_MAX_BUCKETS * sizeof(long));
+    long* row_counts = (long*)malloc(ARCHIVE_MAX_BUCKETS * sizeof(long));
+    TripArchive archive;
+    archive_init(&archive);
+    if (rows == NULL || counts == NULL || row_counts == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        free(rows);
+        free(counts);
+        free(row_counts);
+        return 1;
+    }
+    
+    uint64_t rng = 0xA4093822299F31D0ULL;
+    int64_t now = current_epoch();
+    int64_t span = (int64_t)days * 86400;
+    for (int i = 0; i < trip_count; i++) {
+        BookingRecord* row = &rows[i];
+        int roll = (int)(bench_random(&rng) % 100);
+        row->booking_time = now - span + span * i / trip_count;
+        row->booking_id = 1001 + i;
+        row->ambulance_id = 1 + (int)(bench_random(&rng) % 500);
+        row->emergency_level = roll < 60 ? 1 : (roll < 90 ? 2 : 3);
+        row->status = bench_random(&rng) % 10 == 0 ? 4 : 3;
+        if (bench_random(&rng) % 100 < 85) {
+            row->pickup_time = row->booking_time + 120 + (int64_t)(bench_random(&rng) % 1800);
+        }
+    }
+    
+    double start = monotonic_seconds();
+    for (int i = 0; i < trip_count; i++) {
+        if (archive_append(&archive, &rows[i]) != 0) {
+            printf("Error: Memory allocation failed!\n");
+            archive_free(&archive);
+            free(rows);
+            free(counts);
+            free(row_counts);
+            return 1;
+        }
+    }
+    double build_seconds = monotonic_seconds() - start;
+    
+    // Queries by window: critical calls in the last day, one unit's
+    // last week, cancellations of urgent calls over all time
+    struct {
+        const char* name;
+        TripFilter filter;
+    } queries[] = {
+        {"critical calls, last 24h", {now - 86400, INT64_MAX, 3, 0, 0}},
+        {"one unit, last 7 days", {now - 7 * 86400, INT64_MAX, 0, 0, 42}},
+        {"urgent cancelled, all time", {INT64_MIN, INT64_MAX, 2, 4, 0}},
+    };
+    int query_count = (int)(sizeof(queries) / sizeof(queries[0]));
+    int repeats = 20, mismatches = 0;
+    
+    printf("Trip archive: %d closed trips over %d days (%d archive days)\n", trip_count, days, archive.day_count);
+    printf("  built in %.3f s; rows %.1f MB, columns %.1f MB\n", build_seconds,
+           trip_count * (double)sizeof(BookingRecord) / 1e6,
+           trip_count * (double)(sizeof(int64_t) + 2 + 2 * sizeof(int32_t)) / 1e6);
+    printf("%-28s %10s %12s %12s %9s %s\n", "query", "trips", "rows (ms)", "archive (ms)", "speedup",
+           "days skipped/summarized/scanned");
+    for (int q = 0; q < query_count; q++) {
+        TripStats from_rows, from_archive;
+        start = monotonic_seconds();
+        for (int r = 0; r < repeats; r++) {
+            trip_rows_query(rows, trip_count, &queries[q].filter, &from_rows);
+        }
+        double row_seconds = (monotonic_seconds() - start) / repeats;
+        start = monotonic_seconds();
+        for (int r = 0; r < repeats; r++) {
+            archive_query(&archive, &queries[q].filter, &from_archive);
+        }
+        double archive_seconds = (monotonic_seconds() - start) / repeats;
+        mismatches += from_rows.trips != from_archive.trips || from_rows.answered != from_archive.answered ||
+                      from_rows.max_response != from_archive.max_response ||
+                      fabs(from_rows.mean_response - from_archive.mean_response) > 1e-6;
+        printf("%-28s %10ld %12.3f %12.3f %8.0fx %d/%d/%d\n", queries[q].name, from_archive.trips,
+               row_seconds * 1e3, archive_seconds * 1e3, row_seconds / archive_seconds,
+               from_archive.days_skipped, from_archive.days_summarized, from_archive.days_scanned);
+    }
+    
+    // Hourly call volume for the last 30 days
+    int buckets = 30 * 24;
+    TripFilter hourly = {(now / 3600 + 1 - buckets) * 3600, 0, 0, 0, 0};
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        memset(row_counts, 0, buckets * sizeof(long));
+        for (int i = 0; i < trip_count; i++) {
+            int64_t offset = rows[i].booking_time - hourly.from;
+            if ((rows[i].status == 3 || rows[i].status == 4) && offset >= 0 && offset < (int64_t)buckets * 3600) {
+                row_counts[offset / 3600]++;
+            }
+        }
+    }
+    double row_seconds = (monotonic_seconds() - start) / repeats;
+    long total = 0;
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        total = archive_volume(&archive, &hourly, 3600, counts, buckets);
+    }
+    double archive_seconds = (monotonic_seconds() - start) / repeats;
+    mismatches += memcmp(counts, row_counts, buckets * sizeof(long)) != 0;
+    printf("%-28s %10ld %12.3f %12.3f %8.0fx\n", "hourly volume, last 30 days", total,
+           row_seconds * 1e3, archive_seconds * 1e3, row_seconds / archive_seconds);
+    printf("Answers differing from the row scan: %d\n", mismatches);
+    
+    archive_free(&archive);
+    free(rows);
+    free(counts);
+    free(row_counts);
+    return mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * Counts a byte column one byte at a time through a switch, as the
+ * report loops used to: the baseline for histogram_bytes
+ */
+static void histogram_bytes_switch(const uint8_t* values, size_t count, long* out) {
+    for (size_t i = 0; i < count; i++) {
+        switch (values[i]) {
+            case 0: out[0]++; break;
+            case 1: out[1]++; break;
+            case 2: out[2]++; break;
+            case 3: out[3]++; break;
+            case 4: out[4]++; break;
+            default: out[5]++; break;
+        }
+    }
+}
+
+/**
+ * Times the report recount over a large booking history: the per-record
+ * loop it replaced, the chunked kernel on one thread and on thread_count
+ * threads, and counters_recount with the byte histogram kernel over the
+ * status and level columns (plus a switch loop over the same status
+ * column). Then times finding the cancelled critical bookings with the
+ * filter kernel against reading every record. All results are
+ * cross-checked.
+ */
+static int run_report_benchmark(int booking_count, int thread_count) {
+    BAPESSS_System* system = create_system();
+    int* by_record = (int*)malloc((size_t)booking_count * sizeof(int));
+    int* by_kernel = (int*)malloc((size_t)booking_count * sizeof(int));
+    if (system == NULL || by_record == NULL || by_kernel == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        free(by_record);
+        free(by_kernel);
+        free_system(system);
+        return 1;
+    }
+    
+    uint64_t rng = 0xB7E151628AED2A6BULL;
+    Booking booking;
+    memset(&booking, 0, sizeof(Booking));
+    for (int i = 0; i < booking_count; i++) {
+        uint64_t roll = bench_random(&rng);
+        booking.booking_id = 1001 + i;
+        booking.status = (int)(roll % BOOKING_STATUSES);
+        booking.emergency_level = 1 + (int)((roll >> 8) % EMERGENCY_LEVELS);
+        if (append_booking(system, &booking) == -1) {
+            printf("Error: Memory allocation failed!\n");
+            free(by_record);
+            free(by_kernel);
+            free_system(system);
+            return 1;
+        }
+    }
+    
+    int repeats = 5;
+    ReportCounters loop, one, many, columns;
+    double start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        memset(&loop, 0, sizeof(ReportCounters));
+        for (int i = 0; i < system->booking_count; i++) {
+            BookingRecord* record = booking_at(system, i);
+            loop.booking_status[status_bucket(record->status, BOOKING_STATUSES)]++;
+            loop.booking_level[level_bucket(record->emergency_level, EMERGENCY_LEVELS)]++;
+        }
+    }
+    double loop_seconds = (monotonic_seconds() - start) / repeats;
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        memset(&one, 0, sizeof(ReportCounters));
+        recount_bookings(system, 1, &one);
+    }
+    double one_seconds = (monotonic_seconds() - start) / repeats;
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        memset(&many, 0, sizeof(ReportCounters));
+        recount_bookings(system, thread_count, &many);
+    }
+    double many_seconds = (monotonic_seconds() - start) / repeats;
+    
+    start = monotonic_seconds();
+    if (booking_columns_build(system) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free(by_record);
+        free(by_kernel);
+        free_system(system);
+        return 1;
+    }
+    double build_seconds = monotonic_seconds() - start;
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        counters_recount(system, &columns);
+    }
+    double columns_seconds = (monotonic_seconds() - start) / repeats;
+    
+    long by_switch[BOOKING_STATUSES + 1], by_histogram[BOOKING_STATUSES + 1];
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        memset(by_switch, 0, sizeof(by_switch));
+        histogram_bytes_switch(system->columns.status, (size_t)booking_count, by_switch);
+    }
+    double switch_seconds = (monotonic_seconds() - start) / repeats;
+    memset(by_histogram, 0, sizeof(by_histogram));
+    histogram_bytes(system->columns.status, (size_t)booking_count, BOOKING_STATUSES, by_histogram);
+    
+    // Cancelled critical calls, as a listing of them over the whole history finds them
+    int record_found = 0, kernel_found = 0;
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        record_found = 0;
+        for (int i = 0; i < system->booking_count; i++) {
+            const BookingRecord* record = booking_at(system, i);
+            if (record->status == 4 && record->emergency_level == EMERGENCY_LEVELS) {
+                by_record[record_found++] = i;
+            }
+        }
+    }
+    double record_seconds = (monotonic_seconds() - start) / repeats;
+    start = monotonic_seconds();
+    for (int r = 0; r < repeats; r++) {
+        int stopped;
+        kernel_found = filter_bytes(system->columns.status, system->columns.level, 0, system->booking_count, 4,
+                                    EMERGENCY_LEVELS, by_kernel, booking_count, &stopped);
+    }
+    double filter_seconds = (monotonic_seconds() - start) / repeats;
     
-    if (new_ambulance.type < 1 || new_ambulance.type > 3) {
-        printf("Invalid type! Setting to Basic.\n");
-        new_ambulance.type = 1;
+    int matches = memcmp(&loop, &one, sizeof(ReportCounters)) == 0 &&
+                  memcmp(&loop, &many, sizeof(ReportCounters)) == 0 &&
+                  memcmp(&loop, &columns, sizeof(ReportCounters)) == 0 &&
+                  memcmp(by_switch, by_histogram, sizeof(by_histogram)) == 0 &&
+                  memcmp(loop.booking_status, system->counters.booking_status, sizeof(loop.booking_status)) == 0 &&
+                  record_found == kernel_found &&
+                  memcmp(by_record, by_kernel, (size_t)record_found * sizeof(int)) == 0;
+    const char* kernel = "scalar";
+#ifdef KERNEL_SSE2
+    kernel = "SSE2";
+#endif
+#ifdef KERNEL_AVX2
+    if (__builtin_cpu_supports("avx2")) kernel = "AVX2";
+#endif
+    
+    printf("Report recount: %d bookings (%.0f MB of records, %.0f MB of status and level columns)\n",
+           booking_count, booking_count * (double)sizeof(BookingRecord) / 1e6, booking_count * 2.0 / 1e6);
+    printf("  per-record loop:          %8.1f ms\n", loop_seconds * 1e3);
+    printf("  chunked kernel, 1 thread: %8.1f ms (%.1fx)\n", one_seconds * 1e3, loop_seconds / one_seconds);
+    printf("  chunked kernel, %d thread%s: %*.1f ms (%.1fx)\n", thread_count, thread_count == 1 ? "" : "s",
+           thread_count == 1 ? 8 : 7, many_seconds * 1e3, loop_seconds / many_seconds);
+    char label[32];
+    snprintf(label, sizeof(label), "%s column histograms:", kernel);
+    printf("  %-26s%8.1f ms (%.1fx; building the columns took %.1f ms once)\n", label,
+           columns_seconds * 1e3, loop_seconds / columns_seconds, build_seconds * 1e3);
+    printf("  status column through a switch loop: %.1f ms\n", switch_seconds * 1e3);
+    printf("Cancelled critical bookings (%d): record scan %.1f ms, %s filter kernel %.1f ms (%.1fx)\n",
+           kernel_found, record_seconds * 1e3, kernel, filter_seconds * 1e3, record_seconds / filter_seconds);
+    printf("Counts %s\n", matches ? "match" : "DIFFER");
+    
+    free(by_record);
+    free(by_kernel);
+    free_system(system);
+    return matches ? 0 : 1;
+}
+
+/**
+ * Makes up a patient name: a common first name and a surname of two or
+ * three syllables, so surnames range from common to rare
+ */
+static void bench_patient_name(char* out, size_t size, uint64_t* rng) {
+    static const char* first_names[16] = {"Aarav", "Priya", "Rahul", "Anita", "Vikram", "Sneha", "Arjun",
+                                          "Kavya", "Rohan", "Meera", "Sanjay", "Pooja", "Amit", "Divya",
+                                          "Karan", "Neha"};
+    static const char* syllables[24] = {"sha", "rma", "ver", "ma", "pa", "tel", "nai", "du", "ku", "mar",
+                                        "red", "dy", "ra", "o", "jo", "shi", "ban", "er", "gu", "pta",
+                                        "me", "hta", "de", "sai"};
+    uint64_t roll = bench_random(rng);
+    int length = snprintf(out, size, "%s %c", first_names[roll % 16], 'A' + (int)((roll >> 4) % 26));
+    for (int i = 0, count = 2 + (int)((roll >> 9) % 2); i < count; i++) {
+        length += snprintf(out + length, size - length, "%s", syllables[(roll >> (10 + 5 * i)) % 24]);
+    }
+}
+
+/**
+ * Newest bookings matching a search, found by reading every booking:
+ * the baseline for the index
+ * Returns: Number found (at most max_out)
+ */
+static int search_scan(BAPESSS_System* system, SearchMode mode, const char* text, int* out_slots, int max_out) {
+    int found = 0;
+    for (int slot = system->booking_count - 1; slot >= 0 && found < max_out; slot--) {
+        const BookingRecord* record = booking_at(system, slot);
+        StrRef value = mode == SEARCH_CONTACT ? record->patient_contact : record->patient_name;
+        if (search_matches(booking_str(system, value), text, mode)) {
+            out_slots[found++] = slot;
+        }
+    }
+    return found;
+}
+
+/**
+ * Times patient searches of the kinds a call-back brings against a scan
+ * of every booking, after timing the index build, and checks that both
+ * return the same bookings
+ */
+static int run_search_benchmark(int booking_count) {
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
     }
     
-    printf("Enter current location (X Y coordinates): ");
-    scanf("%f %f", &new_ambulance.location_x, &new_ambulance.location_y);
+    uint64_t rng = 0x6A09E667F3BCC908ULL;
+    Booking booking;
+    memset(&booking, 0, sizeof(Booking));
+    strcpy(booking.pickup_location, "Sector 12");
+    strcpy(booking.hospital, "City Hospital");
+    for (int i = 0; i < booking_count; i++) {
+        booking.booking_id = 1001 + i;
+        bench_patient_name(booking.patient_name, sizeof(booking.patient_name), &rng);
+        snprintf(booking.patient_contact, sizeof(booking.patient_contact), "9%09d",
+                 (int)(bench_random(&rng) % 1000000000));
+        booking.emergency_level = 1 + i % EMERGENCY_LEVELS;
+        if (append_booking(system, &booking) == -1) {
+            printf("Error: Memory allocation failed!\n");
+            free_system(system);
+            return 1;
+        }
+    }
     
-    new_ambulance.status = 0; // Available
+    double start = monotonic_seconds();
+    if (patient_index_build(system) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free_system(system);
+        return 1;
+    }
+    double build_seconds = monotonic_seconds() - start;
+    PatientIndex* index = &system->patients;
+    double index_bytes = (double)index->entries * sizeof(int32_t) + (double)index->gram_count * sizeof(PatientPostings) +
+                         (double)index->table_capacity * (sizeof(uint32_t) + sizeof(int));
+    printf("Patient search: %d bookings\n", booking_count);
+    printf("Index build: %.0f ms, %d grams, %.1f MB\n", build_seconds * 1e3, index->gram_count, index_bytes / 1e6);
     
-    // Add to system
-    system->ambulances[system->ambulance_count] = new_ambulance;
-    system->ambulance_count++;
+    // Each query is taken from a random booking, as a caller would give it
+    static const char* kinds[4] = {"full contact", "contact prefix (6)", "surname", "first name + initial"};
+    int queries = 2000;
+    int scan_queries = (int)(20000000LL / booking_count);
+    if (scan_queries < 5) scan_queries = 5;
+    if (scan_queries > queries) scan_queries = queries;
+    long mismatches = 0;
+    printf("%-22s %10s %10s %10s %12s %9s\n", "search", "p50 (us)", "p99 (us)", "matches", "scan (us)", "speedup");
+    for (int kind = 0; kind < 4; kind++) {
+        static LatencyHistogram latency;
+        memset(&latency, 0, sizeof(LatencyHistogram));
+        SearchMode mode = kind < 2 ? SEARCH_CONTACT : (kind == 2 ? SEARCH_NAME : SEARCH_NAME_PREFIX);
+        uint64_t query_rng = 0xBB67AE8584CAA73BULL + kind;
+        double scan_seconds = 0, index_seconds = 0;
+        long matches = 0;
+        
+        for (int q = 0; q < queries; q++) {
+            const BookingRecord* record = booking_at(system, (int)(bench_random(&query_rng) % booking_count));
+            char text[100];
+            snprintf(text, sizeof(text), "%s",
+                     booking_str(system, kind < 2 ? record->patient_contact : record->patient_name));
+            if (kind == 1) {
+                text[6] = '\0';
+            } else if (kind == 2) {
+                memmove(text, strchr(text, ' ') + 1, strlen(strchr(text, ' ') + 1) + 1);
+            } else if (kind == 3) {
+                strchr(text, ' ')[2] = '\0';
+            }
+            
+            int found_slots[SEARCH_SHOW_COUNT], scanned_slots[SEARCH_SHOW_COUNT];
+            double began = monotonic_seconds();
+            int found = search_patients(system, mode, text, found_slots, SEARCH_SHOW_COUNT);
+            double seconds = monotonic_seconds() - began;
+            latency_record(&latency, seconds);
+            index_seconds += seconds;
+            matches += found;
+            
+            if (q < scan_queries) {
+                began = monotonic_seconds();
+                int scanned = search_scan(system, mode, text, scanned_slots, SEARCH_SHOW_COUNT);
+                scan_seconds += monotonic_seconds() - began;
+                mismatches += scanned != found ||
+                              memcmp(scanned_slots, found_slots, (size_t)found * sizeof(int)) != 0;
+            }
+        }
+        printf("%-22s %10.1f %10.1f %10.1f %12.0f %8.0fx\n", kinds[kind], latency_percentile(&latency, 0.5),
+               latency_percentile(&latency, 0.99), (double)matches / queries, scan_seconds / scan_queries * 1e6,
+               (scan_seconds / scan_queries) / (index_seconds / queries));
+    }
+    printf("Results differing from the scan: %ld (newest %d matches compared per search)\n", mismatches,
+           SEARCH_SHOW_COUNT);
     
-    printf("\nAmbulance added successfully!\n");
-    printf("Ambulance ID: %d\n", new_ambulance.ambulance_id);
+    free_system(system);
+    return mismatches == 0 ? 0 : 1;
 }
 
 /**
- * Finds the nearest available ambulance
+ * Open bookings found by reading every booking: the baseline for the set
+ * of open ones
+ * Returns: Number found (at most max_out)
  */
-void find_nearest_ambulance(BAPESSS_System* system, float loc_x, float loc_y) {
-    printf("\n=== FINDING NEAREST AMBULANCE ===\n");
-    printf("Your location: (%.2f, %.2f)\n", loc_x, loc_y);
+static int list_scan(BAPESSS_System* system, const BookingFilter* filter, int after_slot, int* out_slots,
+                     int max_out) {
+    int found = 0;
+    for (int slot = after_slot + 1; slot < system->booking_count && found < max_out; slot++) {
+        if (booking_listed(booking_at(system, slot), filter)) {
+            out_slots[found++] = slot;
+        }
+    }
+    return found;
+}
+
+/**
+ * Times listing the active calls among a long history page by page
+ * against reading every booking, checks cursor paging against a scan,
+ * and times printing a listing a line at a time against one buffered
+ * write
+ */
+static int run_list_benchmark(int booking_count, int active_count) {
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
     
-    int nearest_id = -1;
-    float min_distance = 1000000; // Large initial value
+    uint64_t rng = 0x3C6EF372FE94F82BULL;
+    int64_t now = current_epoch();
+    Booking booking;
+    memset(&booking, 0, sizeof(Booking));
+    strcpy(booking.pickup_location, "Sector 12");
+    strcpy(booking.hospital, "City Hospital");
+    for (int i = 0; i < booking_count; i++) {
+        // A booking every 30 seconds; the open ones are the newest, as on a live system
+        booking.booking_id = 1001 + i;
+        bench_patient_name(booking.patient_name, sizeof(booking.patient_name), &rng);
+        snprintf(booking.patient_contact, sizeof(booking.patient_contact), "9%09d",
+                 (int)(bench_random(&rng) % 1000000000));
+        booking.emergency_level = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+        booking.status = i >= booking_count - active_count ? (int)(bench_random(&rng) % 3) :
+                         3 + (int)(bench_random(&rng) % 8 == 0);
+        booking.ambulance_id = booking.status == 0 || booking.status == 4 ? 0 : 1 + i % 1000;
+        int slot = append_booking(system, &booking);
+        if (slot == -1) {
+            printf("Error: Memory allocation failed!\n");
+            free_system(system);
+            return 1;
+        }
+        booking_at(system, slot)->booking_time = now - (int64_t)(booking_count - i) * 30;
+    }
     
-    for (int i = 0; i < system->ambulance_count; i++) {
-        if (system->ambulances[i].status == 0) { // Available
-            // Calculate distance (simplified Euclidean distance)
-            float distance = (loc_x - system->ambulances[i].location_x) * 
-                           (loc_x - system->ambulances[i].location_x) +
-                           (loc_y - system->ambulances[i].location_y) * 
-                           (loc_y - system->ambulances[i].location_y);
+    double start = monotonic_seconds();
+    if (active_build(system) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free_system(system);
+        return 1;
+    }
+    printf("Listings: %d bookings, %d open\n", booking_count, system->active.count);
+    printf("Open set build: %.1f ms\n", (monotonic_seconds() - start) * 1e3);
+    
+    // Every page of a listing, as a dispatcher paging through it would ask
+    static const char* kinds[4] = {"active calls", "active, critical", "pending", "last 24 hours"};
+    int rounds = 200;
+    int scan_rounds = (int)(50000000LL / booking_count);
+    if (scan_rounds < 3) scan_rounds = 3;
+    if (scan_rounds > rounds) scan_rounds = rounds;
+    long mismatches = 0;
+    int slots[LIST_MAX_PAGE], scanned_slots[LIST_MAX_PAGE];
+    printf("%-22s %10s %12s %12s %9s\n", "listing", "rows", "list (us)", "scan (us)", "speedup");
+    for (int kind = 0; kind < 4; kind++) {
+        BookingFilter filter = {kind < 2 ? LIST_ACTIVE : (kind == 2 ? 0 : LIST_ANY), kind == 1 ? 3 : 0,
+                                kind == 3 ? now - 24 * 3600 : INT64_MIN, INT64_MAX};
+        double set_seconds = 0, scan_seconds = 0;
+        long rows = 0;
+        for (int round = 0; round < rounds; round++) {
+            int after = -1, found;
+            double began = monotonic_seconds();
+            do {
+                found = list_bookings(system, &filter, after, slots, LIST_MAX_PAGE);
+                rows += found;
+                after = found > 0 ? slots[found - 1] : after;
+            } while (found == LIST_MAX_PAGE);
+            set_seconds += monotonic_seconds() - began;
             
-            if (distance < min_distance) {
-                min_distance = distance;
-                nearest_id = i;
+            if (round < scan_rounds) {
+                int scanned;
+                after = -1;
+                began = monotonic_seconds();
+                do {
+                    scanned = list_scan(system, &filter, after, scanned_slots, LIST_MAX_PAGE);
+                    after = scanned > 0 ? scanned_slots[scanned - 1] : after;
+                } while (scanned == LIST_MAX_PAGE);
+                scan_seconds += monotonic_seconds() - began;
             }
         }
+        printf("%-22s %10ld %12.1f %12.1f %8.0fx\n", kinds[kind], rows / rounds, set_seconds / rounds * 1e6,
+               scan_seconds / scan_rounds * 1e6, (scan_seconds / scan_rounds) / (set_seconds / rounds));
     }
     
-    if (nearest_id != -1) {
-        printf("\nNearest available ambulance found:\n");
-        printf("Ambulance ID: %d\n", system->ambulances[nearest_id].ambulance_id);
-        printf("Vehicle: %s\n", system->ambulances[nearest_id].vehicle_number);
-        printf("Driver: %s\n", system->ambulances[nearest_id].driver_name);
-        printf("Contact: %s\n", system->ambulances[nearest_id].driver_contact);
-        printf("Distance: %.2f units\n", sqrt(min_distance));
-        printf("Location: (%.2f, %.2f)\n", 
-               system->ambulances[nearest_id].location_x,
-               system->ambulances[nearest_id].location_y);
-    } else {
-        printf("\nNo available ambulances found near your location.\n");
+    // Pages from the cursor, for open and closed filters alike, must join
+    // up into exactly what one pass over every booking finds
+    BookingFilter checks[5] = {{LIST_ACTIVE, 0, INT64_MIN, INT64_MAX}, {1, 2, INT64_MIN, INT64_MAX},
+                               {3, 2, INT64_MIN, INT64_MAX}, {LIST_ANY, 1, INT64_MIN, INT64_MAX},
+                               {4, 0, now - 7 * 24 * 3600, INT64_MAX}};
+    long checked = 0;
+    for (int check = 0; check < 5; check++) {
+        int after = -1, expected = -1, found;
+        do {
+            found = list_bookings(system, &checks[check], after, slots, LIST_MAX_PAGE);
+            for (int i = 0; i < found; i++) {
+                int next;
+                mismatches += list_scan(system, &checks[check], expected, &next, 1) != 1 || next != slots[i];
+                expected = slots[i];
+                checked++;
+            }
+            after = found > 0 ? slots[found - 1] : after;
+        } while (found == LIST_MAX_PAGE && mismatches == 0);
+        mismatches += list_scan(system, &checks[check], after, scanned_slots, 1) != 0;
+    }
+    printf("Paged rows differing from the scan: %ld (of %ld)\n", mismatches, checked);
+    
+    // A terminal takes one write per line; the listing writes once per buffer
+    FILE* sink = fopen("/dev/null", "w");
+    if (sink != NULL) {
+        static char line_buffer[BUFSIZ];
+        static TextBuffer text;
+        int rows = booking_count < 100000 ? booking_count : 100000;
+        setvbuf(sink, line_buffer, _IOLBF, sizeof(line_buffer));
+        start = monotonic_seconds();
+        for (int i = 0; i < rows; i++) {
+            const BookingRecord* record = booking_at(system, i);
+            fprintf(sink, "%-6d%-21s%-14s%-12s%d\n", record->booking_id,
+                    booking_str(system, record->patient_name), booking_str(system, record->patient_contact),
+                    "Completed", record->ambulance_id);
+        }
+        double line_seconds = monotonic_seconds() - start;
+        
+        start = monotonic_seconds();
+        text_init(&text, sink);
+        for (int i = 0; i < rows; i++) {
+            text_booking_row(&text, system, i);
+        }
+        text_flush(&text);
+        double buffer_seconds = monotonic_seconds() - start;
+        fclose(sink);
+        printf("Printing %d rows: %.1f ms a line at a time, %.1f ms buffered (%.1fx)\n", rows,
+               line_seconds * 1e3, buffer_seconds * 1e3, line_seconds / buffer_seconds);
     }
+    
+    free_system(system);
+    return mismatches == 0 ? 0 : 1;
 }
 
-// =============================================
-// REPORT AND DATA PERSISTENCE
-// =============================================
+#ifndef _WIN32
+// One racing thread of the claim benchmark
+typedef struct {
+    BAPESSS_System* system;
+    volatile int* start;       // Threads spin until this is set, so they start together
+    int emergency_level;       // Level the thread books for
+    int* claimed;              // Slots this thread claimed
+    int count;                 // Entries in claimed
+} ClaimBenchThread;
 
 /**
- * Generates a system report
+ * Claims ambulances until none is left
  */
-void generate_report(BAPESSS_System* system) {
-    printf("\n=== SYSTEM REPORT ===\n");
-    printf("Generated on: ");
-    char time_buffer[50];
-    get_current_time(time_buffer, sizeof(time_buffer));
-    printf("%s\n\n", time_buffer);
-    
-    printf("Fleet Summary:\n");
-    printf("Total Ambulances: %d\n", system->ambulance_count);
+static void* claim_bench_thread(void* arg) {
+    ClaimBenchThread* bench = (ClaimBenchThread*)arg;
+    while (!__atomic_load_n(bench->start, __ATOMIC_ACQUIRE)) {
+    }
+    for (;;) {
+        int slot = claim_available_ambulance(bench->system, bench->emergency_level);
+        if (slot == -1) {
+            return NULL;
+        }
+        bench->claimed[bench->count++] = slot;
+    }
+}
+
+/**
+ * Stress test for claim_available_ambulance: threads race to claim every
+ * unit of a fleet with no lock held, as bookings do in server mode. Each
+ * round checks that every ambulance was claimed exactly once, settles
+ * the claims, checks the counters and frees the fleet for the next round.
+ */
+static int run_claim_benchmark(int fleet_size, int thread_count, int rounds) {
+    static ClaimBenchThread threads[SERVER_MAX_WORKERS];
+    static pthread_t ids[SERVER_MAX_WORKERS];
+    if (thread_count > SERVER_MAX_WORKERS) thread_count = SERVER_MAX_WORKERS;
     
-    int available = 0, booked = 0, on_trip = 0, maintenance = 0;
-    int basic = 0, advanced = 0, icu = 0;
+    BAPESSS_System* system = create_system();
+    int* seen = (int*)calloc((size_t)fleet_size, sizeof(int));
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    if (system == NULL || seen == NULL || bench_fill(system, fleet_size, 0, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free(seen);
+        free_system(system);
+        return 1;
+    }
+    for (int t = 0; t < thread_count; t++) {
+        threads[t].claimed = (int*)malloc((size_t)fleet_size * sizeof(int));
+        if (threads[t].claimed == NULL) {
+            printf("Error: Memory allocation failed!\n");
+            return 1;
+        }
+    }
     
-    for (int i = 0; i < system->ambulance_count; i++) {
-        switch(system->ambulances[i].status) {
-            case 0: available++; break;
-            case 1: booked++; break;
-            case 2: on_trip++; break;
-            case 3: maintenance++; break;
+    long claims = 0, doubled = 0, missed = 0, contested = 0;
+    int consistent = 1;
+    double seconds = 0;
+    for (int round = 0; round < rounds; round++) {
+        volatile int start = 0;
+        system->defer_claims = 1;
+        for (int t = 0; t < thread_count; t++) {
+            threads[t].system = system;
+            threads[t].start = &start;
+            threads[t].emergency_level = 1 + (t + round) % EMERGENCY_LEVELS;
+            threads[t].count = 0;
+            pthread_create(&ids[t], NULL, claim_bench_thread, &threads[t]);
+        }
+        double begin = monotonic_seconds();
+        __atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+        for (int t = 0; t < thread_count; t++) {
+            pthread_join(ids[t], NULL);
+        }
+        seconds += monotonic_seconds() - begin;
+        
+        memset(seen, 0, (size_t)fleet_size * sizeof(int));
+        int winners = 0;
+        for (int t = 0; t < thread_count; t++) {
+            for (int i = 0; i < threads[t].count; i++) {
+                doubled += seen[threads[t].claimed[i]]++ > 0;
+            }
+            claims += threads[t].count;
+            winners += threads[t].count > 0;
         }
+        for (int i = 0; i < fleet_size; i++) {
+            missed += seen[i] == 0;
+        }
+        contested += winners > 1;
         
-        switch(system->ambulances[i].type) {
-            case 1: basic++; break;
-            case 2: advanced++; break;
-            case 3: icu++; break;
+        fleet_settle(system);
+        system->defer_claims = 0;
+        consistent = consistent && counters_verify(system) && system->counters.ambulance_status[0] == 0;
+        for (int i = 0; i < fleet_size; i++) {
+            set_ambulance_status(system, i, 0);
         }
     }
     
-    printf("  Available: %d\n", available);
-    printf("  Booked: %d\n", booked);
-    printf("  On Trip: %d\n", on_trip);
-    printf("  Maintenance: %d\n", maintenance);
+    printf("Claim stress: %d ambulances, %d threads, %d rounds (%ld rounds split between threads)\n",
+           fleet_size, thread_count, rounds, contested);
+    printf("  claims: %ld in %.3f s (%.0f claims/s)\n", claims, seconds, claims / seconds);
+    printf("  claimed twice: %ld, never claimed: %ld, counters %s\n", doubled, missed,
+           consistent ? "consistent" : "INCONSISTENT");
     
-    printf("\nAmbulance Types:\n");
-    printf("  Basic: %d\n", basic);
-    printf("  Advanced: %d\n", advanced);
-    printf("  Mobile ICU: %d\n", icu);
+    for (int t = 0; t < thread_count; t++) {
+        free(threads[t].claimed);
+    }
+    free(seen);
+    free_system(system);
+    return doubled == 0 && missed == 0 && consistent ? 0 : 1;
+}
+
+// One client thread of the server benchmark
+typedef struct {
+    const char* path;          // Server socket
+    int requests;              // Commands to send, one at a time
+    int booking_count;         // Bookings 1001.. that commands may name
+    uint64_t seed;             // Random state for this client
+    long replies;              // Replies received
+    long failed;               // Replies starting with "error"
+} ServerBenchClient;
+
+/**
+ * Sends a dispatcher-like mix of commands over one connection, waiting
+ * for each reply before sending the next
+ */
+static void* server_bench_client(void* arg) {
+    ServerBenchClient* bench = (ServerBenchClient*)arg;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", bench->path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (fd != -1) close(fd);
+        return NULL;
+    }
     
-    printf("\nBooking Summary:\n");
-    printf("Total Bookings: %d\n", system->booking_count);
+    char line[256];
+    char reply[SERVER_REPLY_SIZE];
+    for (int i = 0; i < bench->requests; i++) {
+        uint64_t pick = bench_random(&bench->seed) % 100;
+        int target = 1001 + (int)(bench_random(&bench->seed) % bench->booking_count);
+        int length;
+        if (pick < 40) {
+            length = snprintf(line, sizeof(line), "nearest|%.2f|%.2f|3\n",
+                              (bench_random(&bench->seed) % 10000) / 100.0,
+                              (bench_random(&bench->seed) % 10000) / 100.0);
+        } else if (pick < 70) {
+            length = snprintf(line, sizeof(line), "find|%d\n", target);
+        } else if (pick < 82) {
+            length = snprintf(line, sizeof(line), "update|%d|2\n", target);
+        } else if (pick < 90) {
+            length = snprintf(line, sizeof(line), "update|%d|3\n", target);
+        } else if (pick < 98) {
+            length = snprintf(line, sizeof(line), "book|Patient %d|97%08d|Sector %d|Hospital %d|%d\n",
+                              i, i, i % 500, i % 20, 1 + i % EMERGENCY_LEVELS);
+        } else {
+            length = snprintf(line, sizeof(line), "report\n");
+        }
+        if (send(fd, line, (size_t)length, 0) != length) {
+            break;
+        }
+        
+        size_t used = 0;
+        while (used == 0 || reply[used - 1] != '\n') {
+            ssize_t count = recv(fd, reply + used, sizeof(reply) - used, 0);
+            if (count <= 0) {
+                close(fd);
+                return NULL;
+            }
+            used += (size_t)count;
+        }
+        bench->replies++;
+        bench->failed += strncmp(reply, "error", 5) == 0;
+    }
+    close(fd);
+    return NULL;
+}
+
+/**
+ * Runs the event loop of a benchmark server on its own thread
+ */
+static void* server_loop_thread(void* arg) {
+    server_loop((DispatchServer*)arg);
+    return NULL;
+}
+
+/**
+ * Serves a fixed client load with growing worker pools and reports the
+ * throughput of each. Queries share their locks and confirm/dispatch
+ * updates leave the fleet alone, so throughput should grow with workers
+ * up to the number of cores. Checks the report counters afterwards.
+ */
+static int run_server_benchmark(int client_count, int requests) {
+    static ServerBenchClient clients[SERVER_MAX_CLIENTS];
+    static pthread_t threads[SERVER_MAX_CLIENTS];
+    const char* path = "bench.sock";
+    BAPESSS_System* system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    if (bench_fill(system, 10000, 200000, &rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        free_system(system);
+        return 1;
+    }
+    if (client_count > SERVER_MAX_CLIENTS) client_count = SERVER_MAX_CLIENTS;
     
-    int pending = 0, confirmed = 0, dispatched = 0, completed = 0, cancelled = 0;
-    int normal = 0, urgent = 0, critical = 0;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    printf("Server benchmark: %d clients x %d commands, %ld cores\n", client_count, requests, cores);
+    printf("%8s %12s %10s %12s %8s %8s\n", "workers", "commands", "seconds", "commands/s", "speedup", "errors");
     
-    for (int i = 0; i < system->booking_count; i++) {
-        switch(system->bookings[i].status) {
-            case 0: pending++; break;
-            case 1: confirmed++; break;
-            case 2: dispatched++; break;
-            case 3: completed++; break;
-            case 4: cancelled++; break;
+    double base_rate = 0;
+    for (int workers = 1; workers <= 2 * cores && workers <= SERVER_MAX_WORKERS; workers *= 2) {
+        DispatchServer* server = server_open(system, path, workers);
+        pthread_t loop;
+        if (server == NULL || pthread_create(&loop, NULL, server_loop_thread, server) != 0) {
+            printf("Error: Could not start the server on %s!\n", path);
+            free_system(system);
+            return 1;
         }
         
-        switch(system->bookings[i].emergency_level) {
-            case 1: normal++; break;
-            case 2: urgent++; break;
-            case 3: critical++; break;
+        double start = monotonic_seconds();
+        for (int i = 0; i < client_count; i++) {
+            clients[i].path = path;
+            clients[i].requests = requests;
+            clients[i].booking_count = 200000;
+            clients[i].seed = 0x2545F4914F6CDD1DULL * (uint64_t)(i + 1) + (uint64_t)workers;
+            clients[i].replies = 0;
+            clients[i].failed = 0;
+            pthread_create(&threads[i], NULL, server_bench_client, &clients[i]);
+        }
+        long replies = 0, failed = 0;
+        for (int i = 0; i < client_count; i++) {
+            pthread_join(threads[i], NULL);
+            replies += clients[i].replies;
+            failed += clients[i].failed;
         }
+        double seconds = monotonic_seconds() - start;
+        
+        server_stop(server);
+        pthread_join(loop, NULL);
+        server_close(server);
+        
+        double rate = replies / seconds;
+        if (base_rate == 0) base_rate = rate;
+        printf("%8d %12ld %10.3f %12.0f %7.2fx %8ld\n", workers, replies, seconds, rate, rate / base_rate, failed);
     }
     
-    printf("  Pending: %d\n", pending);
-    printf("  Confirmed: %d\n", confirmed);
-    printf("  Dispatched: %d\n", dispatched);
-    printf("  Completed: %d\n", completed);
-    printf("  Cancelled: %d\n", cancelled);
+    // Errors above are refused updates (closed or pending bookings), not transport failures
+    int consistent = counters_verify(system);
+    int doubled = count_double_assignments(system);
+    free_system(system);
     
-    printf("\nEmergency Levels:\n");
-    printf("  Normal: %d\n", normal);
-    printf("  Urgent: %d\n", urgent);
-    printf("  Critical: %d\n", critical);
+    // The sample data's open bookings hold their units, so a call next to
+    // one of them must get another
+    system = create_system();
+    if (system == NULL) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    add_sample_data(system);
+    Booking call;
+    memset(&call, 0, sizeof(Booking));
+    strcpy(call.patient_name, "Ann");
+    strcpy(call.patient_contact, "555");
+    strcpy(call.pickup_location, "A");
+    strcpy(call.hospital, "H");
+    call.emergency_level = 2;
+    int nearest = nearest_qualified_ambulance(system, call.emergency_level, 12.5f, 15.3f, NULL, NULL);
+    int sample_doubled = create_booking_with(system, &call, nearest) == -1 ? -1 :
+                         count_double_assignments(system);
+    free_system(system);
     
-    printf("\nUtilization Rate: %.1f%%\n", 
-           system->ambulance_count > 0 ? 
-           (float)(booked + on_trip) / system->ambulance_count * 100 : 0);
+    printf("Report counters after the run: %s\n", consistent ? "consistent" : "INCONSISTENT");
+    printf("Ambulances held by two open bookings: %d (sample data plus a call: %d)\n", doubled, sample_doubled);
+    return consistent && doubled == 0 && sample_doubled == 0 ? 0 : 1;
+}
+
+// Dispatcher thread of the GPS benchmark: nearest-ambulance queries
+// under the shared fleet lock while position reports are applied
+typedef struct {
+    BAPESSS_System* system;
+    pthread_rwlock_t* fleet_lock;
+    volatile int* stop;        // Set when the reader should finish
+    LatencyHistogram* latency; // Lock wait plus query, per query
+} GpsBenchReader;
+
+/**
+ * Runs queries until told to stop
+ */
+static void* gps_bench_reader(void* arg) {
+    GpsBenchReader* reader = (GpsBenchReader*)arg;
+    uint64_t rng = 0xD1B54A32D192ED03ULL;
+    while (!__atomic_load_n(reader->stop, __ATOMIC_ACQUIRE)) {
+        float loc_x = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        float loc_y = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        int level = 1 + (int)(bench_random(&rng) % EMERGENCY_LEVELS);
+        float distance;
+        double begin = monotonic_seconds();
+        pthread_rwlock_rdlock(reader->fleet_lock);
+        nearest_qualified_ambulance(reader->system, level, loc_x, loc_y, &distance, NULL);
+        pthread_rwlock_unlock(reader->fleet_lock);
+        latency_record(reader->latency, monotonic_seconds() - begin);
+    }
+    return NULL;
 }
 
 /**
- * Saves system data to files
+ * Fills reports with units driving around the 0-100 area: each report
+ * moves a random unit 20-120 m along a slowly turning heading, as a
+ * unit at city speed reporting every few seconds would
  */
-void save_data(BAPESSS_System* system) {
-    FILE *amb_file = fopen("ambulances.dat", "wb");
-    FILE *book_file = fopen("bookings.dat", "wb");
+static void gps_bench_reports(PositionUpdate* reports, int count, int fleet_size,
+                              float* pos_x, float* pos_y, float* heading, uint64_t* rng) {
+    for (int i = 0; i < count; i++) {
+        int unit = (int)(bench_random(rng) % (uint64_t)fleet_size);
+        float step = 0.02f + (float)(bench_random(rng) % 1000) / 10000.0f;
+        heading[unit] += ((float)(bench_random(rng) % 1000) / 1000.0f - 0.5f) * 0.5f;
+        pos_x[unit] += step * cosf(heading[unit]);
+        pos_y[unit] += step * sinf(heading[unit]);
+        if (pos_x[unit] < 0 || pos_x[unit] > 100) {
+            pos_x[unit] = pos_x[unit] < 0 ? 0 : 100;
+            heading[unit] = 3.14159265f - heading[unit];
+        }
+        if (pos_y[unit] < 0 || pos_y[unit] > 100) {
+            pos_y[unit] = pos_y[unit] < 0 ? 0 : 100;
+            heading[unit] = -heading[unit];
+        }
+        reports[i].ambulance_id = unit + 1;
+        reports[i].loc_x = pos_x[unit];
+        reports[i].loc_y = pos_y[unit];
+    }
+}
+
+/**
+ * Counts available units whose grid entry is missing, in the wrong cell
+ * or not where the cell says it is
+ */
+static int gps_bench_misplaced(BAPESSS_System* system) {
+    SpatialGrid* grid = &system->grid;
+    int misplaced = 0;
+    for (int i = 0; i < system->ambulance_count; i++) {
+        if (system->amb_status[i] != 0) {
+            continue;
+        }
+        int cell = grid->cell_of[i];
+        int expected = grid_covers(grid, system->amb_x[i], system->amb_y[i]) ?
+                       grid_row(grid, system->amb_y[i]) * grid->cols + grid_col(grid, system->amb_x[i]) :
+                       GRID_OUTLIER_CELL;
+        misplaced += cell == -1 || cell != expected || grid_cell(grid, cell)->slots[grid->pos_in_cell[i]] != i;
+    }
+    return misplaced;
+}
+
+/**
+ * Times applying GPS position reports to the fleet, against taking each
+ * unit out of the grid and putting it back, then applies more reports
+ * in server-sized chunks under an exclusive lock while a dispatcher
+ * thread runs queries, and checks the grid against a full scan
+ */
+static int run_gps_benchmark(int fleet_size, int report_count) {
+    static LatencyHistogram idle = {"queries alone", 100, 0, 0, 0, {0}};
+    static LatencyHistogram busy = {"queries during ingestion", 100, 0, 0, 0, {0}};
+    uint64_t fill_rng = 0x243F6A8885A308D3ULL, rng = 0x13198A2E03707344ULL;
+    BAPESSS_System* baseline = create_system();
+    BAPESSS_System* system = create_system();
+    PositionUpdate* reports = (PositionUpdate*)malloc((size_t)report_count * sizeof(PositionUpdate));
+    float* pos_x = (float*)malloc((size_t)fleet_size * sizeof(float));
+    float* pos_y = (float*)malloc((size_t)fleet_size * sizeof(float));
+    float* heading = (float*)malloc((size_t)fleet_size * sizeof(float));
+    if (baseline == NULL || system == NULL || reports == NULL || pos_x == NULL || pos_y == NULL ||
+        heading == NULL || bench_fill(baseline, fleet_size, 0, &fill_rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    fill_rng = 0x243F6A8885A308D3ULL;
+    if (bench_fill(system, fleet_size, 0, &fill_rng) != 0) {
+        printf("Error: Memory allocation failed!\n");
+        return 1;
+    }
+    for (int i = 0; i < fleet_size; i++) {
+        pos_x[i] = system->amb_x[i];
+        pos_y[i] = system->amb_y[i];
+        heading[i] = (float)(bench_random(&rng) % 6283) / 1000.0f;
+    }
+    gps_bench_reports(reports, report_count, fleet_size, pos_x, pos_y, heading, &rng);
     
-    if (!amb_file || !book_file) {
-        printf("Error opening files for saving!\n");
-        return;
+    // Every report takes the unit out of the grid and puts it back
+    double start = monotonic_seconds();
+    for (int i = 0; i < report_count; i++) {
+        int slot = find_ambulance_slot(baseline, reports[i].ambulance_id);
+        grid_remove(baseline, slot);
+        baseline->amb_x[slot] = reports[i].loc_x;
+        baseline->amb_y[slot] = reports[i].loc_y;
+        grid_insert(baseline, slot);
     }
+    double reinsert_seconds = monotonic_seconds() - start;
     
-    // Save ambulances
-    fwrite(&system->ambulance_count, sizeof(int), 1, amb_file);
-    fwrite(system->ambulances, sizeof(Ambulance), system->ambulance_count, amb_file);
+    start = monotonic_seconds();
+    long applied = 0;
+    for (int done = 0; done < report_count; done += POSITION_MAX_BATCH) {
+        int batch = report_count - done < POSITION_MAX_BATCH ? report_count - done : POSITION_MAX_BATCH;
+        applied += apply_positions(system, reports + done, batch);
+    }
+    double apply_seconds = monotonic_seconds() - start;
     
-    // Save bookings
-    fwrite(&system->booking_count, sizeof(int), 1, book_file);
-    fwrite(system->bookings, sizeof(Booking), system->booking_count, book_file);
+    // Queries alone, then while the next reports are applied as the server does
+    pthread_rwlock_t fleet_lock;
+    pthread_rwlock_init(&fleet_lock, NULL);
+    volatile int stop = 0;
+    GpsBenchReader reader = {system, &fleet_lock, &stop, &idle};
+    pthread_t thread;
+    pthread_create(&thread, NULL, gps_bench_reader, &reader);
+    start = monotonic_seconds();
+    struct timespec pause = {0, 1000000};
+    while (monotonic_seconds() - start < 0.3) {
+        nanosleep(&pause, NULL);
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
     
-    fclose(amb_file);
-    fclose(book_file);
+    gps_bench_reports(reports, report_count, fleet_size, pos_x, pos_y, heading, &rng);
+    stop = 0;
+    reader.latency = &busy;
+    pthread_create(&thread, NULL, gps_bench_reader, &reader);
+    start = monotonic_seconds();
+    for (int done = 0; done < report_count; done += POSITION_CHUNK) {
+        int chunk = report_count - done < POSITION_CHUNK ? report_count - done : POSITION_CHUNK;
+        pthread_rwlock_wrlock(&fleet_lock);
+        applied += apply_positions(system, reports + done, chunk);
+        pthread_rwlock_unlock(&fleet_lock);
+    }
+    double busy_seconds = monotonic_seconds() - start;
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    pthread_rwlock_destroy(&fleet_lock);
     
-    printf("Data saved successfully!\n");
+    // A few wild fixes far outside the city must not stretch the grid,
+    // even once it is rebuilt
+    float width = system->grid.max_x - system->grid.min_x;
+    PositionUpdate wild[3] = {{1, 1e9f, 1e9f, 0}, {2, -1e9f, 50.0f, 0}, {3, 50.0f, 5e8f, 0}};
+    applied += apply_positions(system, wild, 3) - 3;
+    grid_rebuild(system);
+    float wild_width = system->grid.max_x - system->grid.min_x;
+    
+    long mismatches = 0;
+    for (int q = 0; q < 2000; q++) {
+        float loc_x = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        float loc_y = (float)(bench_random(&rng) % 100000) / 1000.0f;
+        int level = 1 + q % EMERGENCY_LEVELS;
+        float scan_distance, index_distance = INFINITY;
+        int scanned = nearest_qualified_scan(system, level, loc_x, loc_y, &scan_distance);
+        int indexed = nearest_qualified_ambulance(system, level, loc_x, loc_y, &index_distance, NULL);
+        mismatches += (scanned == -1) != (indexed == -1) || index_distance != scan_distance;
+    }
+    int misplaced = gps_bench_misplaced(system);
+    
+    printf("GPS ingestion: %d ambulances, %d position reports per run\n", fleet_size, report_count);
+    printf("  remove and re-insert every report: %.0f reports/s\n", report_count / reinsert_seconds);
+    printf("  apply_positions: %.0f reports/s (%ld of %d applied)\n", report_count / apply_seconds,
+           applied, 2 * report_count);
+    printf("  applied in chunks of %d under an exclusive lock: %.0f reports/s\n",
+           POSITION_CHUNK, report_count / busy_seconds);
+    for (int i = 0; i < 2; i++) {
+        LatencyHistogram* latency = i == 0 ? &idle : &busy;
+        printf("  %-25s %8ld queries, p50 %.1f us, p99 %.1f us, max %.1f us\n", latency->name, latency->count,
+               latency_percentile(latency, 0.50), latency_percentile(latency, 0.99), latency->max_seconds * 1e6);
+    }
+    printf("  grid width %.1f, %.1f after 3 wild fixes and a rebuild (%d outliers)\n", width, wild_width,
+           system->grid.outliers.count);
+    printf("  answers differing from a scan: %ld, misplaced grid entries: %d\n", mismatches, misplaced);
+    
+    free(reports);
+    free(pos_x);
+    free(pos_y);
+    free(heading);
+    free_system(baseline);
+    free_system(system);
+    return mismatches == 0 && misplaced == 0 && applied == 2L * report_count && wild_width < 2 * width ? 0 : 1;
 }
+#endif
 
 /**
- * Loads system data from files
+ * Entry point for "--bench <name> [size...]"
+ * Returns: Process exit code
  */
-void load_data(BAPESSS_System* system) {
-    FILE *amb_file = fopen("ambulances.dat", "rb");
-    FILE *book_file = fopen("bookings.dat", "rb");
+int run_benchmark(int argc, char* argv[]) {
+    const char* name = argc >= 3 ? argv[2] : "fleet";
     
-    if (!amb_file || !book_file) {
-        printf("No saved data found or error opening files!\n");
-        return;
+    if (strcmp(name, "fleet") == 0) {
+        int fleet_size = argc >= 4 ? atoi(argv[3]) : 100000;
+        if (fleet_size < 1) fleet_size = 1;
+        return run_fleet_benchmark(fleet_size);
     }
     
-    // Free existing data
-    free(system->ambulances);
-    free(system->bookings);
+    if (strcmp(name, "qualified") == 0) {
+        int fleet_size = argc >= 4 ? atoi(argv[3]) : 100000;
+        if (fleet_size < 1) fleet_size = 1;
+        return run_qualified_benchmark(fleet_size);
+    }
     
-    // Load ambulances
-    fread(&system->ambulance_count, sizeof(int), 1, amb_file);
-    system->ambulance_capacity = system->ambulance_count + 10;
-    system->ambulances = (Ambulance*)malloc(system->ambulance_capacity * sizeof(Ambulance));
-    fread(system->ambulances, sizeof(Ambulance), system->ambulance_count, amb_file);
+    if (strcmp(name, "nearest") == 0) {
+        int fleet_size = argc >= 4 ? atoi(argv[3]) : 2000;
+        int burst = argc >= 5 ? atoi(argv[4]) : 64;
+        if (fleet_size < 1) fleet_size = 1;
+        if (burst < 1) burst = 1;
+        return run_nearest_benchmark(fleet_size, burst);
+    }
     
-    // Load bookings
-    fread(&system->booking_count, sizeof(int), 1, book_file);
-    system->booking_capacity = system->booking_count + 50;
-    system->bookings = (Booking*)malloc(system->booking_capacity * sizeof(Booking));
-    fread(system->bookings, sizeof(Booking), system->booking_count, book_file);
+    if (strcmp(name, "eta") == 0) {
+        int side = argc >= 4 ? atoi(argv[3]) : 500;
+        int fleet_size = argc >= 5 ? atoi(argv[4]) : 2000;
+        if (side < 2) side = 2;
+        if (fleet_size < 1) fleet_size = 1;
+        return run_eta_benchmark(side, fleet_size);
+    }
     
-    fclose(amb_file);
-    fclose(book_file);
+    if (strcmp(name, "load") == 0) {
+        int fleet_size = argc >= 4 ? atoi(argv[3]) : 100000;
+        int booking_target = argc >= 5 ? atoi(argv[4]) : 1000000;
+        if (fleet_size < 1) fleet_size = 1;
+        if (booking_target < 1) booking_target = 1;
+        return run_load_benchmark(fleet_size, booking_target);
+    }
     
-    printf("Data loaded successfully!\n");
-    printf("Ambulances: %d, Bookings: %d\n", system->ambulance_count, system->booking_count);
-}
\ No newline at end of file
+    if (strcmp(name, "snapshot") == 0) {
+        int booking_count = argc >= 4 ? atoi(argv[3]) : 1000000;
+        if (booking_count < 1) booking_count = 1;
+        return run_snapshot_benchmark(booking_count);
+    }
+    
+    if (strcmp(name, "journal") == 0) {
+        int operations = argc >= 4 ? atoi(argv[3]) : 200000;
+        if (operations < 1) operations = 1;
+        return run_journal_benchmark(operations);
+    }
+    
+    if (strcmp(name, "background") == 0) {
+        int booking_count = argc >= 4 ? atoi(argv[3]) : 5000000;
+        if (booking_count < 1) booking_count = 1;
+        return run_background_benchmark(booking_count);
+    }
+    
+    if (strcmp(name, "report") == 0) {
+        int booking_count = argc >= 4 ? atoi(argv[3]) : 10000000;
+        int thread_count = argc >= 5 ? atoi(argv[4]) : recount_threads(AGGREGATE_PARALLEL_MIN);
+        if (booking_count < 1) booking_count = 1;
+        if (thread_count < 1) thread_count = 1;
+        return run_report_benchmark(booking_count, thread_count);
+    }
+    
+    if (strcmp(name, "archive") == 0) {
+        int trip_count = argc >= 4 ? atoi(argv[3]) : 2000000;
+        int days = argc >= 5 ? atoi(argv[4]) : 365;
+        if (trip_count < 1) trip_count = 1;
+        if (days < 1) days = 1;
+        return run_archive_benchmark(trip_count, days);
+    }
+    
+    if (strcmp(name, "search") == 0) {
+        int booking_count = argc >= 4 ? atoi(argv[3]) : 2000000;
+        if (booking_count < 1) booking_count = 1;
+        return run_search_benchmark(booking_count);
+    }
+    
+    if (strcmp(name, "list") == 0) {
+        int booking_count = argc >= 4 ? atoi(argv[3]) : 2000000;
+        int active_count = argc >= 5 ? atoi(argv[4]) : 200;
+        if (booking_count < 1) booking_count = 1;
+        if (active_count < 0) active_count = 0;
+        if (active_count > booking_count) active_count = booking_count;
+        return run_list_benchmark(booking_count, active_count);
+    }
+    
+    if (strcmp(name, "assign") == 0) {
+        int call_count = argc >= 4 ? atoi(argv[3]) : 500;
+        int fleet_size = argc >= 5 ? atoi(argv[4]) : 5000;
+        if (call_count < 1) call_count = 1;
+        if (fleet_size < 1) fleet_size = 1;
+        return run_assign_benchmark(call_count, fleet_size);
+    }
+    
+#ifndef _WIN32
+    if (strcmp(name, "claim") == 0) {
+        int fleet_size = argc >= 4 ? atoi(argv[3]) : 100000;
+        int thread_count = argc >= 5 ? atoi(argv[4]) : 8;
+        int rounds = argc >= 6 ? atoi(argv[5]) : 20;
+        if (fleet_size < 1) fleet_size = 1;
+        if (thread_count < 1) thread_count = 1;
+        if (rounds < 1) rounds = 1;
+        return run_claim_benchmark(fleet_size, thread_count, rounds);
+    }
+    
+    if (strcmp(name, "server") == 0) {
+        int client_count = argc >= 4 ? atoi(argv[3]) : 16;
+        int requests = argc >= 5 ? atoi(argv[4]) : 20000;
+        if (client_count < 1) client_count = 1;
+        if (requests < 1) requests = 1;
+        return run_server_benchmark(client_count, requests);
+    }
+    
+    if (strcmp(name, "gps") == 0) {
+        int fleet_size = argc >= 4 ? atoi(argv[3]) : 50000;
+        int report_count = argc >= 5 ? atoi(argv[4]) : 1000000;
+        if (fleet_size < 1) fleet_size = 1;
+        if (report_count < 1) report_count = 1;
+        return run_gps_benchmark(fleet_size, report_count);
+    }
+#endif
+    
+    printf("Unknown benchmark '%s'. Available: fleet, qualified, nearest, eta, load, snapshot, journal, background, report, archive, search, list, assign, claim, server, gps\n", name);
+    return 1;
+}